@@ -9,11 +9,47 @@
 #include "uart.h"
 #include "string.h"
 #include "intr.h"
+#include "thread.h"
+
+//           COMPILE-TIME CONSTANT DEFINITIONS
+//          
+
+//           Size of the kernel log, a power of two
+
+#ifndef KLOG_SIZE
+#define KLOG_SIZE 16384
+#endif
+
+//           Most bytes the drain thread writes before letting other threads run
+
+#define KLOG_CHUNK 64
 
 //           INTERNAL FUNCTION DECLARATIONS
 //           
 
 static void vprintf_putc(char c, void * aux);
+static void com0_or_klog_putc(char c);
+static void klog_drain(void * arg);
+
+//           INTERNAL GLOBAL VARIABLES
+//          
+
+//           The kernel log is a ring of the last KLOG_SIZE bytes of console output.
+//           klog_tail counts the bytes written since boot, and klog_sent those
+//           written out to UART0 so far. Until console_start_async is called, and
+//           again after console_sync, output goes straight to UART0 instead.
+//          
+//           There is a single hart, so writers need only disable interrupts to
+//           keep from interleaving, and never wait for the drain thread: when the
+//           ring is full, the oldest bytes are overwritten and the drain thread
+//           skips them. klog_dropped counts bytes lost that way.
+
+static char klog_buf[KLOG_SIZE];
+static uint64_t klog_tail;
+static uint64_t klog_sent;
+static uint64_t klog_dropped;
+static char klog_async;
+static struct condition klog_cond = { .name = "klog" };
 
 //           EXPORTED GLOBAL VARIABLES
 //          
@@ -29,20 +65,61 @@ void console_init(void) {
 	console_initialized = 1;
 }
 
+void console_start_async(void) {
+#ifndef CONSOLE_SYNC
+	klog_async = 1;
+	thread_spawn("klog", klog_drain, NULL);
+#endif
+}
+
+void console_sync(void) {
+	int saved_intr_state;
+
+	//           Write out what the drain thread has not, from here on synchronously
+
+	saved_intr_state = intr_disable();
+	klog_async = 0;
+	if (klog_tail - klog_sent > KLOG_SIZE)
+		klog_sent = klog_tail - KLOG_SIZE;
+	while (klog_sent != klog_tail)
+		com0_putc(klog_buf[klog_sent++ % KLOG_SIZE]);
+	intr_restore(saved_intr_state);
+}
+
+size_t console_klog_read(char * buf, size_t n) {
+	int saved_intr_state;
+	uint64_t pos;
+	size_t i;
+
+	//           Copy the last /n/ bytes of the log, or all of it if that is less
+
+	saved_intr_state = intr_disable();
+	if (n > klog_tail)
+		n = klog_tail;
+	if (n > KLOG_SIZE)
+		n = KLOG_SIZE;
+	pos = klog_tail - n;
+	for (i = 0; i < n; i++)
+		buf[i] = klog_buf[(pos + i) % KLOG_SIZE];
+	intr_restore(saved_intr_state);
+
+	return n;
+}
+
 void console_putchar(char c) {
 	static char cprev = '\0';
 
 	switch (c) {
 	case '\r':
-		com0_putc(c);
-    	com0_putc('\n');
+		com0_or_klog_putc(c);
+    	com0_or_klog_putc('\n');
     	break;
 	case '\n':
 		if (cprev != '\r')
-			com0_putc('\r');
+			com0_or_klog_putc('\r');
 		//           nobreak
 	default:
-		com0_putc(c);
+		com0_or_klog_putc(c);
 		break;
 	}
 
@@ -178,4 +255,58 @@ void console_labeled_printf (
 
 void vprintf_putc(char c, void * __attribute__ ((unused)) aux) {
 	console_putchar(c);
+}
+
+void com0_or_klog_putc(char c) {
+	int saved_intr_state;
+
+	//           The log keeps synchronous output too, for console_klog_read
+
+	saved_intr_state = intr_disable();
+	klog_buf[klog_tail % KLOG_SIZE] = c;
+	klog_tail += 1;
+	if (klog_async) {
+		condition_broadcast(&klog_cond);
+	} else {
+		com0_putc(c);
+		klog_sent = klog_tail;
+	}
+	intr_restore(saved_intr_state);
+}
+
+void klog_drain(void * __attribute__ ((unused)) arg) {
+	char chunk[KLOG_CHUNK];
+	int saved_intr_state;
+	size_t n, i;
+
+	for (;;) {
+		saved_intr_state = intr_disable();
+		while (klog_async && klog_sent == klog_tail)
+			condition_wait(&klog_cond);
+		if (!klog_async) {
+			//           console_sync took over
+			intr_restore(saved_intr_state);
+			break;
+		}
+		if (klog_tail - klog_sent > KLOG_SIZE) {
+			klog_dropped += klog_tail - KLOG_SIZE - klog_sent;
+			klog_sent = klog_tail - KLOG_SIZE;
+		}
+		n = klog_tail - klog_sent;
+		if (n > KLOG_CHUNK)
+			n = KLOG_CHUNK;
+		for (i = 0; i < n; i++)
+			chunk[i] = klog_buf[(klog_sent + i) % KLOG_SIZE];
+		klog_sent += n;
+		intr_restore(saved_intr_state);
+
+		//           Busy-wait on the uart with interrupts enabled, then let other
+		//           threads run before the next chunk
+
+		for (i = 0; i < n; i++)
+			com0_putc(chunk[i]);
+		thread_yield();
+	}
+
+	thread_exit();
 }
\ No newline at end of file
@@ -10,6 +10,21 @@
 extern void console_init(void);
 extern int console_initialized;
 
+//           Console output is written to UART0 as it is produced until
+//           console_start_async is called, which needs the thread manager. From
+//           then on it goes into the kernel log, a ring buffer that a kernel thread
+//           writes out to UART0, so that printing does not wait for the uart.
+//           console_sync writes out the rest of the log and returns to synchronous
+//           output, for panic and halt. Defining CONSOLE_SYNC keeps output
+//           synchronous throughout.
+//          
+//           console_klog_read copies the last /n/ bytes of the log, or all of it if
+//           there is less, to /buf/ and returns the number copied.
+
+extern void console_start_async(void);
+extern void console_sync(void);
+extern size_t console_klog_read(char * buf, size_t n);
+
 extern void console_putchar(char c);
 extern char console_getchar(void);
 extern void console_puts(const char * str);
@@ -2,6 +2,7 @@
 #include "elf.h"
 // #define ELF_TEST_USER
 #define ELF_TEST_FLAG 0
+#define ELF_PHDR_MAX 16 // most program headers in an executable
 uint_fast8_t phdr_flag_to_pte_flag(uint_fast32_t phdr_flags)
 {
     uint_fast8_t pte_flags = 0;
@@ -27,10 +28,13 @@ uint_fast8_t phdr_flag_to_pte_flag(uint_fast32_t phdr_flags)
 
 int elf_load(struct io_intf *io, void (**entryptr)(void)) {
     Elf64_Ehdr elf_hdr;
-    int result = ioread(io, &elf_hdr, sizeof(elf_hdr));
+    Elf64_Phdr prog_hdrs[ELF_PHDR_MAX];
+    long result = iopread(io, &elf_hdr, sizeof(elf_hdr), 0);
     // read error
     if (result < 0)
         return result;
+    if (result != sizeof(elf_hdr))
+        return -EBADFMT;
     // check if it is valid elf file
     if (elf_hdr.e_ident[EI_MAG0] != ELFMAG0 || elf_hdr.e_ident[EI_MAG1] != ELFMAG1 ||
         elf_hdr.e_ident[EI_MAG2] != ELFMAG2 || elf_hdr.e_ident[EI_MAG3] != ELFMAG3)
@@ -42,16 +46,18 @@ int elf_load(struct io_intf *io, void (**entryptr)(void)) {
     if (elf_hdr.e_ident[EI_VERSION] != EV_CURRENT)
         return -EBADFMT;
 
+    // read all program headers at once, each read is a trip to the device
+    if (elf_hdr.e_phentsize != sizeof(Elf64_Phdr) || elf_hdr.e_phnum > ELF_PHDR_MAX)
+        return -EBADFMT;
+    result = iopread(io, prog_hdrs, elf_hdr.e_phnum * sizeof(Elf64_Phdr), elf_hdr.e_phoff);
+    if (result < 0)
+        return result;
+    if (result != elf_hdr.e_phnum * sizeof(Elf64_Phdr))
+        return -EBADFMT;
+
     // iterate through program headers, load image if valid
     for (int i = 0; i < elf_hdr.e_phnum; i++) {
-        Elf64_Phdr prog_hdr;
-        uint64_t pos = elf_hdr.e_phoff + i * elf_hdr.e_phentsize;
-        result = ioseek(io, pos);
-        if (result < 0)
-            return result;
-        result = ioread(io, &prog_hdr, elf_hdr.e_phentsize);
-        if (result < 0)
-            return result;
+        const Elf64_Phdr prog_hdr = prog_hdrs[i];
         // check if type and section addr are both valid
 
         // cp2: check if the vaddr already mapped, if not, alloc page to it.
@@ -59,7 +65,6 @@ int elf_load(struct io_intf *io, void (**entryptr)(void)) {
         if (prog_hdr.p_type == PT_LOAD) {
             if (prog_hdr.p_vaddr < USER_START_VMA || prog_hdr.p_vaddr + prog_hdr.p_filesz > USER_END_VMA)
                 return -EINVAL;
-            ioseek(io, prog_hdr.p_offset);
             struct pte *active_space_r = active_space_root();
             struct pte *pte = walk_pt(active_space_r, prog_hdr.p_vaddr, 1);
             if (pte == NULL)
@@ -76,7 +81,7 @@ int elf_load(struct io_intf *io, void (**entryptr)(void)) {
             kprintf("prog_hdr.addr: %x\n", vaddr);
             vaddr = (uintptr_t)(memory_alloc_and_map_range(vaddr, prog_hdr.p_filesz, PTE_R | PTE_W | PTE_U));
             kprintf("loaded vaddr: %x\n", vaddr);
-            result = ioread(io, (void *)vaddr, prog_hdr.p_filesz);
+            result = iopread(io, (void *)vaddr, prog_hdr.p_filesz, prog_hdr.p_offset);
             switch (ELF_TEST_FLAG){
                 case PTE_R:
                     memory_set_range_flags((void *)vaddr, prog_hdr.p_filesz, pte_flags & !(PTE_R));
@@ -14,5 +14,13 @@
 #define EACCESS     8
 #define EBADFD      9
 #define EMFILE     10
+#define ENOMEM     11
+#define EEXIST     12
+#define ENOSPC     13
+#define ENOTDIR    14
+#define EISDIR     15
+#define ENOTEMPTY  16
+#define EPIPE      17
+#define EAGAIN     18
 
 #endif // _ERROR_H_
@@ -14,26 +14,57 @@
 #define BLOCK_SIZE 4096
 #define MAX_DIR_ENTRIES 63
 #define MAX_INODES 1023
-#define BOOT_RESERVED_SPACE_SZ 52
+#define BOOT_RESERVED_SPACE_SZ 28
 #define MAX_FILE_NAME_LENGTH 32 // 32 bytes
-#define DENTRY_RESERVED_SPACE_SZ 28
-#define MAX_FILE_OPEN 32
-#define INUSE 1
-#define UNUSE 0
-
-typedef struct file_t
+#define DENTRY_RESERVED_SPACE_SZ 27
+#define MAX_MOUNTS 4
+#define MAX_EXTENTS 511
+#define KFS_MAGIC 0x3253464b // "KFS2"
+#define KFS_VERSION_1 1
+#define KFS_VERSION_2 2
+// directory entry types; version 1 images only have files
+#define KFS_DT_FILE 0
+#define KFS_DT_DIR 1
+// features of version 2 images
+#define KFS_FEATURE_BITMAP 0x1 // free-inode and free-block bitmaps
+#define KFS_FEATURE_JOURNAL 0x2 // metadata journal, requires KFS_FEATURE_BITMAP
+#define KFS_INODE_MAP_SZ 64    // bytes of the inode bitmap, 512 inodes
+#define KFS_JOURNAL_MAGIC 0x4c4e524a // "JRNL"
+#define KFS_JOURNAL_MAX_BLOCKS 1021  // block numbers that fit in the journal header
+// inode flags of version 2 images
+#define KFS_INODE_COMPRESSED 0x1 // data is compressed, read-only
+// The data of a compressed file starts with an index of its chunks, each
+// holding KFS_CHUNK_SIZE bytes of the file except for the last one. Index
+// entry i is a uint32_t giving where chunk i starts, in bytes from the start
+// of the data; one more entry gives the end of the last chunk. A chunk is a
+// block of LZ4 sequences, or the bytes themselves if it is as long as the
+// part of the file it holds. byte_len is the length of the file.
+#define KFS_CHUNK_SIZE 4096
+
+struct kfs_mount;
+struct kfs_inode;
+
+// An open file. The file operations get the file from its io_intf, which is
+// embedded in it. Closed files go back to a pool and are reused.
+typedef struct kfs_file
 {
-  struct io_intf *io;
+  struct io_intf io_intf;
+  struct kfs_mount *mnt;
+  struct kfs_inode *inode;
   uint64_t file_position;
-  uint64_t file_size;
   uint64_t inode_num;
-  uint64_t flag;
-} __attribute((packed)) file_t;
+  // next file in the pool of closed files
+  struct kfs_file *next;
+} file_t;
 
+// The root directory is the list of entries in the boot block. Other
+// directories are inodes whose data is a dense array of entries.
 typedef struct dentry_t
 {
   char file_name[MAX_FILE_NAME_LENGTH];
   uint32_t inode;
+  // KFS_DT_FILE or KFS_DT_DIR
+  uint8_t type;
   uint8_t reserved[DENTRY_RESERVED_SPACE_SZ];
 } __attribute((packed)) dentry_t;
 
@@ -42,16 +73,66 @@ typedef struct boot_block_t
   uint32_t num_dentry;
   uint32_t num_inodes;
   uint32_t num_data;
+  // KFS_MAGIC in version 2 and later images, zero in version 1 images
+  uint32_t magic;
+  uint32_t version;
+  // KFS_FEATURE_* flags
+  uint32_t features;
+  // block holding the bitmaps, with KFS_FEATURE_BITMAP
+  uint32_t bitmap_block;
+  // first block and length in blocks of the journal, with KFS_FEATURE_JOURNAL
+  uint32_t journal_block;
+  uint32_t journal_len;
   uint8_t reserved[BOOT_RESERVED_SPACE_SZ];
   dentry_t dir_entries[MAX_DIR_ENTRIES];
 } __attribute((packed)) boot_block_t;
 
+// A run of contiguous data blocks
+typedef struct extent_t
+{
+  uint32_t start;
+  uint32_t len;
+} __attribute((packed)) extent_t;
+
 typedef struct inode_t
 {
   uint32_t byte_len;
-  uint32_t data_block_num[MAX_INODES];
+  union
+  {
+    // version 1: every data block of the file
+    uint32_t data_block_num[MAX_INODES];
+    // version 2: extents covering the file in order
+    struct
+    {
+      uint16_t num_extents;
+      // KFS_INODE_* flags
+      uint16_t flags;
+      extent_t extents[MAX_EXTENTS];
+    } __attribute((packed));
+  };
 } __attribute((packed)) inode_t;
 
+// Allocation bitmaps, a set bit means the inode or data block is in use
+typedef struct bitmap_block_t
+{
+  uint8_t inode_map[KFS_INODE_MAP_SZ];
+  uint8_t data_map[BLOCK_SIZE - KFS_INODE_MAP_SZ];
+} __attribute((packed)) bitmap_block_t;
+
+// First block of the journal. A committed transaction has a nonzero count;
+// its copies of the metadata blocks follow the header in the journal, in the
+// order of their block numbers in blocks[].
+typedef struct journal_header_t
+{
+  uint32_t magic;
+  // transaction sequence number
+  uint32_t seq;
+  // number of blocks in the committed transaction, zero if there is none
+  uint32_t count;
+  // where each block belongs, in blocks from the start of the image
+  uint32_t blocks[KFS_JOURNAL_MAX_BLOCKS];
+} __attribute((packed)) journal_header_t;
+
 typedef struct data_block_t
 {
   uint8_t data[BLOCK_SIZE];
@@ -63,14 +144,34 @@ extern void fs_init(void);
 
 extern int fs_mount(struct io_intf * blkio);
 
+extern int fs_mount_as(struct io_intf * blkio, const char * name);
+
 extern int fs_open(const char * name, struct io_intf ** ioptr);
 
+extern int fs_create(const char * name);
+
+extern int fs_unlink(const char * name);
+
+extern int fs_mkdir(const char * name);
+
+extern int fs_rmdir(const char * name);
+
+extern long fs_readdir(const char * name, uint64_t start, dentry_t * buf, uint64_t n);
+
 void fs_close(struct io_intf *io);
 
 long fs_read(struct io_intf *io, void *buf, unsigned long n);
 
 long fs_write(struct io_intf *io, const void *buf, unsigned long n);
 
+long fs_readv(struct io_intf *io, const struct io_vec *iov, int iovcnt);
+
+long fs_writev(struct io_intf *io, const struct io_vec *iov, int iovcnt);
+
+long fs_pread(struct io_intf *io, void *buf, unsigned long n, uint64_t pos);
+
+long fs_pwrite(struct io_intf *io, const void *buf, unsigned long n, uint64_t pos);
+
 int fs_ioctl(struct io_intf *io, int cmd, void *arg);
 
 int fs_getlen(file_t *file, void *arg);
@@ -79,6 +180,12 @@ int fs_getpos(file_t *file, void *arg);
 
 int fs_setpos(file_t *file, void *arg);
 
+int fs_setlen(file_t *file, void *arg);
+
 int fs_getblksz(file_t *file, void *arg);
+
+int fs_flush(file_t *file, void *arg);
+
+int fs_map(file_t *file, void *arg);
 //           _FS_H_
 #endif
@@ -11,16 +11,19 @@
 // terminate. Will not work on real hardware.
 
 void halt_success(void) {
+	console_sync();
 	*(int*)0x100000 = 0x5555; // success
 	for (;;) continue; // just in case
 }
 
 void halt_failure(void) {
+	console_sync();
 	*(int*)0x100000 = 0x3333; // failure
 	for (;;) continue; // just in case
 }
 
 void panic(const char * msg) {
+	console_sync();
 	if (msg != NULL)
 		console_puts(msg);
 	
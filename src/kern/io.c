@@ -3,6 +3,7 @@
 
 #include "io.h"
 #include "error.h"
+#include "thread.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -13,19 +14,34 @@
 
 struct iovprintf_state {
     struct io_intf * io;
+    struct io_buf buf;
     int err;
 };
 
 //           INTERNAL FUNCTION DECLARATIONS
 //          
 
+static void iobuf_close(struct io_intf * io);
+static long iobuf_read(struct io_intf * io, void * buf, unsigned long bufsz);
+static long iobuf_write(struct io_intf * io, const void * buf, unsigned long n);
+static int iobuf_ioctl(struct io_intf * io, int cmd, void * arg);
+static int iobuf_poll(struct io_intf * io, int events);
+
 static void ioterm_close(struct io_intf * io);
 static long ioterm_read(struct io_intf * io, void * buf, size_t len);
 static long ioterm_write(struct io_intf * io, const void * buf, size_t len);
 static int ioterm_ioctl(struct io_intf * io, int cmd, void * arg);
+static int ioterm_poll(struct io_intf * io, int events);
 
 static void iovprintf_putc(char c, void * aux);
 
+//           INTERNAL GLOBAL VARIABLES
+//          
+
+//           Broadcast whenever an object with a poll operation may have become ready
+
+static struct condition io_ready = { .name = "io_ready" };
+
 //           EXPORTED FUNCTION DEFINITIONS
 //          
 
@@ -55,6 +71,101 @@ long iowrite(struct io_intf * io, const void * buf, unsigned long n) {
 
     while (acc < n) {
         cnt = io->ops->write(io, buf+acc, n-acc);
+        if (cnt == -EAGAIN && acc != 0)
+            return acc;
+        else if (cnt < 0)
+            return cnt;
+        else if (cnt == 0)
+            return acc;
+        acc += cnt;
+    }
+
+    return acc;
+}
+
+void io_notify_ready(void) {
+    condition_broadcast(&io_ready);
+}
+
+void io_wait_ready(void) {
+    condition_wait(&io_ready);
+}
+
+long ioreadv(struct io_intf * io, const struct io_vec * iov, int iovcnt) {
+    long cnt, acc = 0;
+    int i;
+
+    if (io->ops->readv != NULL)
+        return io->ops->readv(io, iov, iovcnt);
+    if (io->ops->read == NULL)
+        return -ENOTSUP;
+
+    // go on to the next buffer only if this one was filled
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0)
+            continue;
+        cnt = io->ops->read(io, iov[i].base, iov[i].len);
+        if (cnt < 0)
+            return (acc != 0) ? acc : cnt;
+        acc += cnt;
+        if (cnt < iov[i].len)
+            break;
+    }
+
+    return acc;
+}
+
+long iowritev(struct io_intf * io, const struct io_vec * iov, int iovcnt) {
+    unsigned long skip;
+    long cnt, acc = 0;
+    int i;
+
+    if (io->ops->writev != NULL) {
+        acc = io->ops->writev(io, iov, iovcnt);
+        if (acc < 0)
+            return acc;
+    } else if (io->ops->write == NULL)
+        return -ENOTSUP;
+
+    // write what writev left, or everything, one buffer at a time
+    skip = acc;
+    for (i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].len) {
+            skip -= iov[i].len;
+            continue;
+        }
+        cnt = iowrite(io, iov[i].base + skip, iov[i].len - skip);
+        if (cnt < 0)
+            return cnt;
+        acc += cnt;
+        if (cnt < iov[i].len - skip)
+            break;
+        skip = 0;
+    }
+
+    return acc;
+}
+
+long iopread (
+    struct io_intf * io, void * buf, unsigned long bufsz, uint64_t pos)
+{
+    uint64_t saved_pos;
+    long cnt, acc = 0;
+    int result;
+
+    if (io->ops->pread == NULL) {
+        result = ioctl(io, IOCTL_GETPOS, &saved_pos);
+        if (result == 0)
+            result = ioseek(io, pos);
+        if (result < 0)
+            return result;
+        acc = ioread_full(io, buf, bufsz);
+        ioseek(io, saved_pos);
+        return acc;
+    }
+
+    while (acc < bufsz) {
+        cnt = io->ops->pread(io, buf+acc, bufsz-acc, pos+acc);
         if (cnt < 0)
             return cnt;
         else if (cnt == 0)
@@ -65,10 +176,91 @@ long iowrite(struct io_intf * io, const void * buf, unsigned long n) {
     return acc;
 }
 
+long iopwrite (
+    struct io_intf * io, const void * buf, unsigned long n, uint64_t pos)
+{
+    uint64_t saved_pos;
+    long cnt, acc = 0;
+    int result;
+
+    if (io->ops->pwrite == NULL) {
+        result = ioctl(io, IOCTL_GETPOS, &saved_pos);
+        if (result == 0)
+            result = ioseek(io, pos);
+        if (result < 0)
+            return result;
+        acc = iowrite(io, buf, n);
+        ioseek(io, saved_pos);
+        return acc;
+    }
+
+    while (acc < n) {
+        cnt = io->ops->pwrite(io, buf+acc, n-acc, pos+acc);
+        if (cnt < 0)
+            return cnt;
+        else if (cnt == 0)
+            return acc;
+        acc += cnt;
+    }
+
+    return acc;
+}
+
+long iocopy (
+    struct io_intf * out, struct io_intf * in, unsigned long n,
+    void * buf, unsigned long bufsz)
+{
+    struct io_map map;
+    int mapped = 1;
+    uint64_t pos;
+    long cnt, wcnt, acc = 0;
+
+    if (in->ops->read == NULL || out->ops->write == NULL)
+        return -ENOTSUP;
+
+    while (acc < n) {
+        map.len = n - acc;
+        if (mapped && ioctl(in, IOCTL_MAP, &map) == 0) {
+            if (map.len == 0)
+                break;
+            cnt = iowrite(out, map.ptr, map.len);
+            if (cnt < 0)
+                return cnt;
+            // out is full
+            if (cnt == 0)
+                break;
+            if (ioctl(in, IOCTL_GETPOS, &pos) == 0)
+                ioseek(in, pos + cnt);
+            acc += cnt;
+        } else {
+            mapped = 0;
+            cnt = ioread(in, buf, (n - acc < bufsz) ? n - acc : bufsz);
+            if (cnt < 0)
+                return cnt;
+            else if (cnt == 0)
+                break;
+            wcnt = iowrite(out, buf, cnt);
+            // Move in back to the first byte not written, so that it is read
+            // again; objects that cannot seek lose those bytes
+            if (wcnt < cnt && ioctl(in, IOCTL_GETPOS, &pos) == 0)
+                ioseek(in, pos - (cnt - (wcnt < 0 ? 0 : wcnt)));
+            if (wcnt < 0)
+                return wcnt;
+            acc += wcnt;
+            if (wcnt < cnt)
+                break;
+        }
+    }
+
+    return acc;
+}
+
 long io_lit_read(struct io_intf *io, void *buf, unsigned long bufsz);
 void lit_io_close(struct io_intf *io);
 long io_lit_write(struct io_intf *io, const void *buf, unsigned long n);
 int io_lit_ioctl(struct io_intf *io, int cmd, void *arg);
+long io_lit_pread(struct io_intf *io, void *buf, unsigned long bufsz, uint64_t pos);
+long io_lit_pwrite(struct io_intf *io, const void *buf, unsigned long n, uint64_t pos);
 
 //            Initialize an io_lit. This function should be called with an io_lit, a buffer, and the size of the device.
 //            It should set up all fields within the io_lit struct so that I/O operations can be performed on the io_lit
@@ -86,12 +278,16 @@ struct io_intf *iolit_init(
         .close = lit_io_close,
         .read = io_lit_read,
         .write = io_lit_write,
-        .ctl = io_lit_ioctl};
+        .ctl = io_lit_ioctl,
+        .pread = io_lit_pread,
+        .pwrite = io_lit_pwrite};
     lit->io_intf.ops = &ops;
     lit->io_intf.refcnt = 1;
     lit->buf = buf;
     lit->size = size;
     lit->pos = 0;
+    lit->reqcnt = 0;
+    lit->bytecnt = 0;
     return &(lit->io_intf);
 }
 
@@ -105,26 +301,41 @@ struct io_intf *iolit_init(
  * @param io A pointer to the io_intf structure representing the I/O interface.
  * @param buf A pointer to the buffer where the read data will be stored.
  * @param bufsz The maximum number of bytes to read into the buffer.
- * @return Returns 0 on success, or -EINVAL if the end of the buffer is reached.
+ * @return The number of bytes read, 0 at the end of the buffer.
  */
 
 long io_lit_read(struct io_intf *io, void *buf, unsigned long bufsz)
 {
     struct io_lit *lit = (struct io_lit *)io;
-    if (lit->pos >= lit->size)
+    long bytes_read = io_lit_pread(io, buf, bufsz, lit->pos);
+
+    lit->pos += bytes_read;
+    return bytes_read;
+}
+
+/**
+ * @brief Reads data from an io_lit interface at a given position, like
+ * io_lit_read without using or changing the current position.
+ */
+
+long io_lit_pread(struct io_intf *io, void *buf, unsigned long bufsz, uint64_t pos)
+{
+    struct io_lit *lit = (struct io_lit *)io;
+    if (pos >= lit->size)
     {
-        return -EINVAL; // End of buffer
+        return 0; // End of buffer
     }
 
     size_t bytes_to_read = bufsz;
-    if (lit->pos + bufsz > lit->size)
+    if (pos + bufsz > lit->size)
     {
-        bytes_to_read = lit->size - lit->pos; // Adjust to remaining bytes
+        bytes_to_read = lit->size - pos; // Adjust to remaining bytes
     }
 
-    memcpy(buf, (char *)lit->buf + lit->pos, bytes_to_read);
-    lit->pos += bytes_to_read;
-    return 0;
+    memcpy(buf, (char *)lit->buf + pos, bytes_to_read);
+    lit->reqcnt++;
+    lit->bytecnt += bytes_to_read;
+    return bytes_to_read;
 }
 
 /**
@@ -151,26 +362,41 @@ void lit_io_close(struct io_intf *io)
  * @param io Pointer to the io_intf structure representing the io_lit interface.
  * @param buf Pointer to the buffer containing the data to be written.
  * @param n Number of bytes to write from the buffer.
- * @return Returns 0 on success, or -EINVAL if there is no space left to write.
+ * @return The number of bytes written, 0 if there is no space left to write.
  */
 
 long io_lit_write(struct io_intf *io, const void *buf, unsigned long n)
 {
     struct io_lit *lit = (struct io_lit *)io;
-    if (lit->pos >= lit->size)
+    long bytes_written = io_lit_pwrite(io, buf, n, lit->pos);
+
+    lit->pos += bytes_written;
+    return bytes_written;
+}
+
+/**
+ * @brief Writes data to an io_lit interface at a given position, like
+ * io_lit_write without using or changing the current position.
+ */
+
+long io_lit_pwrite(struct io_intf *io, const void *buf, unsigned long n, uint64_t pos)
+{
+    struct io_lit *lit = (struct io_lit *)io;
+    if (pos >= lit->size)
     {
-        return -EINVAL; // No space left to write
+        return 0; // No space left to write
     }
 
     size_t bytes_to_write = n;
-    if (lit->pos + n > lit->size)
+    if (pos + n > lit->size)
     {
-        bytes_to_write = lit->size - lit->pos; // Adjust to remaining space
+        bytes_to_write = lit->size - pos; // Adjust to remaining space
     }
 
-    memcpy((char *)lit->buf + lit->pos, buf, bytes_to_write);
-    lit->pos += bytes_to_write;
-    return 0;
+    memcpy((char *)lit->buf + pos, buf, bytes_to_write);
+    lit->reqcnt++;
+    lit->bytecnt += bytes_to_write;
+    return bytes_to_write;
 }
 
 /**
@@ -184,18 +410,26 @@ long io_lit_write(struct io_intf *io, const void *buf, unsigned long n)
  * @param cmd The ioctl command to be executed.
  * @param arg Pointer to the argument for the ioctl command, used for passing arguments and returning results.
  *
- * @return 0 on success, -1 on unsupported command, or -ENOTSUP if the command is not supported.
+ * @return 0 on success, -EINVAL for a position past the end, or -ENOTSUP if
+ *         the command is not supported.
  *
  * Supported commands:
  * - IOCTL_GETLEN: Get the length of the IO interface. The length is stored in the location pointed to by arg.
  * - IOCTL_SETPOS: Set the position of the IO interface. The new position is obtained from the location pointed to by arg.
  * - IOCTL_GETPOS: Get the current position of the IO interface. The position is stored in the location pointed to by arg.
  * - IOCTL_GETBLKSZ: Get the block size of the IO interface. The block size (4096) is stored in the location pointed to by arg.
+ * - IOCTL_FLUSH: Nothing to do, memory needs no flushing.
+ * - IOCTL_GETSTATS: Get the reads and writes so far, with nothing else counted.
+ * - IOCTL_MAP: Get a pointer to the bytes at the current position.
+ *
+ * This lets an io_lit stand in for a block device, as a RAM disk.
  */
 int io_lit_ioctl(struct io_intf *io, int cmd, void *arg)
 {
 
     struct io_lit *lit = (struct io_lit *)io;
+    struct io_stats *stats;
+    struct io_map *map;
 
     switch (cmd)
     {
@@ -203,6 +437,10 @@ int io_lit_ioctl(struct io_intf *io, int cmd, void *arg)
         *(uint64_t *)arg = lit->size;
         return 0;
     case IOCTL_SETPOS:
+        if (*(uint64_t *)arg > lit->size)
+        {
+            return -EINVAL;
+        }
         lit->pos = *(uint64_t *)arg;
 
         return 0;
@@ -212,10 +450,25 @@ int io_lit_ioctl(struct io_intf *io, int cmd, void *arg)
     case IOCTL_GETBLKSZ:
         *(uint64_t *)arg = 4096;
         return 0;
+    case IOCTL_FLUSH:
+        return 0;
+    case IOCTL_GETSTATS:
+        stats = arg;
+        memset(stats, 0, sizeof(struct io_stats));
+        stats->reqcnt = lit->reqcnt;
+        stats->bytecnt = lit->bytecnt;
+        return 0;
+    case IOCTL_MAP:
+        map = arg;
+        map->ptr = (char *)lit->buf + lit->pos;
+        if (map->len > lit->size - lit->pos)
+        {
+            map->len = lit->size - lit->pos;
+        }
+        return 0;
     default:
-        return -1;
+        return -ENOTSUP;
     }
-    return -ENOTSUP;
 }
 
 //           I/O term provides three features:
@@ -252,16 +505,67 @@ int io_lit_ioctl(struct io_intf *io, int cmd, void *arg)
 //           if cr_out = 1 and ch == '\n': no ouput, cr_out <- 0;
 //           if cr_out = 1 and ch != '\r' and ch != '\n': output ch, cr_out <- 0.
 
+struct io_intf * iobuf_init(struct io_buf * iob, struct io_intf * rawio) {
+    static const struct io_ops ops = {
+        .close = iobuf_close,
+        .read = iobuf_read,
+        .write = iobuf_write,
+        .ctl = iobuf_ioctl,
+        .poll = iobuf_poll
+    };
+
+    iob->io_intf.ops = &ops;
+    iob->io_intf.refcnt = 1;
+    iob->rawio = rawio;
+    iob->rpos = 0;
+    iob->rlen = 0;
+    iob->wlen = 0;
+
+    return &iob->io_intf;
+}
+
+int iobuf_flush(struct io_buf * iob) {
+    long cnt, i;
+
+    if (iob->wlen == 0)
+        return 0;
+
+    cnt = iowrite(iob->rawio, iob->wbuf, iob->wlen);
+
+    //           A failed write loses what was buffered, as an unbuffered write of the
+    //           same bytes would have. A write that would have had to wait on a
+    //           non-blocking object, in full or after part of the bytes, keeps the
+    //           bytes not written for the next flush.
+    if (cnt == 0 || (cnt < 0 && cnt != -EAGAIN)) {
+        iob->wlen = 0;
+        return (cnt < 0) ? cnt : -EIO;
+    }
+
+    if (cnt == -EAGAIN)
+        cnt = 0;
+
+    if (cnt < iob->wlen) {
+        for (i = 0; i < iob->wlen - cnt; i++)
+            iob->wbuf[i] = iob->wbuf[cnt + i];
+        iob->wlen -= cnt;
+        return -EAGAIN;
+    }
+
+    iob->wlen = 0;
+    return 0;
+}
+
 struct io_intf * ioterm_init(struct io_term * iot, struct io_intf * rawio) {
     static const struct io_ops ops = {
         .close = ioterm_close,
         .read = ioterm_read,
         .write = ioterm_write,
-        .ctl = ioterm_ioctl
+        .ctl = ioterm_ioctl,
+        .poll = ioterm_poll
     };
 
     iot->io_intf.ops = &ops;
-    iot->rawio = rawio;
+    iot->rawio = iobuf_init(&iot->buf, rawio);
     iot->cr_out = 0;
     iot->cr_in = 0;
 
@@ -270,18 +574,24 @@ struct io_intf * ioterm_init(struct io_term * iot, struct io_intf * rawio) {
 
 int ioputs(struct io_intf * io, const char * s) {
     const char nl = '\n';
+    struct io_buf iob;
+    struct io_intf * bio;
     size_t slen;
     long wlen;
 
+    //           Buffer the string and newline, so that a short string goes out in a
+    //           single write.
+
+    bio = iobuf_init(&iob, io);
     slen = strlen(s);
 
-    wlen = iowrite(io, s, slen);
+    wlen = iowrite(bio, s, slen);
     if (wlen < 0)
         return wlen;
 
-    //           Write newline
+    //           Write newline, which flushes the buffer
 
-    wlen = iowrite(io, &nl, 1);
+    wlen = iowrite(bio, &nl, 1);
     if (wlen < 0)
         return wlen;
     
@@ -300,10 +610,19 @@ long ioprintf(struct io_intf * io, const char * fmt, ...) {
 
 long iovprintf(struct io_intf * io, const char * fmt, va_list ap) {
     //           state.nout is number of chars written or negative error code
-    struct iovprintf_state state = { .io = io, .err = 0 };
+    struct iovprintf_state state = { .err = 0 };
     size_t nout;
+    int result;
+
+    //           Characters collect in state.buf and reach /io/ a line at a time.
+    state.io = iobuf_init(&state.buf, io);
 
 	nout = vgprintf(iovprintf_putc, &state, fmt, ap);
+
+    result = iobuf_flush(&state.buf);
+    if (state.err == 0 && result < 0)
+        state.err = result;
+
     return state.err ? state.err : nout;
 }
 
@@ -373,6 +692,130 @@ char * ioterm_getsn(struct io_term * iot, char * buf, size_t n) {
 //           INTERNAL FUNCTION DEFINITIONS
 //          
 
+void iobuf_close(struct io_intf * io) {
+    struct io_buf * const iob = (void*)io - offsetof(struct io_buf, io_intf);
+
+    iobuf_flush(iob);
+    ioclose(iob->rawio);
+}
+
+long iobuf_read(struct io_intf * io, void * buf, unsigned long bufsz) {
+    struct io_buf * const iob = (void*)io - offsetof(struct io_buf, io_intf);
+    unsigned long cnt;
+    long rlen;
+    int result;
+
+    if (bufsz == 0)
+        return 0;
+
+    if (iob->rpos == iob->rlen) {
+        //           Out of read-ahead. Write out anything buffered first, such as a
+        //           prompt or echoed input, since the read may wait for the user.
+        //           Output that a non-blocking object cannot take yet does not keep
+        //           the read from going ahead.
+        result = iobuf_flush(iob);
+        if (result < 0 && result != -EAGAIN)
+            return result;
+
+        if (IO_BUF_SIZE <= bufsz)
+            return ioread(iob->rawio, buf, bufsz);
+
+        rlen = ioread(iob->rawio, iob->rbuf, IO_BUF_SIZE);
+        if (rlen <= 0)
+            return rlen;
+
+        iob->rpos = 0;
+        iob->rlen = rlen;
+    }
+
+    cnt = iob->rlen - iob->rpos;
+    if (bufsz < cnt)
+        cnt = bufsz;
+    
+    memcpy(buf, iob->rbuf + iob->rpos, cnt);
+    iob->rpos += cnt;
+    return cnt;
+}
+
+long iobuf_write(struct io_intf * io, const void * buf, unsigned long n) {
+    struct io_buf * const iob = (void*)io - offsetof(struct io_buf, io_intf);
+    const char * const p = buf;
+    unsigned long i;
+    int result;
+
+    //           If the bytes do not fit, write out what is buffered, and if they
+    //           would fill the buffer by themselves, write them out directly.
+    if (IO_BUF_SIZE - iob->wlen < n) {
+        result = iobuf_flush(iob);
+        if (result < 0)
+            return result;
+        if (IO_BUF_SIZE <= n)
+            return iowrite(iob->rawio, buf, n);
+    }
+
+    memcpy(iob->wbuf + iob->wlen, buf, n);
+    iob->wlen += n;
+
+    for (i = 0; i < n; i++) {
+        if (p[i] == '\n')
+            break;
+    }
+
+    //           The bytes are taken even if the flush leaves some of them buffered;
+    //           they go out with the next one.
+    if (i < n || iob->wlen == IO_BUF_SIZE) {
+        result = iobuf_flush(iob);
+        if (result < 0 && iob->wlen == 0)
+            return result;
+    }
+
+    return n;
+}
+
+int iobuf_ioctl(struct io_intf * io, int cmd, void * arg) {
+    struct io_buf * const iob = (void*)io - offsetof(struct io_buf, io_intf);
+    int result;
+
+    //           Write out buffered bytes before passing any ioctl through, so that the
+    //           backing object's length, position and statistics account for them.
+    //           Only IOCTL_FLUSH fails if a non-blocking object cannot take them yet.
+    result = iobuf_flush(iob);
+    if (result < 0 && (result != -EAGAIN || cmd == IOCTL_FLUSH))
+        return result;
+
+    switch (cmd) {
+    case IOCTL_FLUSH:
+        //           Nothing more to do if the backing object does not buffer
+        result = ioctl(iob->rawio, cmd, arg);
+        return (result == -ENOTSUP) ? 0 : result;
+    case IOCTL_GETPOS:
+        //           The backing object's position is past the read-ahead
+        result = ioctl(iob->rawio, cmd, arg);
+        if (result == 0)
+            *(uint64_t *)arg -= iob->rlen - iob->rpos;
+        return result;
+    case IOCTL_SETPOS:
+    case IOCTL_SETLEN:
+        iob->rpos = 0;
+        iob->rlen = 0;
+        return ioctl(iob->rawio, cmd, arg);
+    default:
+        return ioctl(iob->rawio, cmd, arg);
+    }
+}
+
+int iobuf_poll(struct io_intf * io, int events) {
+    struct io_buf * const iob = (void*)io - offsetof(struct io_buf, io_intf);
+    int revents;
+
+    //           Read-ahead makes a read ready. A write is only ready when the backing
+    //           object is, since any write may flush the write-behind buffer.
+    revents = iopoll(iob->rawio, events);
+    if (iob->rpos != iob->rlen)
+        revents |= events & POLLIN;
+    return revents;
+}
+
 void ioterm_close(struct io_intf * io) {
     struct io_term * const iot = (void*)io - offsetof(struct io_term, io_intf);
     ioclose(iot->rawio);
@@ -564,6 +1007,11 @@ int ioterm_ioctl(struct io_intf * io, int cmd, void * arg) {
         return -ENOTSUP;
 }
 
+int ioterm_poll(struct io_intf * io, int events) {
+    struct io_term * const iot = (void*)io - offsetof(struct io_term, io_intf);
+    return iopoll(iot->rawio, events);
+}
+
 void iovprintf_putc(char c, void * aux) {
     struct iovprintf_state * const state = aux;
     int result;
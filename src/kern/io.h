@@ -22,14 +22,40 @@ struct io_intf; // forward decl.
 // allowed to write fewer than /n/ bytes, but must write at least one. A return
 // value of 0 from /write/ indicates an end-of-file condition (for files that
 // cannot grow).
+//
+// The remaining functions are optional, objects provide them when they can do
+// better than the generic versions in io.c. The /readv/ and /writev/ functions
+// behave like /read/ and /write/ on the buffers in turn, as if they were one.
+// The /pread/ and /pwrite/ functions behave like /read/ and /write/ at
+// position /pos/, and leave the current position alone. The /poll/ function
+// returns the subset of /events/ (POLLIN, POLLOUT) for which /read/ or /write/
+// would not wait now, together with POLLHUP if the other side has gone away.
+// Objects whose reads and writes never wait need not provide it. An object
+// that provides it calls io_notify_ready when it may have become ready.
+
+struct io_vec; // see below
 
 struct io_ops {
 	void (*close)(struct io_intf * io);
 	long (*read)(struct io_intf * io, void * buf, unsigned long bufsz);
 	long (*write)(struct io_intf * io, const void * buf, unsigned long n);
 	int (*ctl)(struct io_intf * io, int cmd, void * arg);
+	long (*readv)(struct io_intf * io, const struct io_vec * iov, int iovcnt);
+	long (*writev)(struct io_intf * io, const struct io_vec * iov, int iovcnt);
+	long (*pread)(struct io_intf * io, void * buf, unsigned long bufsz, uint64_t pos);
+	long (*pwrite)(struct io_intf * io, const void * buf, unsigned long n, uint64_t pos);
+	int (*poll)(struct io_intf * io, int events);
+};
+
+// One buffer of many for ioreadv and iowritev
+
+struct io_vec {
+    void * base;
+    unsigned long len;
 };
 
+#define IO_VEC_MAX 16   // most buffers in one system call
+
 struct io_intf {
 	const struct io_ops * ops;
     uint32_t refcnt;
@@ -40,11 +66,30 @@ struct io_lit {
     void * buf;
     size_t size;
     size_t pos;
+    uint64_t reqcnt;    // reads and writes, for IOCTL_GETSTATS
+    uint64_t bytecnt;   // bytes copied by them
+};
+
+// Size of each of the read-ahead and write-behind buffers of an io_buf.
+
+#ifndef IO_BUF_SIZE
+#define IO_BUF_SIZE 128
+#endif
+
+struct io_buf {
+    struct io_intf io_intf;
+    struct io_intf * rawio;
+    uint16_t rpos;  // next byte of read-ahead to return
+    uint16_t rlen;  // bytes of read-ahead in rbuf
+    uint16_t wlen;  // bytes in wbuf not yet written to rawio
+    char rbuf[IO_BUF_SIZE];
+    char wbuf[IO_BUF_SIZE];
 };
 
 struct io_term {
     struct io_intf io_intf;
     struct io_intf * rawio;
+    struct io_buf buf;
     int8_t cr_out;
     int8_t cr_in;
 };
@@ -60,6 +105,97 @@ struct io_term {
 #define IOCTL_GETREFCNT 7       // arg is pointer to uint32_t
 #define IOCTL_GETDENTRY 8       // arg is pointer to struct dentry
 #define IOCTL_GETDENTRY_NUM 9   // arg is pointer to uint64_t
+#define IOCTL_GETSTATS      10  // arg is pointer to struct io_stats
+#define IOCTL_GETCOALESCE   11  // arg is pointer to struct io_coalesce
+#define IOCTL_SETCOALESCE   12  // arg is pointer to struct io_coalesce
+#define IOCTL_GETPOLL       13  // arg is pointer to struct io_poll
+#define IOCTL_SETPOLL       14  // arg is pointer to struct io_poll
+#define IOCTL_DISCARD       15  // arg is pointer to struct io_range
+#define IOCTL_ZERORANGE     16  // arg is pointer to struct io_range
+#define IOCTL_MAP           17  // arg is pointer to struct io_map
+#define IOCTL_GETFLAGS      18  // arg is pointer to int
+#define IOCTL_SETFLAGS      19  // arg is pointer to int
+
+// Flags for IOCTL_GETFLAGS/IOCTL_SETFLAGS. With O_NONBLOCK set, a read or write
+// that would have to wait for the device or the other end of a pipe fails
+// with -EAGAIN instead. The flag belongs to the I/O object, so it is shared by
+// every descriptor that refers to it.
+
+#define O_NONBLOCK  0x1
+
+// Readiness events for the poll operation and SYSCALL_POLL
+
+#define POLLIN      0x1     // a read would not wait
+#define POLLOUT     0x2     // a write would not wait
+#define POLLHUP     0x4     // the other side has gone away
+#define POLLNVAL    0x8     // not an open file descriptor (SYSCALL_POLL only)
+
+struct io_pollfd {
+    int fd;
+    short events;   // events of interest
+    short revents;  // events that are ready, set by SYSCALL_POLL
+};
+
+// Device statistics returned by IOCTL_GETSTATS. Counters are cumulative since
+// the device was attached.
+
+struct io_stats {
+    uint64_t reqcnt;        // requests submitted to the device
+    uint64_t notifycnt;     // notifications (doorbell writes) sent to the device
+    uint64_t intrcnt;       // completion interrupts taken
+    uint64_t bytecnt;       // bytes transferred
+    uint64_t pollmisscnt;   // polled requests that fell back to an interrupt
+    uint64_t flushcnt;      // cache flushes sent to the device
+};
+
+// Interrupt coalescing parameters for IOCTL_GETCOALESCE/IOCTL_SETCOALESCE. The
+// device raises an interrupt once every /max_frames/ completions; a waiter
+// that has not been woken by an interrupt polls for its completion every
+// /usec/ microseconds. A /max_frames/ of 1 disables coalescing.
+
+struct io_coalesce {
+    uint32_t max_frames;
+    uint32_t usec;
+};
+
+// Byte range for IOCTL_DISCARD and IOCTL_ZERORANGE. Block devices require
+// /pos/ and /len/ to be multiples of the 512-byte sector size.
+
+struct io_range {
+    uint64_t pos;
+    uint64_t len;
+};
+
+// Memory-backed objects tell where their bytes are for IOCTL_MAP, so that
+// the kernel can use them in place instead of reading a copy. On entry /len/
+// is the most bytes the caller wants; on return /ptr/ points to the bytes at
+// the current position and /len/ is how many of them are contiguous there,
+// zero at the end. The position does not move. Other objects fail with
+// -ENOTSUP.
+
+struct io_map {
+    void * ptr;
+    uint64_t len;
+};
+
+// Completion polling parameters for IOCTL_GETPOLL/IOCTL_SETPOLL. In
+// IO_POLL_ON mode the submitter spins on the completion for up to /spin_usec/
+// microseconds before falling back to waiting for an interrupt. IO_POLL_HYBRID
+// spins only while the recent average completion latency is within the spin
+// budget. /avg_usec/ reports that average and is ignored by IOCTL_SETPOLL.
+// Devices may clamp /spin_usec/ to a short maximum, since the spin runs with
+// interrupts disabled.
+
+#define IO_POLL_OFF     0
+#define IO_POLL_ON      1
+#define IO_POLL_HYBRID  2
+
+struct io_poll {
+    uint32_t mode;
+    uint32_t spin_usec;
+    uint32_t avg_usec;
+};
+
 // EXPORTED FUNCTION DECLARATIONS
 //
 
@@ -107,12 +243,83 @@ ioread_full (
 // The iowrite function writes data from a buffer to the I/O object. The /buf/
 // argument is a pointer to the buffer to write, and /n/ the number of bytes to
 // write. This function will not return until it writes /n/ bytes or reaches the
-// end of file. Negative return values signal an error.
+// end of file. Negative return values signal an error. On an O_NONBLOCK object
+// it returns the bytes written so far once a write would wait, or -EAGAIN if
+// there are none.
 
 extern long
 __attribute__ ((nonnull(1,2)))
 iowrite(struct io_intf * io, const void * buf, unsigned long n);
 
+// The ioreadv function reads data from the I/O object into /iovcnt/ buffers,
+// filling each before the next, like ioread into one buffer made of them all.
+// It may return after reading fewer bytes than the buffers hold, but will
+// block until it can read at least one byte. Returns the number of bytes
+// read, 0 at the end of file. Negative return values signal an error.
+
+extern long
+__attribute__ ((nonnull(1,2)))
+ioreadv(struct io_intf * io, const struct io_vec * iov, int iovcnt);
+
+// The iowritev function writes /iovcnt/ buffers to the I/O object one after
+// another, like iowrite of one buffer made of them all. Negative return values
+// signal an error.
+
+extern long
+__attribute__ ((nonnull(1,2)))
+iowritev(struct io_intf * io, const struct io_vec * iov, int iovcnt);
+
+// The iopoll function returns the subset of /events/ that are ready on the I/O
+// object, see the /poll/ operation. Objects without one are always ready.
+
+static inline int
+__attribute__ ((nonnull(1)))
+iopoll(struct io_intf * io, int events);
+
+// The io_notify_ready function wakes all threads in io_wait_ready. Objects that
+// provide /poll/ call it wherever they wake their own waiters. io_wait_ready
+// waits for the next io_notify_ready. To not miss a wakeup, call it with
+// interrupts disabled, after finding that none of the objects of interest is
+// ready.
+
+extern void io_notify_ready(void);
+extern void io_wait_ready(void);
+
+// The iopread function reads data at position /pos/ of the I/O object into a
+// buffer until the buffer is full or it reaches the end of file, like
+// ioread_full. The current position does not change. Objects that do not
+// provide /pread/ are read by moving their position and moving it back, which
+// is not atomic. Negative return values signal an error.
+
+extern long
+__attribute__ ((nonnull(1,2)))
+iopread (
+    struct io_intf * io, void * buf, unsigned long bufsz, uint64_t pos);
+
+// The iopwrite function writes a buffer at position /pos/ of the I/O object,
+// like iowrite. The current position does not change, with the same caveat
+// as for iopread. Negative return values signal an error.
+
+extern long
+__attribute__ ((nonnull(1,2)))
+iopwrite (
+    struct io_intf * io, const void * buf, unsigned long n, uint64_t pos);
+
+// The iocopy function reads up to /n/ bytes from the I/O object /in/ and writes
+// them to /out/, until /n/ bytes are copied or /in/ reaches the end of file. If
+// /in/ supports IOCTL_MAP, its bytes are written in place and its position is
+// moved past them; otherwise they pass through /buf/, /bufsz/ bytes at a time.
+// Copying also stops when /out/ takes fewer bytes than offered, e.g. at its end;
+// /in/ is then left at the first byte not copied, if it supports IOCTL_GETPOS
+// and IOCTL_SETPOS. Returns the number of bytes copied. Negative return values
+// signal an error.
+
+extern long
+__attribute__ ((nonnull(1,2,4)))
+iocopy (
+    struct io_intf * out, struct io_intf * in, unsigned long n,
+    void * buf, unsigned long bufsz);
+
 // The ioctl function invokes special functions on the I/O object. See the IOCTL
 // numbers defined above.
 
@@ -166,8 +373,34 @@ extern struct io_intf *
 __attribute__ ((nonnull(1,2)))
 iolit_init(struct io_lit * lit, void * buf, size_t size);
 
+// An io_buf object is a wrapper around another I/O object that buffers reads
+// and writes, so that character I/O does not cost a call into the backing
+// object per character. Reads are served from a read-ahead buffer, which is
+// refilled with a single read of up to IO_BUF_SIZE bytes. Writes collect in a
+// write-behind buffer, which is written out when it fills, when a write
+// contains a newline, before the next read from the backing object, on any
+// ioctl (including IOCTL_FLUSH) and on close. Reads and writes of at least
+// IO_BUF_SIZE bytes go straight to the backing object.
+//
+// iobuf_init initializes an io_buf object for use with the backing I/O object
+// /rawio/ and returns its io_intf. Closing it closes /rawio/. iobuf_flush
+// writes out the write-behind buffer; it returns 0 on success or a negative
+// error code on error. If /rawio/ is non-blocking and takes only part of the
+// buffer, the rest stays buffered and iobuf_flush returns -EAGAIN. An io_buf
+// is ready for writing only when /rawio/ is.
+
+extern struct io_intf *
+__attribute__ ((nonnull(1,2)))
+iobuf_init(struct io_buf * iob, struct io_intf * rawio);
+
+extern int
+__attribute__ ((nonnull(1)))
+iobuf_flush(struct io_buf * iob);
+
 // An io_term object is a wrapper around a "raw" I/O object. It provides newline
-// conversion and interactive line-editing for string input.
+// conversion and interactive line-editing for string input. Its output and
+// input go through an io_buf over the raw object, so a line is written with a
+// single write and line editing reads ahead of the character it is handling.
 //
 // ioterm_init initializes an io_term object for use with an underlying raw I/O
 // object. The /iot/ argument is a pointer to an io_term struct to initialize
@@ -220,6 +453,13 @@ static inline int ioctl(struct io_intf * io, int cmd, void * arg) {
         return -ENOTSUP;
 }
 
+static inline int iopoll(struct io_intf * io, int events) {
+    if (io->ops->poll)
+        return io->ops->poll(io, events);
+    else
+        return events & (POLLIN | POLLOUT);
+}
+
 static inline int ioseek(struct io_intf * io, uint64_t pos) {
     return ioctl(io, IOCTL_SETPOS, &pos);
 }
@@ -1,134 +1,2338 @@
 #include "fs.h"
 #include "lock.h"
-// boot blocks for the file system
-static boot_block_t* boot_block;
-// io interface for the file system
-static struct io_intf *fs_io = NULL;
-// file descriptor table
-static file_t file_desc_tab[MAX_FILE_OPEN];
+#include "thread.h"
+#include "timer.h"
+
+#define min(a,b) (a < b ? a : b)
+
+// Size of the per-mount name index, a power of two at least twice the
+// number of directory entries so that probe sequences stay short
+#define KFS_NAME_HASH_SIZE 128
+// Name index slot values; other values are a directory entry index plus one
+#define KFS_NAME_HASH_EMPTY 0
+#define KFS_NAME_HASH_DELETED 0xFF
+// Size of the per-mount inode cache, the most inodes of one mount that can be
+// in use at once; opening more fails with -EMFILE
+#define KFS_ICACHE_SIZE 64
+// Size of the per-mount dentry cache, a power of two
+#define KFS_DCACHE_SIZE 256
+// Directory number of the root directory, which is in the boot block
+#define KFS_ROOT_DIR ((uint64_t)-1)
+// Directory entries per block of a subdirectory
+#define KFS_DENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(dentry_t))
+// Size of the per-mount cache of decompressed chunks of compressed files
+#define KFS_CCACHE_SIZE 16
+// Chunk index entries that fit in the per-mount index buffer
+#define KFS_ZINDEX_ENTRIES (BLOCK_SIZE / sizeof(uint32_t))
+
+// Most metadata blocks in one journal transaction, each needs a buffer
+#define KFS_TXN_MAX 32
+// Most metadata blocks one operation changes: removing a file from a
+// subdirectory changes the file's inode, the bitmaps, the directory's inode
+// and two of its blocks. An operation never spans two transactions.
+#define KFS_TXN_OP_BLOCKS 5
+// How often the running transaction is committed if nobody syncs
+#define KFS_COMMIT_INTERVAL_MS 1000
+
+// The running journal transaction of a mount: the latest copy of every
+// metadata block changed since the last commit
+struct kfs_txn
+{
+  // capacity, limited by the size of the journal
+  uint32_t max;
+  uint32_t count;
+  // sequence number of the next commit
+  uint32_t seq;
+  uint64_t blknos[KFS_TXN_MAX];
+  void *data[KFS_TXN_MAX];
+  // buffer for the journal header
+  journal_header_t *header;
+  // data blocks freed in the running transaction, laid out like data_map.
+  // They are free in the bitmap but not allocated again until the
+  // transaction commits, since until then the blocks still belong to their
+  // old files on disk and must keep their contents
+  uint8_t *freed;
+  // for kfs_txn_abort: the count when the operation in progress began, and
+  // the blocks already in the transaction that it changed, with their
+  // contents from before
+  uint32_t op_start;
+  uint32_t op_nsaved;
+  uint32_t op_saved[KFS_TXN_OP_BLOCKS];
+  void *op_undo[KFS_TXN_OP_BLOCKS];
+};
+
+// An in-core copy of an inode, shared by all open files of that inode
+struct kfs_inode
+{
+  uint64_t inode_num;
+  // number of open files using this entry, unreferenced entries may be reused
+  uint64_t refcnt;
+  // whether inode holds a copy of inode_num
+  char valid;
+  // allocated the first time the entry is used
+  inode_t *inode;
+};
+
+// A resolved path component in a subdirectory: name in directory dir is the
+// entry for inode
+struct kfs_dcache_entry
+{
+  uint64_t dir;
+  uint32_t hash;
+  uint32_t inode;
+  uint8_t type;
+  char valid;
+  char name[MAX_FILE_NAME_LENGTH];
+};
+
+// A decompressed chunk of a compressed file
+struct kfs_chunk
+{
+  uint64_t inode_num;
+  uint64_t chunk;
+  // bytes of the file in the chunk, KFS_CHUNK_SIZE except at the end
+  uint32_t len;
+  char valid;
+  // allocated the first time the entry is used
+  uint8_t *data;
+};
+
+// A mounted file system. Each mount has its own block device, boot block and
+// lock, so I/O on different mounts proceeds in parallel.
+struct kfs_mount
+{
+  // mount name, files are opened as "name/file"; the root mount has name ""
+  const char *name;
+  // io interface for the file system
+  struct io_intf *io;
+  // boot blocks for the file system
+  boot_block_t *boot_block;
+  // on-disk format version, KFS_VERSION_1 or KFS_VERSION_2
+  uint32_t version;
+  // KFS_FEATURE_* flags of a version 2 image
+  uint32_t features;
+  // whether the device is in memory and supports IOCTL_MAP
+  char mapped;
+  // allocation bitmaps with KFS_FEATURE_BITMAP, protected by lk
+  bitmap_block_t *bitmap;
+  // running transaction with KFS_FEATURE_JOURNAL, protected by lk
+  struct kfs_txn txn;
+  // serializes device access, the inode cache and the directories of this
+  // mount, so that operations on different mounts do not wait for each other
+  struct lock lk;
+  // inodes of open files
+  struct kfs_inode icache[KFS_ICACHE_SIZE];
+  // name index over the directory, an open-addressing hash table with linear
+  // probing; protected by lk
+  uint8_t name_hash[KFS_NAME_HASH_SIZE];
+  // hash of the name of each directory entry
+  uint32_t dentry_hash[MAX_DIR_ENTRIES];
+  // resolved path components in subdirectories, direct-mapped by the hash of
+  // directory and name; the root directory has the name index instead.
+  // Protected by lk
+  struct kfs_dcache_entry dcache[KFS_DCACHE_SIZE];
+  // a block of a subdirectory, protected by lk
+  dentry_t *dirbuf;
+  // chunks of compressed files, replaced round-robin; protected by lk
+  struct kfs_chunk ccache[KFS_CCACHE_SIZE];
+  uint32_t ccache_next;
+  // a compressed chunk as read from the device, protected by lk
+  uint8_t *zbuf;
+  // entries zindex_base on of the chunk index of inode zindex_inode, if
+  // zindex_len is not zero; protected by lk
+  uint32_t *zindex;
+  uint64_t zindex_inode;
+  uint64_t zindex_base;
+  uint64_t zindex_len;
+};
+
+char fs_initialized = 0;
+// mount table, entry 0 is the root mount
+static struct kfs_mount mount_tab[MAX_MOUNTS];
+// closed files for reuse; the pool grows by one file whenever it is empty
+static file_t *file_pool;
 // base address of the file system, basically just zero, everything operates using offsets
 static size_t fs_base = 0;
+// protects the mount table and the file pool. It is not held while waiting
+// for a mount lock, nor across device I/O except while mounting, so that a
+// busy mount does not hold up the others. Mounts stay in the table once
+// mounted, so a mount found under fs_lk can be used after it is released
 struct lock fs_lk;
 
 /**
- * @brief Mounts the filesystem by initializing the file descriptor table and reading the boot block.
+ * @brief Initializes the mount table.
+ */
+void fs_init(void)
+{
+  lock_init(&fs_lk, "kfs_lock");
+  file_pool = NULL;
+  for (int i = 0; i < MAX_MOUNTS; i++)
+  {
+    mount_tab[i].name = NULL;
+  }
+  fs_initialized = 1;
+}
+
+/**
+ * @brief Hashes a file name (FNV-1a). Names are compared up to
+ * MAX_FILE_NAME_LENGTH characters, as stored in a directory entry.
+ *
+ * @param name The file name.
+ * @return The hash of the name.
+ */
+static uint32_t fs_name_hash(const char *name)
+{
+  uint32_t h = 2166136261u;
+
+  for (int i = 0; i < MAX_FILE_NAME_LENGTH && name[i] != '\0'; i++)
+  {
+    h = (h ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * @brief Adds a directory entry to the name index of a mount. Must be called
+ * with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param dentry Index of the directory entry in the boot block.
+ */
+static void fs_hash_insert(struct kfs_mount *mnt, int dentry)
+{
+  uint32_t h = fs_name_hash(mnt->boot_block->dir_entries[dentry].file_name);
+  uint32_t slot = h;
+
+  mnt->dentry_hash[dentry] = h;
+  // the table is larger than the directory, so there is always a free slot
+  while (mnt->name_hash[slot % KFS_NAME_HASH_SIZE] != KFS_NAME_HASH_EMPTY &&
+         mnt->name_hash[slot % KFS_NAME_HASH_SIZE] != KFS_NAME_HASH_DELETED)
+  {
+    slot++;
+  }
+  mnt->name_hash[slot % KFS_NAME_HASH_SIZE] = dentry + 1;
+}
+
+/**
+ * @brief Removes a directory entry from the name index of a mount. Must be
+ * called with the mount lock held, before the entry itself changes.
+ *
+ * @param mnt The mount.
+ * @param dentry Index of the directory entry in the boot block.
+ */
+static void fs_hash_remove(struct kfs_mount *mnt, int dentry)
+{
+  uint32_t slot = mnt->dentry_hash[dentry];
+
+  while (mnt->name_hash[slot % KFS_NAME_HASH_SIZE] != KFS_NAME_HASH_EMPTY)
+  {
+    if (mnt->name_hash[slot % KFS_NAME_HASH_SIZE] == dentry + 1)
+    {
+      // keep the probe sequences of other names intact
+      mnt->name_hash[slot % KFS_NAME_HASH_SIZE] = KFS_NAME_HASH_DELETED;
+      return;
+    }
+    slot++;
+  }
+}
+
+/**
+ * @brief Looks up a file name in the name index of a mount. Must be called
+ * with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param name The file name, without the mount prefix.
+ * @return Index of the directory entry, or -1 if there is none.
+ */
+static int fs_hash_lookup(struct kfs_mount *mnt, const char *name)
+{
+  uint32_t h = fs_name_hash(name);
+  uint32_t slot = h;
+  uint8_t v;
+
+  if (strlen(name) > MAX_FILE_NAME_LENGTH)
+  {
+    return -1;
+  }
+
+  for (int probes = 0; probes < KFS_NAME_HASH_SIZE; probes++, slot++)
+  {
+    v = mnt->name_hash[slot % KFS_NAME_HASH_SIZE];
+    if (v == KFS_NAME_HASH_EMPTY)
+    {
+      break;
+    }
+    if (v != KFS_NAME_HASH_DELETED && mnt->dentry_hash[v - 1] == h &&
+        strncmp(mnt->boot_block->dir_entries[v - 1].file_name, name, MAX_FILE_NAME_LENGTH) == 0)
+    {
+      return v - 1;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Builds the name index of a mount from its boot block. Called at
+ * mount, before anybody else can find the mount.
+ *
+ * @param mnt The mount.
+ */
+static void fs_hash_build(struct kfs_mount *mnt)
+{
+  memset(mnt->name_hash, KFS_NAME_HASH_EMPTY, sizeof(mnt->name_hash));
+  for (int i = 0; i < mnt->boot_block->num_dentry && i < MAX_DIR_ENTRIES; i++)
+  {
+    fs_hash_insert(mnt, i);
+  }
+}
+
+/**
+ * @brief Writes a block to the device, bypassing the journal.
+ *
+ * @param mnt The mount.
+ * @param blkno Block number from the start of the image.
+ * @param data The block.
+ * @return 0 on success, negative error code on failure.
+ */
+static int kfs_write_block(struct kfs_mount *mnt, uint64_t blkno, const void *data)
+{
+  long result;
+
+  result = iopwrite(mnt->io, data, BLOCK_SIZE, fs_base + blkno * BLOCK_SIZE);
+  return (result < 0) ? result : 0;
+}
+
+/**
+ * @brief Reads a block from the device, bypassing the journal.
+ */
+static int kfs_read_block(struct kfs_mount *mnt, uint64_t blkno, void *data)
+{
+  long result;
+
+  result = iopread(mnt->io, data, BLOCK_SIZE, fs_base + blkno * BLOCK_SIZE);
+  return (result < 0) ? result : 0;
+}
+
+/**
+ * @brief Makes all completed writes to the device durable.
+ */
+static int kfs_flush(struct kfs_mount *mnt)
+{
+  return ioctl(mnt->io, IOCTL_FLUSH, NULL);
+}
+
+/**
+ * @brief Commits the running transaction. Must be called with the mount
+ * lock held.
+ *
+ * The blocks are first written to the journal, then the header that makes
+ * the transaction count, and only then to their home locations, with a flush
+ * after each step. A crash before the header is durable loses the whole
+ * transaction; a crash after it is repaired by replaying the journal at
+ * mount. So a transaction of any size costs three flushes.
+ *
+ * @param mnt The mount.
+ * @return 0 on success, negative error code on failure.
+ */
+static int kfs_txn_commit(struct kfs_mount *mnt)
+{
+  struct kfs_txn *txn = &mnt->txn;
+  journal_header_t *header = txn->header;
+  const uint64_t jblk = mnt->boot_block->journal_block;
+  int result = 0;
+  uint32_t i;
+
+  if (txn->count == 0)
+  {
+    memset(txn->freed, 0, sizeof(mnt->bitmap->data_map));
+    return 0;
+  }
+
+  for (i = 0; result == 0 && i < txn->count; i++)
+  {
+    result = kfs_write_block(mnt, jblk + 1 + i, txn->data[i]);
+  }
+  if (result == 0)
+  {
+    result = kfs_flush(mnt);
+  }
+  if (result == 0)
+  {
+    header->magic = KFS_JOURNAL_MAGIC;
+    header->seq = txn->seq;
+    header->count = txn->count;
+    for (i = 0; i < txn->count; i++)
+    {
+      header->blocks[i] = txn->blknos[i];
+    }
+    result = kfs_write_block(mnt, jblk, header);
+  }
+  if (result == 0)
+  {
+    result = kfs_flush(mnt);
+  }
+  // committed, now the blocks go home
+  for (i = 0; result == 0 && i < txn->count; i++)
+  {
+    result = kfs_write_block(mnt, txn->blknos[i], txn->data[i]);
+  }
+  // replaying a transaction twice is harmless, so clearing the header needs
+  // no flush of its own; the next commit must not overwrite the journal
+  // before both are durable though
+  if (result == 0)
+  {
+    header->count = 0;
+    result = kfs_write_block(mnt, jblk, header);
+  }
+  if (result == 0)
+  {
+    result = kfs_flush(mnt);
+  }
+  if (result == 0)
+  {
+    txn->count = 0;
+    txn->seq++;
+    // the blocks freed are free on disk now
+    memset(txn->freed, 0, sizeof(mnt->bitmap->data_map));
+  }
+  return result;
+}
+
+/**
+ * @brief Makes room in the running transaction for one operation, committing
+ * it if it is too full. Every operation that changes metadata calls this
+ * first. Must be called with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @return 0 on success, negative error code on failure.
+ */
+static int kfs_txn_begin(struct kfs_mount *mnt)
+{
+  struct kfs_txn *txn = &mnt->txn;
+  int result = 0;
+
+  if (!(mnt->features & KFS_FEATURE_JOURNAL))
+  {
+    return 0;
+  }
+  if (txn->count + KFS_TXN_OP_BLOCKS > txn->max)
+  {
+    result = kfs_txn_commit(mnt);
+  }
+  txn->op_start = txn->count;
+  txn->op_nsaved = 0;
+  return result;
+}
+
+/**
+ * @brief Finds a block in the running transaction.
+ *
+ * @return The index of the block in the transaction, or -1 if it is not there.
+ */
+static int kfs_txn_find(const struct kfs_mount *mnt, uint64_t blkno)
+{
+  for (uint32_t i = 0; i < mnt->txn.count; i++)
+  {
+    if (mnt->txn.blknos[i] == blkno)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Writes a metadata block. With a journal the block joins the running
+ * transaction and reaches the disk when that commits; without one it is
+ * written in place. Must be called with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param blkno Block number from the start of the image.
+ * @param data The block.
+ * @return 0 on success, negative error code on failure.
+ */
+static int kfs_write_meta(struct kfs_mount *mnt, uint64_t blkno, const void *data)
+{
+  struct kfs_txn *txn = &mnt->txn;
+  int i;
+
+  if (!(mnt->features & KFS_FEATURE_JOURNAL))
+  {
+    return kfs_write_block(mnt, blkno, data);
+  }
+  i = kfs_txn_find(mnt, blkno);
+  if (i < 0)
+  {
+    // kfs_txn_begin made room
+    assert(txn->count < txn->max);
+    i = txn->count++;
+    txn->blknos[i] = blkno;
+  }
+  else if ((uint32_t)i < txn->op_start)
+  {
+    // an earlier operation changed the block, keep its copy for an abort
+    uint32_t j = 0;
+
+    while (j < txn->op_nsaved && txn->op_saved[j] != (uint32_t)i)
+    {
+      j++;
+    }
+    if (j == txn->op_nsaved)
+    {
+      assert(j < KFS_TXN_OP_BLOCKS);
+      txn->op_saved[j] = i;
+      memcpy(txn->op_undo[j], txn->data[i], BLOCK_SIZE);
+      txn->op_nsaved++;
+    }
+  }
+  memcpy(txn->data[i], data, BLOCK_SIZE);
+  return 0;
+}
+
+/**
+ * @brief Reads a metadata block, taking the copy in the running transaction
+ * if there is one. Must be called with the mount lock held.
+ */
+static int kfs_read_meta(struct kfs_mount *mnt, uint64_t blkno, void *data)
+{
+  int i = kfs_txn_find(mnt, blkno);
+
+  if (i >= 0)
+  {
+    memcpy(data, mnt->txn.data[i], BLOCK_SIZE);
+    return 0;
+  }
+  return kfs_read_block(mnt, blkno, data);
+}
+
+/**
+ * @brief Undoes the metadata changes of an operation that failed part way,
+ * so that the commit does not write half of it. With a journal the blocks
+ * the operation added to the running transaction are dropped and the ones it
+ * changed get their earlier contents back; without one, what was already
+ * written stays. Either way, the boot block, the bitmaps, the name index and
+ * the cached inodes are read again, and the dentry cache is cleared. Must be
+ * called with the mount lock held, after kfs_txn_begin.
+ *
+ * @param mnt The mount.
+ */
+static void kfs_txn_abort(struct kfs_mount *mnt)
+{
+  struct kfs_txn *txn = &mnt->txn;
+
+  if (mnt->features & KFS_FEATURE_JOURNAL)
+  {
+    for (uint32_t j = 0; j < txn->op_nsaved; j++)
+    {
+      memcpy(txn->data[txn->op_saved[j]], txn->op_undo[j], BLOCK_SIZE);
+    }
+    txn->count = txn->op_start;
+    txn->op_nsaved = 0;
+  }
+
+  kfs_read_meta(mnt, 0, mnt->boot_block);
+  if (mnt->features & KFS_FEATURE_BITMAP)
+  {
+    kfs_read_meta(mnt, mnt->boot_block->bitmap_block, mnt->bitmap);
+  }
+  fs_hash_build(mnt);
+  memset(mnt->dcache, 0, sizeof(mnt->dcache));
+  for (int i = 0; i < KFS_ICACHE_SIZE; i++)
+  {
+    if (mnt->icache[i].valid && mnt->icache[i].refcnt == 0)
+    {
+      mnt->icache[i].valid = 0;
+    }
+    else if (mnt->icache[i].valid)
+    {
+      kfs_read_meta(mnt, 1 + mnt->icache[i].inode_num, mnt->icache[i].inode);
+    }
+  }
+}
+
+/**
+ * @brief Sets up the journal of a mount and replays the transaction that a
+ * crash left committed but not written home. Called at mount.
+ *
+ * @param mnt The mount, whose boot block has been read.
+ * @return 0 on success, -ENOTSUP if the journal is too small, or a device error.
+ */
+static int kfs_journal_init(struct kfs_mount *mnt)
+{
+  struct kfs_txn *txn = &mnt->txn;
+  journal_header_t *header;
+  const uint64_t jblk = mnt->boot_block->journal_block;
+  const uint64_t jlen = mnt->boot_block->journal_len;
+  int result;
+
+  if (jlen < 1 + KFS_TXN_OP_BLOCKS)
+  {
+    return -ENOTSUP;
+  }
+  txn->max = min(min(jlen - 1, KFS_TXN_MAX), KFS_JOURNAL_MAX_BLOCKS);
+  txn->count = 0;
+  for (uint32_t i = 0; i < txn->max; i++)
+  {
+    txn->data[i] = kmalloc(BLOCK_SIZE);
+  }
+  txn->header = header = kmalloc(sizeof(journal_header_t));
+  txn->freed = kcalloc(1, sizeof(mnt->bitmap->data_map));
+  for (uint32_t i = 0; i < KFS_TXN_OP_BLOCKS; i++)
+  {
+    txn->op_undo[i] = kmalloc(BLOCK_SIZE);
+  }
+
+  result = kfs_read_block(mnt, jblk, header);
+  if (result < 0)
+  {
+    return result;
+  }
+  if (header->magic != KFS_JOURNAL_MAGIC)
+  {
+    // a fresh journal
+    txn->seq = 1;
+    return 0;
+  }
+  txn->seq = header->seq + 1;
+  if (header->count == 0)
+  {
+    return 0;
+  }
+  if (header->count > jlen - 1 || header->count > KFS_JOURNAL_MAX_BLOCKS)
+  {
+    return -EIO;
+  }
+
+  for (uint32_t i = 0; i < header->count; i++)
+  {
+    result = kfs_read_block(mnt, jblk + 1 + i, txn->data[0]);
+    if (result == 0)
+    {
+      result = kfs_write_block(mnt, header->blocks[i], txn->data[0]);
+    }
+    if (result < 0)
+    {
+      return result;
+    }
+  }
+  result = kfs_flush(mnt);
+  if (result == 0)
+  {
+    header->count = 0;
+    result = kfs_write_block(mnt, jblk, header);
+  }
+  if (result == 0)
+  {
+    result = kfs_flush(mnt);
+  }
+  return result;
+}
+
+/**
+ * @brief Commits the running transaction of a mount periodically, so that
+ * metadata changes become durable even if nobody syncs.
+ *
+ * @param arg The mount.
+ */
+static void kfs_commit_thread(void *arg)
+{
+  struct kfs_mount *mnt = arg;
+  struct alarm al;
+
+  alarm_init(&al, "kfs_commit");
+  for (;;)
+  {
+    alarm_sleep_ms(&al, KFS_COMMIT_INTERVAL_MS);
+    lock_acquire(&mnt->lk);
+    kfs_txn_commit(mnt);
+    lock_release(&mnt->lk);
+  }
+}
+
+/**
+ * @brief Mounts the filesystem as the root file system.
+ *
+ * @param io Pointer to the I/O interface to be used for filesystem operations.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int fs_mount(struct io_intf *io)
+{
+  return fs_mount_as(io, "");
+}
+
+/**
+ * @brief Undoes a mount that failed part way, freeing what fs_mount_as and
+ * kfs_journal_init allocated and leaving the slot as it was before. Must be
+ * called with fs_lk held.
+ *
+ * @param mnt The mount being set up.
+ */
+static void fs_mount_abort(struct kfs_mount *mnt)
+{
+  struct kfs_txn *txn = &mnt->txn;
+
+  for (uint32_t i = 0; i < txn->max; i++)
+  {
+    kfree(txn->data[i]);
+    txn->data[i] = NULL;
+  }
+  for (uint32_t i = 0; i < KFS_TXN_OP_BLOCKS; i++)
+  {
+    kfree(txn->op_undo[i]);
+    txn->op_undo[i] = NULL;
+  }
+  kfree(txn->header);
+  kfree(txn->freed);
+  txn->header = NULL;
+  txn->freed = NULL;
+  txn->max = 0;
+  txn->count = 0;
+  kfree(mnt->bitmap);
+  kfree(mnt->boot_block);
+  mnt->bitmap = NULL;
+  mnt->boot_block = NULL;
+  mnt->features = 0;
+  mnt->version = 0;
+  mnt->mapped = 0;
+  mnt->io = NULL;
+}
+
+/**
+ * @brief Mounts a filesystem under a name by reading its boot block.
+ *
+ * Files on a named mount are opened as "name/file". The first file system
+ * mounted with the empty name is the root file system, which is used for
+ * names without a mount prefix. Both version 1 images (block lists) and
+ * version 2 images (extents, marked with KFS_MAGIC in the boot block) are
+ * supported. A committed transaction left in the journal by a crash is
+ * replayed before the metadata is read.
+ *
+ * @param io Pointer to the I/O interface to be used for filesystem operations.
+ * @param name The mount name, without slashes.
+ * @return 0 on success, -EBUSY if the name is taken, -ENOMEM if the mount table
+ *         is full, -ENOTSUP if the image has an unknown version or a journal
+ *         too small to use.
+ */
+int fs_mount_as(struct io_intf *io, const char *name)
+{
+  struct kfs_mount *mnt = NULL;
+  int result;
+
+  if (!fs_initialized)
+  {
+    fs_init();
+  }
+
+  lock_acquire(&fs_lk);
+  for (int i = 0; i < MAX_MOUNTS; i++)
+  {
+    if (mount_tab[i].name == NULL)
+    {
+      if (mnt == NULL)
+      {
+        mnt = &mount_tab[i];
+      }
+    }
+    else if (strcmp(mount_tab[i].name, name) == 0)
+    {
+      lock_release(&fs_lk);
+      return -EBUSY;
+    }
+  }
+  if (mnt == NULL)
+  {
+    lock_release(&fs_lk);
+    return -ENOMEM;
+  }
+
+  lock_init(&mnt->lk, "kfs_mount_lock");
+  mnt->io = io;
+  struct io_map map = {.len = 0};
+  mnt->mapped = (ioctl(io, IOCTL_MAP, &map) == 0);
+  // Allocate memory for the boot block
+  mnt->boot_block = kmalloc(sizeof(boot_block_t));
+  // Read the boot block
+  // get the boot block, only fs_create and fs_unlink change it after mounting
+  result = iopread(mnt->io, mnt->boot_block, BLOCK_SIZE, 0);
+  if (result < 0)
+  {
+    fs_mount_abort(mnt);
+    lock_release(&fs_lk);
+    return result;
+  }
+  // version 1 images have no magic number, the field is zero there
+  if (mnt->boot_block->magic != KFS_MAGIC)
+  {
+    mnt->version = KFS_VERSION_1;
+  }
+  else if (mnt->boot_block->version == KFS_VERSION_2)
+  {
+    mnt->version = KFS_VERSION_2;
+  }
+  else
+  {
+    fs_mount_abort(mnt);
+    lock_release(&fs_lk);
+    return -ENOTSUP;
+  }
+  mnt->features = (mnt->version == KFS_VERSION_2) ? mnt->boot_block->features : 0;
+  if (mnt->features & KFS_FEATURE_JOURNAL)
+  {
+    // the boot block may have changed in the last committed transaction
+    result = kfs_journal_init(mnt);
+    if (result == 0)
+    {
+      result = iopread(mnt->io, mnt->boot_block, BLOCK_SIZE, 0);
+    }
+    if (result < 0)
+    {
+      fs_mount_abort(mnt);
+      lock_release(&fs_lk);
+      return result;
+    }
+  }
+  if (mnt->features & KFS_FEATURE_BITMAP)
+  {
+    mnt->bitmap = kmalloc(sizeof(bitmap_block_t));
+    result = iopread(mnt->io, mnt->bitmap, BLOCK_SIZE,
+                     fs_base + mnt->boot_block->bitmap_block * BLOCK_SIZE);
+    if (result < 0)
+    {
+      fs_mount_abort(mnt);
+      lock_release(&fs_lk);
+      return result;
+    }
+  }
+  fs_hash_build(mnt);
+  memset(mnt->dcache, 0, sizeof(mnt->dcache));
+  mnt->dirbuf = kmalloc(BLOCK_SIZE);
+  memset(mnt->ccache, 0, sizeof(mnt->ccache));
+  mnt->ccache_next = 0;
+  mnt->zindex_len = 0;
+  if (mnt->version == KFS_VERSION_2)
+  {
+    mnt->zbuf = kmalloc(BLOCK_SIZE);
+    mnt->zindex = kmalloc(BLOCK_SIZE);
+  }
+  mnt->name = name;
+  lock_release(&fs_lk);
+  if (mnt->features & KFS_FEATURE_JOURNAL)
+  {
+    thread_spawn("kfs_commit", kfs_commit_thread, mnt);
+  }
+  return 0;
+}
+
+/**
+ * @brief Finds the mount that a file name refers to.
+ *
+ * A name whose first path component is a mount name, as in "mount/file",
+ * refers to the named mount; any other name is a path on the root mount, so
+ * a mount hides a root directory of the same name. Must be called with
+ * fs_lk held.
+ *
+ * @param nameptr Pointer to the file name, advanced past the mount prefix.
+ * @return The mount, or NULL if there is no root mount.
+ */
+static struct kfs_mount *fs_find_mount(const char **nameptr)
+{
+  const char *name = *nameptr;
+  const char *slash = name;
+  size_t len;
+
+  while (*slash != '\0' && *slash != '/')
+  {
+    slash++;
+  }
+
+  len = slash - name;
+  if (*slash == '/')
+  {
+    for (int i = 0; i < MAX_MOUNTS; i++)
+    {
+      if (mount_tab[i].name != NULL && mount_tab[i].name[0] != '\0' &&
+          strncmp(mount_tab[i].name, name, len) == 0 &&
+          mount_tab[i].name[len] == '\0')
+      {
+        *nameptr = slash + 1;
+        return &mount_tab[i];
+      }
+    }
+  }
+
+  // no prefix, use the root mount
+  for (int i = 0; i < MAX_MOUNTS; i++)
+  {
+    if (mount_tab[i].name != NULL && mount_tab[i].name[0] == '\0')
+    {
+      return &mount_tab[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Takes a file from the pool of closed files, allocating a new one if
+ * the pool is empty. Must be called with fs_lk held.
+ *
+ * @return The file, or NULL if out of memory.
+ */
+static file_t *fs_file_alloc(void)
+{
+  file_t *file = file_pool;
+
+  if (file != NULL)
+  {
+    file_pool = file->next;
+    return file;
+  }
+  return kmalloc(sizeof(file_t));
+}
+
+/**
+ * @brief Returns a closed file to the pool. Must be called with fs_lk held.
+ */
+static void fs_file_free(file_t *file)
+{
+  file->next = file_pool;
+  file_pool = file;
+}
+
+/**
+ * @brief Gets a reference to the cached copy of an inode, reading it from
+ * disk if it is not cached. Must be called with the mount lock held.
+ *
+ * @param mnt The mount the inode belongs to.
+ * @param inode_num The inode number.
+ * @param ip Set to the cache entry on success.
+ * @return 0 on success, -EMFILE if every entry is in use, or a device error.
+ */
+static int fs_inode_get(struct kfs_mount *mnt, uint64_t inode_num, struct kfs_inode **ip)
+{
+  struct kfs_inode *ino = NULL;
+  int result;
+
+  for (int i = 0; i < KFS_ICACHE_SIZE; i++)
+  {
+    if (mnt->icache[i].valid && mnt->icache[i].inode_num == inode_num)
+    {
+      mnt->icache[i].refcnt++;
+      *ip = &mnt->icache[i];
+      return 0;
+    }
+    // remember the first entry we may replace, preferring empty ones
+    if (mnt->icache[i].refcnt == 0 &&
+        (ino == NULL || (ino->valid && !mnt->icache[i].valid)))
+    {
+      ino = &mnt->icache[i];
+    }
+  }
+  if (ino == NULL)
+  {
+    return -EMFILE;
+  }
+
+  if (ino->inode == NULL)
+  {
+    ino->inode = kmalloc(sizeof(inode_t));
+  }
+  ino->valid = 0;
+  result = kfs_read_meta(mnt, 1 + inode_num, ino->inode);
+  if (result < 0)
+  {
+    return result;
+  }
+  ino->inode_num = inode_num;
+  ino->valid = 1;
+  ino->refcnt = 1;
+  *ip = ino;
+  return 0;
+}
+
+/**
+ * @brief Drops a reference to a cached inode. The inode stays cached until
+ * its entry is needed for another inode. Must be called with the mount lock held.
+ *
+ * @param ino The cache entry.
+ */
+static void fs_inode_put(struct kfs_inode *ino)
+{
+  assert(ino->refcnt > 0);
+  ino->refcnt--;
+}
+
+/**
+ * @brief Maps a block of a file to its data block on disk.
+ *
+ * Version 1 inodes list every data block, version 2 inodes list extents.
+ * Besides the data block, returns how many blocks from there on are
+ * contiguous on disk, so callers can move them in one device transfer.
+ *
+ * @param mnt The mount the file belongs to.
+ * @param inode The inode of the file.
+ * @param blkidx Index of the block within the file.
+ * @param maxrun The largest run the caller is interested in, at least 1.
+ * @param blknoptr Set to the data block number.
+ * @param runptr Set to the number of contiguous blocks, at most maxrun.
+ * @return 0 on success, -EINVAL if the block is beyond the inode's map.
+ */
+static int kfs_bmap(const struct kfs_mount *mnt, const inode_t *inode,
+                    uint64_t blkidx, uint64_t maxrun,
+                    uint64_t *blknoptr, uint64_t *runptr)
+{
+  uint64_t run = 1;
+
+  if (mnt->version == KFS_VERSION_1)
+  {
+    if (blkidx >= MAX_INODES)
+    {
+      return -EINVAL;
+    }
+    while (run < maxrun && blkidx + run < MAX_INODES &&
+           inode->data_block_num[blkidx + run] == inode->data_block_num[blkidx] + run)
+    {
+      run++;
+    }
+    *blknoptr = inode->data_block_num[blkidx];
+    *runptr = run;
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < inode->num_extents && i < MAX_EXTENTS; i++)
+  {
+    if (blkidx < inode->extents[i].len)
+    {
+      *blknoptr = inode->extents[i].start + blkidx;
+      *runptr = min(inode->extents[i].len - blkidx, maxrun);
+      return 0;
+    }
+    blkidx -= inode->extents[i].len;
+  }
+  return -EINVAL;
+}
+
+/**
+ * @brief Finds where the data at a file position is on the device, and how
+ * many bytes from there on are stored contiguously.
+ *
+ * @param mnt The mount the file belongs to.
+ * @param inode The inode of the file.
+ * @param pos The file position.
+ * @param n The maximum number of bytes.
+ * @param devposptr Set to the device position of the data.
+ * @param lenptr Set to the length of the contiguous span, at most n.
+ * @return 0 on success, negative error code on failure.
+ */
+static int fs_map_span(const struct kfs_mount *mnt, const inode_t *inode,
+                       uint64_t pos, uint64_t n,
+                       uint64_t *devposptr, uint64_t *lenptr)
+{
+  uint64_t offset = pos % BLOCK_SIZE;
+  uint64_t blkno, run;
+  int result;
+
+  result = kfs_bmap(mnt, inode, pos / BLOCK_SIZE,
+                    (offset + n + BLOCK_SIZE - 1) / BLOCK_SIZE, &blkno, &run);
+  if (result < 0)
+  {
+    return result;
+  }
+
+  *devposptr = fs_base + BLOCK_SIZE + mnt->boot_block->num_inodes * BLOCK_SIZE + blkno * BLOCK_SIZE + offset;
+  *lenptr = min(run * BLOCK_SIZE - offset, n);
+  return 0;
+}
+
+/**
+ * @brief Reads bytes of a file's data from the device, in runs of blocks that
+ * are contiguous on disk so that each run can be a single device request.
+ * Must be called with the mount lock held.
+ *
+ * @param mnt The mount the file belongs to.
+ * @param inode The inode of the file.
+ * @param pos Where to start, in bytes from the start of the file's data.
+ * @param buf The buffer to read into.
+ * @param n The number of bytes, all of which must be inside the file's blocks.
+ * @return 0 on success, negative error code on failure.
+ */
+static int kfs_read_data(struct kfs_mount *mnt, const inode_t *inode,
+                         uint64_t pos, void *buf, uint64_t n)
+{
+  uint64_t done = 0;
+  uint64_t devpos, len;
+  int result;
+
+  while (done < n)
+  {
+    result = fs_map_span(mnt, inode, pos + done, n - done, &devpos, &len);
+    if (result == 0)
+    {
+      result = iopread(mnt->io, (char *)buf + done, len, devpos);
+    }
+    if (result < 0)
+    {
+      return result;
+    }
+    done += len;
+  }
+  return 0;
+}
+
+/**
+ * @brief Tells whether a file's data is compressed.
+ */
+static int kfs_compressed(const struct kfs_mount *mnt, const inode_t *inode)
+{
+  return mnt->version == KFS_VERSION_2 && (inode->flags & KFS_INODE_COMPRESSED);
+}
+
+/**
+ * @brief Decompresses a block of LZ4 sequences.
+ *
+ * A sequence is a token, whose high and low nibbles are the number of
+ * literals and the match length less 4, the literals, and a 2-byte
+ * little-endian offset back into the output where the match is copied from.
+ * A nibble of 15 continues in the following bytes, up to the first byte that
+ * is not 255. The last sequence ends after its literals.
+ *
+ * @param src The compressed block.
+ * @param srclen Its length.
+ * @param dst The buffer for the output.
+ * @param dstlen The length of the buffer.
+ * @return The length of the output, or -EIO if the block is corrupt.
+ */
+static long kfs_lz4_decompress(const uint8_t *src, uint64_t srclen,
+                               uint8_t *dst, uint64_t dstlen)
+{
+  const uint8_t *const src_end = src + srclen;
+  uint8_t *const dst_start = dst;
+  uint8_t *const dst_end = dst + dstlen;
+  uint64_t len, offset;
+  uint8_t token, b;
+
+  while (src < src_end)
+  {
+    token = *src++;
+
+    len = token >> 4;
+    if (len == 15)
+    {
+      do
+      {
+        if (src == src_end)
+        {
+          return -EIO;
+        }
+        b = *src++;
+        len += b;
+      } while (b == 255);
+    }
+    if (len > (uint64_t)(src_end - src) || len > (uint64_t)(dst_end - dst))
+    {
+      return -EIO;
+    }
+    memcpy(dst, src, len);
+    src += len;
+    dst += len;
+    if (src == src_end)
+    {
+      break;
+    }
+
+    if (src_end - src < 2)
+    {
+      return -EIO;
+    }
+    offset = src[0] | (src[1] << 8);
+    src += 2;
+    len = (token & 15) + 4;
+    if ((token & 15) == 15)
+    {
+      do
+      {
+        if (src == src_end)
+        {
+          return -EIO;
+        }
+        b = *src++;
+        len += b;
+      } while (b == 255);
+    }
+    if (offset == 0 || offset > (uint64_t)(dst - dst_start) ||
+        len > (uint64_t)(dst_end - dst))
+    {
+      return -EIO;
+    }
+    // the match may overlap the bytes it produces, which repeats them
+    if (offset >= len)
+    {
+      memcpy(dst, dst - offset, len);
+      dst += len;
+    }
+    else
+    {
+      for (; len != 0; len--, dst++)
+      {
+        *dst = *(dst - offset);
+      }
+    }
+  }
+  return dst - dst_start;
+}
+
+/**
+ * @brief Finds where a chunk of a compressed file is in the file's data. The
+ * chunk index is read a buffer at a time, so reading a file in order reads
+ * each part of the index once. Must be called with the mount lock held.
+ *
+ * @param mnt The mount the file belongs to.
+ * @param ino The cached inode of the file.
+ * @param chunk The chunk number.
+ * @param startptr Set to where the chunk starts in the file's data.
+ * @param lenptr Set to the length of the chunk.
+ * @return 0 on success, -EIO if the index is corrupt, or a device error.
+ */
+static int kfs_chunk_span(struct kfs_mount *mnt, const struct kfs_inode *ino,
+                          uint64_t chunk, uint32_t *startptr, uint32_t *lenptr)
+{
+  const uint64_t nchunks = (ino->inode->byte_len + KFS_CHUNK_SIZE - 1) / KFS_CHUNK_SIZE;
+  // the buffer holds entries chunk and chunk + 1
+  const uint64_t base = chunk - chunk % (KFS_ZINDEX_ENTRIES - 1);
+  uint64_t i;
+  int result;
+
+  if (mnt->zindex_len == 0 || mnt->zindex_inode != ino->inode_num ||
+      mnt->zindex_base != base)
+  {
+    mnt->zindex_len = 0;
+    i = min(KFS_ZINDEX_ENTRIES, nchunks + 1 - base);
+    result = kfs_read_data(mnt, ino->inode, base * sizeof(uint32_t),
+                           mnt->zindex, i * sizeof(uint32_t));
+    if (result < 0)
+    {
+      return result;
+    }
+    mnt->zindex_inode = ino->inode_num;
+    mnt->zindex_base = base;
+    mnt->zindex_len = i;
+  }
+
+  i = chunk - base;
+  if (mnt->zindex[i + 1] < mnt->zindex[i] ||
+      mnt->zindex[i + 1] - mnt->zindex[i] > KFS_CHUNK_SIZE)
+  {
+    return -EIO;
+  }
+  *startptr = mnt->zindex[i];
+  *lenptr = mnt->zindex[i + 1] - mnt->zindex[i];
+  return 0;
+}
+
+/**
+ * @brief Gets a chunk of a compressed file, decompressed, reading it from the
+ * device if it is not cached. The chunk stays valid until the mount lock is
+ * released. Must be called with the mount lock held.
+ *
+ * @param mnt The mount the file belongs to.
+ * @param ino The cached inode of the file.
+ * @param chunk The chunk number, which must be inside the file.
+ * @param cp Set to the cache entry on success.
+ * @return 0 on success, -EIO if the chunk is corrupt, or a device error.
+ */
+static int kfs_chunk_get(struct kfs_mount *mnt, const struct kfs_inode *ino,
+                         uint64_t chunk, struct kfs_chunk **cp)
+{
+  struct kfs_chunk *c;
+  uint32_t start, zlen;
+  long len;
+  int result;
+
+  for (int i = 0; i < KFS_CCACHE_SIZE; i++)
+  {
+    c = &mnt->ccache[i];
+    if (c->valid && c->inode_num == ino->inode_num && c->chunk == chunk)
+    {
+      *cp = c;
+      return 0;
+    }
+  }
+
+  c = &mnt->ccache[mnt->ccache_next];
+  mnt->ccache_next = (mnt->ccache_next + 1) % KFS_CCACHE_SIZE;
+  if (c->data == NULL)
+  {
+    c->data = kmalloc(KFS_CHUNK_SIZE);
+  }
+  c->valid = 0;
+  c->len = min(KFS_CHUNK_SIZE, ino->inode->byte_len - chunk * KFS_CHUNK_SIZE);
+
+  result = kfs_chunk_span(mnt, ino, chunk, &start, &zlen);
+  if (result < 0)
+  {
+    return result;
+  }
+  // a chunk that did not compress is stored as it is
+  if (zlen == c->len)
+  {
+    result = kfs_read_data(mnt, ino->inode, start, c->data, zlen);
+  }
+  else
+  {
+    result = kfs_read_data(mnt, ino->inode, start, mnt->zbuf, zlen);
+    if (result == 0)
+    {
+      len = kfs_lz4_decompress(mnt->zbuf, zlen, c->data, c->len);
+      result = (len == c->len) ? 0 : -EIO;
+    }
+  }
+  if (result < 0)
+  {
+    return result;
+  }
+  c->inode_num = ino->inode_num;
+  c->chunk = chunk;
+  c->valid = 1;
+  *cp = c;
+  return 0;
+}
+
+/**
+ * @brief Drops the cached chunks and chunk index of a file that is deleted.
+ * Must be called with the mount lock held.
+ */
+static void kfs_chunk_forget(struct kfs_mount *mnt, uint64_t inode_num)
+{
+  for (int i = 0; i < KFS_CCACHE_SIZE; i++)
+  {
+    if (mnt->ccache[i].inode_num == inode_num)
+    {
+      mnt->ccache[i].valid = 0;
+    }
+  }
+  if (mnt->zindex_inode == inode_num)
+  {
+    mnt->zindex_len = 0;
+  }
+}
+
+/**
+ * @brief Writes a cached inode back to the device. Must be called with the
+ * mount lock held.
+ */
+static int kfs_write_inode(struct kfs_mount *mnt, const struct kfs_inode *ino)
+{
+  return kfs_write_meta(mnt, 1 + ino->inode_num, ino->inode);
+}
+
+/**
+ * @brief Writes the allocation bitmaps back to the device. Must be called
+ * with the mount lock held.
+ */
+static int kfs_write_bitmap(struct kfs_mount *mnt)
+{
+  return kfs_write_meta(mnt, mnt->boot_block->bitmap_block, mnt->bitmap);
+}
+
+/**
+ * @brief Allocates a data block, preferring the block at the hint so that a
+ * file that grows stays contiguous. Must be called with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param hint The preferred block, usually the one after the file's last block.
+ * @param blknoptr Set to the allocated block.
+ * @return 0 on success, -ENOSPC if the file system is full.
+ */
+static int kfs_alloc_block(struct kfs_mount *mnt, uint64_t hint, uint64_t *blknoptr)
+{
+  const uint64_t ndata = min(mnt->boot_block->num_data, 8 * sizeof(mnt->bitmap->data_map));
+  uint64_t blkno;
+
+  if (hint >= ndata)
+  {
+    hint = 0;
+  }
+  // first free block at or after the hint, wrapping around, that was not
+  // freed in the running transaction
+  for (uint64_t i = 0; i < ndata; i++)
+  {
+    blkno = (hint + i) % ndata;
+    if (!(mnt->bitmap->data_map[blkno / 8] & (1 << (blkno % 8))) &&
+        (mnt->txn.freed == NULL || !(mnt->txn.freed[blkno / 8] & (1 << (blkno % 8)))))
+    {
+      mnt->bitmap->data_map[blkno / 8] |= 1 << (blkno % 8);
+      *blknoptr = blkno;
+      return 0;
+    }
+  }
+  return -ENOSPC;
+}
+
+/**
+ * @brief Frees a data block. With a journal, the block cannot be allocated
+ * again until the running transaction commits. Must be called with the mount
+ * lock held.
+ */
+static void kfs_free_block(struct kfs_mount *mnt, uint64_t blkno)
+{
+  mnt->bitmap->data_map[blkno / 8] &= ~(1 << (blkno % 8));
+  if (mnt->txn.freed != NULL)
+  {
+    mnt->txn.freed[blkno / 8] |= 1 << (blkno % 8);
+  }
+}
+
+/**
+ * @brief Allocates an inode. Must be called with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param inoptr Set to the inode number.
+ * @return 0 on success, -ENOSPC if every inode is in use.
+ */
+static int kfs_alloc_inode(struct kfs_mount *mnt, uint64_t *inoptr)
+{
+  const uint64_t ninodes = min(mnt->boot_block->num_inodes, 8 * KFS_INODE_MAP_SZ);
+
+  for (uint64_t i = 0; i < ninodes; i++)
+  {
+    if (!(mnt->bitmap->inode_map[i / 8] & (1 << (i % 8))))
+    {
+      mnt->bitmap->inode_map[i / 8] |= 1 << (i % 8);
+      *inoptr = i;
+      return 0;
+    }
+  }
+  return -ENOSPC;
+}
+
+/**
+ * @brief Frees an inode. Must be called with the mount lock held.
+ */
+static void kfs_free_inode(struct kfs_mount *mnt, uint64_t inode_num)
+{
+  mnt->bitmap->inode_map[inode_num / 8] &= ~(1 << (inode_num % 8));
+}
+
+/**
+ * @brief Changes the length of a file on a version 2 image with bitmaps.
+ *
+ * Growing allocates data blocks next to the file's last block, extending its
+ * last extent where possible. The new bytes are not cleared; callers either
+ * write them or zero them. Shrinking frees the blocks past the new end. The
+ * inode and the bitmaps are written back. Must be called with the mount lock
+ * held.
+ *
+ * @param mnt The mount.
+ * @param ino The cached inode of the file.
+ * @param len The new length in bytes.
+ * @return 0 on success, -ENOSPC if the file system or the extent list is full.
+ */
+static int kfs_resize(struct kfs_mount *mnt, struct kfs_inode *ino, uint64_t len)
+{
+  inode_t *inode = ino->inode;
+  uint64_t have = 0, want = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint64_t blkno;
+  extent_t *last;
+  int result = 0;
+  int changed = 0; // whether the bitmap changed
+
+  for (uint32_t i = 0; i < inode->num_extents; i++)
+  {
+    have += inode->extents[i].len;
+  }
+
+  // grow one block at a time
+  while (have < want)
+  {
+    last = (inode->num_extents != 0) ? &inode->extents[inode->num_extents - 1] : NULL;
+    result = kfs_alloc_block(mnt, (last != NULL) ? last->start + last->len : 0, &blkno);
+    if (result < 0)
+    {
+      break;
+    }
+    if (last != NULL && blkno == last->start + last->len)
+    {
+      last->len++;
+    }
+    else if (inode->num_extents < MAX_EXTENTS)
+    {
+      inode->extents[inode->num_extents].start = blkno;
+      inode->extents[inode->num_extents].len = 1;
+      inode->num_extents++;
+    }
+    else
+    {
+      kfs_free_block(mnt, blkno);
+      result = -ENOSPC;
+      break;
+    }
+    have++;
+    changed = 1;
+  }
+
+  // shrink from the last extent backwards
+  while (have > want)
+  {
+    last = &inode->extents[inode->num_extents - 1];
+    kfs_free_block(mnt, last->start + last->len - 1);
+    if (--last->len == 0)
+    {
+      inode->num_extents--;
+    }
+    have--;
+    changed = 1;
+  }
+
+  if (result == 0)
+  {
+    inode->byte_len = len;
+  }
+  else if (inode->byte_len > have * BLOCK_SIZE)
+  {
+    inode->byte_len = have * BLOCK_SIZE;
+  }
+
+  // keep the blocks we allocated even on failure, the file owns them
+  if (kfs_write_inode(mnt, ino) < 0 || (changed && kfs_write_bitmap(mnt) < 0))
+  {
+    return -EIO;
+  }
+  return result;
+}
+
+/**
+ * @brief Finds the image block that holds entry i of a subdirectory.
+ */
+static int kfs_dir_block(struct kfs_mount *mnt, const inode_t *dir, uint64_t i, uint64_t *blknoptr)
+{
+  uint64_t blkno, run;
+  int result;
+
+  result = kfs_bmap(mnt, dir, i / KFS_DENTRIES_PER_BLOCK, 1, &blkno, &run);
+  if (result < 0)
+  {
+    return result;
+  }
+  *blknoptr = 1 + mnt->boot_block->num_inodes + blkno;
+  return 0;
+}
+
+/**
+ * @brief Reads entry i of a subdirectory. Directory blocks are metadata, so
+ * they are read and written through the journal. Must be called with the
+ * mount lock held.
+ */
+static int kfs_dir_get(struct kfs_mount *mnt, const inode_t *dir, uint64_t i, dentry_t *dentry)
+{
+  uint64_t blkno;
+  int result;
+
+  result = kfs_dir_block(mnt, dir, i, &blkno);
+  if (result == 0)
+  {
+    result = kfs_read_meta(mnt, blkno, mnt->dirbuf);
+  }
+  if (result == 0)
+  {
+    *dentry = mnt->dirbuf[i % KFS_DENTRIES_PER_BLOCK];
+  }
+  return result;
+}
+
+/**
+ * @brief Writes entry i of a subdirectory. Must be called with the mount lock
+ * held.
+ */
+static int kfs_dir_set(struct kfs_mount *mnt, const inode_t *dir, uint64_t i, const dentry_t *dentry)
+{
+  uint64_t blkno;
+  int result;
+
+  result = kfs_dir_block(mnt, dir, i, &blkno);
+  if (result == 0)
+  {
+    result = kfs_read_meta(mnt, blkno, mnt->dirbuf);
+  }
+  if (result == 0)
+  {
+    mnt->dirbuf[i % KFS_DENTRIES_PER_BLOCK] = *dentry;
+    result = kfs_write_meta(mnt, blkno, mnt->dirbuf);
+  }
+  return result;
+}
+
+/**
+ * @brief Searches a subdirectory for a name, one block at a time. Must be
+ * called with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param dir The inode of the directory.
+ * @param name The name.
+ * @param dentry Set to a copy of the entry.
+ * @param idxptr Set to the index of the entry.
+ * @return 0 on success, -ENOENT if there is no such entry.
+ */
+static int kfs_dir_find(struct kfs_mount *mnt, const inode_t *dir, const char *name,
+                        dentry_t *dentry, uint64_t *idxptr)
+{
+  const uint64_t n = dir->byte_len / sizeof(dentry_t);
+  uint64_t blkno;
+  int result;
+
+  for (uint64_t i = 0; i < n; i++)
+  {
+    if (i % KFS_DENTRIES_PER_BLOCK == 0)
+    {
+      result = kfs_dir_block(mnt, dir, i, &blkno);
+      if (result == 0)
+      {
+        result = kfs_read_meta(mnt, blkno, mnt->dirbuf);
+      }
+      if (result < 0)
+      {
+        return result;
+      }
+    }
+    if (strncmp(mnt->dirbuf[i % KFS_DENTRIES_PER_BLOCK].file_name, name, MAX_FILE_NAME_LENGTH) == 0)
+    {
+      *dentry = mnt->dirbuf[i % KFS_DENTRIES_PER_BLOCK];
+      *idxptr = i;
+      return 0;
+    }
+  }
+  return -ENOENT;
+}
+
+/**
+ * @brief Finds the dentry cache slot of a name in a subdirectory.
+ */
+static struct kfs_dcache_entry *fs_dcache_slot(struct kfs_mount *mnt, uint64_t dir,
+                                               const char *name, uint32_t *hashptr)
+{
+  *hashptr = fs_name_hash(name) ^ (uint32_t)(dir * 2654435761u);
+  return &mnt->dcache[*hashptr % KFS_DCACHE_SIZE];
+}
+
+/**
+ * @brief Forgets a name in a subdirectory once its entry is removed. Must be
+ * called with the mount lock held.
+ */
+static void fs_dcache_remove(struct kfs_mount *mnt, uint64_t dir, const char *name)
+{
+  uint32_t h;
+  struct kfs_dcache_entry *de = fs_dcache_slot(mnt, dir, name, &h);
+
+  if (de->valid && de->hash == h && de->dir == dir &&
+      strncmp(de->name, name, MAX_FILE_NAME_LENGTH) == 0)
+  {
+    de->valid = 0;
+  }
+}
+
+/**
+ * @brief Looks up a name in a directory. Names in the root directory are
+ * found with the name index; names in subdirectories with the dentry cache,
+ * or by searching the directory if they are not cached. Must be called with
+ * the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param dir The directory, KFS_ROOT_DIR or the inode number of a subdirectory.
+ * @param name The name.
+ * @param dentry Set to a copy of the entry.
+ * @return 0 on success, -ENOENT if there is no such entry.
+ */
+static int fs_dir_lookup(struct kfs_mount *mnt, uint64_t dir, const char *name, dentry_t *dentry)
+{
+  struct kfs_dcache_entry *de;
+  struct kfs_inode *ino;
+  uint64_t i;
+  uint32_t h;
+  int result;
+
+  if (dir == KFS_ROOT_DIR)
+  {
+    result = fs_hash_lookup(mnt, name);
+    if (result < 0)
+    {
+      return -ENOENT;
+    }
+    *dentry = mnt->boot_block->dir_entries[result];
+    return 0;
+  }
+
+  de = fs_dcache_slot(mnt, dir, name, &h);
+  if (de->valid && de->hash == h && de->dir == dir &&
+      strncmp(de->name, name, MAX_FILE_NAME_LENGTH) == 0)
+  {
+    memset(dentry, 0, sizeof(dentry_t));
+    strncpy(dentry->file_name, name, MAX_FILE_NAME_LENGTH);
+    dentry->inode = de->inode;
+    dentry->type = de->type;
+    return 0;
+  }
+
+  result = fs_inode_get(mnt, dir, &ino);
+  if (result < 0)
+  {
+    return result;
+  }
+  result = kfs_dir_find(mnt, ino->inode, name, dentry, &i);
+  fs_inode_put(ino);
+  if (result < 0)
+  {
+    return result;
+  }
+
+  de->dir = dir;
+  de->hash = h;
+  de->inode = dentry->inode;
+  de->type = dentry->type;
+  strncpy(de->name, name, MAX_FILE_NAME_LENGTH);
+  de->valid = 1;
+  return 0;
+}
+
+/**
+ * @brief Resolves a path to the directory that holds its last component.
+ * Must be called with the mount lock held.
+ *
+ * @param mnt The mount.
+ * @param path The path within the mount, components are separated by '/'.
+ * @param dirptr Set to the directory, KFS_ROOT_DIR or a subdirectory inode number.
+ * @param name Set to the last component.
+ * @return 0 on success, -ENOENT if a directory on the path does not exist,
+ *         -ENOTDIR if one is a file, -EINVAL if a component is empty or too long.
+ */
+static int fs_resolve(struct kfs_mount *mnt, const char *path, uint64_t *dirptr,
+                      char name[MAX_FILE_NAME_LENGTH + 1])
+{
+  uint64_t dir = KFS_ROOT_DIR;
+  dentry_t dentry;
+  const char *end;
+  size_t len;
+  int result;
+
+  while (*path == '/')
+  {
+    path++;
+  }
+  for (;;)
+  {
+    end = path;
+    while (*end != '\0' && *end != '/')
+    {
+      end++;
+    }
+    len = end - path;
+    if (len == 0 || len > MAX_FILE_NAME_LENGTH)
+    {
+      return -EINVAL;
+    }
+    memcpy(name, path, len);
+    name[len] = '\0';
+
+    while (*end == '/')
+    {
+      end++;
+    }
+    if (*end == '\0')
+    {
+      break;
+    }
+
+    result = fs_dir_lookup(mnt, dir, name, &dentry);
+    if (result < 0)
+    {
+      return result;
+    }
+    if (dentry.type != KFS_DT_DIR)
+    {
+      return -ENOTDIR;
+    }
+    dir = dentry.inode;
+    path = end;
+  }
+  *dirptr = dir;
+  return 0;
+}
+
+/**
+ * @brief Adds an entry to a directory. The root directory has room for
+ * MAX_DIR_ENTRIES entries, subdirectories grow as needed. Must be called with
+ * the mount lock held.
+ */
+static int fs_dir_add(struct kfs_mount *mnt, uint64_t dir, const dentry_t *dentry)
+{
+  boot_block_t *boot_block = mnt->boot_block;
+  struct kfs_inode *ino;
+  uint64_t n;
+  int result;
+
+  if (dir == KFS_ROOT_DIR)
+  {
+    if (boot_block->num_dentry >= MAX_DIR_ENTRIES)
+    {
+      return -ENOSPC;
+    }
+    boot_block->dir_entries[boot_block->num_dentry] = *dentry;
+    boot_block->num_dentry++;
+    fs_hash_insert(mnt, boot_block->num_dentry - 1);
+    return kfs_write_meta(mnt, 0, boot_block);
+  }
+
+  result = fs_inode_get(mnt, dir, &ino);
+  if (result < 0)
+  {
+    return result;
+  }
+  n = ino->inode->byte_len / sizeof(dentry_t);
+  result = kfs_resize(mnt, ino, (n + 1) * sizeof(dentry_t));
+  if (result == 0)
+  {
+    result = kfs_dir_set(mnt, ino->inode, n, dentry);
+  }
+  fs_inode_put(ino);
+  return result;
+}
+
+/**
+ * @brief Removes an entry from a directory. The last entry moves into its
+ * slot so that the directory stays dense. Must be called with the mount lock
+ * held.
+ */
+static int fs_dir_remove(struct kfs_mount *mnt, uint64_t dir, const char *name)
+{
+  boot_block_t *boot_block = mnt->boot_block;
+  struct kfs_inode *ino;
+  dentry_t dentry;
+  uint64_t i, last;
+  int result;
+
+  if (dir == KFS_ROOT_DIR)
+  {
+    result = fs_hash_lookup(mnt, name);
+    if (result < 0)
+    {
+      return -ENOENT;
+    }
+    i = result;
+    last = boot_block->num_dentry - 1;
+    fs_hash_remove(mnt, i);
+    if (i != last)
+    {
+      fs_hash_remove(mnt, last);
+      boot_block->dir_entries[i] = boot_block->dir_entries[last];
+      fs_hash_insert(mnt, i);
+    }
+    boot_block->num_dentry--;
+    return kfs_write_meta(mnt, 0, boot_block);
+  }
+
+  fs_dcache_remove(mnt, dir, name);
+  result = fs_inode_get(mnt, dir, &ino);
+  if (result < 0)
+  {
+    return result;
+  }
+  result = kfs_dir_find(mnt, ino->inode, name, &dentry, &i);
+  if (result == 0)
+  {
+    last = ino->inode->byte_len / sizeof(dentry_t) - 1;
+    if (i != last)
+    {
+      result = kfs_dir_get(mnt, ino->inode, last, &dentry);
+      if (result == 0)
+      {
+        result = kfs_dir_set(mnt, ino->inode, i, &dentry);
+      }
+    }
+  }
+  if (result == 0)
+  {
+    result = kfs_resize(mnt, ino, last * sizeof(dentry_t));
+  }
+  fs_inode_put(ino);
+  return result;
+}
+
+/**
+ * @brief Opens a file and sets up an I/O interface for it.
+ *
+ * This function resolves the path of a file on its mount, one directory at a
+ * time. If the file is found, it takes a file from the pool of closed files
+ * and sets up the I/O interface embedded in it.
+ *
+ * @param name The path of the file to open, optionally prefixed with a mount name.
+ * @param io A pointer to a pointer to an I/O interface structure. This will be set to the newly created I/O interface.
+ * @return 0 on success, -ENOENT if there is no such file, -EISDIR if it is a
+ *         directory, -ENOMEM if out of memory.
+ */
+
+int fs_open(const char *name, struct io_intf **io)
+{
+  // search the file in its directory
+
+  lock_acquire(&fs_lk);
+  static const struct io_ops fs_io_ops = {
+      .close = fs_close,
+      .read = fs_read,
+      .write = fs_write,
+      .ctl = fs_ioctl,
+      .readv = fs_readv,
+      .writev = fs_writev,
+      .pread = fs_pread,
+      .pwrite = fs_pwrite};
+  struct kfs_mount *mnt = fs_find_mount(&name);
+  lock_release(&fs_lk);
+  if (mnt == NULL)
+  {
+    return -ENOENT;
+  }
+  char comp[MAX_FILE_NAME_LENGTH + 1];
+  dentry_t dentry;
+  uint64_t dir;
+  // get the in-core inode, it is read from disk only if no open file uses it
+  struct kfs_inode *inode;
+  lock_acquire(&mnt->lk);
+  int result = fs_resolve(mnt, name, &dir, comp);
+  if (result == 0)
+  {
+    result = fs_dir_lookup(mnt, dir, comp, &dentry);
+  }
+  if (result == 0 && dentry.type == KFS_DT_DIR)
+  {
+    result = -EISDIR;
+  }
+  if (result == 0)
+  {
+    result = fs_inode_get(mnt, dentry.inode, &inode);
+  }
+  lock_release(&mnt->lk);
+  if (result < 0)
+  {
+    return result;
+  }
+  // set up a new file, its io interface is embedded in it
+  lock_acquire(&fs_lk);
+  file_t *file = fs_file_alloc();
+  lock_release(&fs_lk);
+  if (file == NULL)
+  {
+    lock_acquire(&mnt->lk);
+    fs_inode_put(inode);
+    lock_release(&mnt->lk);
+    return -ENOMEM;
+  }
+  file->io_intf.ops = &fs_io_ops;
+  // initialize the reference count to 1
+  file->io_intf.refcnt = 1;
+  file->mnt = mnt;
+  file->inode = inode;
+  file->inode_num = dentry.inode;
+  file->file_position = 0;
+  file->next = NULL;
+  // pass the io interface to the caller
+  *io = &file->io_intf;
+  return 0;
+}
+
+/**
+ * @brief Creates an empty file or directory.
+ *
+ * Allocates an inode from the inode bitmap and adds an entry for it to its
+ * parent directory. Only images with allocation bitmaps support this.
+ *
+ * @param name The path, optionally prefixed with a mount name.
+ * @param type KFS_DT_FILE or KFS_DT_DIR.
+ * @return 0 on success, -EEXIST if the name exists, -ENOSPC if the directory
+ *         or the inode table is full, -ENOTSUP if the image has no bitmaps.
+ */
+static int fs_mknod(const char *name, uint8_t type)
+{
+  struct kfs_mount *mnt;
+  struct kfs_inode *ino;
+  char comp[MAX_FILE_NAME_LENGTH + 1];
+  dentry_t dentry;
+  uint64_t dir, inode_num;
+  int result;
+
+  lock_acquire(&fs_lk);
+  mnt = fs_find_mount(&name);
+  lock_release(&fs_lk);
+  if (mnt == NULL)
+  {
+    return -ENOENT;
+  }
+  if (!(mnt->features & KFS_FEATURE_BITMAP))
+  {
+    return -ENOTSUP;
+  }
+
+  lock_acquire(&mnt->lk);
+  result = fs_resolve(mnt, name, &dir, comp);
+  if (result == 0)
+  {
+    result = fs_dir_lookup(mnt, dir, comp, &dentry);
+    result = (result == 0) ? -EEXIST : (result == -ENOENT) ? 0 : result;
+  }
+  if (result == 0 && dir == KFS_ROOT_DIR && mnt->boot_block->num_dentry >= MAX_DIR_ENTRIES)
+  {
+    result = -ENOSPC;
+  }
+  if (result == 0)
+  {
+    result = kfs_txn_begin(mnt);
+  }
+  if (result == 0)
+  {
+    result = kfs_alloc_inode(mnt, &inode_num);
+  }
+  if (result == 0)
+  {
+    // a freed inode still has its old contents on disk, start over empty
+    result = fs_inode_get(mnt, inode_num, &ino);
+    if (result == 0)
+    {
+      memset(ino->inode, 0, sizeof(inode_t));
+      result = kfs_write_inode(mnt, ino);
+      fs_inode_put(ino);
+    }
+    if (result == 0)
+    {
+      memset(&dentry, 0, sizeof(dentry_t));
+      strncpy(dentry.file_name, comp, MAX_FILE_NAME_LENGTH);
+      dentry.inode = inode_num;
+      dentry.type = type;
+      result = fs_dir_add(mnt, dir, &dentry);
+    }
+    if (result == 0)
+    {
+      result = kfs_write_bitmap(mnt);
+    }
+    if (result < 0)
+    {
+      kfs_txn_abort(mnt);
+    }
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
+
+/**
+ * @brief Creates an empty file.
+ *
+ * @param name The path of the file, optionally prefixed with a mount name.
+ * @return 0 on success, or a negative error code, see fs_mknod.
+ */
+int fs_create(const char *name)
+{
+  return fs_mknod(name, KFS_DT_FILE);
+}
+
+/**
+ * @brief Creates an empty directory.
+ *
+ * @param name The path of the directory, optionally prefixed with a mount name.
+ * @return 0 on success, or a negative error code, see fs_mknod.
+ */
+int fs_mkdir(const char *name)
+{
+  return fs_mknod(name, KFS_DT_DIR);
+}
+
+/**
+ * @brief Deletes a file that is not open or an empty directory.
+ *
+ * Removes the entry from its parent directory, then frees the data blocks
+ * and the inode. If a step fails, the changes made so far are undone with
+ * kfs_txn_abort.
+ *
+ * @param name The path, optionally prefixed with a mount name.
+ * @param type KFS_DT_FILE or KFS_DT_DIR, the type the entry must have.
+ * @return 0 on success, -ENOENT if there is no such entry, -EISDIR or -ENOTDIR
+ *         if it has the other type, -EBUSY if the file is open, -ENOTEMPTY if
+ *         the directory is not empty, -ENOTSUP if the image has no bitmaps.
+ */
+static int fs_remove(const char *name, uint8_t type)
+{
+  struct kfs_mount *mnt;
+  struct kfs_inode *ino;
+  char comp[MAX_FILE_NAME_LENGTH + 1];
+  dentry_t dentry;
+  uint64_t dir;
+  int result;
+
+  lock_acquire(&fs_lk);
+  mnt = fs_find_mount(&name);
+  lock_release(&fs_lk);
+  if (mnt == NULL)
+  {
+    return -ENOENT;
+  }
+  if (!(mnt->features & KFS_FEATURE_BITMAP))
+  {
+    return -ENOTSUP;
+  }
+
+  lock_acquire(&mnt->lk);
+  result = fs_resolve(mnt, name, &dir, comp);
+  if (result == 0)
+  {
+    result = fs_dir_lookup(mnt, dir, comp, &dentry);
+  }
+  if (result == 0 && dentry.type != type)
+  {
+    result = (type == KFS_DT_DIR) ? -ENOTDIR : -EISDIR;
+  }
+  for (int j = 0; result == 0 && j < KFS_ICACHE_SIZE; j++)
+  {
+    if (mnt->icache[j].valid && mnt->icache[j].inode_num == dentry.inode &&
+        mnt->icache[j].refcnt != 0)
+    {
+      result = -EBUSY;
+    }
+  }
+
+  if (result == 0)
+  {
+    result = kfs_txn_begin(mnt);
+  }
+  if (result == 0)
+  {
+    result = fs_inode_get(mnt, dentry.inode, &ino);
+  }
+  if (result == 0)
+  {
+    if (type == KFS_DT_DIR && ino->inode->byte_len != 0)
+    {
+      result = -ENOTEMPTY;
+    }
+    else
+    {
+      // the entry goes first, so that it never names a freed inode
+      result = fs_dir_remove(mnt, dir, comp);
+      if (result == 0)
+      {
+        result = kfs_resize(mnt, ino, 0);
+      }
+      if (result == 0)
+      {
+        kfs_free_inode(mnt, dentry.inode);
+        result = kfs_write_bitmap(mnt);
+      }
+      if (result < 0)
+      {
+        kfs_txn_abort(mnt);
+      }
+    }
+    fs_inode_put(ino);
+    // nobody may find the stale copy once the inode is reused
+    if (result == 0)
+    {
+      ino->valid = 0;
+      kfs_chunk_forget(mnt, dentry.inode);
+    }
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
+
+/**
+ * @brief Deletes a file that is not open.
+ *
+ * @param name The path of the file, optionally prefixed with a mount name.
+ * @return 0 on success, or a negative error code, see fs_remove.
+ */
+int fs_unlink(const char *name)
+{
+  return fs_remove(name, KFS_DT_FILE);
+}
+
+/**
+ * @brief Deletes an empty directory.
+ *
+ * @param name The path of the directory, optionally prefixed with a mount name.
+ * @return 0 on success, or a negative error code, see fs_remove.
+ */
+int fs_rmdir(const char *name)
+{
+  return fs_remove(name, KFS_DT_DIR);
+}
+
+/**
+ * @brief Reads the entries of a directory.
+ *
+ * @param name The path of the directory, optionally prefixed with a mount
+ *             name; an empty path is the root directory.
+ * @param start Index of the first entry to read.
+ * @param buf Where to put the entries.
+ * @param n Size of buf in entries.
+ * @return The number of entries read, zero past the last one, -ENOTDIR if the
+ *         path is a file, -ENOENT if it does not exist.
+ */
+long fs_readdir(const char *name, uint64_t start, dentry_t *buf, uint64_t n)
+{
+  struct kfs_mount *mnt;
+  struct kfs_inode *ino;
+  char comp[MAX_FILE_NAME_LENGTH + 1];
+  dentry_t dentry;
+  uint64_t dir = KFS_ROOT_DIR;
+  uint64_t count = 0;
+  int result = 0;
+
+  lock_acquire(&fs_lk);
+  mnt = fs_find_mount(&name);
+  lock_release(&fs_lk);
+  if (mnt == NULL)
+  {
+    return -ENOENT;
+  }
+
+  lock_acquire(&mnt->lk);
+  while (*name == '/')
+  {
+    name++;
+  }
+  if (*name != '\0')
+  {
+    result = fs_resolve(mnt, name, &dir, comp);
+    if (result == 0)
+    {
+      result = fs_dir_lookup(mnt, dir, comp, &dentry);
+    }
+    if (result == 0 && dentry.type != KFS_DT_DIR)
+    {
+      result = -ENOTDIR;
+    }
+    if (result == 0)
+    {
+      dir = dentry.inode;
+    }
+  }
+
+  if (result == 0 && dir == KFS_ROOT_DIR)
+  {
+    for (; start + count < mnt->boot_block->num_dentry && count < n; count++)
+    {
+      buf[count] = mnt->boot_block->dir_entries[start + count];
+    }
+  }
+  else if (result == 0)
+  {
+    result = fs_inode_get(mnt, dir, &ino);
+    if (result == 0)
+    {
+      for (; result == 0 && start + count < ino->inode->byte_len / sizeof(dentry_t) && count < n; count++)
+      {
+        result = kfs_dir_get(mnt, ino->inode, start + count, &buf[count]);
+      }
+      fs_inode_put(ino);
+    }
+  }
+  lock_release(&mnt->lk);
+  return (result < 0) ? result : (long)count;
+}
+
+/**
+ * @brief Closes a file associated with the given I/O interface.
  *
- * This function sets up the filesystem by associating it with the provided I/O interface,
- * reading the boot block into memory, and initializing the file descriptor table.
+ * Drops the file's reference to its cached inode and returns the file,
+ * together with its I/O interface, to the pool of closed files.
  *
- * @param io Pointer to the I/O interface to be used for filesystem operations.
- * @return 0 on success, non-zero error code on failure.
+ * @param io Pointer to the I/O interface to be closed.
  */
-int fs_mount(struct io_intf *io)
+void fs_close(struct io_intf *io)
 {
-  lock_init(&fs_lk, "kfs_lock");
-  fs_io = io;
-  // Allocate memory for the boot block
-  boot_block = kmalloc(sizeof(boot_block_t));
-  ioseek(fs_io, 0);
-  ioread_full(fs_io, boot_block, BLOCK_SIZE);
-  // Read the boot block
-  // get the boot block, the boot block won't be changed after mounting
-  for (int i = 0; i < MAX_FILE_OPEN; i++)
-  {
-    file_desc_tab[i].flag = UNUSE;
-    // mark all file as UNUSE for initialization, all UNUSED files can be flushed by fs_open with new file opened
-  }
-  return 0;
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+
+  lock_acquire(&file->mnt->lk);
+  fs_inode_put(file->inode);
+  lock_release(&file->mnt->lk);
+  lock_acquire(&fs_lk);
+  fs_file_free(file);
+  lock_release(&fs_lk);
 }
 
 /**
- * @brief Opens a file and sets up an I/O interface for it.
+ * @brief Writes data to a file at a position. Must be called with the mount
+ * lock held; the file position is left to the caller.
  *
- * This function searches for a file by its name in the directory entries of the boot block.
- * If the file is found, it allocates memory for a new I/O interface, sets up the interface,
- * and initializes a file descriptor for the file.
+ * @param file The open file.
+ * @param file_position Where in the file to start writing, at most its length.
+ * @param buf Pointer to the buffer containing the data to be written.
+ * @param n Number of bytes to write from the buffer.
+ * @return The number of bytes successfully written, or a negative error code.
  *
- * @param name The name of the file to open.
- * @param io A pointer to a pointer to an I/O interface structure. This will be set to the newly created I/O interface.
- * @return 0 on success, -1 on failure (e.g., memory allocation failure).
+ * @note Files on images without bitmaps cannot grow; writes past their end
+ *       are cut short. Compressed files cannot be written at all.
  */
 
-int fs_open(const char *name, struct io_intf **io)
+static long kfs_file_write(file_t *file, uint64_t file_position, const void *buf, unsigned long n)
 {
-  // search the file in the directory
+  struct kfs_mount *mnt = file->mnt;
+  inode_t *file_inode = file->inode->inode;
+  int result = 0;
 
-  lock_acquire(&fs_lk);
-  static const struct io_ops fs_io_ops = {
-      .close = fs_close,
-      .read = fs_read,
-      .write = fs_write,
-      .ctl = fs_ioctl};
-  for (int i = 0; i < boot_block->num_dentry; i++)
+  if (file_position > file_inode->byte_len)
   {
-    if (strcmp(boot_block->dir_entries[i].file_name, name) == 0)
+    // the file was truncated by another open file
+    return -EINVAL;
+  }
+
+  if (kfs_compressed(mnt, file_inode))
+  {
+    // compressed files are read-only
+    return -ENOTSUP;
+  }
+
+  if (file_position + n > file_inode->byte_len)
+  {
+    if (mnt->features & KFS_FEATURE_BITMAP)
     {
-      // file found
-      // set up a new instance of io_interface for the file struct
-      struct io_intf *file_io = (struct io_intf *)kmalloc(sizeof(struct io_intf));
-      if (file_io == NULL)
+      // grow the file, new blocks are allocated next to its last block
+      result = kfs_txn_begin(mnt);
+      if (result == 0)
       {
-        return -EINVAL; // Handle memory allocation failure
+        result = kfs_resize(mnt, file->inode, file_position + n);
       }
-
-      file_io->ops = &fs_io_ops;
-      // initialize the reference count to 1
-      file_io->refcnt = 1;
-      // pass the io interface to the caller
-      *io = file_io;
-      // check if the file has unique io interface
-
-      // set inode_num to be the inode number of the file
-      uint64_t inode_num = boot_block->dir_entries[i].inode;
-      // seek to the inode position
-      uint64_t position = fs_base + BLOCK_SIZE + boot_block->dir_entries[i].inode * BLOCK_SIZE;
-      // console_printf("Seeking to position: %d\n", position);
-      uint64_t file_position = 0;
-      ioseek(fs_io, position);
-      inode_t* file_inode = kmalloc(BLOCK_SIZE);
-      ioread_full(fs_io, file_inode, BLOCK_SIZE);
-      uint64_t file_size = (uint64_t)(file_inode->byte_len);
-      uint64_t flag = INUSE;
-      for (int j = 0; j < MAX_FILE_OPEN; j++)
+      if (result < 0)
       {
-        if (file_desc_tab[j].flag == UNUSE)
-        {
-          file_desc_tab[j].file_position = file_position;
-          file_desc_tab[j].file_size = file_size;
-          file_desc_tab[j].inode_num = inode_num;
-          file_desc_tab[j].flag = flag;
-          file_desc_tab[j].io = file_io;
-          lock_release(&fs_lk);
-          return 0;
-        }
+        return result;
       }
     }
+    else
+    {
+      // files on images without bitmaps cannot grow
+      // Zero byte written means EOF
+      n = file_inode->byte_len - file_position;
+    }
   }
-  // console_printf("File not found\n");
-  lock_release(&fs_lk);
-  return -ENOENT;
-}
 
-/**
- * @brief Closes a file associated with the given I/O interface.
- *
- * This function iterates through the file descriptor table to find the entry
- * that matches the provided I/O interface. Once found, it marks the file
- * descriptor as unused and frees the associated I/O interface memory.
- *
- * @param io Pointer to the I/O interface to be closed.
- */
-void fs_close(struct io_intf *io)
-{
-  for (int i = 0; i < MAX_FILE_OPEN; i++)
+  uint64_t bytes_written = 0;
+
+  // Write the data in runs of blocks that are contiguous on disk, only the
+  // bytes that change are written; the block device takes care of partial
+  // sectors and moves whole blocks straight from the buffer
+  while (bytes_written < n)
   {
-    if (file_desc_tab[i].io == io)
+    uint64_t devpos, len;
+
+    result = fs_map_span(mnt, file_inode, file_position + bytes_written, n - bytes_written, &devpos, &len);
+
+    if (result < 0)
     {
-      file_desc_tab[i].flag = UNUSE;
-      kfree(file_desc_tab[i].io);
-      return;
+      return result;
+    }
+
+    result = iopwrite(mnt->io, (const char *)buf + bytes_written, len, devpos);
+
+    if (result < 0)
+    {
+      return result;
     }
+    bytes_written += len;
   }
+
+  return n;
 }
 
 /**
@@ -142,312 +2346,250 @@ void fs_close(struct io_intf *io)
  * @param io Pointer to the I/O interface representing the file.
  * @param buf Pointer to the buffer containing the data to be written.
  * @param n Number of bytes to write from the buffer.
- * @return The number of bytes successfully written, or -1 if an error occurs.
+ * @return The number of bytes successfully written, or a negative error code.
  *
- * @note The function assumes that the file descriptor table and other
- *       filesystem structures are properly initialized and accessible.
- *       It also assumes that the file is not full and has enough space
- *       to accommodate the data being written.
+ * @note Files on images without bitmaps cannot grow; writes past their end
+ *       are cut short. Compressed files cannot be written at all.
  */
 
 long fs_write(struct io_intf *io, const void *buf, unsigned long n)
 {
-  lock_acquire(&fs_lk);
-  int result = 0;
-  for (int i = 0; i < MAX_FILE_OPEN; i++)
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+  struct kfs_mount *mnt = file->mnt;
+  long result;
+
+  // device access is serialized per mount
+  lock_acquire(&mnt->lk);
+  result = kfs_file_write(file, file->file_position, buf, n);
+  if (result > 0)
   {
-    if (io == file_desc_tab[i].io && file_desc_tab[i].flag == INUSE)
-    {
-      // found the file
-      file_t *file = &file_desc_tab[i];
-      uint64_t file_position = file->file_position;
-      uint64_t inode_num = file->inode_num;
+    // Update the file position
+    file->file_position += result;
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
 
-      // Seek to the inode position
-      result = ioseek(fs_io, fs_base + BLOCK_SIZE + inode_num * BLOCK_SIZE);
+/**
+ * @brief Writes data to a file at a given position, without using or
+ * changing the file position. See fs_write().
+ */
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-      // Read the inode
-      inode_t *file_inode = kmalloc(sizeof(inode_t));
-      result = ioread_full(fs_io, file_inode, BLOCK_SIZE);
+long fs_pwrite(struct io_intf *io, const void *buf, unsigned long n, uint64_t pos)
+{
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+  struct kfs_mount *mnt = file->mnt;
+  long result;
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-      // Calculate the number of blocks written based on the file position
-      uint64_t written_blocks = file_position / BLOCK_SIZE;
-      uint64_t written_bytes = file_position % BLOCK_SIZE;
+  lock_acquire(&mnt->lk);
+  result = kfs_file_write(file, pos, buf, n);
+  lock_release(&mnt->lk);
+  return result;
+}
 
-      if (file_position + n > file_inode->byte_len)
-      {
-        // Check if the file is full
-        // Zero byte written means EOF
-        n = file_inode->byte_len - file_position;
-      }
+/**
+ * @brief Writes several buffers to a file one after another, under one
+ * acquisition of the mount lock, so that other writers cannot come between
+ * them. See fs_write().
+ *
+ * @param io Pointer to the I/O interface representing the file.
+ * @param iov The buffers.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes successfully written, or a negative error code.
+ */
 
-      // Seek to the data block position
-      result = ioseek(fs_io, fs_base + BLOCK_SIZE + boot_block->num_inodes * BLOCK_SIZE + file_inode->data_block_num[written_blocks] * BLOCK_SIZE);
+long fs_writev(struct io_intf *io, const struct io_vec *iov, int iovcnt)
+{
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+  struct kfs_mount *mnt = file->mnt;
+  long result, total = 0;
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-      // Read the data block
-      data_block_t* data_block = kmalloc(sizeof(data_block_t));
-      size_t pos = 0;
-      result = ioctl(fs_io, IOCTL_GETPOS, &pos);
-      if (result < 0)
+  lock_acquire(&mnt->lk);
+  for (int i = 0; i < iovcnt; i++)
+  {
+    result = kfs_file_write(file, file->file_position, iov[i].base, iov[i].len);
+    if (result < 0)
+    {
+      if (total == 0)
       {
-        lock_release(&fs_lk);
-        return result;
+        total = result;
       }
+      break;
+    }
+    file->file_position += result;
+    total += result;
+    if (result < iov[i].len)
+    {
+      break;
+    }
+  }
+  lock_release(&mnt->lk);
+  return total;
+}
 
-      result = ioread_full(fs_io, data_block, BLOCK_SIZE);
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-      uint64_t bytes_written = 0;
+/**
+ * @brief Reads data from a file at a position into a buffer. Must be called
+ * with the mount lock held; the file position is left to the caller.
+ *
+ * @param file The open file.
+ * @param file_position Where in the file to start reading.
+ * @param buf Pointer to the buffer where the read data will be stored.
+ * @param n The number of bytes to read from the file.
+ * @return The number of bytes read on success, 0 at the end of the file, or a
+ *         negative error code.
+ */
 
-      // Write data to the blocks
-      while (bytes_written < n)
-      {
-        if (written_bytes == BLOCK_SIZE)
-        {
-          // Write the current data block to disk
-          result = ioseek(fs_io, fs_base + BLOCK_SIZE + boot_block->num_inodes * BLOCK_SIZE + file_inode->data_block_num[written_blocks] * BLOCK_SIZE);
-
-          if (result < 0)
-          {
-            lock_release(&fs_lk);
-            return result;
-          }
-          result = iowrite(fs_io, data_block, BLOCK_SIZE);
-
-          if (result < 0)
-          {
-            lock_release(&fs_lk);
-            return result;
-          }
-          // Move to the next block
-          written_blocks++;
-          written_bytes = 0;
-
-          // Check if the file is full
-          if (written_blocks == MAX_INODES)
-          {
-            return -EINVAL;
-          }
-
-          // Seek to the next data block position
-          result = ioseek(fs_io, fs_base + BLOCK_SIZE + boot_block->num_inodes * BLOCK_SIZE + file_inode->data_block_num[written_blocks] * BLOCK_SIZE);
-
-          if (result < 0)
-          {
-            lock_release(&fs_lk);
-            return result;
-          }
-
-          // Read the next data block
-          result = ioread_full(fs_io, data_block, BLOCK_SIZE);
-
-          if (result < 0)
-          {
-            lock_release(&fs_lk);
-            return result;
-          }
-        }
+static long kfs_file_read(file_t *file, uint64_t file_position, void *buf, unsigned long n)
+{
+  struct kfs_mount *mnt = file->mnt;
+  inode_t *file_inode = file->inode->inode;
+  int result = 0;
 
-        // Write the byte to the data block
-        data_block->data[written_bytes] = ((char *)buf)[bytes_written];
-        written_bytes++;
-        bytes_written++;
-      }
+  // check if the file_position is greater than the file size
+  if (file_position >= file_inode->byte_len)
+  {
+    // Zero byte read means EOF, also if another open file truncated it
+    n = 0;
+  }
+  else if (file_position + n > file_inode->byte_len)
+  {
+    // Zero byte read means EOF
+    n = file_inode->byte_len - file_position;
+  }
 
-      result = ioseek(fs_io, fs_base + BLOCK_SIZE + boot_block->num_inodes * BLOCK_SIZE + file_inode->data_block_num[written_blocks] * BLOCK_SIZE);
+  uint64_t bytes_read = 0; // Counter for the number of bytes read
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
+  if (kfs_compressed(mnt, file_inode))
+  {
+    // copy out of the decompressed chunks
+    while (bytes_read < n)
+    {
+      struct kfs_chunk *chunk;
+      uint64_t pos = file_position + bytes_read;
+      uint64_t offset = pos % KFS_CHUNK_SIZE;
+      uint64_t len;
 
-      result = iowrite(fs_io, data_block, BLOCK_SIZE);
+      result = kfs_chunk_get(mnt, file->inode, pos / KFS_CHUNK_SIZE, &chunk);
 
       if (result < 0)
       {
-        lock_release(&fs_lk);
         return result;
       }
+      len = min(chunk->len - offset, n - bytes_read);
+      memcpy((char *)buf + bytes_read, chunk->data + offset, len);
+      bytes_read += len;
+    }
+  }
+  else
+  {
+    // Read the data straight into the buffer. Only the requested bytes are
+    // read, so small sequential reads are served from the sector the block
+    // device already has buffered.
+    result = kfs_read_data(mnt, file_inode, file_position, buf, n);
 
-      // Update the file position
-      // console_printf("n: %d\n", n);
-      file->file_position += n;
-      // console_printf("file position: %d\n", file->file_position);
-      lock_release(&fs_lk);
-      return n;
+    if (result < 0)
+    {
+      return result;
     }
   }
-  lock_release(&fs_lk);
-  return -ENOENT;
+  return n; // Return the number of bytes read
 }
 
 /**
  * @brief Reads data from a file into a buffer.
  *
  * This function reads up to `n` bytes of data from the file associated with the given
- * I/O interface (`io`) into the provided buffer (`buf`). It searches through the file
- * descriptor table to find the matching I/O interface and reads the file data starting
- * from the current file position.
+ * I/O interface (`io`) into the provided buffer (`buf`), starting from the current
+ * file position. The file is found from the interface embedded in it.
  *
  * @param io Pointer to the I/O interface associated with the file.
  * @param buf Pointer to the buffer where the read data will be stored.
  * @param n The number of bytes to read from the file.
- * @return The number of bytes read on success, or -1 if an error occurs (e.g., if the
- *         file descriptor is not found or if the file is full).
+ * @return The number of bytes read on success, or a negative error code.
  */
 
 long fs_read(struct io_intf *io, void *buf, unsigned long n)
 {
-  lock_acquire(&fs_lk);
-  int result = 0;
-  // Loop through the file descriptor table to find the matching io interface
-  for (int i = 0; i < MAX_FILE_OPEN; i++)
-  {
-    if (io == file_desc_tab[i].io && file_desc_tab[i].flag == INUSE)
-    {
-      // Found the file descriptor
-      file_t *file = &file_desc_tab[i];
-      uint64_t file_position = file->file_position; // Current position in the file
-      uint64_t inode_num = file->inode_num;         // Inode number of the file
-      // Seek to the inode location in the filesystem
-      result = ioseek(fs_io, fs_base + BLOCK_SIZE + inode_num * BLOCK_SIZE);
-
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-
-      // Read the inode data
-      inode_t *file_inode = kmalloc(sizeof(inode_t));
-      memset(file_inode, 0, sizeof(inode_t));
-
-      result = ioread_full(fs_io, file_inode, BLOCK_SIZE); // Read the inode data
-
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-      // Calculate the number of blocks and bytes to read based on the file position
-      uint64_t read_blocks = file_position / BLOCK_SIZE;
-      uint64_t read_bytes = file_position % BLOCK_SIZE;
-
-      // Seek to the data block that contains the file data
-      data_block_t* data_block = kmalloc(sizeof(data_block_t));
-      if (read_blocks == sizeof(file_inode->data_block_num) / sizeof(file_inode->data_block_num[0]))
-      {
-        lock_release(&fs_lk);
-        return -EINVAL;
-      }
-      // check if the file_position is greater than the file size
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+  struct kfs_mount *mnt = file->mnt;
+  long result;
 
-      if (file_position + n > file_inode->byte_len)
-      {
-        // Zero byte read means EOF
-        n = file_inode->byte_len - file_position;
-      }
+  // device access is serialized per mount
+  lock_acquire(&mnt->lk);
+  result = kfs_file_read(file, file->file_position, buf, n);
+  if (result > 0)
+  {
+    // Update the file position after reading
+    file->file_position += result;
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
 
-      result = ioseek(fs_io, fs_base + BLOCK_SIZE + boot_block->num_inodes * BLOCK_SIZE + file_inode->data_block_num[read_blocks] * BLOCK_SIZE);
+/**
+ * @brief Reads data from a file at a given position, without using or
+ * changing the file position, so that processes sharing the file do not race
+ * on it. See fs_read().
+ */
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
-      // console_printf("Reading from block: %d\n", file_inode.data_block_num[read_blocks]);
-      uint64_t pos = 0;
-      fs_io->ops->ctl(fs_io, IOCTL_GETPOS, &pos);
+long fs_pread(struct io_intf *io, void *buf, unsigned long n, uint64_t pos)
+{
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+  struct kfs_mount *mnt = file->mnt;
+  long result;
 
-      result = ioread_full(fs_io, data_block, BLOCK_SIZE); // Read the data block
+  lock_acquire(&mnt->lk);
+  result = kfs_file_read(file, pos, buf, n);
+  lock_release(&mnt->lk);
+  return result;
+}
 
-      if (result < 0)
-      {
-        lock_release(&fs_lk);
-        return result;
-      }
+/**
+ * @brief Reads data from a file into several buffers in turn, under one
+ * acquisition of the mount lock. See fs_read().
+ *
+ * @param io Pointer to the I/O interface associated with the file.
+ * @param iov The buffers.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes read on success, or a negative error code.
+ */
 
-      uint64_t bytes_read = 0; // Counter for the number of bytes read
+long fs_readv(struct io_intf *io, const struct io_vec *iov, int iovcnt)
+{
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+  struct kfs_mount *mnt = file->mnt;
+  long result, total = 0;
 
-      // Read data from the file until the requested number of bytes is read
-      while (bytes_read < n)
+  lock_acquire(&mnt->lk);
+  for (int i = 0; i < iovcnt; i++)
+  {
+    result = kfs_file_read(file, file->file_position, iov[i].base, iov[i].len);
+    if (result < 0)
+    {
+      if (total == 0)
       {
-        if (read_bytes == BLOCK_SIZE)
-        {
-          // Move to the next block if the current block is fully read
-          read_blocks++;
-          read_bytes = 0;
-          // Check if the file is full
-          if (read_blocks == MAX_INODES)
-          {
-            // If the file is full, return an error
-            lock_release(&fs_lk);
-            return -EINVAL;
-          }
-          // Seek to the next data block
-          result = ioseek(fs_io, fs_base + BLOCK_SIZE + boot_block->num_inodes * BLOCK_SIZE + file_inode->data_block_num[read_blocks] * BLOCK_SIZE);
-
-          if (result < 0)
-          {
-            lock_release(&fs_lk);
-            return result;
-          }
-
-          result = ioread_full(fs_io, data_block, BLOCK_SIZE); // Read the next data block
-
-          if (result < 0)
-          {
-            lock_release(&fs_lk);
-            return result;
-          }
-        }
-        // Copy data from the data block to the buffer
-        // kprintf("%s on line %d storing byte at address: %x\n", __FILE__, __LINE__, &((char *)buf)[bytes_read]);
-
-        ((char *)buf)[bytes_read] = data_block->data[read_bytes];
-        // console_putchar(data_block.data[read_bytes]);
-        read_bytes++;
-        bytes_read++;
+        total = result;
       }
-      // Update the file position after reading
-      // console_printf("added %d bytes to the buffer\n", bytes_read);
-      file->file_position += n;
-      lock_release(&fs_lk);
-
-      return n; // Return the number of bytes read
+      break;
+    }
+    file->file_position += result;
+    total += result;
+    if (result < iov[i].len)
+    {
+      break;
     }
   }
-  // If the file descriptor is not found, return an error
-  lock_release(&fs_lk);
-  return -ENOENT;
+  lock_release(&mnt->lk);
+  return total;
 }
 
+
 /**
  * @brief Perform an I/O control operation on a file.
  *
- * This function iterates through the file descriptor table to find the file
- * associated with the provided I/O interface (`io`). Once found, it performs
- * the specified I/O control command (`cmd`) on the file.
+ * This function performs the specified I/O control command (`cmd`) on the
+ * file that embeds the provided I/O interface (`io`).
  *
  * @param io Pointer to the I/O interface structure.
  * @param cmd The I/O control command to be performed. Supported commands are:
@@ -455,56 +2597,58 @@ long fs_read(struct io_intf *io, void *buf, unsigned long n)
  *            - IOCTL_SETPOS: Set the position within the file.
  *            - IOCTL_GETPOS: Get the current position within the file.
  *            - IOCTL_GETBLKSZ: Get the block size of the file.
+ *            - IOCTL_FLUSH: Commit the journal and flush the device.
+ *            - IOCTL_MAP: Get a pointer to the file's bytes on a device in memory.
  * @param arg Pointer to the argument for the I/O control command.
  *
- * @return The result of the I/O control command, or -1 if the command is not supported,
- *         or -ENOTSUP if the provided I/O interface does not match any file.
+ * @return The result of the I/O control command, or -EINVAL if the command is
+ *         not supported.
  */
 
 int fs_ioctl(struct io_intf *io, int cmd, void *arg)
 {
-  lock_acquire(&fs_lk);
-  for (int i = 0; i < MAX_FILE_OPEN; i++)
+  file_t *const file = (void *)io - offsetof(file_t, io_intf);
+
+  switch (cmd)
   {
-    file_t *file = &(file_desc_tab[i]);
-    struct io_intf *file_io = file->io;
-    // check if the file_io is the same `io_intf` as the argument provided
-    if (io == file_io)
-    {
-      switch (cmd)
-      {
-      case IOCTL_GETLEN:
-        lock_release(&fs_lk);
-        return fs_getlen(file, arg);
-      case IOCTL_SETPOS:
-        lock_release(&fs_lk);
-        return fs_setpos(file, arg);
-      case IOCTL_GETPOS:
-        lock_release(&fs_lk);
-        return fs_getpos(file, arg);
-      case IOCTL_GETBLKSZ:
-        lock_release(&fs_lk);
-        return fs_getblksz(file, arg);
-      case IOCTL_GETREFCNT:
-        *(uint64_t *)arg = file_io->refcnt;
-        lock_release(&fs_lk);
-        return 0;
-      case IOCTL_GETDENTRY:
-        memcpy(arg, boot_block->dir_entries, sizeof(dentry_t) * boot_block->num_dentry);
-        lock_release(&fs_lk);
-        return 0;
-      case IOCTL_GETDENTRY_NUM:
-        *(uint64_t *)arg = boot_block->num_dentry;
-        lock_release(&fs_lk);
-        return 0;
-      default:
-        lock_release(&fs_lk);
-        return -EINVAL;
-      }
-    }
+  case IOCTL_GETLEN:
+    return fs_getlen(file, arg);
+  case IOCTL_SETPOS:
+    return fs_setpos(file, arg);
+  case IOCTL_SETLEN:
+    return fs_setlen(file, arg);
+  case IOCTL_GETPOS:
+    return fs_getpos(file, arg);
+  case IOCTL_GETBLKSZ:
+    return fs_getblksz(file, arg);
+  case IOCTL_GETREFCNT:
+    *(uint64_t *)arg = io->refcnt;
+    return 0;
+  // the directory is protected by the mount lock
+  case IOCTL_GETDENTRY:
+    lock_acquire(&file->mnt->lk);
+    memcpy(arg, file->mnt->boot_block->dir_entries, sizeof(dentry_t) * file->mnt->boot_block->num_dentry);
+    lock_release(&file->mnt->lk);
+    return 0;
+  case IOCTL_GETDENTRY_NUM:
+    lock_acquire(&file->mnt->lk);
+    *(uint64_t *)arg = file->mnt->boot_block->num_dentry;
+    lock_release(&file->mnt->lk);
+    return 0;
+  case IOCTL_FLUSH:
+    return fs_flush(file, arg);
+  case IOCTL_MAP:
+    return fs_map(file, arg);
+  // device statistics and coalescing are passed through to the block device
+  case IOCTL_GETSTATS:
+  case IOCTL_GETCOALESCE:
+  case IOCTL_SETCOALESCE:
+  case IOCTL_GETPOLL:
+  case IOCTL_SETPOLL:
+    return ioctl(file->mnt->io, cmd, arg);
+  default:
+    return -EINVAL;
   }
-  lock_release(&fs_lk);
-  return -ENOTSUP;
 }
 
 /**
@@ -520,7 +2664,7 @@ int fs_getlen(file_t *file, void *arg)
 {
   if (arg != NULL)
   {
-    uint64_t size = file->file_size;
+    uint64_t size = file->inode->inode->byte_len;
     *(uint64_t *)arg = size;
   }
   else
@@ -562,7 +2706,7 @@ int fs_getpos(file_t *file, void *arg)
  */
 int fs_setpos(file_t *file, void *arg)
 {
-  if (*(uint64_t *)arg > file->file_size)
+  if (*(uint64_t *)arg > file->inode->inode->byte_len)
   {
     return -EINVAL;
   }
@@ -570,6 +2714,62 @@ int fs_setpos(file_t *file, void *arg)
   return 0;
 }
 
+/**
+ * @brief Set the length of the file (truncate or extend).
+ *
+ * Shrinking frees the blocks past the new end. Extending allocates blocks
+ * and fills the new bytes with zeros. Only files on images with allocation
+ * bitmaps can change length.
+ *
+ * @param file Pointer to the file structure.
+ * @param arg The new length of the file.
+ * @return 0 on success, -ENOTSUP if the image has no bitmaps or the file is
+ *         compressed, -ENOSPC if it is full.
+ */
+int fs_setlen(file_t *file, void *arg)
+{
+  static const char zeros[BLOCK_SIZE];
+  struct kfs_mount *mnt = file->mnt;
+  inode_t *file_inode = file->inode->inode;
+  uint64_t len, old_len, pos, devpos, n;
+  int result;
+
+  if (arg == NULL)
+  {
+    return -EINVAL;
+  }
+  if (!(mnt->features & KFS_FEATURE_BITMAP))
+  {
+    return -ENOTSUP;
+  }
+  len = *(uint64_t *)arg;
+
+  lock_acquire(&mnt->lk);
+  if (kfs_compressed(mnt, file_inode))
+  {
+    lock_release(&mnt->lk);
+    return -ENOTSUP;
+  }
+  old_len = file_inode->byte_len;
+  result = kfs_txn_begin(mnt);
+  if (result == 0)
+  {
+    result = kfs_resize(mnt, file->inode, len);
+  }
+
+  // clear the bytes that the file grew by
+  for (pos = old_len; result == 0 && pos < len; pos += n)
+  {
+    result = fs_map_span(mnt, file_inode, pos, min(len - pos, BLOCK_SIZE - pos % BLOCK_SIZE), &devpos, &n);
+    if (result == 0)
+      result = iopwrite(mnt->io, zeros, n, devpos);
+    if (result > 0)
+      result = 0;
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
+
 /**
  * @brief Get the block size of the file.
  *
@@ -591,4 +2791,86 @@ int fs_getblksz(file_t *file, void *arg)
     return -EINVAL;
   }
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Makes the file system durable: commits the running journal
+ * transaction, which ends with a flush, or just flushes the block device if
+ * there is nothing to commit.
+ *
+ * @param file Pointer to the file structure.
+ * @param arg Ignored.
+ * @return 0 on success, negative error code on failure.
+ */
+int fs_flush(file_t *file, void *arg)
+{
+  struct kfs_mount *mnt = file->mnt;
+  int result;
+
+  lock_acquire(&mnt->lk);
+  if (mnt->txn.count != 0)
+  {
+    result = kfs_txn_commit(mnt);
+  }
+  else
+  {
+    result = kfs_flush(mnt);
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
+
+/**
+ * @brief Gets a pointer to the bytes of the file at the current position, on
+ * a mount whose device is in memory, so they can be used without a copy. The
+ * pointer stays valid while the file is open and its length does not change.
+ *
+ * @param file Pointer to the file structure.
+ * @param arg Pointer to a struct io_map, see IOCTL_MAP.
+ * @return 0 on success, -ENOTSUP if the device is not in memory or the file
+ *         is compressed, or a negative error code.
+ */
+int fs_map(file_t *file, void *arg)
+{
+  struct kfs_mount *mnt = file->mnt;
+  inode_t *file_inode = file->inode->inode;
+  struct io_map *map = arg;
+  uint64_t devpos, len;
+  int result;
+
+  if (map == NULL)
+  {
+    return -EINVAL;
+  }
+  if (!mnt->mapped)
+  {
+    return -ENOTSUP;
+  }
+
+  lock_acquire(&mnt->lk);
+  if (kfs_compressed(mnt, file_inode))
+  {
+    lock_release(&mnt->lk);
+    return -ENOTSUP;
+  }
+  if (file->file_position >= file_inode->byte_len)
+  {
+    map->ptr = NULL;
+    map->len = 0;
+    lock_release(&mnt->lk);
+    return 0;
+  }
+  len = min(map->len, file_inode->byte_len - file->file_position);
+  result = fs_map_span(mnt, file_inode, file->file_position, len, &devpos, &len);
+  if (result == 0)
+  {
+    result = ioseek(mnt->io, devpos);
+  }
+  if (result == 0)
+  {
+    map->len = len;
+    result = ioctl(mnt->io, IOCTL_MAP, map);
+  }
+  lock_release(&mnt->lk);
+  return result;
+}
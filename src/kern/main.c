@@ -18,6 +18,28 @@
 // #define INIT_PROC "lock_test"
 // #define INIT_PROC "refcnt"
 // #define INIT_PROC "pipe_test"
+// #define INIT_PROC "blkintr"
+// #define INIT_PROC "blklat"
+// #define INIT_PROC "blkmq"
+// #define INIT_PROC "blkdual"
+// #define INIT_PROC "blksmall"
+// #define INIT_PROC "blkseq"
+// #define INIT_PROC "fsopen"
+// #define INIT_PROC "fsload"
+// #define INIT_PROC "fsappend"
+// #define INIT_PROC "fsjournal"
+// #define INIT_PROC "fsmany"
+// #define INIT_PROC "fspath"
+// #define INIT_PROC "pipebench"
+// #define INIT_PROC "splicebench"
+// #define INIT_PROC "catbench"
+// #define INIT_PROC "vecbench"
+// #define INIT_PROC "linebench"
+// #define INIT_PROC "echopoll"
+// #define INIT_PROC "uringbench"
+// #define INIT_PROC "uartbench"
+// #define INIT_PROC "execbench"
+// #define INIT_PROC "vconbench"
 
 
 #include "console.h"
@@ -36,8 +58,12 @@
 #include "process.h"
 #include "config.h"
 
+extern char _initrd_start[];
+extern char _initrd_end[];
+
 void main(void)
 {
+    static struct io_lit initrd;
     struct io_intf *initio;
     struct io_intf *blkio;
     void *mmio_base;
@@ -51,6 +77,7 @@ void main(void)
     thread_init();
     procmgr_init();
     timer_init();
+    console_start_async();
 
     // Attach NS16550a serial devices
 
@@ -71,17 +98,42 @@ void main(void)
 
     intr_enable();
 
-    result = device_open(&blkio, "blk", 0);
+    // A kfs image linked into the kernel (make INITRD=...) is mounted from
+    // memory as the root file system, and blk0, if any, as "disk"
+
+    if (_initrd_end - _initrd_start != 0) {
+        result = fs_mount(iolit_init(&initrd, _initrd_start,
+            _initrd_end - _initrd_start));
+
+        if (result != 0)
+            panic("fs_mount of initrd failed");
+
+        debug("Mounted initrd");
+
+        if (device_open(&blkio, "blk", 0) == 0) {
+            if (fs_mount_as(blkio, "disk") == 0)
+                debug("Mounted blk0 as disk");
+        }
+    } else {
+        result = device_open(&blkio, "blk", 0);
 
-    if (result != 0)
-        panic("device_open failed");
+        if (result != 0)
+            panic("device_open failed");
 
-    result = fs_mount(blkio);
+        result = fs_mount(blkio);
 
-    debug("Mounted blk0");
+        debug("Mounted blk0");
 
-    if (result != 0)
-        panic("fs_mount failed");
+        if (result != 0)
+            panic("fs_mount failed");
+    }
+
+    // A second block device, if present, is mounted as "scratch"
+
+    if (device_open(&blkio, "blk", 1) == 0) {
+        if (fs_mount_as(blkio, "scratch") == 0)
+            debug("Mounted blk1 as scratch");
+    }
 
     result = fs_open(INIT_PROC, &initio);
 
@@ -46,6 +46,8 @@ extern char _kimg_rodata_end[];
 extern char _kimg_data_start[];
 extern char _kimg_data_end[];
 extern char _kimg_end[];
+extern char _initrd_start[];
+extern char _initrd_end[];
 
 // INTERNAL TYPE DEFINITIONS
 //
@@ -126,8 +128,8 @@ static struct pte main_pt0_0x80000[PTE_CNT]
  * Memory layout:
  * - 0 to RAM_START: RW gigapages (MMIO region)
  * - RAM_START to _kimg_end: RX/R/RW pages based on kernel image
- * - _kimg_end to RAM_START + MEGA_SIZE: RW pages (heap and free page pool)
- * - RAM_START + MEGA_SIZE to RAM_END: RW megapages (free page pool)
+ * - _kimg_end to RAM_START + MEGA_SIZE: RW pages (initrd, heap and free page pool)
+ * - RAM_START + MEGA_SIZE to RAM_END: RW megapages (rest of a large initrd, free page pool)
  *
  * @note This function must be called during the system initialization process.
  *       It assumes that the kernel image is loaded at RAM_START and that the
@@ -159,6 +161,8 @@ void memory_init(void)
     kprintf("           RAM: [%p,%p): %zu MB\n",
             RAM_START, RAM_END, RAM_SIZE / 1024 / 1024);
     kprintf("  Kernel image: [%p,%p)\n", _kimg_start, _kimg_end);
+    if (_initrd_end - _initrd_start != 0)
+        kprintf("        initrd: [%p,%p)\n", _initrd_start, _initrd_end);
 
     // Kernel must fit inside 2MB megapage (one level 1 PTE)
 
@@ -169,8 +173,8 @@ void memory_init(void)
     //
     //         0 to RAM_START:           RW gigapages (MMIO region)
     // RAM_START to _kimg_end:           RX/R/RW pages based on kernel image
-    // _kimg_end to RAM_START+MEGA_SIZE: RW pages (heap and free page pool)
-    // RAM_START+MEGA_SIZE to RAM_END:   RW megapages (free page pool)
+    // _kimg_end to RAM_START+MEGA_SIZE: RW pages (initrd, heap and free page pool)
+    // RAM_START+MEGA_SIZE to RAM_END:   RW megapages (initrd, free page pool)
     //
     // RAM_START = 0x80000000
     // MEGA_SIZE = 2 MB
@@ -224,11 +228,11 @@ void memory_init(void)
     csrw_satp(main_mtag);
     sfence_vma();
 
-    // Give the memory between the end of the kernel image and the next page
-    // boundary to the heap allocator, but make sure it is at least
-    // HEAP_INIT_MIN bytes.
+    // Give the memory between the end of the kernel image, or of the initrd
+    // linked in after it, and the next page boundary to the heap allocator,
+    // but make sure it is at least HEAP_INIT_MIN bytes.
 
-    heap_start = _kimg_end;
+    heap_start = (_initrd_end - _initrd_start != 0) ? _initrd_end : _kimg_end;
     heap_end = round_up_ptr(heap_start, PAGE_SIZE);
     if (heap_end - heap_start < HEAP_INIT_MIN)
     {
@@ -689,6 +693,76 @@ void memory_set_range_flags(
     }
 }
 
+// Translates a virtual pointer in the active memory space to a physical
+// address. Unlike walk_pt, never follows an invalid page table entry.
+/**
+ * @brief Translates a virtual pointer to a physical address.
+ *
+ * Pointers outside of user space are direct-mapped and returned unchanged.
+ * User pointers are looked up in the active page table, and only pages that
+ * are mapped (not merely reserved for demand paging) with at least the given
+ * flags are translated.
+ *
+ * @param vp The virtual pointer to translate.
+ * @param rwxug_flags Flags that the page containing vp must be mapped with.
+ * @return The physical address, or 0 if the page is not mapped with the flags.
+ */
+uintptr_t memory_vptr_to_pma(const void *vp, uint_fast8_t rwxug_flags)
+{
+    const uintptr_t vma = (uintptr_t)vp;
+    struct pte *pt1, *pt0;
+    struct pte *root = active_space_root();
+
+    if (vma < USER_START_VMA || USER_END_VMA <= vma)
+        return vma;
+
+    if (!(root[VPN2(vma)].flags & PTE_V))
+        return 0;
+    pt1 = pagenum_to_pageptr(root[VPN2(vma)].ppn);
+    if (!(pt1[VPN1(vma)].flags & PTE_V))
+        return 0;
+    pt0 = pagenum_to_pageptr(pt1[VPN1(vma)].ppn);
+    if (!(pt0[VPN0(vma)].flags & PTE_V) ||
+        (pt0[VPN0(vma)].flags & rwxug_flags) != rwxug_flags)
+        return 0;
+
+    return (uintptr_t)pagenum_to_pageptr(pt0[VPN0(vma)].ppn) + (vma & (PAGE_SIZE - 1));
+}
+
+// Exchanges the physical page behind a mapped user page with another page,
+// for moving whole pages in and out of kernel buffers without copying them.
+/**
+ * @brief Exchanges the physical page mapped at a user virtual page.
+ *
+ * The page at vp keeps its flags but is backed by pp afterwards. The page that
+ * backed it before is returned and belongs to the caller from then on. Both
+ * pages must come from memory_alloc_page, since the user page is eventually
+ * freed with memory_free_page.
+ *
+ * @param vp Page-aligned user virtual pointer.
+ * @param pp Direct-mapped pointer of the page to map at vp.
+ * @param rwxug_flags Flags that the page at vp must be mapped with.
+ * @return The page previously mapped at vp, or NULL if vp is not a page-aligned
+ *         user page mapped with the flags.
+ */
+void *memory_exchange_page(void *vp, void *pp, uint_fast8_t rwxug_flags)
+{
+    const uintptr_t vma = (uintptr_t)vp;
+    uintptr_t old_pma;
+    struct pte *pte;
+
+    if (vma < USER_START_VMA || USER_END_VMA <= vma || !aligned_addr(vma, PAGE_SIZE))
+        return NULL;
+    old_pma = memory_vptr_to_pma(vp, rwxug_flags);
+    if (old_pma == 0)
+        return NULL;
+
+    pte = walk_pt(active_space_root(), vma, 0);
+    pte->ppn = pageptr_to_pagenum(pp);
+    sfence_vma();
+    return (void *)old_pma;
+}
+
 // Checks if a virtual address range is mapped with specified flags. Returns 1
 // if and only if every virtual page containing the specified virtual address
 // range is mapped with the at least the specified flags.
@@ -724,6 +798,37 @@ int memory_validate_vptr_len(
     return 0;
 }
 
+// Checks that a buffer a system call is given lies in user space and that
+// every page of it is mapped with all of the specified flags, so that the
+// kernel can access it without faulting.
+/**
+ * @brief Validates a user buffer before the kernel reads or writes it.
+ *
+ * Unlike memory_validate_vptr_len, which accepts a page mapped with any of the
+ * flags, every page from the one containing vp up to the one containing the
+ * last byte must be a user page mapped with all of rwxug_flags.
+ *
+ * @param vp The start of the buffer.
+ * @param len The length of the buffer in bytes.
+ * @param rwxug_flags Flags every page must be mapped with, e.g. PTE_U | PTE_W
+ *        for a buffer the kernel stores into.
+ * @return 0 if the buffer is valid, -EINVAL otherwise.
+ */
+int memory_validate_user_vptr_len(
+    const void *vp, size_t len, uint_fast8_t rwxug_flags)
+{
+    const uintptr_t start = (uintptr_t)vp;
+
+    if (start < USER_START_VMA || USER_END_VMA <= start || USER_END_VMA - start < len)
+        return -EINVAL;
+    for (uintptr_t vma = round_down_addr(start, PAGE_SIZE); vma < start + len; vma += PAGE_SIZE)
+    {
+        if (memory_vptr_to_pma((const void *)vma, rwxug_flags) == 0)
+            return -EINVAL;
+    }
+    return 0;
+}
+
 // Checks if the virtual pointer points to a mapped range containing a
 // null-terminated string. Returns 1 if and only if the virtual pointer points
 // to a mapped readable page with the specified flags, and every byte starting
@@ -155,6 +155,15 @@ const void * vp, size_t size, uint_fast8_t rwxug_flags);
 extern int memory_validate_vptr_len (
     const void * vp, size_t len, uint_fast8_t rwxug_flags);
 
+// int memory_validate_user_vptr_len (
+//     const void * vp, size_t len, uint_fast8_t rwxug_flags);
+// Checks that a buffer passed to a system call lies in user space and that
+// every page containing a byte of it is mapped with all of the specified
+// flags. Returns 0 if so and -EINVAL otherwise.
+
+extern int memory_validate_user_vptr_len (
+    const void * vp, size_t len, uint_fast8_t rwxug_flags);
+
 // int memory_validate_vstr (
 //     const char * vs, uint_fast8_t ug_flags)
 // Checks if the virtual pointer points to a mapped range containing a
@@ -166,6 +175,27 @@ extern int memory_validate_vptr_len (
 extern int memory_validate_vstr (
     const char * vs, uint_fast8_t ug_flags);
 
+// uintptr_t memory_vptr_to_pma (
+//     const void * vp, uint_fast8_t rwxug_flags)
+// Translates a virtual pointer in the active memory space to a physical
+// address, for handing buffers to DMA-capable devices. Pointers outside of
+// user space are direct-mapped. Returns 0 if the page containing /vp/ is not
+// mapped with at least the specified flags.
+
+extern uintptr_t memory_vptr_to_pma (
+    const void * vp, uint_fast8_t rwxug_flags);
+
+// void * memory_exchange_page (
+//     void * vp, void * pp, uint_fast8_t rwxug_flags)
+// Maps the physical page /pp/ at the page-aligned user address /vp/ in place of
+// the page mapped there, keeping its flags, and returns the direct-mapped
+// address of the old page, which now belongs to the caller. Returns NULL and
+// changes nothing if /vp/ is not a user page mapped with at least the
+// specified flags.
+
+extern void * memory_exchange_page (
+    void * vp, void * pp, uint_fast8_t rwxug_flags);
+
 // Called from excp.c to handle a page fault at the specified address. Either
 // maps a page containing the faulting address, or calls process_exit().
 
@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# Description:
+# Places the kfs image in file `$1` into an object which contains an ".initrd"
+# section. At link time, this will be placed after the kernel image, see
+# kernel.ld, and main() mounts it as the root file system from memory.
+# Without an argument the section is empty and the kernel mounts blk0.
+#
+# Like mkcomp.sh, but the section is writable, so files can be changed until
+# the machine is reset.
+
+AS=riscv64-unknown-elf-as
+OBJCOPY=riscv64-unknown-elf-objcopy
+echo .end | $AS -o empty.o
+if [ -z "$1" ]; then
+	mv empty.o initrd.o
+else
+	$OBJCOPY --set-section-flags .initrd=alloc,load,data --add-section .initrd=$1 empty.o initrd.o
+	rm empty.o
+fi
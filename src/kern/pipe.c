@@ -3,155 +3,663 @@
 #include "device.h"
 #include "pipe.h"
 #include "heap.h"
+#include "memory.h"
 #include "string.h"
 
+#define min(a,b) (a < b ? a : b)
+
+// A pipe is a ring buffer of /capacity/ bytes spread over whole pages. head
+// and tail count the bytes read and written since the pipe was made, so the
+// pipe holds tail - head bytes starting at ring position head % capacity.
+// Each end has its own io_intf and reference count; the pipe goes away when
+// both ends are closed.
+//
+// _splice() does its I/O on the other object without the pipe lock, so that a
+// splice waiting for that object does not hold up the other end of the pipe.
+// While a splice fills the free part of the ring, /filling/ keeps other
+// writers out of it; while one drains the data, /draining/ keeps other
+// readers out. The ends do not touch each other's part of the ring.
+
 struct pipe {
-    struct io_intf io_intf;
-    struct lock buf_lock;
-    char data[PIPE_SIZE];
-    size_t size_read;
-    size_t size_written;
+    struct io_intf rd_io;   // read end
+    struct io_intf wr_io;   // write end
+    struct lock buf_lock;   // serializes readers and writers
+    char * pages[PIPE_MAX_CAPACITY / PAGE_SIZE];
+    size_t capacity;
+    uint64_t head;
+    uint64_t tail;
+    char rd_open;           // whether the read end is open
+    char wr_open;           // whether the write end is open
+    char rd_nonblock;       // whether reads fail with -EAGAIN rather than wait
+    char wr_nonblock;       // whether writes fail with -EAGAIN rather than wait
+    char filling;           // whether a splice is reading into the ring
+    char draining;          // whether a splice is writing out of the ring
     struct condition not_empty;
-    struct condition empty;
+    struct condition not_full;
 };
 
 
 // INTERNAL FUNCTION DEFINITIONS
-// 
+//
 
 
-int pipe_open(struct io_intf ** ioptr);
-static void pipe_close(struct io_intf * io);
+int pipe_open(struct io_intf ** rdptr, struct io_intf ** wrptr, size_t capacity);
+static void pipe_rd_close(struct io_intf * io);
+static void pipe_wr_close(struct io_intf * io);
 static long pipe_read(struct io_intf * io, void * buf, unsigned long bufsz);
 static long pipe_write(struct io_intf * io, const void * buf, unsigned long n);
-static int pipe_ioctl(struct io_intf * io, int cmd, void * arg);
+static int pipe_rd_ioctl(struct io_intf * io, int cmd, void * arg);
+static int pipe_wr_ioctl(struct io_intf * io, int cmd, void * arg);
+static int pipe_ioctl(struct pipe * pi, int cmd, void * arg);
+static int pipe_rd_poll(struct io_intf * io, int events);
+static int pipe_wr_poll(struct io_intf * io, int events);
+long pipe_vmsplice(struct io_intf * io, void * buf, unsigned long n);
+int pipe_is_read_end(const struct io_intf * io);
+long pipe_splice(struct io_intf * in, struct io_intf * out, unsigned long n);
+static int pipe_wait_data(struct pipe * pi);
+static int pipe_wait_room(struct pipe * pi);
+static void pipe_wake(struct condition * cond);
+static long pipe_fill(struct pipe * pi, struct io_intf * in, unsigned long n);
+static long pipe_drain(struct pipe * pi, struct io_intf * out, unsigned long n);
 
 
 // EXPORTED FUNCTION DEFINITIONS
-static const struct io_ops pipe_ops = {
-    .close = pipe_close,
+static const struct io_ops pipe_rd_ops = {
+    .close = pipe_rd_close,
     .read = pipe_read,
+    .ctl = pipe_rd_ioctl,
+    .poll = pipe_rd_poll
+};
+
+static const struct io_ops pipe_wr_ops = {
+    .close = pipe_wr_close,
     .write = pipe_write,
-    .ctl = pipe_ioctl
+    .ctl = pipe_wr_ioctl,
+    .poll = pipe_wr_poll
 };
 
 /**
  * @brief Open a pipe, allow communcation between two processes (from the same fork) if the pipe is created before fork,
  * called on _pipe() syscall
- * @param ioptr the pointer to the io interface to be filled in
- * @return always 0, means success
+ * @param rdptr set to the io interface of the read end
+ * @param wrptr set to the io interface of the write end
+ * @param capacity the size of the ring buffer in bytes, PIPE_DEFAULT_CAPACITY if 0
+ * @return 0 on success, -EINVAL if the capacity is larger than PIPE_MAX_CAPACITY
  */
-int pipe_open(struct io_intf ** ioptr) {
+int pipe_open(struct io_intf ** rdptr, struct io_intf ** wrptr, size_t capacity) {
     struct pipe * pi;
+
+    if (capacity == 0)
+        capacity = PIPE_DEFAULT_CAPACITY;
+    if (capacity > PIPE_MAX_CAPACITY)
+        return -EINVAL;
+
     pi = kmalloc(sizeof(struct pipe));
-    pi->io_intf.ops = &pipe_ops;
+    if (pi == NULL)
+        return -ENOMEM;
+    memset(pi, 0, sizeof(struct pipe));
+    for (size_t i = 0; i * PAGE_SIZE < capacity; i++)
+        pi->pages[i] = memory_alloc_page();
 
-    pi->size_read = 0;
-    pi->size_written = 0;
-    memset(pi->data, 0, PIPE_SIZE);
+    pi->rd_io.ops = &pipe_rd_ops;
+    pi->rd_io.refcnt = 1;
+    pi->wr_io.ops = &pipe_wr_ops;
+    pi->wr_io.refcnt = 1;
+    pi->capacity = capacity;
+    pi->rd_open = 1;
+    pi->wr_open = 1;
     lock_init(&pi->buf_lock, "pipe_lock");
+    condition_init(&pi->not_empty, "pipe_not_empty");
+    condition_init(&pi->not_full, "pipe_not_full");
 
-    *ioptr = &pi->io_intf;
-    (*ioptr)->refcnt = 1;
+    *rdptr = &pi->rd_io;
+    *wrptr = &pi->wr_io;
     return 0;
 }
 
 /**
- * @brief Read from pipe buffer, compatible with ioread
- * @param io the io interface in the pipe struct to read from
- * @param buf the buffer to read to
- * @param bufsz the size of the buffer to read, but actually not used, just used to comply with ioread
- * @note This function will block until there is data to read
- * @return number of bytes read, if negative, error code
+ * @brief Find the contiguous part of the ring at a position
+ * @param pi the pipe
+ * @param pos the position in the pipe, a count of bytes like head and tail
+ * @param lenp set to the number of bytes up to the end of the page or of the
+ *        ring, whichever comes first
+ * @return pointer to the byte at pos
  */
-long pipe_read(struct io_intf * io, void * buf, unsigned long bufsz) {
+static char * pipe_slot(struct pipe * pi, uint64_t pos, size_t * lenp) {
+    const size_t off = pos % pi->capacity;
 
-    lock_acquire(&((struct pipe *)io)->buf_lock); // wait for read to complete
-    
-    struct pipe * pi = (struct pipe *)io; // io_intf is the first member of struct pipe
+    *lenp = min(PAGE_SIZE - off % PAGE_SIZE, pi->capacity - off);
+    return pi->pages[off / PAGE_SIZE] + off % PAGE_SIZE;
+}
 
-    if(bufsz > PIPE_SIZE) {
-        lock_release(&pi->buf_lock);
-        return -EINVAL;
+/**
+ * @brief Copy bytes between a buffer and the ring, wrapping around its end and
+ * crossing page boundaries as needed. Must be called with the pipe lock held.
+ * @param pi the pipe
+ * @param pos the position in the pipe, a count of bytes like head and tail
+ * @param buf the buffer to copy from or to
+ * @param n number of bytes to copy
+ * @param to_ring whether to copy from buf into the ring, or the other way
+ */
+static void pipe_copy(struct pipe * pi, uint64_t pos, void * buf, size_t n, int to_ring) {
+    size_t len;
+    char * p;
+
+    while (n != 0) {
+        p = pipe_slot(pi, pos, &len);
+        len = min(len, n);
+        if (to_ring)
+            memcpy(p, buf, len);
+        else
+            memcpy(buf, p, len);
+        buf += len;
+        pos += len;
+        n -= len;
     }
+}
 
-    size_t initial_size_read = pi->size_read;
-    if(pi->size_read == pi->size_written) {
+/**
+ * @brief Like pipe_copy for a user buffer, but whole ring pages that line up
+ * with whole user pages trade places with them instead of being copied. Must
+ * be called with the pipe lock held.
+ * @param pi the pipe
+ * @param pos the position in the pipe, a count of bytes like head and tail
+ * @param buf the user buffer to move from or to
+ * @param n number of bytes to move
+ * @param to_ring whether to move from buf into the ring, or the other way
+ * @note Moving into the ring leaves the user page zeroed. The ring page it
+ *       gets may hold data that passed through the pipe before, or whatever
+ *       the page held before the pipe was opened, so it is cleared first.
+ */
+static void pipe_move(struct pipe * pi, uint64_t pos, void * buf, size_t n, int to_ring) {
+    const uint_fast8_t flags = PTE_U | (to_ring ? PTE_R : PTE_W);
+    size_t len;
+    void * old;
+    char * p;
+
+    while (n != 0) {
+        p = pipe_slot(pi, pos, &len);
+        len = min(len, n);
+        old = NULL;
+        if (len == PAGE_SIZE && (uintptr_t)buf % PAGE_SIZE == 0) {
+            if (to_ring)
+                memset(p, 0, PAGE_SIZE);
+            old = memory_exchange_page(buf, p, flags);
+        }
+        if (old != NULL)
+            pi->pages[pos % pi->capacity / PAGE_SIZE] = old;
+        else
+            pipe_copy(pi, pos, buf, len, to_ring);
+        buf += len;
+        pos += len;
+        n -= len;
+    }
+}
+
+/**
+ * @brief Wait until the pipe has data or its write end is closed, and no
+ * splice is draining it. Must be called with the pipe lock held, which is
+ * held again on return.
+ * @param pi the pipe
+ * @return 0, or -EAGAIN without waiting if the read end is non-blocking
+ */
+static int pipe_wait_data(struct pipe * pi) {
+    int s;
+
+    if (((pi->tail == pi->head && pi->wr_open) || pi->draining) && pi->rd_nonblock)
+        return -EAGAIN;
+
+    // Interrupts stay off from the check to the wait, so that a writer cannot
+    // slip in between and have its wakeup missed
+    s = intr_disable();
+    while ((pi->tail == pi->head && pi->wr_open) || pi->draining) {
         lock_release(&pi->buf_lock);
         condition_wait(&pi->not_empty);
         lock_acquire(&pi->buf_lock);
     }
+    intr_restore(s);
+    return 0;
+}
 
-    while(pi->size_read != pi->size_written) {
-        // copy data from pipe to buf
-        for(size_t i = 0; i < pi->size_written-pi->size_read; i++) {
-            ((char *)buf)[i] = pi->data[i];
-            pi->size_read ++;
-        }
+/**
+ * @brief Wait until the pipe has room or its read end is closed, and no
+ * splice is filling it. Must be called with the pipe lock held, which is held
+ * again on return.
+ * @param pi the pipe
+ * @return 0, or -EAGAIN without waiting if the write end is non-blocking
+ */
+static int pipe_wait_room(struct pipe * pi) {
+    int s;
+
+    if (((pi->tail - pi->head == pi->capacity && pi->rd_open) || pi->filling) &&
+        pi->wr_nonblock)
+        return -EAGAIN;
+
+    s = intr_disable();
+    while ((pi->tail - pi->head == pi->capacity && pi->rd_open) || pi->filling) {
+        lock_release(&pi->buf_lock);
+        condition_wait(&pi->not_full);
+        lock_acquire(&pi->buf_lock);
     }
+    intr_restore(s);
+    return 0;
+}
 
-    condition_broadcast(&pi->empty);
+/**
+ * @brief Wake the threads waiting on one of the pipe's conditions, and any
+ * polling threads, which may be waiting for either end
+ * @param cond not_empty or not_full
+ */
+static void pipe_wake(struct condition * cond) {
+    condition_broadcast(cond);
+    io_notify_ready();
+}
+
+/**
+ * @brief Read from pipe buffer, compatible with ioread
+ * @param io the io interface of the read end
+ * @param buf the buffer to read to
+ * @param bufsz the size of the buffer
+ * @note This function will block until there is data to read, and then reads
+ *       what is there up to bufsz bytes
+ * @return number of bytes read, 0 once the pipe is empty and the write end is closed
+ */
+long pipe_read(struct io_intf * io, void * buf, unsigned long bufsz) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, rd_io);
+    size_t n;
+
+    if (bufsz == 0)
+        return 0;
+
+    lock_acquire(&pi->buf_lock);
+    if (pipe_wait_data(pi) < 0) {
+        lock_release(&pi->buf_lock);
+        return -EAGAIN;
+    }
+
+    n = min(bufsz, pi->tail - pi->head);
+    pipe_copy(pi, pi->head, buf, n, 0);
+    pi->head += n;
+
+    pipe_wake(&pi->not_full);
     lock_release(&pi->buf_lock);
-    return pi->size_read - initial_size_read;    
+    return n;
 }
 
 /**
  * @brief Write to a pipe buffer indicated by the io interface in parameter, compatible with iowrite
- * @param io the io interface in the pipe struct to write to
- * @param buf the buffer to write to
+ * @param io the io interface of the write end
+ * @param buf the buffer to write from
  * @param n number of bytes to write
- * @return number of bytes written, if negative, error code
+ * @note This function will block until there is room, and then writes as much
+ *       as fits up to n bytes; iowrite keeps calling it for the rest
+ * @return number of bytes written, -EPIPE if the read end is closed
  */
 long pipe_write(struct io_intf * io, const void * buf, unsigned long n){
-    lock_acquire(&((struct pipe *)io)->buf_lock); // wait for write to complete
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, wr_io);
+
+    if (n == 0)
+        return 0;
 
-    struct pipe * pi = (struct pipe *)io; // io_intf is the first member of struct pipe
+    lock_acquire(&pi->buf_lock);
+    if (pipe_wait_room(pi) < 0) {
+        lock_release(&pi->buf_lock);
+        return -EAGAIN;
+    }
 
-    if(n > PIPE_SIZE) {
+    if (!pi->rd_open) {
         lock_release(&pi->buf_lock);
+        return -EPIPE;
+    }
+
+    n = min(n, pi->capacity - (pi->tail - pi->head));
+    pipe_copy(pi, pi->tail, (void *)buf, n, 1);
+    pi->tail += n;
+
+    pipe_wake(&pi->not_empty);
+    lock_release(&pi->buf_lock);
+    return n;
+}
+
+/**
+ * @brief Tell whether an io interface is the read end of a pipe, into whose
+ * user buffers _vmsplice() writes
+ * @param io the io interface
+ * @return 1 if io is the read end of a pipe, 0 otherwise
+ */
+int pipe_is_read_end(const struct io_intf * io) {
+    return io->ops == &pipe_rd_ops;
+}
+
+/**
+ * @brief Move data between a user buffer and a pipe, called on _vmsplice()
+ * syscall. Behaves like pipe_write on the write end and like pipe_read on the
+ * read end, except that whole pages of a page-aligned buffer are moved into or
+ * out of the ring by remapping them rather than copied.
+ * @param io the io interface of either end of a pipe
+ * @param buf the user buffer; whole pages moved into the pipe read as zeros after
+ * @param n number of bytes to move
+ * @return number of bytes moved, 0 at end of file, -EPIPE if the read end is
+ *         closed, -EINVAL if io is not a pipe
+ */
+long pipe_vmsplice(struct io_intf * io, void * buf, unsigned long n) {
+    struct pipe * pi;
+
+    if (io->ops == &pipe_wr_ops) {
+        pi = (void *)io - offsetof(struct pipe, wr_io);
+        if (n == 0)
+            return 0;
+        lock_acquire(&pi->buf_lock);
+        if (pipe_wait_room(pi) < 0) {
+            lock_release(&pi->buf_lock);
+            return -EAGAIN;
+        }
+        if (!pi->rd_open) {
+            lock_release(&pi->buf_lock);
+            return -EPIPE;
+        }
+        n = min(n, pi->capacity - (pi->tail - pi->head));
+        pipe_move(pi, pi->tail, buf, n, 1);
+        pi->tail += n;
+        pipe_wake(&pi->not_empty);
+    } else if (io->ops == &pipe_rd_ops) {
+        pi = (void *)io - offsetof(struct pipe, rd_io);
+        if (n == 0)
+            return 0;
+        lock_acquire(&pi->buf_lock);
+        if (pipe_wait_data(pi) < 0) {
+            lock_release(&pi->buf_lock);
+            return -EAGAIN;
+        }
+        n = min(n, pi->tail - pi->head);
+        pipe_move(pi, pi->head, buf, n, 0);
+        pi->head += n;
+        pipe_wake(&pi->not_full);
+    } else
         return -EINVAL;
+
+    lock_release(&pi->buf_lock);
+    return n;
+}
+
+/**
+ * @brief Move data between a pipe and another io object without passing it
+ * through user space, called on _splice() syscall. If out is the write end of
+ * a pipe, in is read straight into the ring; otherwise, if in is the read end
+ * of a pipe, out is written straight from the ring.
+ * @param in the io interface to read from
+ * @param out the io interface to write to
+ * @param n largest number of bytes to move
+ * @return number of bytes moved, 0 at end of file, or a negative error code;
+ *         -EINVAL if neither side is a pipe or both are the same pipe
+ */
+long pipe_splice(struct io_intf * in, struct io_intf * out, unsigned long n) {
+    struct pipe * pi;
+
+    if (out->ops == &pipe_wr_ops) {
+        pi = (void *)out - offsetof(struct pipe, wr_io);
+        if (in == &pi->rd_io)
+            return -EINVAL;
+        return pipe_fill(pi, in, n);
+    }
+    if (in->ops == &pipe_rd_ops)
+        return pipe_drain((void *)in - offsetof(struct pipe, rd_io), out, n);
+    return -EINVAL;
+}
+
+/**
+ * @brief Read from an io object into the free part of the ring. Waits for
+ * room, then fills up to n bytes of it, stopping early at a short read. The
+ * pipe lock is dropped for each read, with /filling/ set so that no other
+ * writer uses the free part meanwhile; what was read is handed to the reader
+ * after each read.
+ * @param pi the pipe
+ * @param in the io interface to read from
+ * @param n largest number of bytes to read
+ * @return number of bytes read, or a negative error code if nothing was read
+ */
+static long pipe_fill(struct pipe * pi, struct io_intf * in, unsigned long n) {
+    long total = 0;
+    long result;
+    size_t len;
+    char * p;
+
+    if (n == 0)
+        return 0;
+
+    lock_acquire(&pi->buf_lock);
+    if (pipe_wait_room(pi) < 0) {
+        lock_release(&pi->buf_lock);
+        return -EAGAIN;
+    }
+    if (!pi->rd_open) {
+        lock_release(&pi->buf_lock);
+        return -EPIPE;
     }
 
-    if(pi->size_read != pi->size_written) { // reader has not read previous data yet
+    n = min(n, pi->capacity - (pi->tail - pi->head));
+    pi->filling = 1;
+    while (total < n) {
+        p = pipe_slot(pi, pi->tail, &len);
+        len = min(len, n - total);
         lock_release(&pi->buf_lock);
-        condition_wait(&pi->empty);
+        result = ioread(in, p, len);
         lock_acquire(&pi->buf_lock);
+        if (result < 0) {
+            if (total == 0)
+                total = result;
+            break;
+        }
+        pi->tail += result;
+        total += result;
+        pipe_wake(&pi->not_empty);
+        if (result < len)
+            break;
+    }
+    pi->filling = 0;
+
+    // writers wait on not_full while the ring is being filled
+    pipe_wake(&pi->not_full);
+    lock_release(&pi->buf_lock);
+    return total;
+}
+
+/**
+ * @brief Write the data in the ring to an io object. Waits for data, then
+ * writes up to n bytes of it. The pipe lock is dropped for each write, with
+ * /draining/ set so that no other reader takes the data meanwhile; the room
+ * written out is handed to the writer after each write.
+ * @param pi the pipe
+ * @param out the io interface to write to
+ * @param n largest number of bytes to write
+ * @return number of bytes written, 0 at end of file, or a negative error code
+ *         if nothing was written
+ */
+static long pipe_drain(struct pipe * pi, struct io_intf * out, unsigned long n) {
+    long total = 0;
+    long result;
+    size_t len;
+    char * p;
+
+    if (n == 0)
+        return 0;
+
+    lock_acquire(&pi->buf_lock);
+    if (pipe_wait_data(pi) < 0) {
+        lock_release(&pi->buf_lock);
+        return -EAGAIN;
     }
 
-    for(size_t i = 0; i < n; i++) {
-        pi->data[i] = ((char *)buf)[i];
-        pi->size_written ++;
+    n = min(n, pi->tail - pi->head);
+    pi->draining = 1;
+    while (total < n) {
+        p = pipe_slot(pi, pi->head, &len);
+        len = min(len, n - total);
+        lock_release(&pi->buf_lock);
+        result = iowrite(out, p, len);
+        lock_acquire(&pi->buf_lock);
+        if (result < 0) {
+            if (total == 0)
+                total = result;
+            break;
+        }
+        pi->head += result;
+        total += result;
+        pipe_wake(&pi->not_full);
+        if (result < len)
+            break;
     }
+    pi->draining = 0;
 
-    condition_broadcast(&pi->not_empty);
+    // readers wait on not_empty while the ring is being drained
+    pipe_wake(&pi->not_empty);
     lock_release(&pi->buf_lock);
-    return n;
+    return total;
+}
+
+/**
+ * @brief Perform ioctl on the read end: IOCTL_GETFLAGS and IOCTL_SETFLAGS get
+ * and set O_NONBLOCK for reads; anything else goes to pipe_ioctl
+ */
+static int pipe_rd_ioctl(struct io_intf * io, int cmd, void * arg) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, rd_io);
+
+    switch (cmd) {
+    case IOCTL_GETFLAGS:
+        *(int *)arg = pi->rd_nonblock ? O_NONBLOCK : 0;
+        return 0;
+    case IOCTL_SETFLAGS:
+        pi->rd_nonblock = (*(int *)arg & O_NONBLOCK) != 0;
+        return 0;
+    default:
+        return pipe_ioctl(pi, cmd, arg);
+    }
 }
 
 /**
- * @brief Perform ioctl on pipe, only support PIPE_WAIT_EMPTY, compatible with ioctl
- * @param io the io interface in the pipe struct to perform ioctl on
- * @param cmd the command to perform, please include pipe.h for the command
- * @param arg the argument to the command, currently no use
+ * @brief Perform ioctl on the write end: IOCTL_GETFLAGS and IOCTL_SETFLAGS get
+ * and set O_NONBLOCK for writes; anything else goes to pipe_ioctl
  */
-int pipe_ioctl(struct io_intf * io, int cmd, void * arg) {
-    struct pipe * pi = (struct pipe *)io; // io_intf is the first member of struct pipe
+static int pipe_wr_ioctl(struct io_intf * io, int cmd, void * arg) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, wr_io);
 
-    if(cmd == PIPE_WAIT_EMPTY){
-        if(pi->size_read != pi->size_written)
-            condition_wait(&(pi->empty));
+    switch (cmd) {
+    case IOCTL_GETFLAGS:
+        *(int *)arg = pi->wr_nonblock ? O_NONBLOCK : 0;
+        return 0;
+    case IOCTL_SETFLAGS:
+        pi->wr_nonblock = (*(int *)arg & O_NONBLOCK) != 0;
         return 0;
+    default:
+        return pipe_ioctl(pi, cmd, arg);
     }
-    return -ENOTSUP;
 }
 
 /**
- * @brief Close the pipe, free the memory, compatible with ioclose
- * @param io the io interface in the pipe struct to close
+ * @brief Report the readiness of the read end, compatible with iopoll
+ * @param io the io interface of the read end
+ * @param events the events of interest
+ * @return POLLIN if there is data or the write end is closed, in which case a
+ *         read returns end of file, unless a splice is draining the pipe, and
+ *         POLLHUP if the write end is closed
  */
-void pipe_close(struct io_intf * io) {
-    struct pipe * pi = (struct pipe *)io; // io_intf is the first member of struct pipe
-    lock_acquire(&pi->buf_lock);
+static int pipe_rd_poll(struct io_intf * io, int events) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, rd_io);
+    int revents = 0;
+
+    if ((pi->tail != pi->head || !pi->wr_open) && !pi->draining)
+        revents |= events & POLLIN;
+    if (!pi->wr_open)
+        revents |= POLLHUP;
+    return revents;
+}
+
+/**
+ * @brief Report the readiness of the write end, compatible with iopoll
+ * @param io the io interface of the write end
+ * @param events the events of interest
+ * @return POLLOUT if there is room or the read end is closed, in which case a
+ *         write fails with -EPIPE, unless a splice is filling the pipe, and
+ *         POLLHUP if the read end is closed
+ */
+static int pipe_wr_poll(struct io_intf * io, int events) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, wr_io);
+    int revents = 0;
+
+    if ((pi->tail - pi->head != pi->capacity || !pi->rd_open) && !pi->filling)
+        revents |= events & POLLOUT;
+    if (!pi->rd_open)
+        revents |= POLLHUP;
+    return revents;
+}
+
+/**
+ * @brief Perform ioctl on either end of a pipe, compatible with ioctl
+ * @param pi the pipe
+ * @param cmd the command to perform: PIPE_WAIT_EMPTY waits until the reader
+ *        has taken everything, IOCTL_GETLEN gets the number of bytes in the pipe
+ * @param arg the argument to the command, a uint64_t pointer for IOCTL_GETLEN
+ */
+static int pipe_ioctl(struct pipe * pi, int cmd, void * arg) {
+    int s;
+
+    switch (cmd) {
+    case PIPE_WAIT_EMPTY:
+        s = intr_disable();
+        while (pi->tail != pi->head && pi->rd_open)
+            condition_wait(&pi->not_full);
+        intr_restore(s);
+        return 0;
+    case IOCTL_GETLEN:
+        *(uint64_t *)arg = pi->tail - pi->head;
+        return 0;
+    default:
+        return -ENOTSUP;
+    }
+}
+
+/**
+ * @brief Free a pipe whose ends are both closed
+ * @param pi the pipe
+ */
+static void pipe_free(struct pipe * pi) {
+    for (size_t i = 0; i * PAGE_SIZE < pi->capacity; i++)
+        memory_free_page(pi->pages[i]);
     kfree(pi);
 }
 
+/**
+ * @brief Close the read end once its last reference is gone, compatible with
+ * ioclose. Blocked and later writers fail with -EPIPE.
+ * @param io the io interface of the read end
+ */
+void pipe_rd_close(struct io_intf * io) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, rd_io);
+    int last;
+
+    lock_acquire(&pi->buf_lock);
+    pi->rd_open = 0;
+    last = !pi->wr_open;
+    pipe_wake(&pi->not_full);
+    lock_release(&pi->buf_lock);
+    if (last)
+        pipe_free(pi);
+}
+
+/**
+ * @brief Close the write end once its last reference is gone, compatible
+ * with ioclose. Readers get the rest of the data and then end of file.
+ * @param io the io interface of the write end
+ */
+void pipe_wr_close(struct io_intf * io) {
+    struct pipe * const pi = (void *)io - offsetof(struct pipe, wr_io);
+    int last;
+
+    lock_acquire(&pi->buf_lock);
+    pi->wr_open = 0;
+    last = !pi->rd_open;
+    pipe_wake(&pi->not_empty);
+    lock_release(&pi->buf_lock);
+    if (last)
+        pipe_free(pi);
+}
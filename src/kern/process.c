@@ -13,6 +13,7 @@
 #include "memory.h"
 #include "elf.h"
 #include "thread.h"
+#include "uring.h"
 
 // COMPILE-TIME PARAMETERS
 //
@@ -71,6 +72,7 @@ void procmgr_init(void){
     main_proc.id = MAIN_PID; // main process always have pid 0
     main_proc.tid = running_thread(); // main thread always have tid 0
     main_proc.mtag = active_memory_space();
+    main_proc.ring = NULL;
     thread_set_process(main_proc.tid, &main_proc);
     // just in case
     for (int i = 0; i < PROCESS_IOMAX; i++){
@@ -92,6 +94,8 @@ void procmgr_init(void){
  * @return int Returns 0 on success, or a negative error code on failure.
  */
 int process_exec(struct io_intf *exeio){
+    // 0. The ring is in the old memory, so stop its workers first
+    uring_release(current_process());
     // 1. Any virtual memory mappings belonging to other user processes should be unmapped
     memory_unmap_and_free_user();
     // 2. A fresh 2nd level (root) page table should be created and initialized with the default mappings for a user process
@@ -129,6 +133,9 @@ int process_exec(struct io_intf *exeio){
  */
 void process_exit(void){
 
+    // stop the ring's workers before the memory they use goes away
+    uring_release(current_process());
+
     // reclaim memory space
     if(running_thread() != main_proc.tid){
         memory_space_reclaim();
@@ -177,6 +184,7 @@ int process_fork(const struct trap_frame * parent_tfr){
     proctab[child_pid] = kmalloc(sizeof(struct process));
     proctab[child_pid]->id = child_pid;
     proctab[child_pid]->mtag = memory_space_clone(0);
+    proctab[child_pid]->ring = NULL; // the child starts without a ring
 
 
     // copies the io_intf pointers from parent's iotab to child's iotab 
@@ -21,6 +21,7 @@ struct process {
     int tid; // thread id of associated thread
     uintptr_t mtag; // memory space identifier
     struct io_intf * iotab[PROCESS_IOMAX]; // an array of io_intf pointers
+    struct uring_ctx * ring; // submission and completion rings, or NULL
 };
 
 // EXPORTED VARIABLES DECLARATIONS
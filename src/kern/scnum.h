@@ -10,11 +10,21 @@
 #define SYSCALL_DEVOPEN 10
 #define SYSCALL_FSOPEN  11
 #define SYSCALL_PIPE    12
+#define SYSCALL_FSCREATE 13
+#define SYSCALL_FSUNLINK 14
+#define SYSCALL_MKDIR   15
+#define SYSCALL_RMDIR   16
+#define SYSCALL_READDIR 17
 
 #define SYSCALL_CLOSE   20
 #define SYSCALL_READ    21
 #define SYSCALL_WRITE   22
 #define SYSCALL_IOCTL   23
+#define SYSCALL_FSYNC   24
+#define SYSCALL_TRUNCATE 25
+#define SYSCALL_SPLICE  26
+#define SYSCALL_VMSPLICE 27
+#define SYSCALL_SENDFILE 28
 
 #define SYSCALL_EXEC    30
 #define SYSCALL_FORK    31
@@ -22,5 +32,14 @@
 #define SYSCALL_USLEEP  40
 #define SYSCALL_WAIT    41
 
+#define SYSCALL_READV   50
+#define SYSCALL_WRITEV  51
+#define SYSCALL_PREAD   52
+#define SYSCALL_PWRITE  53
+#define SYSCALL_POLL    54
+#define SYSCALL_URING_SETUP 55
+#define SYSCALL_URING_ENTER 56
+#define SYSCALL_KLOG    57
+
 
 #endif // _SCNUM_H_
@@ -13,6 +13,9 @@ struct vsnprintf_state {
 	size_t rem;
 };
 
+// memcpy moves whole words through this type, which may alias anything
+typedef uint64_t __attribute__ ((__may_alias__)) copy_word_t;
+
 //           INTERNAL FUNCTION DECLARATIONS
 //           
 
@@ -123,12 +126,38 @@ void * memset(void * s, int c, size_t n) {
 }
 
 void * memcpy(void * restrict dst, const void * restrict src, size_t n) {
+	const size_t wsz = sizeof(copy_word_t);
 	char * p = dst;
-	
+	const char * q = src;
+
+	// If both pointers are equally aligned, copy bytes up to a word boundary
+	// and then eight words, and then single words, at a time
+	if ((((uintptr_t)p ^ (uintptr_t)q) & (wsz - 1)) == 0) {
+		while (n != 0 && ((uintptr_t)p & (wsz - 1)) != 0) {
+			*p++ = *q++;
+			n -= 1;
+		}
+
+		while (n >= 8 * wsz) {
+			copy_word_t * const wp = (copy_word_t *)p;
+			const copy_word_t * const wq = (const copy_word_t *)q;
+			wp[0] = wq[0]; wp[1] = wq[1]; wp[2] = wq[2]; wp[3] = wq[3];
+			wp[4] = wq[4]; wp[5] = wq[5]; wp[6] = wq[6]; wp[7] = wq[7];
+			p += 8 * wsz;
+			q += 8 * wsz;
+			n -= 8 * wsz;
+		}
+
+		while (n >= wsz) {
+			*(copy_word_t *)p = *(const copy_word_t *)q;
+			p += wsz;
+			q += wsz;
+			n -= wsz;
+		}
+	}
+
 	while (n != 0) {
-		*(char*)p = *(const char*)src;
-		p += 1;
-		src += 1;
+		*p++ = *q++;
 		n -= 1;
 	}
 
@@ -10,6 +10,8 @@
 #include "timer.h"
 #include "memory.h"
 #include "pipe.h"
+#include "uring.h"
+#include "string.h"
 
 #define PC_ALIGN 4
 /*
@@ -73,7 +75,7 @@ static int sysmsgout(const char *msg)
 static int sysclose(int fd)
 {
   // close the device at the specified file descriptor
-  if (fd < 0 || fd >= MAX_FILE_OPEN)
+  if (fd < 0 || fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
@@ -110,7 +112,7 @@ static int sysclose(int fd)
 static int sysread(int fd, void *buf, size_t bufsz)
 {
   // read from the device at the specified file descriptor
-  if (fd < 0 || fd >= MAX_FILE_OPEN)
+  if (fd < 0 || fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
@@ -149,7 +151,7 @@ static int sysread(int fd, void *buf, size_t bufsz)
  */
 static int syswrite(int fd, const void *buf, size_t len)
 {
-  if (fd < 0 || fd >= MAX_FILE_OPEN)
+  if (fd < 0 || fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
@@ -189,7 +191,7 @@ static int syswrite(int fd, const void *buf, size_t len)
  */
 static int sysioctl(int fd, const int cmd, void *arg)
 {
-  if (fd < 0 || fd >= MAX_FILE_OPEN)
+  if (fd < 0 || fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
@@ -210,6 +212,62 @@ static int sysioctl(int fd, const int cmd, void *arg)
   return result;
 }
 
+/**
+ * @brief Makes previous writes to a file descriptor durable.
+ *
+ * Writes to block devices complete once the device has accepted them and may
+ * still sit in its volatile cache. This issues IOCTL_FLUSH on the I/O object
+ * so that user programs pay for a cache flush only when they need durability.
+ *
+ * @param fd The file descriptor to flush.
+ * @return 0 on success, or a negative error code on failure.
+ */
+static int sysfsync(int fd)
+{
+  if (fd < 0 || fd >= PROCESS_IOMAX)
+  {
+    return -EBADFD;
+  }
+  struct process *proc = current_process();
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  return ioctl(proc->iotab[fd], IOCTL_FLUSH, NULL);
+}
+
+/**
+ * @brief Sets the length of an open file.
+ *
+ * Shrinking a file frees its blocks past the new end, and growing it fills
+ * the new bytes with zeros. This issues IOCTL_SETLEN on the I/O object.
+ *
+ * @param fd The file descriptor of the file.
+ * @param len The new length in bytes.
+ * @return 0 on success, or a negative error code on failure.
+ */
+static int systruncate(int fd, uint64_t len)
+{
+  if (fd < 0 || fd >= PROCESS_IOMAX)
+  {
+    return -EBADFD;
+  }
+  struct process *proc = current_process();
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  return ioctl(proc->iotab[fd], IOCTL_SETLEN, &len);
+}
+
 /**
  * @brief Opens a device and associates it with a file descriptor in the current process.
  *
@@ -233,7 +291,7 @@ static int sysdevopen(int fd, const char *name, int instno)
     return -ENOENT;
   }
 
-  if (fd >= MAX_FILE_OPEN)
+  if (fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
@@ -241,7 +299,7 @@ static int sysdevopen(int fd, const char *name, int instno)
   if (fd < 0)
   {
     // find the next empty entry of proc->iotab
-    for (int i = 0; i < MAX_FILE_OPEN; i++)
+    for (int i = 0; i < PROCESS_IOMAX; i++)
     {
       if (proc->iotab[i] == NULL)
       {
@@ -249,6 +307,10 @@ static int sysdevopen(int fd, const char *name, int instno)
         break;
       }
     }
+    if (fd < 0)
+    {
+      return -EMFILE;
+    }
   }
   if (proc->iotab[fd] != NULL)
   {
@@ -271,7 +333,7 @@ static int sysdevopen(int fd, const char *name, int instno)
  * it with the provided file descriptor (fd) in the current process's I/O table.
  *
  * @param fd The file descriptor to associate with the opened file. Must be within
- *           the valid range [0, MAX_FILE_OPEN).
+ *           the valid range [0, PROCESS_IOMAX).
  * @param name The name of the file to open.
  * @return 0 on success, or a negative error code on failure:
  *         - -ENODEV: if the I/O interface is NULL.
@@ -287,14 +349,14 @@ static int sysfsopen(int fd, const char *name)
   {
     return -ENOENT;
   }
-  if (fd >= MAX_FILE_OPEN)
+  if (fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
   if (fd < 0)
   {
     // find the next empty entry of proc->iotab
-    for (int i = 0; i < MAX_FILE_OPEN; i++)
+    for (int i = 0; i < PROCESS_IOMAX; i++)
     {
       if (proc->iotab[i] == NULL)
       {
@@ -302,6 +364,10 @@ static int sysfsopen(int fd, const char *name)
         break;
       }
     }
+    if (fd < 0)
+    {
+      return -EMFILE;
+    }
   }
   if (proc->iotab[fd] != NULL)
   {
@@ -325,49 +391,584 @@ static int sysfsopen(int fd, const char *name)
   return fd;
 }
 
-static int syspipe(int fd)
+/**
+ * @brief Creates an empty file.
+ *
+ * @param name The name of the file to create.
+ * @return 0 on success, or a negative error code returned by fs_create().
+ */
+static int sysfscreate(const char *name)
+{
+  return fs_create(name);
+}
+
+/**
+ * @brief Deletes a file that no process has open.
+ *
+ * @param name The name of the file to delete.
+ * @return 0 on success, or a negative error code returned by fs_unlink().
+ */
+static int sysfsunlink(const char *name)
+{
+  return fs_unlink(name);
+}
+
+/**
+ * @brief Creates an empty directory.
+ *
+ * @param name The path of the directory to create.
+ * @return 0 on success, or a negative error code returned by fs_mkdir().
+ */
+static int sysmkdir(const char *name)
+{
+  return fs_mkdir(name);
+}
+
+/**
+ * @brief Deletes an empty directory.
+ *
+ * @param name The path of the directory to delete.
+ * @return 0 on success, or a negative error code returned by fs_rmdir().
+ */
+static int sysrmdir(const char *name)
+{
+  return fs_rmdir(name);
+}
+
+/**
+ * @brief Reads the entries of a directory, starting at entry /start/.
+ *
+ * @param name The path of the directory, "" for the root directory.
+ * @param start Index of the first entry to read.
+ * @param buf Buffer for up to /n/ directory entries.
+ * @param n Size of the buffer in entries.
+ * The entries are read into a kernel page, a page's worth at a time, and
+ * copied out to the user buffer only after fs_readdir() has dropped the file
+ * system locks.
+ *
+ * @param name The path of the directory, "" for the root directory.
+ * @param start Index of the first entry to read.
+ * @param buf Buffer for up to /n/ directory entries.
+ * @param n Size of the buffer in entries.
+ * @return The number of entries read, zero at the end of the directory, or a
+ *         negative error code: -EINVAL if the name or buffer is not valid user
+ *         memory, or one returned by fs_readdir().
+ */
+static long sysreaddir(const char *name, uint64_t start, dentry_t *buf, size_t n)
+{
+  const size_t chunk_max = PAGE_SIZE / sizeof(dentry_t);
+  dentry_t *chunk;
+  size_t total = 0;
+  size_t want;
+  long cnt = 0;
+  int result;
+
+  if (n > SIZE_MAX / sizeof(dentry_t))
+  {
+    return -EINVAL;
+  }
+  result = memory_validate_vstr(name, PTE_U);
+  if (result == 0)
+  {
+    result = memory_validate_user_vptr_len(buf, n * sizeof(dentry_t), PTE_U | PTE_W);
+  }
+  if (result != 0)
+  {
+    return result;
+  }
+
+  chunk = memory_alloc_page();
+  while (total < n)
+  {
+    want = (n - total < chunk_max) ? n - total : chunk_max;
+    cnt = fs_readdir(name, start + total, chunk, want);
+    if (cnt <= 0)
+    {
+      break;
+    }
+    memcpy(buf + total, chunk, cnt * sizeof(dentry_t));
+    total += cnt;
+    if ((size_t)cnt < want)
+    {
+      break;
+    }
+  }
+  memory_free_page(chunk);
+  return (cnt < 0 && total == 0) ? cnt : (long)total;
+}
+
+/**
+ * @brief Creates a pipe and opens its two ends in the lowest free file
+ * descriptors.
+ *
+ * @param fds Set to the descriptor of the read end and of the write end.
+ * @param capacity Size of the pipe's buffer in bytes, 0 for the default.
+ * @return 0 on success, -EMFILE if fewer than two descriptors are free,
+ *         -EINVAL if the capacity is too large, or another negative error code.
+ */
+static int syspipe(int *fds, size_t capacity)
 {
   struct process *proc = current_process();
+  struct io_intf *rdio, *wrio;
+  int rd = -1, wr = -1;
+  int result;
+
   if (proc == NULL)
   {
     return -ENOENT;
   }
-  if (fd >= MAX_FILE_OPEN)
+  result = memory_validate_vptr_len(fds, 2 * sizeof(int), PTE_U | PTE_W);
+  if (result < 0)
   {
-    return -EBADFD;
+    return result;
   }
-  if (fd < 0)
+  // find the next two empty entries of proc->iotab
+  for (int i = 0; i < PROCESS_IOMAX && wr < 0; i++)
   {
-    // find the next empty entry of proc->iotab
-    for (int i = 0; i < MAX_FILE_OPEN; i++)
+    if (proc->iotab[i] == NULL)
     {
-      if (proc->iotab[i] == NULL)
+      if (rd < 0)
       {
-        fd = i;
-        break;
+        rd = i;
+      }
+      else
+      {
+        wr = i;
       }
     }
   }
-  if (proc->iotab[fd] != NULL)
+  if (wr < 0)
   {
-    ioref(proc->iotab[fd]);
-    kprintf("Pipe already opened\n");
-    return fd;
+    return -EMFILE;
   }
 
-  struct io_intf *io;
-  int result = pipe_open(&io);
+  result = pipe_open(&rdio, &wrio, capacity);
   if (result < 0)
   {
     return result;
   }
-  if (io == NULL)
+  proc->iotab[rd] = rdio;
+  proc->iotab[wr] = wrio;
+  fds[0] = rd;
+  fds[1] = wr;
+  return 0;
+}
+
+/**
+ * @brief Copies a user array of buffers into the kernel and checks that every
+ * buffer is mapped, so that it cannot change while it is used.
+ *
+ * @param uiov The user's array of buffers.
+ * @param iovcnt The number of buffers, at most IO_VEC_MAX.
+ * @param iov Set to the buffers.
+ * @param rwxug_flags Flags every page of every buffer must be mapped with,
+ *        all of them: PTE_U | PTE_W when the kernel writes into the buffers,
+ *        PTE_U | PTE_R when it reads them.
+ * @return 0 on success, -EINVAL if iovcnt is out of range or a buffer is not
+ *         mapped.
+ */
+static int copy_iov(const struct io_vec *uiov, int iovcnt, struct io_vec *iov,
+                    uint_fast8_t rwxug_flags)
+{
+  int result;
+
+  if (iovcnt < 0 || iovcnt > IO_VEC_MAX)
   {
-    return -ENODEV;
+    return -EINVAL;
   }
-  proc->iotab[fd] = io;
+  result = memory_validate_user_vptr_len(uiov, iovcnt * sizeof(struct io_vec), PTE_U | PTE_R);
+  if (result != 0)
+  {
+    return result;
+  }
+  for (int i = 0; i < iovcnt; i++)
+  {
+    iov[i] = uiov[i];
+    result = memory_validate_user_vptr_len(iov[i].base, iov[i].len, rwxug_flags);
+    if (result != 0)
+    {
+      return result;
+    }
+  }
+  return 0;
+}
 
-  return fd;
+/**
+ * @brief Reads from a file descriptor into several buffers in turn.
+ *
+ * @param fd The file descriptor to read from.
+ * @param uiov The buffers, at most IO_VEC_MAX of them.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes read, 0 at end of file, or a negative error
+ *         code: -EBADFD if fd is invalid, -EINVAL if a buffer is.
+ */
+static long sysreadv(int fd, const struct io_vec *uiov, int iovcnt)
+{
+  struct process *proc = current_process();
+  struct io_vec iov[IO_VEC_MAX];
+  int result;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (fd < 0 || fd >= PROCESS_IOMAX || proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  result = copy_iov(uiov, iovcnt, iov, PTE_U | PTE_W);
+  if (result != 0)
+  {
+    return result;
+  }
+  return ioreadv(proc->iotab[fd], iov, iovcnt);
+}
+
+/**
+ * @brief Writes several buffers to a file descriptor one after another, with
+ * one system call.
+ *
+ * @param fd The file descriptor to write to.
+ * @param uiov The buffers, at most IO_VEC_MAX of them.
+ * @param iovcnt The number of buffers.
+ * @return The number of bytes written, or a negative error code: -EBADFD if
+ *         fd is invalid, -EINVAL if a buffer is.
+ */
+static long syswritev(int fd, const struct io_vec *uiov, int iovcnt)
+{
+  struct process *proc = current_process();
+  struct io_vec iov[IO_VEC_MAX];
+  int result;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (fd < 0 || fd >= PROCESS_IOMAX || proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  result = copy_iov(uiov, iovcnt, iov, PTE_U | PTE_R);
+  if (result != 0)
+  {
+    return result;
+  }
+  return iowritev(proc->iotab[fd], iov, iovcnt);
+}
+
+/**
+ * @brief Reads from a file descriptor at a position, without moving its
+ * position, so that processes sharing it after a fork do not race.
+ *
+ * @param fd The file descriptor to read from.
+ * @param buf The buffer to read into.
+ * @param bufsz The size of the buffer.
+ * @param pos Where to read.
+ * @return The number of bytes read, fewer than bufsz only at end of file, or
+ *         a negative error code.
+ */
+static long syspread(int fd, void *buf, size_t bufsz, uint64_t pos)
+{
+  struct process *proc = current_process();
+  int result;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (fd < 0 || fd >= PROCESS_IOMAX || proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  result = memory_validate_user_vptr_len(buf, bufsz, PTE_U | PTE_W);
+  if (result != 0)
+  {
+    return result;
+  }
+  return iopread(proc->iotab[fd], buf, bufsz, pos);
+}
+
+/**
+ * @brief Writes to a file descriptor at a position, without moving its
+ * position.
+ *
+ * @param fd The file descriptor to write to.
+ * @param buf The data to write.
+ * @param len The number of bytes to write.
+ * @param pos Where to write.
+ * @return The number of bytes written, or a negative error code.
+ */
+static long syspwrite(int fd, const void *buf, size_t len, uint64_t pos)
+{
+  struct process *proc = current_process();
+  int result;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (fd < 0 || fd >= PROCESS_IOMAX || proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  result = memory_validate_user_vptr_len(buf, len, PTE_U | PTE_R);
+  if (result != 0)
+  {
+    return result;
+  }
+  return iopwrite(proc->iotab[fd], buf, len, pos);
+}
+
+/**
+ * @brief Waits until at least one of several file descriptors is ready.
+ *
+ * Checks each descriptor's readiness with iopoll and, if none is ready,
+ * sleeps until a device or pipe reports that it may have become ready, then
+ * checks again. Interrupts stay off from the check to the wait, so a wakeup
+ * between them is not missed.
+ *
+ * @param fds The descriptors and the events of interest; revents is set to
+ *        the events that are ready, or POLLNVAL for a descriptor that is not
+ *        open.
+ * @param nfds The number of entries in fds, at most PROCESS_IOMAX.
+ * @param wait Whether to wait for an event; if 0, reports readiness at once.
+ * @return The number of entries with revents set, or a negative error code.
+ */
+static int syspoll(struct io_pollfd *fds, int nfds, int wait)
+{
+  struct process *proc = current_process();
+  int ready, result, s;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (nfds < 0 || nfds > PROCESS_IOMAX)
+  {
+    return -EINVAL;
+  }
+  result = memory_validate_vptr_len(fds, nfds * sizeof(struct io_pollfd), PTE_U | PTE_R | PTE_W);
+  if (result != 0)
+  {
+    return result;
+  }
+
+  s = intr_disable();
+  for (;;)
+  {
+    ready = 0;
+    for (int i = 0; i < nfds; i++)
+    {
+      if (fds[i].fd < 0 || fds[i].fd >= PROCESS_IOMAX || proc->iotab[fds[i].fd] == NULL)
+      {
+        fds[i].revents = POLLNVAL;
+      }
+      else
+      {
+        fds[i].revents = iopoll(proc->iotab[fds[i].fd], fds[i].events);
+      }
+      if (fds[i].revents != 0)
+      {
+        ready += 1;
+      }
+    }
+    if (ready != 0 || !wait)
+    {
+      break;
+    }
+    io_wait_ready();
+  }
+  intr_restore(s);
+
+  return ready;
+}
+
+/**
+ * @brief Attaches submission and completion rings to the current process.
+ *
+ * @param ring A zeroed, page-aligned struct uring in the process's memory.
+ * @return 0 on success, or a negative error code: -EBUSY if the process
+ *         already has a ring, -EINVAL if ring is not page-aligned.
+ */
+static int sysuring_setup(struct uring *ring)
+{
+  struct process *proc = current_process();
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  return uring_setup(proc, ring);
+}
+
+/**
+ * @brief Starts work on newly submitted ring entries and waits for
+ * completions.
+ *
+ * @param min_complete The number of completion entries to wait for.
+ * @return The number of completion entries ready to reap, or a negative
+ *         error code: -EINVAL if the process has no ring or min_complete
+ *         is larger than the queue.
+ */
+static long sysuring_enter(unsigned int min_complete)
+{
+  struct process *proc = current_process();
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  return uring_enter(proc, min_complete);
+}
+
+/**
+ * @brief Reads the end of the kernel log, the console output kept in memory.
+ *
+ * @param buf The buffer to copy the log into.
+ * @param bufsz The size of the buffer; the last bufsz bytes of the log are
+ *        copied, or all of it if it is shorter.
+ * @return The number of bytes copied, or a negative error code.
+ */
+static long sysklog(char *buf, size_t bufsz)
+{
+  int result;
+
+  result = memory_validate_user_vptr_len(buf, bufsz, PTE_U | PTE_W);
+  if (result != 0)
+  {
+    return result;
+  }
+  return console_klog_read(buf, bufsz);
+}
+
+/**
+ * @brief Moves data between a user buffer and either end of a pipe, moving
+ * whole pages of a page-aligned buffer by remapping them instead of copying.
+ *
+ * @param fd Descriptor of either end of a pipe.
+ * @param buf User buffer to move data into the pipe from, or out of it to.
+ *            It must be writable for the read end. Whole pages moved into
+ *            the pipe read as zeros afterwards.
+ * @param len Largest number of bytes to move.
+ * @return The number of bytes moved, or a negative error code returned by
+ *         pipe_vmsplice(), -EBADFD if fd is not open.
+ */
+static long sysvmsplice(int fd, void *buf, size_t len)
+{
+  struct process *proc = current_process();
+  int result;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (fd < 0 || fd >= PROCESS_IOMAX || proc->iotab[fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  // the read end writes into the buffer
+  result = memory_validate_user_vptr_len(buf, len,
+                                         PTE_U | PTE_R | (pipe_is_read_end(proc->iotab[fd]) ? PTE_W : 0));
+  if (result != 0)
+  {
+    return result;
+  }
+  return pipe_vmsplice(proc->iotab[fd], buf, len);
+}
+
+/**
+ * @brief Moves data from one file descriptor to another inside the kernel,
+ * where one of them is a pipe.
+ *
+ * @param fd_in Descriptor to read from.
+ * @param fd_out Descriptor to write to.
+ * @param len Largest number of bytes to move.
+ * @return The number of bytes moved, 0 at end of file, or a negative error
+ *         code returned by pipe_splice(), -EBADFD if either fd is not open.
+ */
+static long syssplice(int fd_in, int fd_out, size_t len)
+{
+  struct process *proc = current_process();
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (fd_in < 0 || fd_in >= PROCESS_IOMAX || proc->iotab[fd_in] == NULL ||
+      fd_out < 0 || fd_out >= PROCESS_IOMAX || proc->iotab[fd_out] == NULL)
+  {
+    return -EBADFD;
+  }
+  return pipe_splice(proc->iotab[fd_in], proc->iotab[fd_out], len);
+}
+
+/**
+ * @brief Copies data from one file descriptor to another inside the kernel,
+ * through one page of kernel memory reused for the whole transfer, or
+ * straight from the source if it is in memory (see iocopy()).
+ *
+ * @param out_fd Descriptor to write to.
+ * @param in_fd Descriptor to read from.
+ * @param offset If not NULL, where in in_fd to start reading; set to where
+ *               reading stopped, and in_fd's position is left unchanged.
+ * @param count Largest number of bytes to copy.
+ * @return The number of bytes copied, or a negative error code:
+ *         - -EBADFD: Either file descriptor is invalid.
+ *         - -EINVAL: offset is not a valid pointer.
+ *         - Any negative value returned by iocopy() or the seek on in_fd.
+ */
+static long syssendfile(int out_fd, int in_fd, uint64_t *offset, size_t count)
+{
+  struct process *proc = current_process();
+  struct io_intf *in, *out;
+  uint64_t saved_pos, pos;
+  void *buf;
+  long result;
+
+  if (proc == NULL)
+  {
+    return -ENOENT;
+  }
+  if (in_fd < 0 || in_fd >= PROCESS_IOMAX || proc->iotab[in_fd] == NULL ||
+      out_fd < 0 || out_fd >= PROCESS_IOMAX || proc->iotab[out_fd] == NULL)
+  {
+    return -EBADFD;
+  }
+  in = proc->iotab[in_fd];
+  out = proc->iotab[out_fd];
+
+  if (offset != NULL)
+  {
+    result = memory_validate_vptr_len(offset, sizeof(uint64_t), PTE_U | PTE_W);
+    if (result != 0)
+    {
+      return result;
+    }
+    result = ioctl(in, IOCTL_GETPOS, &saved_pos);
+    if (result < 0)
+    {
+      return result;
+    }
+    result = ioseek(in, *offset);
+    if (result < 0)
+    {
+      return result;
+    }
+  }
+
+  buf = memory_alloc_page();
+  result = iocopy(out, in, count, buf, PAGE_SIZE);
+  memory_free_page(buf);
+
+  if (offset != NULL)
+  {
+    if (ioctl(in, IOCTL_GETPOS, &pos) == 0)
+    {
+      *offset = pos;
+    }
+    ioseek(in, saved_pos);
+  }
+  return result;
 }
 
 /**
@@ -390,7 +991,7 @@ static int sysexec(int fd)
   {
     return -ENOENT;
   }
-  if (fd < 0 || fd >= MAX_FILE_OPEN)
+  if (fd < 0 || fd >= PROCESS_IOMAX)
   {
     return -EBADFD;
   }
@@ -532,14 +1133,72 @@ void syscall_handler(struct trap_frame *tfr)
   case SYSCALL_IOCTL:
     tfr->x[TFR_A0] = sysioctl((int)tfr->x[TFR_A0], (const int)tfr->x[TFR_A1], (void *)tfr->x[TFR_A2]);
     break;
+  case SYSCALL_FSYNC:
+    tfr->x[TFR_A0] = sysfsync((int)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_TRUNCATE:
+    tfr->x[TFR_A0] = systruncate((int)tfr->x[TFR_A0], (uint64_t)tfr->x[TFR_A1]);
+    break;
+  case SYSCALL_SPLICE:
+    tfr->x[TFR_A0] = syssplice((int)tfr->x[TFR_A0], (int)tfr->x[TFR_A1], (size_t)tfr->x[TFR_A2]);
+    break;
+  case SYSCALL_VMSPLICE:
+    tfr->x[TFR_A0] = sysvmsplice((int)tfr->x[TFR_A0], (void *)tfr->x[TFR_A1], (size_t)tfr->x[TFR_A2]);
+    break;
+  case SYSCALL_READV:
+    tfr->x[TFR_A0] = sysreadv((int)tfr->x[TFR_A0], (const struct io_vec *)tfr->x[TFR_A1], (int)tfr->x[TFR_A2]);
+    break;
+  case SYSCALL_WRITEV:
+    tfr->x[TFR_A0] = syswritev((int)tfr->x[TFR_A0], (const struct io_vec *)tfr->x[TFR_A1], (int)tfr->x[TFR_A2]);
+    break;
+  case SYSCALL_PREAD:
+    tfr->x[TFR_A0] = syspread((int)tfr->x[TFR_A0], (void *)tfr->x[TFR_A1],
+                              (size_t)tfr->x[TFR_A2], (uint64_t)tfr->x[TFR_A3]);
+    break;
+  case SYSCALL_PWRITE:
+    tfr->x[TFR_A0] = syspwrite((int)tfr->x[TFR_A0], (const void *)tfr->x[TFR_A1],
+                               (size_t)tfr->x[TFR_A2], (uint64_t)tfr->x[TFR_A3]);
+    break;
+  case SYSCALL_POLL:
+    tfr->x[TFR_A0] = syspoll((struct io_pollfd *)tfr->x[TFR_A0], (int)tfr->x[TFR_A1], (int)tfr->x[TFR_A2]);
+    break;
+  case SYSCALL_URING_SETUP:
+    tfr->x[TFR_A0] = sysuring_setup((struct uring *)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_URING_ENTER:
+    tfr->x[TFR_A0] = sysuring_enter((unsigned int)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_KLOG:
+    tfr->x[TFR_A0] = sysklog((char *)tfr->x[TFR_A0], (size_t)tfr->x[TFR_A1]);
+    break;
+  case SYSCALL_SENDFILE:
+    tfr->x[TFR_A0] = syssendfile((int)tfr->x[TFR_A0], (int)tfr->x[TFR_A1],
+                                 (uint64_t *)tfr->x[TFR_A2], (size_t)tfr->x[TFR_A3]);
+    break;
   case SYSCALL_DEVOPEN:
     tfr->x[TFR_A0] = sysdevopen((int)tfr->x[TFR_A0], (const char *)tfr->x[TFR_A1], (int)tfr->x[TFR_A2]);
     break;
   case SYSCALL_FSOPEN:
     tfr->x[TFR_A0] = sysfsopen((int)tfr->x[TFR_A0], (const char *)tfr->x[TFR_A1]);
     break;
+  case SYSCALL_FSCREATE:
+    tfr->x[TFR_A0] = sysfscreate((const char *)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_FSUNLINK:
+    tfr->x[TFR_A0] = sysfsunlink((const char *)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_MKDIR:
+    tfr->x[TFR_A0] = sysmkdir((const char *)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_RMDIR:
+    tfr->x[TFR_A0] = sysrmdir((const char *)tfr->x[TFR_A0]);
+    break;
+  case SYSCALL_READDIR:
+    tfr->x[TFR_A0] = sysreaddir((const char *)tfr->x[TFR_A0], (uint64_t)tfr->x[TFR_A1],
+                                (dentry_t *)tfr->x[TFR_A2], (size_t)tfr->x[TFR_A3]);
+    break;
   case SYSCALL_PIPE:
-    tfr->x[TFR_A0] = syspipe((int)tfr->x[TFR_A0]);
+    tfr->x[TFR_A0] = syspipe((int *)tfr->x[TFR_A0], (size_t)tfr->x[TFR_A1]);
     break;
   case SYSCALL_EXEC:
     tfr->x[TFR_A0] = sysexec((int)tfr->x[TFR_A0]);
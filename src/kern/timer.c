@@ -174,6 +174,10 @@ void timer_intr_handler(struct trap_frame * tfr) {
 
 }
 
+uint64_t timer_get_time(void) {
+    return get_mtime();
+}
+
 void enable_mmode_timer_intr(void) {
     // see _mmode_trap_handler in trapasm.s
     asm ("ecall" ::: "memory");
@@ -39,6 +39,11 @@ extern void alarm_reset(struct alarm * al);
 
 extern void timer_intr_handler(struct trap_frame * tfr); // called from intr.c
 
+// Returns the current value of the machine timer, in TIMER_FREQ ticks since
+// timer_init. Used for fine-grained timing where an alarm would be too coarse.
+
+extern uint64_t timer_get_time(void);
+
 static inline void alarm_sleep_sec(struct alarm * al, unsigned int sec);
 static inline void alarm_sleep_ms(struct alarm * al, unsigned long ms);
 static inline void alarm_sleep_us(struct alarm * al, unsigned long us);
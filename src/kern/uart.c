@@ -12,6 +12,7 @@
 #include "halt.h"
 #include "intr.h"
 #include "limits.h"
+#include "string.h"
 
 // COMPILE-TIME CONSTANT DEFINITIONS
 //
@@ -28,6 +29,16 @@
 #define UART_IRQ_PRIO 3
 #endif
 
+// Number of bytes in the receive FIFO at which the uart raises an interrupt:
+// 1, 4, 8 or 14. Fewer bytes raise one after a few character times without
+// more input.
+
+#ifndef UART_RX_TRIGGER
+#define UART_RX_TRIGGER 8
+#endif
+
+#define UART_FIFO_SIZE 16
+
 // INTERNAL TYPE DEFINITIONS
 // 
 
@@ -61,6 +72,21 @@ struct uart_regs {
 #define LSR_THRE (1 << 5)
 #define IER_DREIE (1 << 0)
 #define IER_THREIE (1 << 1)
+#define FCR_FIFOE (1 << 0) // enable FIFOs
+#define FCR_RFR (1 << 1) // reset receive FIFO
+#define FCR_TFR (1 << 2) // reset transmit FIFO
+
+#if UART_RX_TRIGGER == 1
+#define FCR_RXTRIG (0 << 6)
+#elif UART_RX_TRIGGER == 4
+#define FCR_RXTRIG (1 << 6)
+#elif UART_RX_TRIGGER == 8
+#define FCR_RXTRIG (2 << 6)
+#elif UART_RX_TRIGGER == 14
+#define FCR_RXTRIG (3 << 6)
+#else
+#error "UART_RX_TRIGGER must be 1, 4, 8 or 14"
+#endif
 
 struct ringbuf {
     uint16_t hpos; // head of queue (from where elements are removed)
@@ -73,11 +99,16 @@ struct uart_device {
 	int irqno;
 
 	uint32_t rxovrcnt; // number of times OE was set
+	uint64_t reqcnt; // calls to uart_read and uart_write
+	uint64_t bytecnt; // bytes they transferred
+	uint64_t intrcnt; // interrupts taken
+	int flags; // O_NONBLOCK
 
 	struct io_intf io_intf;
 	
 	struct condition rxbnotempty;
 	struct condition txbnotfull;	
+	struct condition txbempty;
 
 	struct ringbuf rxbuf;
 	struct ringbuf txbuf;
@@ -90,6 +121,8 @@ static int uart_open(struct io_intf ** ioptr, void * aux);
 static void uart_close(struct io_intf * io);
 static long uart_read(struct io_intf * io, void * buf, unsigned long bufsz);
 static long uart_write(struct io_intf * io, const void * buf, unsigned long n);
+static int uart_ioctl(struct io_intf * io, int cmd, void * arg);
+static int uart_poll(struct io_intf * io, int events);
 
 static void uart_isr(int irqno, void * driver_private);
 
@@ -108,7 +141,9 @@ void uart_attach(void * mmio_base, int irqno) {
 	static const struct io_ops uart_ops = {
 		.close = uart_close,
 		.read = uart_read,
-		.write = uart_write
+		.write = uart_write,
+		.ctl = uart_ioctl,
+		.poll = uart_poll
 	};
 
 	struct uart_device * dev;
@@ -128,6 +163,7 @@ void uart_attach(void * mmio_base, int irqno) {
 
 	condition_init(&dev->rxbnotempty, "rxnotempty");
 	condition_init(&dev->txbnotfull, "txnotfull");
+	condition_init(&dev->txbempty, "txempty");
 
 	rbuf_init(&dev->rxbuf);
 	rbuf_init(&dev->txbuf);
@@ -140,6 +176,10 @@ void uart_attach(void * mmio_base, int irqno) {
     // fence o,o ?
     dev->regs->lcr = 0; // DLAB=0
 
+	// Enable the FIFOs, so that each interrupt can move many bytes
+
+	dev->regs->fcr = FCR_FIFOE | FCR_RFR | FCR_TFR | FCR_RXTRIG;
+
 	intr_register_isr(irqno, UART_IRQ_PRIO, uart_isr, dev);
 	device_register("ser", &uart_open, dev);
 }
@@ -156,9 +196,12 @@ int uart_open(struct io_intf ** ioptr, void * aux) {
 	
 	rbuf_init(&dev->rxbuf);
 	rbuf_init(&dev->txbuf);
+	dev->flags = 0;
 
-	// Read receive buffer register to clear it. Enable RX interrupts only.
+	// Empty the FIFOs and read receive buffer register to clear it. Enable RX
+	// interrupts only.
 
+	dev->regs->fcr = FCR_FIFOE | FCR_RFR | FCR_TFR | FCR_RXTRIG;
 	dev->regs->rbr; // forces a read
 	dev->regs->ier = IER_DREIE;
 
@@ -210,6 +253,11 @@ long uart_read(struct io_intf * io, void * buf, unsigned long bufsz) {
 
 	intr_disable();
 
+	if (rbuf_empty(&dev->rxbuf) && (dev->flags & O_NONBLOCK)) {
+		intr_enable();
+		return -EAGAIN;
+	}
+
 	while (rbuf_empty(&dev->rxbuf))
 		condition_wait(&dev->rxbnotempty);
 
@@ -220,6 +268,8 @@ long uart_read(struct io_intf * io, void * buf, unsigned long bufsz) {
 	
 	dev->regs->ier |= IER_DREIE; // enable receive interrupts
 	
+	dev->reqcnt += 1;
+	dev->bytecnt += p - (char*)buf;
 	return p - (char*)buf;
 }
 
@@ -240,6 +290,12 @@ long uart_write(struct io_intf * io, const void * buf, unsigned long n) {
 
 	while (p - (char*)buf < n) {
 		intr_disable();
+		if (rbuf_full(&dev->txbuf) && (dev->flags & O_NONBLOCK)) {
+			intr_enable();
+			if (p == buf)
+				return -EAGAIN;
+			break;
+		}
 		while (rbuf_full(&dev->txbuf))
 			condition_wait(&dev->txbnotfull);
 		intr_enable();
@@ -250,32 +306,111 @@ long uart_write(struct io_intf * io, const void * buf, unsigned long n) {
 		dev->regs->ier |= IER_THREIE;
 	}
 
+	dev->reqcnt += 1;
+	dev->bytecnt += p - (char*)buf;
 	return p - (char*)buf;
 }
 
+// The uart supports IOCTL_GETSTATS, which reports the number of read and write
+// calls, the bytes they transferred and the interrupts taken, so that callers
+// can see how well they batch their I/O, IOCTL_FLUSH, which waits until the
+// transmit buffer has drained into the uart, and IOCTL_GETFLAGS and
+// IOCTL_SETFLAGS for O_NONBLOCK.
+
+int uart_ioctl(struct io_intf * io, int cmd, void * arg) {
+	struct uart_device * const dev =
+		(void*)io - offsetof(struct uart_device, io_intf);
+	struct io_stats * stats;
+
+	trace("%s(cmd=%d,arg=%p)", __func__, cmd, arg);
+	assert (io != NULL);
+
+	switch (cmd) {
+	case IOCTL_GETSTATS:
+		stats = arg;
+		memset(stats, 0, sizeof(struct io_stats));
+		stats->reqcnt = dev->reqcnt;
+		stats->bytecnt = dev->bytecnt;
+		stats->intrcnt = dev->intrcnt;
+		return 0;
+	case IOCTL_FLUSH:
+		intr_disable();
+		while (!rbuf_empty(&dev->txbuf))
+			condition_wait(&dev->txbempty);
+		intr_enable();
+		return 0;
+	case IOCTL_GETFLAGS:
+		*(int *)arg = dev->flags;
+		return 0;
+	case IOCTL_SETFLAGS:
+		dev->flags = *(int *)arg & O_NONBLOCK;
+		return 0;
+	default:
+		return -ENOTSUP;
+	}
+}
+
+int uart_poll(struct io_intf * io, int events) {
+	struct uart_device * const dev =
+		(void*)io - offsetof(struct uart_device, io_intf);
+	int revents = 0;
+
+	if (!rbuf_empty(&dev->rxbuf))
+		revents |= events & POLLIN;
+	if (!rbuf_full(&dev->txbuf))
+		revents |= events & POLLOUT;
+	return revents;
+}
+
 void uart_isr(int irqno, void * aux) {
 	struct uart_device * const dev = aux;
-	const uint_fast8_t line_status = dev->regs->lsr;
+	uint_fast8_t line_status = dev->regs->lsr;
+	int was_empty, was_full;
+	int n;
+
+	dev->intrcnt += 1;
 
 	if (line_status & LSR_OE)
 		dev->rxovrcnt += 1;
-	
-	if (line_status & LSR_DR) {
-		if (!rbuf_full(&dev->rxbuf)) {
-			if (rbuf_empty(&dev->rxbuf))
-				condition_broadcast(&dev->rxbnotempty);
-			rbuf_put(&dev->rxbuf, dev->regs->rbr);
-		} else
+
+	// Drain the whole receive FIFO, reading the line status again after each
+	// byte, until it is empty or the ring buffer is full.
+
+	was_empty = rbuf_empty(&dev->rxbuf);
+
+	while (line_status & LSR_DR) {
+		if (rbuf_full(&dev->rxbuf)) {
 			dev->regs->ier &= ~IER_DREIE;
+			break;
+		}
+		rbuf_put(&dev->rxbuf, dev->regs->rbr);
+		line_status = dev->regs->lsr;
+		if (line_status & LSR_OE)
+			dev->rxovrcnt += 1;
+	}
+
+	if (was_empty && !rbuf_empty(&dev->rxbuf)) {
+		condition_broadcast(&dev->rxbnotempty);
+		io_notify_ready();
 	}
 
+	// THRE means the transmit FIFO is empty, so it takes a whole FIFO's worth.
+
 	if (line_status & LSR_THRE) {
-		if (!rbuf_empty(&dev->txbuf)) {
-			if (rbuf_full(&dev->txbuf))
-				condition_broadcast(&dev->txbnotfull);
+		was_full = rbuf_full(&dev->txbuf);
+
+		for (n = 0; n < UART_FIFO_SIZE && !rbuf_empty(&dev->txbuf); n++)
 			dev->regs->thr = rbuf_get(&dev->txbuf);
-		} else
+
+		if (rbuf_empty(&dev->txbuf)) {
 			dev->regs->ier &= ~IER_THREIE;
+			condition_broadcast(&dev->txbempty);
+		}
+
+		if (was_full && n != 0) {
+			condition_broadcast(&dev->txbnotfull);
+			io_notify_ready();
+		}
 	}
 }
 
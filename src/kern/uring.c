@@ -0,0 +1,270 @@
+// uring.c - Asynchronous submission and completion rings
+//
+
+#include "uring.h"
+#include "process.h"
+#include "thread.h"
+#include "timer.h"
+#include "memory.h"
+#include "heap.h"
+#include "intr.h"
+#include "error.h"
+#include "string.h"
+
+// INTERNAL CONSTANT DEFINITIONS
+//
+
+// Longest sleep of URING_OP_USLEEP between checks for the ring being released
+
+#define URING_USLEEP_SLICE_US 10000
+
+// INTERNAL TYPE DEFINITIONS
+//
+
+struct uring_ctx {
+    struct uring * ring;        // in the process's memory
+    struct condition sq_cond;   // SQ entries submitted, or stopping
+    struct condition cq_cond;   // CQ entry posted
+    struct condition cq_room;   // CQ entries may have been reaped, or stopping
+    int tids[URING_WORKERS];
+    char stopping;
+};
+
+// INTERNAL FUNCTION DECLARATIONS
+//
+
+static void uring_worker(void * arg);
+static long uring_execute(struct uring_ctx * ctx, struct process * proc,
+    const struct uring_sqe * sqe);
+static long uring_poll(struct uring_ctx * ctx, struct io_intf * io, int events);
+
+// EXPORTED FUNCTION DEFINITIONS
+//
+
+int uring_setup(struct process * proc, struct uring * ring) {
+    struct uring_ctx * ctx;
+    int result;
+    int i;
+
+    if (proc->ring != NULL)
+        return -EBUSY;
+
+    if ((uintptr_t)ring % PAGE_SIZE != 0)
+        return -EINVAL;
+
+    result = memory_validate_user_vptr_len(ring, sizeof(struct uring), PTE_U | PTE_R | PTE_W);
+    if (result != 0)
+        return result;
+
+    ctx = kcalloc(1, sizeof(struct uring_ctx));
+    if (ctx == NULL)
+        return -ENOMEM;
+
+    ctx->ring = ring;
+    condition_init(&ctx->sq_cond, "uring_sq");
+    condition_init(&ctx->cq_cond, "uring_cq");
+    condition_init(&ctx->cq_room, "uring_cq_room");
+    proc->ring = ctx;
+
+    // The workers are children of the process's thread and belong to the
+    // process, so they run in its memory space and use its iotab.
+
+    for (i = 0; i < URING_WORKERS; i++)
+        ctx->tids[i] = thread_spawn("uring", uring_worker, ctx);
+
+    return 0;
+}
+
+long uring_enter(struct process * proc, unsigned int min_complete) {
+    struct uring_ctx * const ctx = proc->ring;
+    struct uring * ring;
+    long n;
+    int s;
+
+    if (ctx == NULL)
+        return -EINVAL;
+    if (min_complete > URING_ENTRIES)
+        return -EINVAL;
+
+    ring = ctx->ring;
+
+    s = intr_disable();
+    if (ring->sq_head != ring->sq_tail)
+        condition_broadcast(&ctx->sq_cond);
+    condition_broadcast(&ctx->cq_room);
+    while (ring->cq_tail - ring->cq_head < min_complete)
+        condition_wait(&ctx->cq_cond);
+    n = ring->cq_tail - ring->cq_head;
+    intr_restore(s);
+
+    return n;
+}
+
+void uring_release(struct process * proc) {
+    struct uring_ctx * const ctx = proc->ring;
+    int i;
+
+    if (ctx == NULL)
+        return;
+
+    // Workers finish the request they are carrying out, if any, and exit.
+    // Requests still in the SQ are dropped. Workers waiting for a descriptor
+    // to become ready or sleeping for URING_OP_USLEEP give up, so that a
+    // request cannot keep the process from exiting.
+
+    ctx->stopping = 1;
+    condition_broadcast(&ctx->sq_cond);
+    condition_broadcast(&ctx->cq_room);
+    io_notify_ready();
+
+    for (i = 0; i < URING_WORKERS; i++)
+        thread_join(ctx->tids[i]);
+
+    proc->ring = NULL;
+    kfree(ctx);
+}
+
+// INTERNAL FUNCTION DEFINITIONS
+//
+
+void uring_worker(void * arg) {
+    struct uring_ctx * const ctx = arg;
+    struct uring * const ring = ctx->ring;
+    struct process * const proc = current_process();
+    struct uring_sqe sqe;
+    struct uring_cqe cqe;
+    int s;
+
+    for (;;) {
+        // Take the next request. The process cannot run between the check
+        // and the wait with interrupts off, so a submission is not missed.
+
+        s = intr_disable();
+        while (ring->sq_head == ring->sq_tail && !ctx->stopping)
+            condition_wait(&ctx->sq_cond);
+        if (ctx->stopping) {
+            intr_restore(s);
+            break;
+        }
+        sqe = ring->sqes[ring->sq_head % URING_ENTRIES];
+        ring->sq_head += 1;
+        intr_restore(s);
+
+        // Carry it out, which may sleep; the other workers take further
+        // requests meanwhile.
+
+        cqe.user_data = sqe.user_data;
+        cqe.res = uring_execute(ctx, proc, &sqe);
+
+        // Post the result, waiting for room if the process has not reaped
+
+        s = intr_disable();
+        while (ring->cq_tail - ring->cq_head >= URING_ENTRIES && !ctx->stopping)
+            condition_wait(&ctx->cq_room);
+        if (!ctx->stopping) {
+            ring->cqes[ring->cq_tail % URING_ENTRIES] = cqe;
+            asm volatile ("" ::: "memory");
+            ring->cq_tail += 1;
+            condition_broadcast(&ctx->cq_cond);
+        }
+        intr_restore(s);
+    }
+
+    thread_exit();
+}
+
+long uring_execute(struct uring_ctx * ctx, struct process * proc,
+    const struct uring_sqe * sqe)
+{
+    struct io_intf * io;
+    struct alarm al;
+    uint64_t left;
+    long result;
+
+    switch (sqe->op) {
+    case URING_OP_NOP:
+        return 0;
+    case URING_OP_USLEEP:
+        alarm_init(&al, "uring");
+        for (left = sqe->len; left != 0 && !ctx->stopping; ) {
+            if (left < URING_USLEEP_SLICE_US) {
+                alarm_sleep_us(&al, left);
+                left = 0;
+            } else {
+                alarm_sleep_us(&al, URING_USLEEP_SLICE_US);
+                left -= URING_USLEEP_SLICE_US;
+            }
+        }
+        return 0;
+    default:
+        break;
+    }
+
+    if (sqe->fd < 0 || sqe->fd >= PROCESS_IOMAX || proc->iotab[sqe->fd] == NULL)
+        return -EBADFD;
+
+    // Hold a reference for the whole request, so that the process closing
+    // the descriptor meanwhile does not free the object under the worker.
+
+    io = proc->iotab[sqe->fd];
+    ioref(io);
+
+    // Reads and writes first wait for the descriptor to be ready, where the
+    // release of the ring can stop them, so that a read of a serial port or
+    // pipe with nothing to read does not block in the device.
+
+    switch (sqe->op) {
+    case URING_OP_READ:
+        result = memory_validate_user_vptr_len(sqe->buf, sqe->len, PTE_U | PTE_W);
+        if (result != 0)
+            break;
+        result = uring_poll(ctx, io, POLLIN);
+        if (result <= 0)
+            break;
+        if (sqe->pos == URING_POS_CUR)
+            result = ioread(io, sqe->buf, sqe->len);
+        else
+            result = iopread(io, sqe->buf, sqe->len, sqe->pos);
+        break;
+    case URING_OP_WRITE:
+        result = memory_validate_user_vptr_len(sqe->buf, sqe->len, PTE_U | PTE_R);
+        if (result != 0)
+            break;
+        result = uring_poll(ctx, io, POLLOUT);
+        if (result <= 0)
+            break;
+        if (sqe->pos == URING_POS_CUR)
+            result = iowrite(io, sqe->buf, sqe->len);
+        else
+            result = iopwrite(io, sqe->buf, sqe->len, sqe->pos);
+        break;
+    case URING_OP_FSYNC:
+        result = ioctl(io, IOCTL_FLUSH, NULL);
+        break;
+    case URING_OP_POLL:
+        result = uring_poll(ctx, io, sqe->len);
+        break;
+    default:
+        result = -EINVAL;
+        break;
+    }
+
+    ioclose(io);
+    return result;
+}
+
+// Waits until one of /events/ is ready on /io/, like SYSCALL_POLL for one
+// descriptor, and returns the events that are, or -EBUSY if the ring is
+// released first.
+
+long uring_poll(struct uring_ctx * ctx, struct io_intf * io, int events) {
+    int revents;
+    int s;
+
+    s = intr_disable();
+    while ((revents = iopoll(io, events)) == 0 && !ctx->stopping)
+        io_wait_ready();
+    intr_restore(s);
+
+    return (revents != 0) ? revents : -EBUSY;
+}
@@ -0,0 +1,77 @@
+// uring.h - Asynchronous submission and completion rings
+//
+// A process submits I/O requests by filling entries of a submission queue
+// (SQ) and reaps their results from a completion queue (CQ). Both queues are
+// in a struct uring in the process's own memory, which the kernel uses in
+// place, so that submitting and reaping cost no system call. Kernel worker
+// threads take requests from the SQ, carry them out and post their results to
+// the CQ, in the order they complete rather than the order submitted.
+//
+// The process writes sqes[] and sq_tail and cq_head; the kernel writes
+// sq_head, cqes[] and cq_tail. Head and tail count entries since setup, so a
+// queue holds tail - head entries, starting at index head % URING_ENTRIES.
+// Keep at most URING_ENTRIES requests in flight or unreaped; a worker that
+// finds the CQ full waits for the next _uring_enter.
+//
+// _uring_setup(ring) attaches a zeroed, page-aligned struct uring to the
+// process and starts its workers. _uring_enter(min_complete) wakes the
+// workers for any new SQ entries and waits until the CQ holds at least
+// /min_complete/ entries; it returns the number it holds. The ring stays
+// attached until the process exits or execs. Requests in progress are then
+// abandoned while they wait for a descriptor to be ready or sleep, and
+// otherwise finished first.
+//
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdint.h>
+
+#define URING_ENTRIES 64    // entries in each queue, a power of two
+#define URING_WORKERS 2     // kernel threads serving a ring
+
+// Operations. /len/ is the byte count for URING_OP_READ and URING_OP_WRITE,
+// the events of interest for URING_OP_POLL and microseconds for
+// URING_OP_USLEEP. The result of a read or write is as for _read and _write,
+// of URING_OP_POLL the events that are ready, and otherwise 0, or a negative
+// error code.
+
+#define URING_OP_NOP    0
+#define URING_OP_READ   1
+#define URING_OP_WRITE  2
+#define URING_OP_FSYNC  3
+#define URING_OP_POLL   4
+#define URING_OP_USLEEP 5
+
+#define URING_POS_CUR   UINT64_MAX  // read or write at the current position
+
+struct uring_sqe {
+    uint32_t op;
+    int32_t fd;
+    void * buf;
+    uint64_t len;
+    uint64_t pos;       // position for reads and writes, or URING_POS_CUR
+    uint64_t user_data; // copied to the completion
+};
+
+struct uring_cqe {
+    uint64_t user_data;
+    int64_t res;
+};
+
+struct uring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    struct uring_sqe sqes[URING_ENTRIES];
+    struct uring_cqe cqes[URING_ENTRIES];
+};
+
+struct process;
+
+extern int uring_setup(struct process * proc, struct uring * ring);
+extern long uring_enter(struct process * proc, unsigned int min_complete);
+extern void uring_release(struct process * proc);
+
+#endif // _URING_H_
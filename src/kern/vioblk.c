@@ -11,8 +11,8 @@
 #include "string.h"
 #include "thread.h"
 #include "lock.h"
-
-struct lock vblk_lk;
+#include "timer.h"
+#include "memory.h"
 
 #define min(a,b) (a < b ? a : b)
 
@@ -21,6 +21,21 @@ struct lock vblk_lk;
 
 #define VIOBLK_IRQ_PRIO 1
 
+//           Default interval at which a waiter polls for a completion whose interrupt
+//           was suppressed by coalescing.
+
+#define VIOBLK_COALESCE_USEC_DEFAULT 100
+
+//           Default time a polling submitter spins on the used ring before it falls
+//           back to waiting for the completion interrupt.
+
+#define VIOBLK_POLL_SPIN_USEC_DEFAULT 50
+
+//           Upper bound on the spin budget accepted by IOCTL_SETPOLL. The submitter
+//           spins with interrupts disabled, so a longer spin would stall the hart.
+
+#define VIOBLK_POLL_SPIN_USEC_MAX 500
+
 //           INTERNAL CONSTANT DEFINITIONS
 //          
 
@@ -56,6 +71,17 @@ struct vioblk_request_header {
 
 #define VIRTIO_BLK_T_IN             0
 #define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_T_FLUSH          4
+#define VIRTIO_BLK_T_DISCARD        11
+#define VIRTIO_BLK_T_WRITE_ZEROES   13
+
+//           Data segment of VIRTIO_BLK_T_DISCARD and VIRTIO_BLK_T_WRITE_ZEROES requests
+
+struct vioblk_discard_write_zeroes {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+};
 
 //           Status byte values
 
@@ -66,9 +92,74 @@ struct vioblk_request_header {
 // Queue size that we use
 #define VIOBLK_Q_SIZE 1
 
+//           Maximum number of request queues used with VIRTIO_BLK_F_MQ
+
+#define VIOBLK_QUEUE_MAX 4
+
+//           Maximum number of data segments in one request. Block-aligned transfers go
+//           directly to or from the caller's buffer, one segment per page.
+
+#define VIOBLK_SEG_MAX 8
+
+//           Number of locks that serialize writes through the block buffers, picked
+//           by block number.
+
+#define VIOBLK_BLKLOCKS 8
+
+
+//           Request queue structure. Each virtqueue carries one request at a time and
+//           has its own lock, descriptors, request header, status byte and block
+//           buffer, so requests on different queues proceed in parallel.
+
+struct vioblk_queue {
+    //           serializes requests on this queue
+    struct lock lk;
+    uint16_t qid;
+
+    //           signaled from ISR
+    struct condition used_updated;
+    //           completions since last interrupt (coalescing)
+    uint32_t frames_pending;
+    //           used to poll for completions that do not raise an interrupt
+    struct alarm poll_alarm;
+    //           average completion latency in timer ticks
+    uint64_t lat_avg;
+
+    struct io_stats stats;
+
+    //           Block currently in block buffer, and the device write generation when
+    //           it was read
+    uint64_t bufblkno;
+    uint64_t bufgen;
+    //           Block buffer
+    char * blkbuf;
+
+    //           We use a simple scheme of one transaction at a time. The rings have
+    //           room for the used_event and avail_event fields of EVENT_IDX.
+
+    union {
+        struct virtq_avail avail;
+        char _avail_filler[VIRTQ_AVAIL_EVENT_SIZE(VIOBLK_Q_SIZE)];
+    };
+
+    union {
+        volatile struct virtq_used used;
+        char _used_filler[VIRTQ_USED_EVENT_SIZE(VIOBLK_Q_SIZE)];
+    };
+
+    //           The first descriptor is an indirect descriptor and is the one used in
+    //           the avail and used rings. The second descriptor points to the header,
+    //           the next VIOBLK_SEG_MAX point to the data segments, and the last one to
+    //           the status byte.
+
+    struct virtq_desc desc[VIOBLK_SEG_MAX + 3];
+    struct vioblk_request_header req_header;
+    struct vioblk_discard_write_zeroes req_seg;
+    uint8_t req_status;
+};
 
 //           Main device structure.
-//          
+//          
 //           FIXME You may modify this structure in any way you want. It is given as a
 //           hint to help you, but you may have your own (better!) way of doing things.
 
@@ -80,6 +171,13 @@ struct vioblk_device {
     int8_t opened;
     int8_t readonly;
 
+    //           protects the position; requests are serialized per queue
+    struct lock lk;
+    //           serialize writes to the same block, so that the read-modify-write of
+    //           a partial block on one queue cannot undo a direct write, discard
+    //           or zeroing of the block on another; block b uses b % VIOBLK_BLKLOCKS
+    struct lock blklk[VIOBLK_BLKLOCKS];
+
     //           optimal block size
     uint32_t blksz;
     //           current position
@@ -89,35 +187,29 @@ struct vioblk_device {
     //           size of device in blksz blocks
     uint64_t blkcnt;
 
-    struct {
-        //           signaled from ISR
-        struct condition used_updated;
-
-        //           We use a simple scheme of one transaction at a time.
-
-        union {
-            struct virtq_avail avail;
-            char _avail_filler[VIRTQ_AVAIL_SIZE(VIOBLK_Q_SIZE)];
-        };
-
-        union {
-            volatile struct virtq_used used;
-            char _used_filler[VIRTQ_USED_SIZE(VIOBLK_Q_SIZE)];
-        };
-
-        //           The first descriptor is an indirect descriptor and is the one used in
-        //           the avail and used rings. The second descriptor points to the header,
-        //           the third points to the data, and the fourth to the status byte.
-
-        struct virtq_desc desc[4];
-        struct vioblk_request_header req_header;
-        uint8_t req_status;
-    } vq;
-
-    //           Block currently in block buffer
-    uint64_t bufblkno;
-    //           Block buffer
-    char * blkbuf;
+    //           VIRTIO_F_EVENT_IDX, VIRTIO_BLK_F_FLUSH, VIRTIO_BLK_F_DISCARD and
+    //           VIRTIO_BLK_F_WRITE_ZEROES negotiated
+    int8_t event_idx;
+    int8_t flush;
+    int8_t discard;
+    int8_t write_zeroes;
+    //           interrupt coalescing parameters
+    struct io_coalesce coalesce;
+    //           completion polling mode
+    struct io_poll poll;
+
+    //           interrupts taken (shared by all queues)
+    uint64_t intrcnt;
+    //           incremented after every completed write; block buffers read under an
+    //           older generation may be stale
+    uint64_t wgen;
+
+    //           data segments per request (VIRTIO_BLK_F_SEG_MAX)
+    uint16_t seg_max;
+
+    //           request queues
+    uint16_t nq;
+    struct vioblk_queue * q[VIOBLK_QUEUE_MAX];
 };
 
 #define VIOBLK_ATTEMPT_MAX 10
@@ -127,11 +219,18 @@ struct vioblk_device {
 #define VIOBLK_DESC_INDIRECT_TAB_OFFSET 1 // offset to the descriptor table pointed by the interrupt descriptor
 #define VIOBLK_DESC_HEADER_ID 0
 #define VIOBLK_DESC_DATA_ID 1
-#define VIOBLK_DESC_STATUS_ID 2
+#define VIOBLK_DESC_STATUS_ID (VIOBLK_DESC_DATA_ID + VIOBLK_SEG_MAX)
+
+//           A physically contiguous piece of a request's data
+
+struct vioblk_seg {
+    uint64_t addr;
+    uint32_t len;
+};
 
 
 //           INTERNAL FUNCTION DECLARATIONS
-//          
+//          
 
 static int vioblk_open(struct io_intf ** ioptr, void * aux);
 
@@ -147,11 +246,46 @@ static long vioblk_write (
     const void * restrict buf,
     unsigned long n);
 
+static long vioblk_pread (
+    struct io_intf * restrict io,
+    void * restrict buf,
+    unsigned long bufsz,
+    uint64_t pos);
+
+static long vioblk_pwrite (
+    struct io_intf * restrict io,
+    const void * restrict buf,
+    unsigned long n,
+    uint64_t pos);
+
+static long vioblk_read_at (
+    struct io_intf * restrict io,
+    void * restrict buf,
+    unsigned long bufsz,
+    uint64_t * posp);
+
+static long vioblk_write_at (
+    struct io_intf * restrict io,
+    const void * restrict buf,
+    unsigned long n,
+    uint64_t * posp);
+
 static int vioblk_ioctl (
     struct io_intf * restrict io, int cmd, void * restrict arg);
 
 static void vioblk_isr(int irqno, void * aux);
 
+static struct vioblk_queue * vioblk_queue_init (
+    struct vioblk_device * dev, uint16_t qid);
+static struct vioblk_queue * vioblk_get_queue(struct vioblk_device * dev);
+static void vioblk_submit_and_wait (
+    struct vioblk_device * const dev, struct vioblk_queue * const q);
+static void vioblk_lock_queues(struct vioblk_device * dev);
+static unsigned int vioblk_lock_blocks (
+    struct vioblk_device * dev, uint64_t pos, uint64_t len);
+static void vioblk_unlock_blocks(struct vioblk_device * dev, unsigned int mask);
+static void vioblk_unlock_queues(struct vioblk_device * dev);
+
 //           IOCTLs
 
 static int vioblk_getlen(const struct vioblk_device * dev, uint64_t * lenptr);
@@ -159,9 +293,19 @@ static int vioblk_getpos(const struct vioblk_device * dev, uint64_t * posptr);
 static int vioblk_setpos(struct vioblk_device * dev, const uint64_t * posptr);
 static int vioblk_getblksz (
     const struct vioblk_device * dev, uint32_t * blkszptr);
+static int vioblk_getstats (
+    const struct vioblk_device * dev, struct io_stats * statsptr);
+static int vioblk_getcoalesce (
+    const struct vioblk_device * dev, struct io_coalesce * coalptr);
+static int vioblk_setcoalesce (
+    struct vioblk_device * dev, const struct io_coalesce * coalptr);
+static int vioblk_getpoll (
+    const struct vioblk_device * dev, struct io_poll * pollptr);
+static int vioblk_setpoll (
+    struct vioblk_device * dev, const struct io_poll * pollptr);
 
 //           EXPORTED FUNCTION DEFINITIONS
-//          
+//          
 
 //           Attaches a VirtIO block device. Declared and called directly from virtio.c.
 
@@ -170,6 +314,8 @@ static const struct io_ops vio_ops = {
     .read = vioblk_read,
     .write = vioblk_write,
     .ctl = vioblk_ioctl,
+    .pread = vioblk_pread,
+    .pwrite = vioblk_pwrite,
 };
 
 /**
@@ -189,6 +335,7 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
     virtio_featset_t enabled_features, wanted_features, needed_features;
     struct vioblk_device * dev;
     uint_fast32_t blksz;
+    uint_fast16_t nq;
     int result;
 
     assert (regs->device_id == VIRTIO_ID_BLOCK);
@@ -203,8 +350,14 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
     //            - VIRTIO_F_RING_RESET and
     //            - VIRTIO_F_INDIRECT_DESC
     //           We want:
-    //            - VIRTIO_BLK_F_BLK_SIZE and
-    //            - VIRTIO_BLK_F_TOPOLOGY.
+    //            - VIRTIO_BLK_F_BLK_SIZE,
+    //            - VIRTIO_BLK_F_TOPOLOGY,
+    //            - VIRTIO_BLK_F_SEG_MAX (multi-segment requests) and
+    //            - VIRTIO_F_EVENT_IDX (notification suppression and coalescing),
+    //            - VIRTIO_BLK_F_FLUSH (write-back cache with explicit flushes),
+    //            - VIRTIO_BLK_F_DISCARD,
+    //            - VIRTIO_BLK_F_WRITE_ZEROES and
+    //            - VIRTIO_BLK_F_MQ (one lock and virtqueue per request queue).
 
     virtio_featset_init(needed_features);
     virtio_featset_add(needed_features, VIRTIO_F_RING_RESET);
@@ -212,6 +365,12 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
     virtio_featset_init(wanted_features);
     virtio_featset_add(wanted_features, VIRTIO_BLK_F_BLK_SIZE);
     virtio_featset_add(wanted_features, VIRTIO_BLK_F_TOPOLOGY);
+    virtio_featset_add(wanted_features, VIRTIO_BLK_F_SEG_MAX);
+    virtio_featset_add(wanted_features, VIRTIO_F_EVENT_IDX);
+    virtio_featset_add(wanted_features, VIRTIO_BLK_F_FLUSH);
+    virtio_featset_add(wanted_features, VIRTIO_BLK_F_DISCARD);
+    virtio_featset_add(wanted_features, VIRTIO_BLK_F_WRITE_ZEROES);
+    virtio_featset_add(wanted_features, VIRTIO_BLK_F_MQ);
     result = virtio_negotiate_features(regs,
         enabled_features, wanted_features, needed_features);
 
@@ -231,16 +390,27 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
     assert(blksz % VIOBLK_SECTOR_SIZE == 0);
     debug("%p: virtio block device block size is %lu", regs, (long)blksz);
 
+    //           With MQ, the device tells us how many request queues it has. We use at
+    //           most VIOBLK_QUEUE_MAX of them.
+
+    nq = 1;
+    if (virtio_featset_test(enabled_features, VIRTIO_BLK_F_MQ))
+        nq = min(regs->config.blk.num_queues, VIOBLK_QUEUE_MAX);
+    if (nq == 0)
+        nq = 1;
+    debug("%p: virtio block device using %u request queues", regs, (unsigned)nq);
+
     //           Allocate initialize device struct
 
-    dev = kmalloc(sizeof(struct vioblk_device) + blksz);
+    dev = kmalloc(sizeof(struct vioblk_device));
     memset(dev, 0, sizeof(struct vioblk_device));
 
-    lock_init(&vblk_lk, "vioblk_lock");
+    lock_init(&dev->lk, "vioblk_lock");
+    for (uint_fast16_t i = 0; i < VIOBLK_BLKLOCKS; i++)
+        lock_init(&dev->blklk[i], "vioblk_blk_lock");
 
     //           FIXME Finish initialization of vioblk device here
     dev->regs = regs;
-    dev->instno = 0; // not needed (piazza post @567)
     dev->io_intf.ops = &vio_ops; //pointer to io_ops
     dev->irqno = irqno;
     dev->opened = 0;
@@ -249,50 +419,31 @@ void vioblk_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
     dev->pos = 0; 
     dev->size = regs->config.blk.capacity * VIOBLK_SECTOR_SIZE; 
     dev->blkcnt = dev->size / blksz;
-    dev->bufblkno = UINT64_MAX; // the data in the buffer is nothing, the block number cannot reach -1 in unsigned because INT64_MAX * blksz is so large
-    dev->blkbuf = (void *)(dev)+sizeof(struct vioblk_device); // the block buffer is after the dev struct
-
-    condition_init(&(dev->vq.used_updated), "used ring updated");
-
-
-
-    // fills out the descriptors in the virtq struct
-
-    // indirect descriptor
-    struct virtq_desc* indirect_desc = &(dev->vq.desc[0]);  
-    indirect_desc->addr = (uint64_t)(void *)(dev->vq.desc)+sizeof(struct virtq_desc); // points to the second entry in the desc[] array
-    indirect_desc->flags |= VIRTQ_DESC_F_INDIRECT;
-    indirect_desc->len = 3*sizeof(struct virtq_desc); // 3 because 1 descriptor for each of request header, data, and status
-    indirect_desc->next = 0; // doesn't matter because the NEXT flag is not set
-
-    struct virtq_desc* desc_tab = (void *)(dev->vq.desc)+sizeof(struct virtq_desc);
-    // descriptor to the header
-    desc_tab[VIOBLK_DESC_HEADER_ID].addr = (uint64_t)(void *) (&(dev->vq.req_header));
-    desc_tab[VIOBLK_DESC_HEADER_ID].len = sizeof(struct vioblk_request_header); // section 2.7.5.3
-    desc_tab[VIOBLK_DESC_HEADER_ID].flags |= VIRTQ_DESC_F_NEXT;
-    desc_tab[VIOBLK_DESC_HEADER_ID].next = VIOBLK_DESC_DATA_ID; // pointing to the descriptor of the data buffer
-    
-    // descriptor to the data buffer (block buffer?)
-    desc_tab[VIOBLK_DESC_DATA_ID].addr = (uint64_t)(void *) (dev->blkbuf);
-    desc_tab[VIOBLK_DESC_DATA_ID].flags |= VIRTQ_DESC_F_NEXT; // we should change whether this is device-writable in the before IO operation
-    desc_tab[VIOBLK_DESC_DATA_ID].len = blksz; // so that the device know the size of the buffer
-    desc_tab[VIOBLK_DESC_DATA_ID].next = VIOBLK_DESC_STATUS_ID; // pointing to the descriptor of the status byte
-
-    //descriptor to the status BYTE;
-    desc_tab[VIOBLK_DESC_STATUS_ID].addr = (uint64_t)(void *)(&(dev->vq.req_status));
-    desc_tab[VIOBLK_DESC_STATUS_ID].flags |= VIRTQ_DESC_F_WRITE; // the status byte is always device writable
-    desc_tab[VIOBLK_DESC_STATUS_ID].len = sizeof(uint8_t);
-    desc_tab[VIOBLK_DESC_STATUS_ID].next = 0; // doesn't matter because NEXT flag is not set
-
-    // attaches virtq_avail and virtq_used structs using the virtio_attach_virtq function
-
-    // the size of queue is 1
-    // There's only one queue so the qid is 0
-    virtio_attach_virtq(dev->regs, 0, VIOBLK_Q_SIZE, (uint64_t)(void *)(&(dev->vq.desc)), (uint64_t)(void *)(&(dev->vq.used)), (uint64_t)(void *)(&(dev->vq.avail)));
+    dev->event_idx = virtio_featset_test(enabled_features, VIRTIO_F_EVENT_IDX);
+    dev->flush = virtio_featset_test(enabled_features, VIRTIO_BLK_F_FLUSH);
+    dev->discard = virtio_featset_test(enabled_features, VIRTIO_BLK_F_DISCARD);
+    dev->write_zeroes = virtio_featset_test(enabled_features, VIRTIO_BLK_F_WRITE_ZEROES);
+    dev->coalesce.max_frames = 1; // interrupt on every completion
+    dev->coalesce.usec = VIOBLK_COALESCE_USEC_DEFAULT;
+    dev->poll.mode = IO_POLL_OFF;
+    dev->poll.spin_usec = VIOBLK_POLL_SPIN_USEC_DEFAULT;
+
+    //           Without VIRTIO_BLK_F_SEG_MAX we do not know the device limit, so each
+    //           request carries a single segment.
+
+    dev->seg_max = 1;
+    if (virtio_featset_test(enabled_features, VIRTIO_BLK_F_SEG_MAX))
+        dev->seg_max = min(regs->config.blk.seg_max, VIOBLK_SEG_MAX);
+    if (dev->seg_max == 0)
+        dev->seg_max = 1;
+
+    dev->nq = nq;
+    for (uint_fast16_t i = 0; i < nq; i++)
+        dev->q[i] = vioblk_queue_init(dev, i);
     
     // Finally, the isr and dev are registered
     intr_register_isr(irqno, VIOBLK_IRQ_PRIO, vioblk_isr, dev);
-    device_register("blk", &vioblk_open, dev);
+    dev->instno = device_register("blk", &vioblk_open, dev);
 
     regs->status |= VIRTIO_STAT_DRIVER_OK;    
     //           fence o,oi
@@ -310,22 +461,25 @@ int vioblk_open(struct io_intf ** ioptr, void * aux) {
     //           FIXME your code here
 
     struct vioblk_device * const dev = aux;
-    // int size = sizeof(dev->vq._avail_filler);
+    struct vioblk_queue * q;
 
     assert (ioptr != NULL);
 
     if (dev->opened)
         return -EBUSY;
 
-    // sets the virtq_avail and virtq_used queues such that they are available for use.
-    virtio_enable_virtq(dev->regs, 0);
+    for (uint_fast16_t i = 0; i < dev->nq; i++) {
+        q = dev->q[i];
 
-    dev->vq.avail.flags = 0; // we need notification, so NO_NOTIF flag should not be set
-    dev->vq.avail.idx = 0; // the index of the indirect descriptor
-    // dev->vq._avail_filler[] = (uint64_t)(void *)(&(dev->vq.avail)) + sizeof(struct virtq_avail);
-    dev->vq.avail.ring[0] = 0; // we would only have one request at a time, so index will always be 0
+        // sets the virtq_avail and virtq_used queues such that they are available for use.
+        virtio_enable_virtq(dev->regs, q->qid);
 
-    // dev->vq.used.ring = (uint64_t)(void *)(&(dev->vq.used)) + sizeof(struct virtq_used);
+        q->avail.flags = 0; // we need notification, so NO_NOTIF flag should not be set
+        q->avail.idx = 0; // the index of the indirect descriptor
+        q->avail.ring[0] = 0; // we would only have one request at a time, so index will always be 0
+        *virtq_used_event(&q->avail, VIOBLK_Q_SIZE) = q->used.idx;
+        q->frames_pending = 0;
+    }
 
     // enable interrupt
     intr_enable_irq(dev->irqno);
@@ -355,90 +509,505 @@ void vioblk_close(struct io_intf * io) {
     assert(dev->opened);
 
     // resets the virtq_avail and virtq_used queues
-    virtio_reset_virtq(dev->regs, 0);
+    for (uint_fast16_t i = 0; i < dev->nq; i++)
+        virtio_reset_virtq(dev->regs, dev->q[i]->qid);
 
     intr_disable_irq(dev->irqno);
     dev->opened = 0;
 }
 
 /**
- * @brief performs a single block io request (read/write to a signle block) with the provided device struct, block number and op_type
- * @param dev the pointer to the device that is performing this io
- * @param blk_no the block number that this io request will access
- * @param op_type read or write, can be VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
- * @return 0 if the read/write is success, -1 if not success
+ * @brief allocates a request queue, fills out its descriptors and attaches it to the device as virtqueue qid
+ * @param dev the device that the queue belongs to
+ * @param qid the virtqueue index
+ * @return the new queue
  */
-int vioblk_io_request(struct vioblk_device * const dev, uint64_t blk_no, uint32_t op_type){
-    assert(dev->opened);
+static struct vioblk_queue * vioblk_queue_init (
+    struct vioblk_device * dev, uint16_t qid)
+{
+    struct vioblk_queue * q;
 
-    if(op_type == VIRTIO_BLK_T_OUT && dev->bufblkno != blk_no){
-        // for write operation, check if the blk_no is the same as the number of the block in the dev buffer
-        kprintf("The block number requested is not the same as the number of the block in the buffer!\n");
-        return -1;
-    }
+    q = kmalloc(sizeof(struct vioblk_queue));
+    memset(q, 0, sizeof(struct vioblk_queue));
+
+    q->qid = qid;
+    q->bufblkno = UINT64_MAX; // the data in the buffer is nothing, the block number cannot reach -1 in unsigned because INT64_MAX * blksz is so large
+    q->blkbuf = kmalloc(dev->blksz);
+
+    lock_init(&q->lk, "vioblk_queue_lock");
+    condition_init(&(q->used_updated), "used ring updated");
+    alarm_init(&q->poll_alarm, "vioblk poll");
+
+    // fills out the descriptors in the virtq struct
+
+    // indirect descriptor
+    struct virtq_desc* indirect_desc = &(q->desc[0]);  
+    indirect_desc->addr = (uint64_t)(void *)(q->desc)+sizeof(struct virtq_desc); // points to the second entry in the desc[] array
+    indirect_desc->flags |= VIRTQ_DESC_F_INDIRECT;
+    indirect_desc->len = (VIOBLK_SEG_MAX+2)*sizeof(struct virtq_desc); // 1 descriptor for the request header, VIOBLK_SEG_MAX for data, and 1 for status
+    indirect_desc->next = 0; // doesn't matter because the NEXT flag is not set
+
+    struct virtq_desc* desc_tab = (void *)(q->desc)+sizeof(struct virtq_desc);
+    // descriptor to the header
+    desc_tab[VIOBLK_DESC_HEADER_ID].addr = (uint64_t)(void *) (&(q->req_header));
+    desc_tab[VIOBLK_DESC_HEADER_ID].len = sizeof(struct vioblk_request_header); // section 2.7.5.3
+    desc_tab[VIOBLK_DESC_HEADER_ID].flags |= VIRTQ_DESC_F_NEXT;
+    desc_tab[VIOBLK_DESC_HEADER_ID].next = VIOBLK_DESC_DATA_ID; // pointing to the descriptor of the data buffer
     
-    // VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT 
-    dev->vq.req_header.type = op_type; 
-    // the sector size is always 512 as defined by the virtio protocol, but we want to read/write by aligning to block size
-    uint64_t sector_no = blk_no * dev->blksz / VIOBLK_SECTOR_SIZE; 
+    // descriptor to the data buffer (block buffer?)
+    desc_tab[VIOBLK_DESC_DATA_ID].addr = (uint64_t)(void *) (q->blkbuf);
+    desc_tab[VIOBLK_DESC_DATA_ID].flags |= VIRTQ_DESC_F_NEXT; // we should change whether this is device-writable in the before IO operation
+    desc_tab[VIOBLK_DESC_DATA_ID].len = dev->blksz; // so that the device know the size of the buffer
+    desc_tab[VIOBLK_DESC_DATA_ID].next = VIOBLK_DESC_STATUS_ID; // pointing to the descriptor of the status byte
 
-    assert(sector_no < dev->regs->config.blk.capacity);
+    //descriptor to the status BYTE;
+    desc_tab[VIOBLK_DESC_STATUS_ID].addr = (uint64_t)(void *)(&(q->req_status));
+    desc_tab[VIOBLK_DESC_STATUS_ID].flags |= VIRTQ_DESC_F_WRITE; // the status byte is always device writable
+    desc_tab[VIOBLK_DESC_STATUS_ID].len = sizeof(uint8_t);
+    desc_tab[VIOBLK_DESC_STATUS_ID].next = 0; // doesn't matter because NEXT flag is not set
 
-    dev->vq.req_header.sector = sector_no;
+    // attaches virtq_avail and virtq_used structs using the virtio_attach_virtq function
+    // the size of queue is 1
+    virtio_attach_virtq(dev->regs, qid, VIOBLK_Q_SIZE, (uint64_t)(void *)(&(q->desc)), (uint64_t)(void *)(&(q->used)), (uint64_t)(void *)(&(q->avail)));
 
+    return q;
+}
 
-    for(int i = 0; i < VIOBLK_ATTEMPT_MAX; i++) {
-        int next_idx = dev->vq.used.idx;
-        intr_disable(); // we don't want interrupt to trigger before entering condition_wait
-        if(op_type == VIRTIO_BLK_T_IN){
-            dev->vq.desc[2].flags |= VIRTQ_DESC_F_WRITE; // the data buffer is device-writable
+/**
+ * @brief picks the request queue for the running thread. Threads are spread across queues by
+ * thread id, so concurrent submitters from different threads use different locks and virtqueues.
+ * @param dev the device that is about to submit a request
+ * @return the queue to use (not locked)
+ */
+static struct vioblk_queue * vioblk_get_queue(struct vioblk_device * dev){
+    return dev->q[running_thread() % dev->nq];
+}
+
+/**
+ * @brief decides whether the next request should be completed by spinning on the used ring
+ * @param dev the device that is about to submit a request
+ * @param q the queue that the request is submitted on
+ * @return 1 if the submitter should spin, 0 if it should wait for an interrupt
+ */
+static int vioblk_should_poll (
+    const struct vioblk_device * dev, const struct vioblk_queue * q)
+{
+    switch(dev->poll.mode){
+    case IO_POLL_ON:
+        return 1;
+    case IO_POLL_HYBRID:
+        // spin only if recent requests have completed within the spin budget
+        return q->lat_avg <= dev->poll.spin_usec * (TIMER_FREQ / 1000 / 1000);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief asks the device for (or suppresses) an interrupt when the used index of q moves past next_idx
+ * @param dev the device to configure
+ * @param q the queue to configure
+ * @param next_idx the used index before the pending request completes
+ * @param want_intr 1 to request an interrupt for the pending request, 0 to suppress it
+ * @return no return
+ */
+static void vioblk_arm_intr (
+    struct vioblk_device * dev, struct vioblk_queue * q,
+    uint16_t next_idx, int want_intr)
+{
+    if(dev->event_idx){
+        // the device interrupts when the used index moves past used_event, so
+        // one behind the current index means no interrupt for this completion
+        *virtq_used_event(&q->avail, VIOBLK_Q_SIZE) =
+            want_intr ? next_idx : (uint16_t)(next_idx - 1);
+    }else{
+        q->avail.flags = want_intr ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+    __sync_synchronize();
+}
+
+/**
+ * @brief makes the prepared descriptor chain of q available to the device and waits for it to be used.
+ * Depending on the polling and coalescing settings, the wait either spins on the used ring,
+ * sleeps until the completion interrupt, or polls on an alarm when the interrupt was coalesced away.
+ * Must be called with q->lk held.
+ * @param dev the device that is performing this io
+ * @param q the queue that the request is submitted on
+ * @return no return, the used index has advanced by one when this returns
+ */
+static void vioblk_submit_and_wait (
+    struct vioblk_device * const dev, struct vioblk_queue * const q)
+{
+    const uint16_t next_idx = q->used.idx;
+    const uint16_t old_avail_idx = q->avail.idx;
+    const int poll = vioblk_should_poll(dev, q);
+    int want_intr = 1;
+    uint64_t t_start, t_end, t_spin_end;
+
+    // With EVENT_IDX, ask for an interrupt only on every max_frames-th
+    // completion. A polling submitter does not need an interrupt at all.
+    if(poll){
+        want_intr = 0;
+    }else if(dev->event_idx){
+        if(q->frames_pending + 1 >= dev->coalesce.max_frames){
+            q->frames_pending = 0;
         }else{
-            dev->vq.desc[2].flags &= ~VIRTQ_DESC_F_WRITE; // the data buffer is not device-writable in a write operation
+            q->frames_pending++;
+            want_intr = 0;
+        }
+    }
+    vioblk_arm_intr(dev, q, next_idx, want_intr);
+
+    intr_disable(); // we don't want interrupt to trigger before entering condition_wait
+    t_start = timer_get_time();
+    q->avail.idx ++;
+    q->stats.reqcnt++;
+    // the device must see the new avail index before we read avail_event
+    __sync_synchronize();
+    if(!dev->event_idx || virtq_need_event(
+        *virtq_avail_event(&q->used, VIOBLK_Q_SIZE),
+        q->avail.idx, old_avail_idx))
+    {
+        virtio_notify_avail(dev->regs, q->qid);
+        q->stats.notifycnt++;
+    }
+    // kprintf("notifying the block device a read/write op.\n");
+
+    if(poll){
+        // spin for a bounded time, then fall back to the interrupt
+        t_spin_end = t_start + dev->poll.spin_usec * (TIMER_FREQ / 1000 / 1000);
+        while(q->used.idx == next_idx && timer_get_time() < t_spin_end)
+            continue;
+        if(q->used.idx == next_idx){
+            q->stats.pollmisscnt++;
+            // re-check after arming in case the device completed in between
+            vioblk_arm_intr(dev, q, next_idx, 1);
+            want_intr = 1;
         }
-        dev->vq.avail.idx ++;
-        virtio_notify_avail(dev->regs, 0);
-        // kprintf("notifying the block device a read/write op.\n");
-        condition_wait(&(dev->vq.used_updated)); //wait for a read/write to complete
+    }
+
+    if(want_intr){
+        // the ISR may have run already if the device was quick
+        while(q->used.idx == next_idx)
+            condition_wait(&(q->used_updated)); //wait for a read/write to complete
+        intr_enable();
+    }else if(q->used.idx == next_idx){
+        // no interrupt will come for this completion, so poll for it
+        intr_enable();
+        alarm_reset(&q->poll_alarm);
+        while(q->used.idx == next_idx)
+            alarm_sleep_us(&q->poll_alarm, dev->coalesce.usec);
+    }else{
         intr_enable();
+    }
 
-        // if there's a used buffer notification, then the idx will be updated by plus 1.
-        assert(next_idx != dev->vq.used.idx);
-        // kprintf("the idx of the used ring has update!\n");
+    // exponentially weighted moving average (1/8) of completion latency
+    t_end = timer_get_time();
+    q->lat_avg = q->lat_avg - q->lat_avg / 8 + (t_end - t_start) / 8;
+}
+
+/**
+ * @brief performs a single request on a queue of the device and retries it on error.
+ * One data descriptor is set up for each segment; a request without data (such as a flush)
+ * passes no segments, and the header is chained directly to the status byte.
+ * Must be called with q->lk held.
+ * @param dev the pointer to the device that is performing this io
+ * @param q the queue that the request is submitted on
+ * @param type the request type, one of the VIRTIO_BLK_T_* values
+ * @param sector the first 512-byte sector that the request accesses (0 if unused)
+ * @param segs the physical data segments, in order
+ * @param nseg the number of segments, at most dev->seg_max
+ * @return 0 if the request is successful, -EIO on device error, -ENOTSUP if the device does not support the request
+ */
+static int vioblk_request_segs (
+    struct vioblk_device * const dev, struct vioblk_queue * const q,
+    uint32_t type, uint64_t sector, const struct vioblk_seg * segs, int nseg)
+{
+    struct virtq_desc * const desc_tab = &q->desc[VIOBLK_DESC_INDIRECT_TAB_OFFSET];
+    uint64_t len = 0;
+    int result = -EIO;
 
-        if(op_type == VIRTIO_BLK_T_IN){ // if this is a read operation
-            // now blkbuf contains the block data, update the bufblkno
-            dev->bufblkno = blk_no;
+    assert(dev->opened);
+    assert(nseg <= dev->seg_max);
+
+    q->req_header.type = type;
+    q->req_header.sector = sector;
+
+    if(nseg != 0){
+        desc_tab[VIOBLK_DESC_HEADER_ID].next = VIOBLK_DESC_DATA_ID;
+        for(int i = 0; i < nseg; i++){
+            struct virtq_desc * const d = &desc_tab[VIOBLK_DESC_DATA_ID + i];
+            d->addr = segs[i].addr;
+            d->len = segs[i].len;
+            d->flags = VIRTQ_DESC_F_NEXT;
+            if(type == VIRTIO_BLK_T_IN)
+                d->flags |= VIRTQ_DESC_F_WRITE; // the data buffer is device-writable
+            d->next = (i + 1 < nseg) ? VIOBLK_DESC_DATA_ID + i + 1 : VIOBLK_DESC_STATUS_ID;
+            len += segs[i].len;
         }
+    }else{
+        // no data segment, the header is followed directly by the status byte
+        desc_tab[VIOBLK_DESC_HEADER_ID].next = VIOBLK_DESC_STATUS_ID;
+    }
+
+    for(int i = 0; i < VIOBLK_ATTEMPT_MAX; i++) {
+        uint16_t next_idx = q->used.idx;
+
+        vioblk_submit_and_wait(dev, q);
+
+        // if there's a used buffer notification, then the idx will be updated by plus 1.
+        assert(next_idx != q->used.idx);
 
         // check the id and the len
-        // dev->vq.used.flags does not matter because we don't use VIRTQ_USED_F_NO_NOTIFY
+        // q->used.flags does not matter because we don't use VIRTQ_USED_F_NO_NOTIFY
         // should use next_idx as index byt it's always 0 because modulo QUEUE_SIZE(1) will always be 0
-        if(dev->vq.used.ring[0].id != 0) {
+        if(q->used.ring[0].id != 0) {
             // we only have one descriptor chain, so id should always be 0
-            // 
             kprintf("the used ring is not returning id of 0.\n");
         }
 
-        // if(op_type == VIRTIO_BLK_T_IN && dev->vq.used.ring[0].len != dev->blksz){
-        //     kprintf("For a block read request, the number of bytes read is not the same as block size.\n");
-        // }
-
-        // if(op_type == VIRTIO_BLK_T_OUT && dev->vq.used.ring[0].len != 0){
-        //     kprintf("For a block write request, the number of bytes read is not 0\n");
-        // }
-
-        if (dev->vq.req_status == VIRTIO_BLK_S_OK)
+        if (q->req_status == VIRTIO_BLK_S_OK)
         {
-            // kprintf("read/write request ok!\n");
-            return 0; 
-        }else if(dev->vq.req_status == VIRTIO_BLK_S_IOERR){
+            if(type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT)
+                q->stats.bytecnt += len;
+            result = 0;
+            break;
+        }else if(q->req_status == VIRTIO_BLK_S_IOERR){
             kprintf("read/write request IO Error!\n");
-        }else if(dev->vq.req_status == VIRTIO_BLK_S_UNSUPP){
+        }else if(q->req_status == VIRTIO_BLK_S_UNSUPP){
+            // retrying will not help
             kprintf("read/write request un supported\n");
+            result = -ENOTSUP;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief performs a single request with one data buffer from the kernel's direct-mapped memory.
+ * Must be called with q->lk held.
+ * @param dev the pointer to the device that is performing this io
+ * @param q the queue that the request is submitted on
+ * @param type the request type, one of the VIRTIO_BLK_T_* values
+ * @param sector the first 512-byte sector that the request accesses (0 if unused)
+ * @param data the buffer to transfer, or NULL if the request carries no data
+ * @param len the length of data in bytes
+ * @return 0 if the request is successful, -EIO on device error, -ENOTSUP if the device does not support the request
+ */
+static int vioblk_request (
+    struct vioblk_device * const dev, struct vioblk_queue * const q,
+    uint32_t type, uint64_t sector, void * data, uint32_t len)
+{
+    const struct vioblk_seg seg = { (uint64_t)data, len };
+
+    return vioblk_request_segs(dev, q, type, sector, &seg, len != 0);
+}
+
+/**
+ * @brief splits a buffer into physical segments for a direct transfer, one per page.
+ * Stops at the first page that is not mapped with the needed access (such as a user page that
+ * has not been faulted in yet), and trims the total to a multiple of the block size.
+ * @param dev the device that will perform the transfer
+ * @param buf the virtual address of the buffer
+ * @param len the length of the buffer in bytes
+ * @param type VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+ * @param segs filled out with the segments, must hold dev->seg_max entries
+ * @param nsegptr set to the number of segments
+ * @return the number of bytes covered by the segments, 0 if a direct transfer is not possible
+ */
+static uint64_t vioblk_map_segs (
+    const struct vioblk_device * dev, const void * buf, uint64_t len,
+    uint32_t type, struct vioblk_seg * segs, int * nsegptr)
+{
+    // the device writes the buffer of a read, and reads the buffer of a write
+    const uint_fast8_t flags = (type == VIRTIO_BLK_T_IN) ? PTE_W : PTE_R;
+    uint64_t total = 0;
+    int nseg = 0;
+
+    while(total < len && nseg < dev->seg_max){
+        const char * p = (const char *)buf + total;
+        uint64_t n = min(len - total, PAGE_SIZE - ((uintptr_t)p & (PAGE_SIZE - 1)));
+        uintptr_t pma = memory_vptr_to_pma(p, flags);
+
+        if(pma == 0)
+            break;
+        segs[nseg].addr = pma;
+        segs[nseg].len = n;
+        nseg++;
+        total += n;
+    }
+
+    // drop the partial block at the end
+    while(nseg != 0 && total % dev->blksz != 0){
+        uint64_t excess = total % dev->blksz;
+        if(segs[nseg-1].len > excess){
+            segs[nseg-1].len -= excess;
+            total -= excess;
+        }else{
+            total -= segs[nseg-1].len;
+            nseg--;
         }
     }
 
-    return -1;
+    *nsegptr = nseg;
+    return total;
+}
+
+/**
+ * @brief transfers whole blocks directly between the device and the caller's buffer, bypassing the
+ * block buffer of the queue. Contiguous blocks are moved in a single multi-segment request.
+ * @param dev the device that is performing this io
+ * @param q the queue that the request is submitted on, must be locked
+ * @param type VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+ * @param pos the block-aligned device position
+ * @param segs the segments from vioblk_map_segs
+ * @param nseg the number of segments
+ * @return 0 if success, -EIO if not success
+ */
+static int vioblk_direct_request (
+    struct vioblk_device * const dev, struct vioblk_queue * const q,
+    uint32_t type, uint64_t pos, const struct vioblk_seg * segs, int nseg)
+{
+    if(vioblk_request_segs(dev, q, type, pos / VIOBLK_SECTOR_SIZE, segs, nseg) != 0)
+        return -EIO;
+
+    // block buffers of all queues may hold stale copies of what was written
+    if(type == VIRTIO_BLK_T_OUT)
+        __sync_add_and_fetch(&dev->wgen, 1);
+
+    return 0;
+}
+
+/**
+ * @brief performs a single block io request (read/write to a signle block) through the block buffer of q
+ * @param dev the pointer to the device that is performing this io
+ * @param q the queue that the request is submitted on, must be locked
+ * @param blk_no the block number that this io request will access
+ * @param op_type read or write, can be VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+ * @return 0 if the read/write is success, -1 if not success
+ */
+int vioblk_io_request (
+    struct vioblk_device * const dev, struct vioblk_queue * const q,
+    uint64_t blk_no, uint32_t op_type)
+{
+    uint64_t gen;
+
+    assert(dev->opened);
+
+    if(op_type == VIRTIO_BLK_T_OUT && q->bufblkno != blk_no){
+        // for write operation, check if the blk_no is the same as the number of the block in the queue buffer
+        kprintf("The block number requested is not the same as the number of the block in the buffer!\n");
+        return -1;
+    }
+
+    // the sector size is always 512 as defined by the virtio protocol, but we want to read/write by aligning to block size
+    uint64_t sector_no = blk_no * dev->blksz / VIOBLK_SECTOR_SIZE; 
+
+    assert(sector_no < dev->regs->config.blk.capacity);
+
+    // a write that completes while this read is in flight makes the result stale
+    gen = dev->wgen;
+
+    if(vioblk_request(dev, q, op_type, sector_no, q->blkbuf, dev->blksz) != 0){
+        q->bufblkno = UINT64_MAX;
+        return -1;
+    }
+
+    if(op_type == VIRTIO_BLK_T_IN){ // if this is a read operation
+        // now blkbuf contains the block data, update the bufblkno
+        q->bufblkno = blk_no;
+        q->bufgen = gen;
+    }else{
+        // invalidate the copies of other queues; ours holds what was written
+        q->bufgen = __sync_add_and_fetch(&dev->wgen, 1);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief asks the device to make all completed writes durable (VIRTIO_BLK_T_FLUSH).
+ * Writes complete as soon as the device accepts them, so a flush is the only durability barrier.
+ * @param dev the device to flush
+ * @return 0 if success, negative if error
+ */
+static int vioblk_flush(struct vioblk_device * const dev){
+    struct vioblk_queue * const q = vioblk_get_queue(dev);
+    int result;
+
+    // without VIRTIO_BLK_F_FLUSH the device has no volatile write cache
+    if(!dev->flush)
+        return 0;
+
+    lock_acquire(&q->lk);
+    q->stats.flushcnt++;
+    result = vioblk_request(dev, q, VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+    lock_release(&q->lk);
+    return result;
+}
+
+/**
+ * @brief discards or zeroes a byte range of the device (VIRTIO_BLK_T_DISCARD or VIRTIO_BLK_T_WRITE_ZEROES).
+ * The range must be aligned to 512-byte sectors and within the device.
+ * @param dev the device that you want to access
+ * @param type VIRTIO_BLK_T_DISCARD or VIRTIO_BLK_T_WRITE_ZEROES
+ * @param rngptr the byte range to discard or zero
+ * @return 0 if success, negative if error
+ */
+static int vioblk_range_request (
+    struct vioblk_device * const dev, uint32_t type, const struct io_range * rngptr)
+{
+    struct vioblk_queue * const q = vioblk_get_queue(dev);
+    uint64_t sector, nsectors, max_sectors, n;
+    unsigned int blkmask;
+    int result = 0;
+
+    if (rngptr == NULL)
+        return -EINVAL;
+    if (rngptr->pos % VIOBLK_SECTOR_SIZE != 0 || rngptr->len % VIOBLK_SECTOR_SIZE != 0)
+        return -EINVAL;
+    if (rngptr->pos > dev->size || rngptr->len > dev->size - rngptr->pos)
+        return -EINVAL;
+
+    if (type == VIRTIO_BLK_T_DISCARD) {
+        if (!dev->discard)
+            return -ENOTSUP;
+        max_sectors = dev->regs->config.blk.max_discard_sectors;
+    } else {
+        if (!dev->write_zeroes)
+            return -ENOTSUP;
+        max_sectors = dev->regs->config.blk.max_write_zeroes_sectors;
+    }
+
+    if (max_sectors == 0)
+        max_sectors = UINT32_MAX;
+
+    sector = rngptr->pos / VIOBLK_SECTOR_SIZE;
+    nsectors = rngptr->len / VIOBLK_SECTOR_SIZE;
+
+    blkmask = vioblk_lock_blocks(dev, rngptr->pos, rngptr->len);
+    lock_acquire(&q->lk);
+
+    // one segment per request, split to the device limit
+    while (nsectors != 0) {
+        n = min(nsectors, max_sectors);
+        q->req_seg.sector = sector;
+        q->req_seg.num_sectors = n;
+        q->req_seg.flags = 0;
+        result = vioblk_request(dev, q, type, 0, &q->req_seg, sizeof(q->req_seg));
+        if (result != 0)
+            break;
+        sector += n;
+        nsectors -= n;
+    }
+
+    // cached blocks may have been discarded or zeroed
+    __sync_add_and_fetch(&dev->wgen, 1);
+    lock_release(&q->lk);
+    vioblk_unlock_blocks(dev, blkmask);
+    return result;
 }
 
 /**
@@ -449,52 +1018,109 @@ int vioblk_io_request(struct vioblk_device * const dev, uint64_t blk_no, uint32_
  * @param io the pointer to the io_intf contained in the device struct
  * @param buf the pointer to the buf that the result will be in
  * @param bufsz the maximum length of data that a single call will read
+ * @param posp the position to read at, advanced past the bytes read; the
+ * device position, or a copy of it for vioblk_pread
  * @return the number of bytes read into the buf, as required by io_ops
  * 
  */
-long vioblk_read (
+static long vioblk_read_at (
     struct io_intf * restrict io,
     void * restrict buf,
-    unsigned long bufsz)
+    unsigned long bufsz,
+    uint64_t * posp)
 {
     struct vioblk_device * const dev = (void *) io - offsetof(struct vioblk_device, io_intf);
+    struct vioblk_queue * const q = vioblk_get_queue(dev);
+    struct vioblk_seg segs[VIOBLK_SEG_MAX];
+    uint64_t blk_no, pos, len;
+    int nseg, result;
 
-    lock_acquire(&vblk_lk);
+    // the device lock only covers the position; the transfer itself runs
+    // under the lock of the queue so that other threads can use other queues
+    lock_acquire(&dev->lk);
 
     trace("%s(buf=%p, bufsz=%ld)", __func__, buf, bufsz);
     assert(io != NULL);
     assert(dev->opened); 
     //           FIXME your code here
 
-    if(dev->pos + bufsz > dev->regs->config.blk.capacity * VIOBLK_SECTOR_SIZE){
+    if(*posp + bufsz > dev->regs->config.blk.capacity * VIOBLK_SECTOR_SIZE){
         kprintf("read exceeds block device capacity");
-        lock_release(&vblk_lk);
+        lock_release(&dev->lk);
         return 0;
     }
 
+    // a block-aligned read of whole blocks goes directly into buf in one request
+    if(*posp % dev->blksz == 0 && bufsz >= dev->blksz){
+        len = vioblk_map_segs(dev, buf, bufsz, VIRTIO_BLK_T_IN, segs, &nseg);
+        if(len != 0){
+            pos = *posp;
+            *posp += len;
+            lock_release(&dev->lk);
+
+            lock_acquire(&q->lk);
+            result = vioblk_direct_request(dev, q, VIRTIO_BLK_T_IN, pos, segs, nseg);
+            lock_release(&q->lk);
+            return (result == 0) ? (long)len : result;
+        }
+    }
+
 
     // if data in the block buffer is already the block that we need
-    // we can directly copy data from the buffer in dev struct to the output buffer
+    // we can directly copy data from the buffer of the queue to the output buffer
 
-    int blk_no = (dev->pos) / (dev->blksz);
-    int pos_in_blk = (dev->pos) % (dev->blksz);  // the offset of current "cursor" position in block
+    blk_no = *posp / (dev->blksz);
+    int pos_in_blk = *posp % (dev->blksz);  // the offset of current "cursor" position in block
     int start_pos = pos_in_blk; // the index that we are start reading from 
     int end_pos = min(dev->blksz, start_pos + bufsz); // read until the end of block unless we are reading enough before that, this position is  (we read until end_pos - 1)
 
+    *posp += end_pos - start_pos;
+    lock_release(&dev->lk);
+
+    lock_acquire(&q->lk);
+
     // if the buffer does not contain the block that we want, read it from the device
-    if(dev->bufblkno != blk_no){
-        // request data from vioblk device, data should be in dev->blkbuf after this.
-        vioblk_io_request(dev, blk_no, VIRTIO_BLK_T_IN);
+    if(q->bufblkno != blk_no || q->bufgen != dev->wgen){
+        // request data from vioblk device, data should be in q->blkbuf after this.
+        if(vioblk_io_request(dev, q, blk_no, VIRTIO_BLK_T_IN) != 0){
+            lock_release(&q->lk);
+            return -EIO;
+        }
     }
 
     // now we need to copy data from the buffer we read from the device to the output buffer
-    memcpy(buf, dev->blkbuf + pos_in_blk, end_pos - start_pos); // copy to the end of the block
+    memcpy(buf, q->blkbuf + pos_in_blk, end_pos - start_pos); // copy to the end of the block
 
-    dev->pos += end_pos - start_pos;
-    lock_release(&vblk_lk);
+    lock_release(&q->lk);
     return end_pos - start_pos;
 }
 
+/**
+ * @brief performs a read at the device position and advances it, see vioblk_read_at
+ */
+long vioblk_read (
+    struct io_intf * restrict io,
+    void * restrict buf,
+    unsigned long bufsz)
+{
+    struct vioblk_device * const dev = (void *) io - offsetof(struct vioblk_device, io_intf);
+
+    return vioblk_read_at(io, buf, bufsz, &dev->pos);
+}
+
+/**
+ * @brief performs a read at a given position, without using or moving the
+ * device position, see vioblk_read_at
+ */
+long vioblk_pread (
+    struct io_intf * restrict io,
+    void * restrict buf,
+    unsigned long bufsz,
+    uint64_t pos)
+{
+    return vioblk_read_at(io, buf, bufsz, &pos);
+}
+
 /**
  * @brief performs a write to a block device indicated by the io_intf, using data in buf.
  * Will only perform write to a single block.
@@ -503,62 +1129,132 @@ long vioblk_read (
  * @param io the pointer to the io_intf contained in the device struct
  * @param buf the pointer to the buffer in which the data writing to the block device is from
  * @param n the requested length of data to write, might not write all in a single call, to write all, used iowrite()
+ * @param posp the position to write at, advanced past the bytes written; the
+ * device position, or a copy of it for vioblk_pwrite
  */
-long vioblk_write (
+static long vioblk_write_at (
     struct io_intf * restrict io,
     const void * restrict buf,
-    unsigned long n)
+    unsigned long n,
+    uint64_t * posp)
 {
     // FIXME your code here
 
-    lock_acquire(&vblk_lk);
     struct vioblk_device * const dev = (void *) io - offsetof(struct vioblk_device, io_intf);
+    struct vioblk_queue * const q = vioblk_get_queue(dev);
+    struct vioblk_seg segs[VIOBLK_SEG_MAX];
+    struct lock * blklk;
+    uint64_t blk_no, pos, len;
+    unsigned int blkmask;
+    int nseg, result;
+
+    lock_acquire(&dev->lk);
 
     trace("%s(buf=%p, bufsz=%ld)", __func__, buf, n);
     assert(io != NULL);
     assert(dev->opened); 
 
-    if(dev->pos + n > dev->regs->config.blk.capacity * VIOBLK_SECTOR_SIZE){
+    if(*posp + n > dev->regs->config.blk.capacity * VIOBLK_SECTOR_SIZE){
         kprintf("write exceeds block device capacity");
-        lock_release(&vblk_lk);
+        lock_release(&dev->lk);
         return 0;
     }
 
-    int blk_no = (dev->pos) / (dev->blksz);
-    int pos_in_blk = (dev->pos) % (dev->blksz); // the offset of the current cursor in the block
+    // a block-aligned write of whole blocks goes directly from buf in one request
+    if(*posp % dev->blksz == 0 && n >= dev->blksz){
+        len = vioblk_map_segs(dev, buf, n, VIRTIO_BLK_T_OUT, segs, &nseg);
+        if(len != 0){
+            pos = *posp;
+            *posp += len;
+            lock_release(&dev->lk);
+
+            // the locks of the blocks written keep a partial-block write on
+            // another queue from writing back a copy read before this write
+            blkmask = vioblk_lock_blocks(dev, pos, len);
+            lock_acquire(&q->lk);
+            result = vioblk_direct_request(dev, q, VIRTIO_BLK_T_OUT, pos, segs, nseg);
+            lock_release(&q->lk);
+            vioblk_unlock_blocks(dev, blkmask);
+            return (result == 0) ? (long)len : result;
+        }
+    }
+
+    blk_no = *posp / (dev->blksz);
+    int pos_in_blk = *posp % (dev->blksz); // the offset of the current cursor in the block
     int start_pos = pos_in_blk;
     int end_pos = min(dev->blksz, start_pos+n); // we write until the end of the block unless we are writing enough data, does not include this position
     // n - bytes_written is the number of bytes that still need to be written
 
+    *posp += end_pos - start_pos;
+    lock_release(&dev->lk);
+
+    // the block lock is held from reading the block to writing it back, so
+    // that writes to the block through other queues wait; it is taken before
+    // the queue lock
+    blklk = &dev->blklk[blk_no % VIOBLK_BLKLOCKS];
+    lock_acquire(blklk);
+    lock_acquire(&q->lk);
+
     // if the write is not a full block 
     // and the block in the buffer is not the block that we want to write to,
     // we need to read the block first
-    if((end_pos != dev->blksz || start_pos != 0) && dev->bufblkno != blk_no){
-        vioblk_io_request(dev, blk_no, VIRTIO_BLK_T_IN);
-        // now we have a full block in the block buffer of the device struct
-        assert(dev->bufblkno == blk_no);
+    if((end_pos != dev->blksz || start_pos != 0) &&
+        (q->bufblkno != blk_no || q->bufgen != dev->wgen))
+    {
+        if(vioblk_io_request(dev, q, blk_no, VIRTIO_BLK_T_IN) != 0){
+            lock_release(&q->lk);
+            lock_release(blklk);
+            return -EIO;
+        }
+        // now we have a full block in the block buffer of the queue
+        assert(q->bufblkno == blk_no);
     }
 
     // the block buffer is already the block that we want to write to
     // we can directly modify the part of the data that we want to modify and then request a write
-
-    // if we are writing a full block, makesure to update the bufblkno as writing into dev->buf
-    if(start_pos == 0 || end_pos == dev->blksz){
-        dev->bufblkno = blk_no;
-    }
+    q->bufblkno = blk_no;
 
     // copy date from buf to the block buffer
-    memcpy(dev->blkbuf + start_pos, buf, end_pos - start_pos);
+    memcpy(q->blkbuf + start_pos, buf, end_pos - start_pos);
 
     // request a write operation
-    vioblk_io_request(dev, dev->bufblkno, VIRTIO_BLK_T_OUT);
+    if(vioblk_io_request(dev, q, blk_no, VIRTIO_BLK_T_OUT) != 0){
+        lock_release(&q->lk);
+        lock_release(blklk);
+        return -EIO;
+    }
 
-    // write to device is done, update bytes_written to device
-    dev->pos += end_pos - start_pos;
-    lock_release(&vblk_lk);
+    lock_release(&q->lk);
+    lock_release(blklk);
     return end_pos - start_pos;
 }
 
+/**
+ * @brief performs a write at the device position and advances it, see vioblk_write_at
+ */
+long vioblk_write (
+    struct io_intf * restrict io,
+    const void * restrict buf,
+    unsigned long n)
+{
+    struct vioblk_device * const dev = (void *) io - offsetof(struct vioblk_device, io_intf);
+
+    return vioblk_write_at(io, buf, n, &dev->pos);
+}
+
+/**
+ * @brief performs a write at a given position, without using or moving the
+ * device position, see vioblk_write_at
+ */
+long vioblk_pwrite (
+    struct io_intf * restrict io,
+    const void * restrict buf,
+    unsigned long n,
+    uint64_t pos)
+{
+    return vioblk_write_at(io, buf, n, &pos);
+}
+
 /**
  * @brief virtio block device io control function, as specified by io_ops.
  * can perform getlen, getpos, setpos, and getblksz functions as specified by cmd.
@@ -569,35 +1265,52 @@ long vioblk_write (
  * @return 0 if successful, negative if error
  */
 int vioblk_ioctl(struct io_intf * restrict io, int cmd, void * restrict arg) {
-    lock_acquire(&vblk_lk);
     struct vioblk_device * const dev = (void*)io -
         offsetof(struct vioblk_device, io_intf);
+    int result;
     
     trace("%s(cmd=%d,arg=%p)", __func__, cmd, arg);
     
     switch (cmd) {
     case IOCTL_GETLEN:
-        lock_release(&vblk_lk);
         return vioblk_getlen(dev, arg);
     case IOCTL_GETPOS:
-        lock_release(&vblk_lk);
-        return vioblk_getpos(dev, arg);
+        lock_acquire(&dev->lk);
+        result = vioblk_getpos(dev, arg);
+        lock_release(&dev->lk);
+        return result;
     case IOCTL_SETPOS:
-        lock_release(&vblk_lk);
-        return vioblk_setpos(dev, arg);
+        lock_acquire(&dev->lk);
+        result = vioblk_setpos(dev, arg);
+        lock_release(&dev->lk);
+        return result;
     case IOCTL_GETBLKSZ:
-        lock_release(&vblk_lk);
         return vioblk_getblksz(dev, arg);
+    case IOCTL_GETSTATS:
+        return vioblk_getstats(dev, arg);
+    case IOCTL_GETCOALESCE:
+        return vioblk_getcoalesce(dev, arg);
+    case IOCTL_SETCOALESCE:
+        return vioblk_setcoalesce(dev, arg);
+    case IOCTL_FLUSH:
+        return vioblk_flush(dev);
+    case IOCTL_DISCARD:
+        return vioblk_range_request(dev, VIRTIO_BLK_T_DISCARD, arg);
+    case IOCTL_ZERORANGE:
+        return vioblk_range_request(dev, VIRTIO_BLK_T_WRITE_ZEROES, arg);
+    case IOCTL_GETPOLL:
+        return vioblk_getpoll(dev, arg);
+    case IOCTL_SETPOLL:
+        return vioblk_setpoll(dev, arg);
     default:
-        lock_release(&vblk_lk);
         return -ENOTSUP;
     }
 }
 
 /**
  * @brief the interrupt service routine for virtio block device, aux points to the device triggering this isr.
- * If there's a used buffer notification from the block device, it will broadcast the condition used_updated in the device
- * to continue execute a read/write operation.
+ * If there's a used buffer notification from the block device, it will broadcast the condition used_updated
+ * of every queue; waiters re-check their own used ring.
  * @param irqno the interrupt request number of the device that triggered this isr
  * @param aux the pointer to the device struct triggered this isr
  * @return no return 
@@ -608,8 +1321,11 @@ void vioblk_isr(int irqno, void * aux) {
     const uint32_t USED_BUFFER_NOTIF = (1 << 0); 
 
     if(dev->regs->interrupt_status & USED_BUFFER_NOTIF){
+        dev->intrcnt++;
         // There's a new used buffer, signal the condition to let driver continue.
-        condition_broadcast(&(dev->vq.used_updated));
+        // The interrupt does not say which queue it is for.
+        for (uint_fast16_t i = 0; i < dev->nq; i++)
+            condition_broadcast(&(dev->q[i]->used_updated));
 
         // acknolwedge the interrupt is handled to the device
         dev->regs->interrupt_ack |= USED_BUFFER_NOTIF;
@@ -680,3 +1396,177 @@ int vioblk_getblksz (
     *blkszptr = dev->blksz;
     return 0;
 }
+
+/**
+ * @brief Gets the request, notification, interrupt and byte counters of the block device
+ * @param dev the device that you want to access
+ * @param statsptr the pointer to the stats struct, result will be put here
+ * @return 0 if success, negative if error
+ */
+int vioblk_getstats (
+    const struct vioblk_device * dev, struct io_stats * statsptr)
+{
+    const struct io_stats * qs;
+
+    if (statsptr == NULL)
+        return -EINVAL;
+
+    // counters are kept per queue and summed here
+    memset(statsptr, 0, sizeof(struct io_stats));
+    for (uint_fast16_t i = 0; i < dev->nq; i++) {
+        qs = &dev->q[i]->stats;
+        statsptr->reqcnt += qs->reqcnt;
+        statsptr->notifycnt += qs->notifycnt;
+        statsptr->bytecnt += qs->bytecnt;
+        statsptr->pollmisscnt += qs->pollmisscnt;
+        statsptr->flushcnt += qs->flushcnt;
+    }
+    statsptr->intrcnt = dev->intrcnt;
+    return 0;
+}
+
+/**
+ * @brief Gets the interrupt coalescing parameters of the block device
+ * @param dev the device that you want to access
+ * @param coalptr the pointer to the coalescing parameters, result will be put here
+ * @return 0 if success, negative if error
+ */
+int vioblk_getcoalesce (
+    const struct vioblk_device * dev, struct io_coalesce * coalptr)
+{
+    if (coalptr == NULL)
+        return -EINVAL;
+    *coalptr = dev->coalesce;
+    return 0;
+}
+
+/**
+ * @brief Sets the interrupt coalescing parameters of the block device.
+ * More than one completion per interrupt requires VIRTIO_F_EVENT_IDX and a nonzero poll interval.
+ * @param dev the device that you want to access
+ * @param coalptr the pointer to the new coalescing parameters
+ * @return 0 if success, negative if error
+ */
+int vioblk_setcoalesce (
+    struct vioblk_device * dev, const struct io_coalesce * coalptr)
+{
+    if (coalptr == NULL || coalptr->max_frames == 0)
+        return -EINVAL;
+    if (coalptr->max_frames > 1 && coalptr->usec == 0)
+        return -EINVAL;
+    if (coalptr->max_frames > 1 && !dev->event_idx)
+        return -ENOTSUP;
+
+    // changed under every queue lock so that no request is in flight
+
+    vioblk_lock_queues(dev);
+    dev->coalesce = *coalptr;
+    vioblk_unlock_queues(dev);
+    return 0;
+}
+
+/**
+ * @brief Gets the completion polling mode of the block device and its recent average completion latency
+ * @param dev the device that you want to access
+ * @param pollptr the pointer to the polling parameters, result will be put here
+ * @return 0 if success, negative if error
+ */
+int vioblk_getpoll (
+    const struct vioblk_device * dev, struct io_poll * pollptr)
+{
+    uint64_t lat_sum = 0;
+
+    if (pollptr == NULL)
+        return -EINVAL;
+    *pollptr = dev->poll;
+    for (uint_fast16_t i = 0; i < dev->nq; i++)
+        lat_sum += dev->q[i]->lat_avg;
+    pollptr->avg_usec = lat_sum / dev->nq / (TIMER_FREQ / 1000 / 1000);
+    return 0;
+}
+
+/**
+ * @brief Sets the completion polling mode of the block device.
+ * The spin budget is clamped to VIOBLK_POLL_SPIN_USEC_MAX.
+ * @param dev the device that you want to access
+ * @param pollptr the pointer to the new polling parameters
+ * @return 0 if success, negative if error
+ */
+int vioblk_setpoll (
+    struct vioblk_device * dev, const struct io_poll * pollptr)
+{
+    if (pollptr == NULL || pollptr->mode > IO_POLL_HYBRID)
+        return -EINVAL;
+
+    // changed under every queue lock so that no request is in flight
+
+    vioblk_lock_queues(dev);
+    dev->poll.mode = pollptr->mode;
+    dev->poll.spin_usec = min(pollptr->spin_usec, VIOBLK_POLL_SPIN_USEC_MAX);
+    vioblk_unlock_queues(dev);
+    return 0;
+}
+
+/**
+ * @brief Acquires the lock of every request queue of the device, in queue order
+ * @param dev the device whose queues are locked
+ * @return None
+ */
+static void vioblk_lock_queues(struct vioblk_device * dev) {
+    for (uint_fast16_t i = 0; i < dev->nq; i++)
+        lock_acquire(&dev->q[i]->lk);
+}
+
+/**
+ * @brief Acquires the block locks of every block in a byte range, in ascending
+ * lock order so that two writers of overlapping ranges cannot deadlock.
+ * Taken before any queue lock.
+ * @param dev the device whose block locks are taken
+ * @param pos the start of the range
+ * @param len the length of the range, may be zero
+ * @return the mask of the locks taken, for vioblk_unlock_blocks
+ */
+static unsigned int vioblk_lock_blocks (
+    struct vioblk_device * dev, uint64_t pos, uint64_t len)
+{
+    uint64_t first, last;
+    unsigned int mask = 0;
+
+    if (len == 0)
+        return 0;
+
+    first = pos / dev->blksz;
+    last = (pos + len - 1) / dev->blksz;
+    if (last - first >= VIOBLK_BLKLOCKS - 1)
+        mask = (1U << VIOBLK_BLKLOCKS) - 1;
+    else
+        for (uint64_t b = first; b <= last; b++)
+            mask |= 1U << (b % VIOBLK_BLKLOCKS);
+
+    for (uint_fast16_t i = 0; i < VIOBLK_BLKLOCKS; i++)
+        if (mask & (1U << i))
+            lock_acquire(&dev->blklk[i]);
+    return mask;
+}
+
+/**
+ * @brief Releases the block locks taken by vioblk_lock_blocks
+ * @param dev the device whose block locks are released
+ * @param mask the mask returned by vioblk_lock_blocks
+ * @return None
+ */
+static void vioblk_unlock_blocks(struct vioblk_device * dev, unsigned int mask) {
+    for (uint_fast16_t i = VIOBLK_BLKLOCKS; i > 0; i--)
+        if (mask & (1U << (i-1)))
+            lock_release(&dev->blklk[i-1]);
+}
+
+/**
+ * @brief Releases the locks taken by vioblk_lock_queues
+ * @param dev the device whose queues are unlocked
+ * @return None
+ */
+static void vioblk_unlock_queues(struct vioblk_device * dev) {
+    for (uint_fast16_t i = dev->nq; i > 0; i--)
+        lock_release(&dev->q[i-1]->lk);
+}
@@ -0,0 +1,742 @@
+//           viocons.c - VirtIO console (multiport serial)
+//
+
+#include "virtio.h"
+#include "intr.h"
+#include "halt.h"
+#include "heap.h"
+#include "io.h"
+#include "device.h"
+#include "error.h"
+#include "string.h"
+#include "thread.h"
+#include "memory.h"
+
+#include "limits.h"
+
+#define min(a,b) (a < b ? a : b)
+
+//           COMPILE-TIME PARAMETERS
+//
+
+#define VIOCONS_IRQ_PRIO 1
+
+//           Buffers in each receive and transmit virtqueue. A writer fills as many
+//           free transmit buffers as it can before notifying the device, so up to
+//           VIOCONS_Q_SIZE buffers are in flight at once.
+
+#ifndef VIOCONS_Q_SIZE
+#define VIOCONS_Q_SIZE 8
+#endif
+
+//           Maximum number of ports used with VIRTIO_CONSOLE_F_MULTIPORT
+
+#ifndef VIOCONS_PORT_MAX
+#define VIOCONS_PORT_MAX 4
+#endif
+
+//           INTERNAL CONSTANT DEFINITIONS
+//
+
+//           VirtIO console device feature bits (number, *not* mask)
+
+#define VIRTIO_CONSOLE_F_SIZE           0
+#define VIRTIO_CONSOLE_F_MULTIPORT      1
+#define VIRTIO_CONSOLE_F_EMERG_WRITE    2
+
+//           Control messages (Section 5.3.6.2). The device sends DEVICE_ADD for each
+//           port once the driver sends DEVICE_READY, and the driver answers each
+//           with PORT_READY. PORT_OPEN goes both ways: the driver sends it when a
+//           port is opened or closed, the device when the host side connects or
+//           disconnects. PORT_NAME is followed by the name, without a terminator.
+
+#define VIRTIO_CONSOLE_DEVICE_READY     0
+#define VIRTIO_CONSOLE_DEVICE_ADD       1
+#define VIRTIO_CONSOLE_DEVICE_REMOVE    2
+#define VIRTIO_CONSOLE_PORT_READY       3
+#define VIRTIO_CONSOLE_CONSOLE_PORT     4
+#define VIRTIO_CONSOLE_RESIZE           5
+#define VIRTIO_CONSOLE_PORT_OPEN        6
+#define VIRTIO_CONSOLE_PORT_NAME        7
+
+//           Size of a data buffer, one page, and of a control buffer, which holds a
+//           control message and a port name
+
+#define VIOCONS_BUFSZ PAGE_SIZE
+#define VIOCONS_CTRL_BUFSZ 64
+#define VIOCONS_NAME_MAX (VIOCONS_CTRL_BUFSZ - sizeof(struct viocons_control))
+
+//           Virtqueue indices. Port 0 uses queues 0 and 1, the control queues are 2
+//           and 3, and port n > 0 uses queues 2n+2 and 2n+3.
+
+#define VIOCONS_CTRL_RXQ 2
+#define VIOCONS_CTRL_TXQ 3
+#define VIOCONS_PORT_RXQ(id) ((id) == 0 ? 0 : 2 * (id) + 2)
+#define VIOCONS_PORT_TXQ(id) (VIOCONS_PORT_RXQ(id) + 1)
+
+//           INTERNAL TYPE DEFINITIONS
+//
+
+struct viocons_control {
+    uint32_t id;
+    uint16_t event;
+    uint16_t value;
+};
+
+//           A virtqueue with a buffer for each descriptor. Receive queues keep all
+//           their buffers available to the device and hand each back once the reader
+//           has consumed it. Transmit queues keep a list of free descriptors, and
+//           descriptors the device has used go back on it when reclaimed.
+
+struct viocons_vq {
+    uint16_t qid;
+    //           used ring entries consumed or reclaimed
+    uint16_t last_used;
+    //           free descriptors (transmit queues only)
+    uint16_t nfree;
+    uint16_t free[VIOCONS_Q_SIZE];
+    char * bufs[VIOCONS_Q_SIZE];
+
+    struct virtq_desc desc[VIOCONS_Q_SIZE] __attribute__ ((aligned (16)));
+
+    union {
+        struct virtq_avail avail;
+        char _avail_filler[VIRTQ_AVAIL_SIZE(VIOCONS_Q_SIZE)];
+    };
+
+    union {
+        volatile struct virtq_used used;
+        char _used_filler[VIRTQ_USED_SIZE(VIOCONS_Q_SIZE)];
+    };
+};
+
+struct viocons_device;
+
+struct viocons_port {
+    struct viocons_device * dev;
+    struct io_intf io_intf;
+    uint16_t id;
+    //           added by the device, and host side connected
+    int8_t present;
+    int8_t host_open;
+    int flags; // O_NONBLOCK
+
+    //           bytes of the oldest used receive buffer already read
+    uint32_t rx_off;
+    //           signaled from ISR
+    struct condition rx_cond;
+    struct condition tx_cond;
+
+    uint64_t reqcnt;
+    uint64_t bytecnt;
+
+    struct viocons_vq * rxq;
+    struct viocons_vq * txq;
+    char name[VIOCONS_NAME_MAX + 1];
+};
+
+struct viocons_device {
+    volatile struct virtio_mmio_regs * regs;
+    uint16_t irqno;
+    //           VIRTIO_CONSOLE_F_MULTIPORT negotiated
+    int8_t multiport;
+
+    //           interrupts taken and notifications sent (shared by all ports)
+    uint64_t intrcnt;
+    uint64_t notifycnt;
+
+    struct viocons_vq * ctrl_rxq;
+    struct viocons_vq * ctrl_txq;
+
+    uint16_t nports;
+    struct viocons_port * ports[VIOCONS_PORT_MAX];
+};
+
+//           INTERNAL FUNCTION DECLARATIONS
+//
+
+static int viocons_open(struct io_intf ** ioptr, void * aux);
+static void viocons_close(struct io_intf * io);
+static long viocons_read(struct io_intf * io, void * buf, unsigned long bufsz);
+static long viocons_write(struct io_intf * io, const void * buf, unsigned long n);
+static int viocons_ioctl(struct io_intf * io, int cmd, void * arg);
+static int viocons_poll(struct io_intf * io, int events);
+
+static void viocons_isr(int irqno, void * aux);
+
+static struct viocons_vq * viocons_vq_init (
+    struct viocons_device * dev, uint16_t qid, uint32_t bufsz, int rx);
+static void viocons_vq_post(struct viocons_vq * vq, uint16_t id, uint32_t len);
+static void viocons_vq_kick(struct viocons_device * dev, struct viocons_vq * vq);
+static void viocons_vq_reclaim(struct viocons_vq * vq);
+
+static void viocons_control(struct viocons_device * dev);
+static void viocons_send_control (
+    struct viocons_device * dev, uint32_t id, uint16_t event, uint16_t value);
+
+//           EXPORTED FUNCTION DEFINITIONS
+//
+
+static const struct io_ops viocons_ops = {
+    .close = viocons_close,
+    .read = viocons_read,
+    .write = viocons_write,
+    .ctl = viocons_ioctl,
+    .poll = viocons_poll
+};
+
+/**
+ * @brief attaches a virtio console device. Each port is registered as a "vcon" device, in
+ * order of port number, and its virtqueues are set up with receive buffers made available.
+ * With VIRTIO_CONSOLE_F_MULTIPORT, the device then adds the ports it has over the control
+ * queue; without it, the device has only port 0. Declared and called directly from virtio.c.
+ * @param regs the address of the MMIO registers of the device
+ * @param irqno the interrupt request number of the device
+ * @return no return
+ */
+void viocons_attach(volatile struct virtio_mmio_regs * regs, int irqno) {
+    virtio_featset_t enabled_features, wanted_features, needed_features;
+    struct viocons_device * dev;
+    struct viocons_port * port;
+    uint_fast16_t i;
+    int result;
+
+    assert (regs->device_id == VIRTIO_ID_CONSOLE);
+
+    //           Signal device that we found a driver
+
+    regs->status |= VIRTIO_STAT_DRIVER;
+    //           fence o,io
+    __sync_synchronize();
+
+    //           We want VIRTIO_CONSOLE_F_MULTIPORT, for ports beyond port 0
+
+    virtio_featset_init(needed_features);
+    virtio_featset_init(wanted_features);
+    virtio_featset_add(wanted_features, VIRTIO_CONSOLE_F_MULTIPORT);
+    result = virtio_negotiate_features(regs,
+        enabled_features, wanted_features, needed_features);
+
+    if (result != 0) {
+        kprintf("%p: virtio feature negotiation failed\n", regs);
+        return;
+    }
+
+    dev = kcalloc(1, sizeof(struct viocons_device));
+    dev->regs = regs;
+    dev->irqno = irqno;
+    dev->multiport = virtio_featset_test(enabled_features, VIRTIO_CONSOLE_F_MULTIPORT);
+
+    dev->nports = 1;
+    if (dev->multiport)
+        dev->nports = min(regs->config.console.max_nr_ports, VIOCONS_PORT_MAX);
+    if (dev->nports == 0)
+        dev->nports = 1;
+    debug("%p: virtio console device using %u ports", regs, (unsigned)dev->nports);
+
+    //           Set up the virtqueues of every port we may use now, since the device
+    //           must have them before DRIVER_OK. The ports are registered in order, so
+    //           that a port's instance number is its port number.
+
+    for (i = 0; i < dev->nports; i++) {
+        port = kcalloc(1, sizeof(struct viocons_port));
+        port->dev = dev;
+        port->id = i;
+        port->present = !dev->multiport;
+        port->io_intf.ops = &viocons_ops;
+        condition_init(&port->rx_cond, "viocons_rx");
+        condition_init(&port->tx_cond, "viocons_tx");
+        port->rxq = viocons_vq_init(dev, VIOCONS_PORT_RXQ(i), VIOCONS_BUFSZ, 1);
+        port->txq = viocons_vq_init(dev, VIOCONS_PORT_TXQ(i), VIOCONS_BUFSZ, 0);
+        dev->ports[i] = port;
+        device_register("vcon", &viocons_open, port);
+    }
+
+    if (dev->multiport) {
+        dev->ctrl_rxq = viocons_vq_init(dev, VIOCONS_CTRL_RXQ, VIOCONS_CTRL_BUFSZ, 1);
+        dev->ctrl_txq = viocons_vq_init(dev, VIOCONS_CTRL_TXQ, VIOCONS_CTRL_BUFSZ, 0);
+    }
+
+    intr_register_isr(irqno, VIOCONS_IRQ_PRIO, viocons_isr, dev);
+
+    regs->status |= VIRTIO_STAT_DRIVER_OK;
+    //           fence o,oi
+    __sync_synchronize();
+
+    //           Control messages arrive at any time, so the interrupt stays enabled.
+    //           Interrupts are still disabled during attach, so we also take the
+    //           device's answers to DEVICE_READY here if it has already sent them.
+
+    intr_enable_irq(irqno);
+
+    if (dev->multiport) {
+        viocons_send_control(dev, 0, VIRTIO_CONSOLE_DEVICE_READY, 1);
+        viocons_control(dev);
+    }
+}
+
+/**
+ * @brief opens a port of a virtio console device, telling the device so with PORT_OPEN
+ * @param ioptr will point to the io_intf of the port
+ * @param aux the pointer to the port struct
+ * @return 0 if successful, -ENODEV if the device has not added the port, -EBUSY if it is open
+ */
+int viocons_open(struct io_intf ** ioptr, void * aux) {
+    struct viocons_port * const port = aux;
+
+    assert (ioptr != NULL);
+
+    if (!port->present)
+        return -ENODEV;
+    if (port->io_intf.refcnt)
+        return -EBUSY;
+
+    port->flags = 0;
+    if (port->dev->multiport)
+        viocons_send_control(port->dev, port->id, VIRTIO_CONSOLE_PORT_OPEN, 1);
+
+    *ioptr = &port->io_intf;
+    port->io_intf.refcnt = 1;
+    return 0;
+}
+
+/**
+ * @brief closes a port. Its receive buffers stay with the device, so that input that
+ * arrives while it is closed is kept until it is opened again, as far as they hold it.
+ * @param io the io_intf of the port
+ * @return no return
+ */
+void viocons_close(struct io_intf * io) {
+    struct viocons_port * const port =
+        (void*)io - offsetof(struct viocons_port, io_intf);
+
+    trace("%s()", __func__);
+    assert (io != NULL);
+
+    if (port->dev->multiport && port->present)
+        viocons_send_control(port->dev, port->id, VIRTIO_CONSOLE_PORT_OPEN, 0);
+}
+
+/**
+ * @brief reads from a port, waiting until the device has filled at least one receive
+ * buffer and then taking from as many filled buffers as fit. Each buffer read to the end
+ * is made available to the device again, with one notification for all of them.
+ * @param io the io_intf of the port
+ * @param buf the buffer to read into
+ * @param bufsz the size of the buffer
+ * @return number of bytes read, or -EAGAIN with O_NONBLOCK and nothing to read
+ */
+long viocons_read(struct io_intf * io, void * buf, unsigned long bufsz) {
+    struct viocons_port * const port =
+        (void*)io - offsetof(struct viocons_port, io_intf);
+    struct viocons_vq * const vq = port->rxq;
+    char * p = buf;
+    struct virtq_used_elem elem;
+    unsigned long n;
+    int reposted = 0;
+    int s;
+
+    trace("%s(buf=%p,bufsz=%ld)", __func__, buf, bufsz);
+    assert (io != NULL);
+
+    if (LONG_MAX < bufsz)
+        bufsz = LONG_MAX;
+
+    if (bufsz == 0)
+        return 0;
+
+    s = intr_disable();
+
+    if (vq->last_used == vq->used.idx && (port->flags & O_NONBLOCK)) {
+        intr_restore(s);
+        return -EAGAIN;
+    }
+
+    while (vq->last_used == vq->used.idx && port->present)
+        condition_wait(&port->rx_cond);
+
+    intr_restore(s);
+
+    //           A removed port reads as end of file once its input is consumed
+
+    while (vq->last_used != vq->used.idx && p - (char*)buf < bufsz) {
+        //           fence i,r: read the entry after the index that covers it
+        __sync_synchronize();
+        elem = vq->used.ring[vq->last_used % VIOCONS_Q_SIZE];
+        n = min(elem.len - port->rx_off, bufsz - (p - (char*)buf));
+        memcpy(p, vq->bufs[elem.id] + port->rx_off, n);
+        p += n;
+        port->rx_off += n;
+
+        if (port->rx_off == elem.len) {
+            port->rx_off = 0;
+            vq->last_used += 1;
+            viocons_vq_post(vq, elem.id, VIOCONS_BUFSZ);
+            reposted = 1;
+        }
+    }
+
+    if (reposted)
+        viocons_vq_kick(port->dev, vq);
+
+    port->reqcnt += 1;
+    port->bytecnt += p - (char*)buf;
+    return p - (char*)buf;
+}
+
+/**
+ * @brief writes to a port, copying into as many free transmit buffers as the data needs
+ * and notifying the device once for all of them. Waits for a buffer only when none is
+ * free; transmit interrupts are suppressed except while a writer waits.
+ * @param io the io_intf of the port
+ * @param buf the data to write
+ * @param n the number of bytes to write
+ * @return number of bytes written, or -EAGAIN with O_NONBLOCK and no buffer free
+ */
+long viocons_write(struct io_intf * io, const void * buf, unsigned long n) {
+    struct viocons_port * const port =
+        (void*)io - offsetof(struct viocons_port, io_intf);
+    struct viocons_vq * const vq = port->txq;
+    const char * p = buf;
+    unsigned long cnt;
+    uint16_t id;
+    int s;
+
+    trace("%s(n=%ld)", __func__, n);
+    assert (io != NULL);
+
+    if (LONG_MAX < n)
+        n = LONG_MAX;
+
+    while (p - (char*)buf < n) {
+        s = intr_disable();
+        viocons_vq_reclaim(vq);
+
+        if (vq->nfree == 0 && (port->flags & O_NONBLOCK)) {
+            intr_restore(s);
+            if (p == buf)
+                return -EAGAIN;
+            break;
+        }
+
+        if (vq->nfree == 0) {
+            vq->avail.flags = 0;
+            //           fence w,r: ask for the interrupt before checking again
+            __sync_synchronize();
+            viocons_vq_reclaim(vq);
+            while (vq->nfree == 0) {
+                condition_wait(&port->tx_cond);
+                viocons_vq_reclaim(vq);
+            }
+            vq->avail.flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+        }
+
+        while (vq->nfree != 0 && p - (char*)buf < n) {
+            id = vq->free[--vq->nfree];
+            cnt = min(n - (p - (char*)buf), VIOCONS_BUFSZ);
+            memcpy(vq->bufs[id], p, cnt);
+            viocons_vq_post(vq, id, cnt);
+            p += cnt;
+        }
+
+        intr_restore(s);
+        viocons_vq_kick(port->dev, vq);
+    }
+
+    port->reqcnt += 1;
+    port->bytecnt += p - (char*)buf;
+    return p - (char*)buf;
+}
+
+// A port supports IOCTL_GETSTATS, which reports its read and write calls and the
+// bytes they transferred along with the device's notifications and interrupts,
+// IOCTL_FLUSH, which waits until the device has taken all written data, and
+// IOCTL_GETFLAGS and IOCTL_SETFLAGS for O_NONBLOCK.
+
+int viocons_ioctl(struct io_intf * io, int cmd, void * arg) {
+    struct viocons_port * const port =
+        (void*)io - offsetof(struct viocons_port, io_intf);
+    struct viocons_vq * const vq = port->txq;
+    struct io_stats * stats;
+    int s;
+
+    trace("%s(cmd=%d,arg=%p)", __func__, cmd, arg);
+    assert (io != NULL);
+
+    switch (cmd) {
+    case IOCTL_GETSTATS:
+        stats = arg;
+        memset(stats, 0, sizeof(struct io_stats));
+        stats->reqcnt = port->reqcnt;
+        stats->bytecnt = port->bytecnt;
+        stats->notifycnt = port->dev->notifycnt;
+        stats->intrcnt = port->dev->intrcnt;
+        return 0;
+    case IOCTL_FLUSH:
+        s = intr_disable();
+        vq->avail.flags = 0;
+        __sync_synchronize();
+        viocons_vq_reclaim(vq);
+        while (vq->nfree != VIOCONS_Q_SIZE) {
+            condition_wait(&port->tx_cond);
+            viocons_vq_reclaim(vq);
+        }
+        vq->avail.flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+        intr_restore(s);
+        return 0;
+    case IOCTL_GETFLAGS:
+        *(int *)arg = port->flags;
+        return 0;
+    case IOCTL_SETFLAGS:
+        port->flags = *(int *)arg & O_NONBLOCK;
+        return 0;
+    default:
+        return -ENOTSUP;
+    }
+}
+
+int viocons_poll(struct io_intf * io, int events) {
+    struct viocons_port * const port =
+        (void*)io - offsetof(struct viocons_port, io_intf);
+    int revents = 0;
+
+    if (port->rxq->last_used != port->rxq->used.idx)
+        revents |= events & POLLIN;
+    if (port->txq->nfree != 0 || port->txq->last_used != port->txq->used.idx)
+        revents |= events & POLLOUT;
+    if (!port->present)
+        revents |= POLLHUP;
+
+    //           A poller waiting for room needs the transmit interrupt
+
+    if ((events & POLLOUT) && !(revents & POLLOUT)) {
+        port->txq->avail.flags = 0;
+        __sync_synchronize();
+    }
+
+    return revents;
+}
+
+/**
+ * @brief the interrupt service routine of a virtio console device. Takes any control
+ * messages and wakes the readers and writers of every port, which check their own queues.
+ * @param irqno the interrupt request number of the device
+ * @param aux the pointer to the device struct
+ * @return no return
+ */
+void viocons_isr(int irqno, void * aux) {
+    struct viocons_device * const dev = aux;
+    uint32_t status;
+    uint_fast16_t i;
+
+    status = dev->regs->interrupt_status;
+    dev->regs->interrupt_ack = status;
+    //           fence o,i
+    __sync_synchronize();
+
+    dev->intrcnt += 1;
+
+    if (dev->multiport)
+        viocons_control(dev);
+
+    for (i = 0; i < dev->nports; i++) {
+        condition_broadcast(&dev->ports[i]->rx_cond);
+        condition_broadcast(&dev->ports[i]->tx_cond);
+    }
+
+    io_notify_ready();
+}
+
+//           INTERNAL FUNCTION DEFINITIONS
+//
+
+/**
+ * @brief allocates a virtqueue with a buffer for each descriptor and attaches it to the
+ * device. The buffers of a receive queue are device-writable and made available at once;
+ * those of a transmit queue go on its free list.
+ * @param dev the device the queue belongs to
+ * @param qid the virtqueue index
+ * @param bufsz the size of each buffer, VIOCONS_BUFSZ or VIOCONS_CTRL_BUFSZ
+ * @param rx 1 for a receive queue, 0 for a transmit queue
+ * @return the new queue
+ */
+struct viocons_vq * viocons_vq_init (
+    struct viocons_device * dev, uint16_t qid, uint32_t bufsz, int rx)
+{
+    struct viocons_vq * vq;
+    uint_fast16_t i;
+
+    vq = kcalloc(1, sizeof(struct viocons_vq));
+    vq->qid = qid;
+
+    for (i = 0; i < VIOCONS_Q_SIZE; i++) {
+        //           Data buffers are whole pages, control buffers come from the heap
+        vq->bufs[i] = (bufsz == PAGE_SIZE) ? memory_alloc_page() : kmalloc(bufsz);
+        vq->desc[i].addr = (uint64_t)(void *)vq->bufs[i];
+        vq->desc[i].len = bufsz;
+        vq->desc[i].flags = rx ? VIRTQ_DESC_F_WRITE : 0;
+        vq->desc[i].next = 0;
+    }
+
+    virtio_attach_virtq(dev->regs, qid, VIOCONS_Q_SIZE,
+        (uint64_t)(void *)vq->desc, (uint64_t)(void *)&vq->used,
+        (uint64_t)(void *)&vq->avail);
+    virtio_enable_virtq(dev->regs, qid);
+
+    if (rx) {
+        for (i = 0; i < VIOCONS_Q_SIZE; i++)
+            viocons_vq_post(vq, i, bufsz);
+    } else {
+        for (i = 0; i < VIOCONS_Q_SIZE; i++)
+            vq->free[vq->nfree++] = i;
+        vq->avail.flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+
+    return vq;
+}
+
+/**
+ * @brief makes the buffer of descriptor id available to the device. The device does not
+ * see it until the queue is kicked.
+ * @param vq the queue
+ * @param id the descriptor
+ * @param len the bytes to send, or the room to receive into
+ * @return no return
+ */
+void viocons_vq_post(struct viocons_vq * vq, uint16_t id, uint32_t len) {
+    vq->desc[id].len = len;
+    vq->avail.ring[vq->avail.idx % VIOCONS_Q_SIZE] = id;
+    //           fence w,w: the entry before the index that covers it
+    __sync_synchronize();
+    vq->avail.idx += 1;
+}
+
+/**
+ * @brief notifies the device of newly available buffers, unless it has asked not to be
+ * @param dev the device
+ * @param vq the queue
+ * @return no return
+ */
+void viocons_vq_kick(struct viocons_device * dev, struct viocons_vq * vq) {
+    //           fence w,r
+    __sync_synchronize();
+    if (vq->used.flags & VIRTQ_USED_F_NO_NOTIFY)
+        return;
+    virtio_notify_avail(dev->regs, vq->qid);
+    dev->notifycnt += 1;
+}
+
+//           Puts the descriptors the device has used back on the free list of a
+//           transmit queue.
+
+void viocons_vq_reclaim(struct viocons_vq * vq) {
+    while (vq->last_used != vq->used.idx) {
+        __sync_synchronize();
+        vq->free[vq->nfree++] = vq->used.ring[vq->last_used % VIOCONS_Q_SIZE].id;
+        vq->last_used += 1;
+    }
+}
+
+/**
+ * @brief takes the control messages the device has sent, answering DEVICE_ADD with
+ * PORT_READY and noting port names and host connections, and makes their buffers
+ * available again
+ * @param dev the device
+ * @return no return
+ */
+void viocons_control(struct viocons_device * dev) {
+    struct viocons_vq * const vq = dev->ctrl_rxq;
+    struct viocons_control * msg;
+    struct viocons_port * port;
+    struct virtq_used_elem elem;
+    uint32_t namelen;
+    int reposted = 0;
+    int s;
+
+    s = intr_disable();
+
+    while (vq->last_used != vq->used.idx) {
+        __sync_synchronize();
+        elem = vq->used.ring[vq->last_used % VIOCONS_Q_SIZE];
+        vq->last_used += 1;
+        msg = (void *)vq->bufs[elem.id];
+
+        port = NULL;
+        if (elem.len >= sizeof(struct viocons_control) && msg->id < dev->nports)
+            port = dev->ports[msg->id];
+
+        switch (msg->event) {
+        case VIRTIO_CONSOLE_DEVICE_ADD:
+            //           Ports beyond those we set up are refused
+            if (port != NULL)
+                port->present = 1;
+            viocons_send_control(dev, msg->id,
+                VIRTIO_CONSOLE_PORT_READY, port != NULL);
+            break;
+        case VIRTIO_CONSOLE_DEVICE_REMOVE:
+            if (port != NULL) {
+                port->present = 0;
+                port->host_open = 0;
+            }
+            break;
+        case VIRTIO_CONSOLE_PORT_OPEN:
+            if (port != NULL)
+                port->host_open = msg->value;
+            break;
+        case VIRTIO_CONSOLE_PORT_NAME:
+            if (port != NULL) {
+                namelen = min(elem.len - sizeof(struct viocons_control),
+                    VIOCONS_NAME_MAX);
+                memcpy(port->name, msg + 1, namelen);
+                port->name[namelen] = '\0';
+                debug("vcon%u is %s", (unsigned)msg->id, port->name);
+            }
+            break;
+        default:
+            //           CONSOLE_PORT and RESIZE do not matter to us
+            break;
+        }
+
+        viocons_vq_post(vq, elem.id, VIOCONS_CTRL_BUFSZ);
+        reposted = 1;
+    }
+
+    if (reposted)
+        viocons_vq_kick(dev, vq);
+
+    intr_restore(s);
+}
+
+/**
+ * @brief sends a control message. The device takes control messages as soon as it is
+ * notified, so when no buffer is free this spins until one is.
+ * @param dev the device
+ * @param id the port the message is about
+ * @param event the VIRTIO_CONSOLE_ event
+ * @param value the event's value
+ * @return no return
+ */
+void viocons_send_control (
+    struct viocons_device * dev, uint32_t id, uint16_t event, uint16_t value)
+{
+    struct viocons_vq * const vq = dev->ctrl_txq;
+    struct viocons_control * msg;
+    uint16_t desc;
+    int s;
+
+    s = intr_disable();
+
+    viocons_vq_reclaim(vq);
+    while (vq->nfree == 0)
+        viocons_vq_reclaim(vq);
+
+    desc = vq->free[--vq->nfree];
+    msg = (void *)vq->bufs[desc];
+    msg->id = id;
+    msg->event = event;
+    msg->value = value;
+    viocons_vq_post(vq, desc, sizeof(struct viocons_control));
+    viocons_vq_kick(dev, vq);
+
+    intr_restore(s);
+}
@@ -107,6 +107,13 @@ struct virtio_mmio_regs {
             uint32_t max_secure_erase_seg;
             uint32_t secure_erase_sector_alignment;
         } blk;
+        //           Console device config
+        struct {
+            uint16_t cols;
+            uint16_t rows;
+            uint32_t max_nr_ports;
+            uint32_t emerg_wr;
+        } console;
         uint8_t raw[0];
     } config;
 };
@@ -149,6 +156,17 @@ struct virtq_used {
 #define VIRTQ_USED_SIZE(n) \
     (sizeof(struct virtq_used)+(n)*sizeof(struct virtq_used_elem))
 
+//           With VIRTIO_F_EVENT_IDX, the avail ring is followed by a used_event field
+//           and the used ring by an avail_event field (Section 2.7.10). The rings
+//           must be allocated with room for the extra uint16_t when the feature is
+//           negotiated.
+
+#define VIRTQ_AVAIL_EVENT_SIZE(n) \
+    (VIRTQ_AVAIL_SIZE(n)+sizeof(uint16_t))
+
+#define VIRTQ_USED_EVENT_SIZE(n) \
+    (VIRTQ_USED_SIZE(n)+sizeof(uint16_t))
+
 
 //           EXPORTED FUNCTION DEFINITIONS
 //          
@@ -180,6 +198,26 @@ static inline void virtio_enable_virtq (
 static inline void virtio_reset_virtq (
     volatile struct virtio_mmio_regs * regs, int qid);
 
+//           Returns a pointer to the used_event field of an avail ring of /len/
+//           elements. The driver writes the used ring index at which it next wants an
+//           interrupt.
+
+static inline volatile uint16_t * virtq_used_event (
+    struct virtq_avail * avail, uint_fast16_t len);
+
+//           Returns a pointer to the avail_event field of a used ring of /len/
+//           elements. The device writes the avail ring index at which it next wants a
+//           notification.
+
+static inline volatile uint16_t * virtq_avail_event (
+    volatile struct virtq_used * used, uint_fast16_t len);
+
+//           Returns 1 if moving a ring index from /old_idx/ to /new_idx/ passes
+//           /event_idx/, i.e. the other side asked to be notified, and 0 otherwise.
+
+static inline int virtq_need_event (
+    uint16_t event_idx, uint16_t new_idx, uint16_t old_idx);
+
 //           Zero-initializes a VirtIO feature set bitmap.
 
 static inline void virtio_featset_init(virtio_featset_t fts);
@@ -281,6 +319,24 @@ static inline void virtio_reset_virtq (
     regs->queue_reset = 1;
 }
 
+static inline volatile uint16_t * virtq_used_event (
+    struct virtq_avail * avail, uint_fast16_t len)
+{
+    return (volatile uint16_t *)&avail->ring[len];
+}
+
+static inline volatile uint16_t * virtq_avail_event (
+    volatile struct virtq_used * used, uint_fast16_t len)
+{
+    return (volatile uint16_t *)&used->ring[len];
+}
+
+static inline int virtq_need_event (
+    uint16_t event_idx, uint16_t new_idx, uint16_t old_idx)
+{
+    return ((uint16_t)(new_idx - event_idx - 1) < (uint16_t)(new_idx - old_idx));
+}
+
 static inline void virtio_featset_init(virtio_featset_t fts) {
     uint_fast8_t i;
 
@@ -0,0 +1,44 @@
+// bench.h - Timing helpers for benchmark programs
+//
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+#define BENCH_TIMER_FREQ 10000000UL // must match TIMER_FREQ in kern/timer.h
+
+// Returns the current time in timer ticks. The kernel enables the time CSR for
+// user mode (scounteren), so this does not trap.
+
+static inline uint64_t bench_time(void)
+{
+  uint64_t t;
+  asm volatile("rdtime %0" : "=r"(t));
+  return t;
+}
+
+static inline uint64_t bench_ticks_to_usec(uint64_t ticks)
+{
+  return ticks / (BENCH_TIMER_FREQ / 1000000);
+}
+
+// Sorts /n/ samples in place and returns the /pct/-th percentile.
+
+static inline uint64_t bench_percentile(uint64_t *samples, int n, int pct)
+{
+  int i, j;
+  uint64_t t;
+
+  for (i = 1; i < n; i++)
+  {
+    t = samples[i];
+    for (j = i; j > 0 && samples[j - 1] > t; j--)
+      samples[j] = samples[j - 1];
+    samples[j] = t;
+  }
+
+  return samples[(n - 1) * pct / 100];
+}
+
+#endif // _BENCH_H_
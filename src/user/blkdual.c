@@ -0,0 +1,92 @@
+// blkdual.c - Two-disk block read benchmark
+//
+// Reads the same file from the root mount and from the "scratch" mount, first
+// one after the other and then with one reader per disk at the same time.
+// Needs a second kfs image; run the kernel with make SCRATCH=scratch.raw,
+// where scratch.raw is a copy of kfs.raw.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_SCRATCH_FILE "scratch/zork"
+#define BENCH_CHUNK 4096
+
+static char buf[BENCH_CHUNK];
+
+static void read_file(const char *name)
+{
+  long n;
+  int result;
+
+  result = _fsopen(0, name);
+  assert(result >= 0);
+
+  do
+  {
+    n = _read(0, buf, BENCH_CHUNK);
+    assert(n >= 0);
+  } while (n == BENCH_CHUNK);
+
+  _close(0);
+}
+
+static void reader(const char *name)
+{
+  // the forked reader gets its own file so that it has its own position
+  _close(0);
+  read_file(name);
+  _exit();
+}
+
+static void report(const char *label, uint64_t len, uint64_t t0)
+{
+  uint64_t usec;
+  char msg[128];
+
+  usec = bench_ticks_to_usec(bench_time() - t0);
+  if (usec == 0)
+    usec = 1;
+
+  snprintf(msg, sizeof(msg), "%s: %lu us, %lu KB/s", label,
+           (unsigned long)usec,
+           (unsigned long)(2 * len * 1000000 / 1024 / usec));
+  _msgout(msg);
+}
+
+void main()
+{
+  uint64_t len, t0;
+  int tids[2];
+  int result;
+
+  result = _fsopen(0, BENCH_SCRATCH_FILE);
+  if (result < 0)
+  {
+    _msgout("blkdual: no scratch mount, run with SCRATCH=scratch.raw");
+    _exit();
+  }
+  result = _ioctl(0, IOCTL_GETLEN, &len);
+  assert(result >= 0);
+  _close(0);
+
+  t0 = bench_time();
+  read_file(BENCH_FILE);
+  read_file(BENCH_SCRATCH_FILE);
+  report("sequential", len, t0);
+
+  t0 = bench_time();
+  tids[0] = _fork();
+  assert(tids[0] >= 0);
+  if (tids[0] == 0)
+    reader(BENCH_FILE);
+  tids[1] = _fork();
+  assert(tids[1] >= 0);
+  if (tids[1] == 0)
+    reader(BENCH_SCRATCH_FILE);
+  _wait(tids[0]);
+  _wait(tids[1]);
+  report("parallel", len, t0);
+}
@@ -0,0 +1,76 @@
+// blkintr.c - Block device interrupt coalescing benchmark
+//
+// Reads a file sequentially twice, once with one interrupt per completion and
+// once with interrupt coalescing enabled, and reports the number of block
+// device interrupts and notifications per MB transferred in each case.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_CHUNK 4096
+#define BENCH_MB (1024 * 1024)
+
+static char buf[BENCH_CHUNK];
+
+static void run(const char * label, const struct io_coalesce * coal)
+{
+  struct io_stats before, after;
+  uint64_t pos = 0;
+  uint64_t bytes, intrs, notifs;
+  char msg[128];
+  int result;
+  long n;
+
+  result = _ioctl(0, IOCTL_SETCOALESCE, (void *)coal);
+  if (result < 0)
+  {
+    snprintf(msg, sizeof(msg), "%s: IOCTL_SETCOALESCE failed (%d)", label, result);
+    _msgout(msg);
+    return;
+  }
+
+  result = _ioctl(0, IOCTL_SETPOS, &pos);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  do
+  {
+    n = _read(0, buf, BENCH_CHUNK);
+    assert(n >= 0);
+  } while (n == BENCH_CHUNK);
+
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+
+  bytes = after.bytecnt - before.bytecnt;
+  intrs = after.intrcnt - before.intrcnt;
+  notifs = after.notifycnt - before.notifycnt;
+  if (bytes == 0)
+    bytes = 1;
+
+  snprintf(msg, sizeof(msg),
+           "%s: %lu requests, %lu intr/MB, %lu notify/MB",
+           label, (unsigned long)(after.reqcnt - before.reqcnt),
+           (unsigned long)(intrs * BENCH_MB / bytes),
+           (unsigned long)(notifs * BENCH_MB / bytes));
+  _msgout(msg);
+}
+
+void main()
+{
+  struct io_coalesce off = {.max_frames = 1, .usec = 100};
+  struct io_coalesce on = {.max_frames = 16, .usec = 100};
+  int result;
+
+  result = _fsopen(0, BENCH_FILE);
+  assert(result >= 0);
+
+  run("coalescing off", &off);
+  run("coalescing on (16 frames, 100us)", &on);
+  run("coalescing off", &off);
+
+  _close(0);
+}
@@ -0,0 +1,76 @@
+// blklat.c - Block read latency benchmark
+//
+// Measures the latency of 4 KiB file reads with interrupt-driven, polled and
+// hybrid completion on the block device, and reports p50/p99 for each mode.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_CHUNK 4096
+#define BENCH_SAMPLES 256
+
+static char buf[BENCH_CHUNK];
+static uint64_t samples[BENCH_SAMPLES];
+
+static void run(const char * label, uint32_t mode)
+{
+  struct io_poll poll = {.mode = mode, .spin_usec = 200};
+  struct io_stats before, after;
+  uint64_t len, pos;
+  uint64_t t0;
+  char msg[128];
+  int result;
+  int i;
+
+  result = _ioctl(0, IOCTL_SETPOLL, &poll);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETLEN, &len);
+  assert(result >= 0 && len >= BENCH_CHUNK);
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  for (i = 0; i < BENCH_SAMPLES; i++)
+  {
+    // stride through the file so every read goes to the device
+    pos = (uint64_t)i * BENCH_CHUNK % (len - BENCH_CHUNK + 1);
+    result = _ioctl(0, IOCTL_SETPOS, &pos);
+    assert(result >= 0);
+    t0 = bench_time();
+    result = _read(0, buf, BENCH_CHUNK);
+    samples[i] = bench_time() - t0;
+    assert(result == BENCH_CHUNK);
+  }
+
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETPOLL, &poll);
+  assert(result >= 0);
+
+  snprintf(msg, sizeof(msg),
+           "%s: p50 %lu us, p99 %lu us, %lu intr, %lu poll misses, avg dev %u us",
+           label,
+           (unsigned long)bench_ticks_to_usec(bench_percentile(samples, BENCH_SAMPLES, 50)),
+           (unsigned long)bench_ticks_to_usec(bench_percentile(samples, BENCH_SAMPLES, 99)),
+           (unsigned long)(after.intrcnt - before.intrcnt),
+           (unsigned long)(after.pollmisscnt - before.pollmisscnt),
+           poll.avg_usec);
+  _msgout(msg);
+}
+
+void main()
+{
+  int result;
+
+  result = _fsopen(0, BENCH_FILE);
+  assert(result >= 0);
+
+  run("interrupt", IO_POLL_OFF);
+  run("polled", IO_POLL_ON);
+  run("hybrid", IO_POLL_HYBRID);
+  run("interrupt", IO_POLL_OFF);
+
+  _close(0);
+}
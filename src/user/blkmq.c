@@ -0,0 +1,89 @@
+// blkmq.c - Concurrent block read benchmark
+//
+// Forks a number of readers that each read a file sequentially in 4 KiB
+// chunks, and reports the aggregate throughput and the number of device
+// requests. Run with the kernel Makefile's VIOBLK_QUEUES set to 1 and to 4 to
+// compare a single request queue with several.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_CHUNK 4096
+#define BENCH_READERS_MAX 4
+
+static char buf[BENCH_CHUNK];
+
+static void reader(void)
+{
+  long n;
+  int result;
+
+  // each reader opens the file itself so that it has its own position
+  _close(0);
+  result = _fsopen(0, BENCH_FILE);
+  assert(result >= 0);
+
+  do
+  {
+    n = _read(0, buf, BENCH_CHUNK);
+    assert(n >= 0);
+  } while (n == BENCH_CHUNK);
+
+  _exit();
+}
+
+static void run(int nreaders)
+{
+  struct io_stats before, after;
+  uint64_t len, t0, usec;
+  char msg[128];
+  int tids[BENCH_READERS_MAX];
+  int result;
+  int i;
+
+  result = _ioctl(0, IOCTL_GETLEN, &len);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  t0 = bench_time();
+  for (i = 0; i < nreaders; i++)
+  {
+    tids[i] = _fork();
+    assert(tids[i] >= 0);
+    if (tids[i] == 0)
+      reader();
+  }
+  for (i = 0; i < nreaders; i++)
+    _wait(tids[i]);
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+  if (usec == 0)
+    usec = 1;
+
+  snprintf(msg, sizeof(msg),
+           "%d readers: %lu us, %lu KB/s, %lu requests",
+           nreaders, (unsigned long)usec,
+           (unsigned long)(len * nreaders * 1000000 / 1024 / usec),
+           (unsigned long)(after.reqcnt - before.reqcnt));
+  _msgout(msg);
+}
+
+void main()
+{
+  int result;
+
+  result = _fsopen(0, BENCH_FILE);
+  assert(result >= 0);
+
+  run(1);
+  run(2);
+  run(4);
+
+  _close(0);
+}
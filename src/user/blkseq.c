@@ -0,0 +1,67 @@
+// blkseq.c - Sequential read throughput benchmark
+//
+// Reads whole files sequentially with several chunk sizes and reports the
+// throughput and the number of block device requests. Block-aligned chunks
+// are transferred straight into the buffer, with blocks that are contiguous
+// on disk moved in a single request.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_CHUNK_MAX 32768
+
+static const char * const files[] = { "zork", "rogue" };
+static const int chunks[] = { 512, 4096, 32768 };
+
+static char buf[BENCH_CHUNK_MAX];
+
+static void run(const char *name, int chunk)
+{
+  struct io_stats before, after;
+  uint64_t len, t0, usec;
+  char msg[128];
+  long n;
+  int result;
+
+  result = _fsopen(0, name);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETLEN, &len);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  t0 = bench_time();
+  do
+  {
+    n = _read(0, buf, chunk);
+    assert(n >= 0);
+  } while (n == chunk);
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+  _close(0);
+  if (usec == 0)
+    usec = 1;
+
+  snprintf(msg, sizeof(msg),
+           "%s, %d byte reads: %lu us, %lu KB/s, %lu requests",
+           name, chunk, (unsigned long)usec,
+           (unsigned long)(len * 1000000 / 1024 / usec),
+           (unsigned long)(after.reqcnt - before.reqcnt));
+  _msgout(msg);
+}
+
+void main()
+{
+  int i, j;
+
+  // touch the buffer so that every page of it is mapped before the first run
+  memset(buf, 0, sizeof(buf));
+
+  for (i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    for (j = 0; j < sizeof(chunks) / sizeof(chunks[0]); j++)
+      run(files[i], chunks[j]);
+}
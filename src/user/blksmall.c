@@ -0,0 +1,52 @@
+// blksmall.c - Small read benchmark
+//
+// Reads the start of a file one byte at a time and reports the time and the
+// number of block device requests per read. With the inode cached in memory
+// and only the requested bytes read from the device, consecutive small reads
+// are mostly served from the sector the device driver already has buffered.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_READS 8192
+
+void main()
+{
+  struct io_stats before, after;
+  uint64_t t0, usec, reqs;
+  char msg[128];
+  char c;
+  int result;
+  int i;
+
+  result = _fsopen(0, BENCH_FILE);
+  assert(result >= 0);
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_READS; i++)
+  {
+    result = _read(0, &c, 1);
+    assert(result == 1);
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+  reqs = after.reqcnt - before.reqcnt;
+
+  snprintf(msg, sizeof(msg),
+           "%d 1-byte reads: %lu us, %lu ns/read, %lu requests (%lu.%02lu per read)",
+           BENCH_READS, (unsigned long)usec,
+           (unsigned long)(usec * 1000 / BENCH_READS),
+           (unsigned long)reqs,
+           (unsigned long)(reqs / BENCH_READS),
+           (unsigned long)(reqs * 100 / BENCH_READS % 100));
+  _msgout(msg);
+
+  _close(0);
+}
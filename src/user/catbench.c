@@ -0,0 +1,94 @@
+// catbench.c - cat throughput benchmark
+//
+// Copies a large program file into a new file the way cat would, first a
+// block at a time through a user buffer with _read and _write, then with a
+// single _sendfile that copies it inside the kernel. Reports the time,
+// throughput and number of system calls of each. The output is a file
+// rather than a serial port so that the port's speed does not hide the cost
+// of the copy.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_OUT "catbench.out"
+#define BENCH_BLOCK 4096
+#define IN_FD 0
+#define OUT_FD 1
+
+static char buf[BENCH_BLOCK];
+
+static void open_files(void)
+{
+  int result;
+
+  result = _fsopen(IN_FD, BENCH_FILE);
+  assert(result >= 0);
+  result = _fscreate(BENCH_OUT);
+  assert(result >= 0);
+  result = _fsopen(OUT_FD, BENCH_OUT);
+  assert(result >= 0);
+}
+
+static void close_files(void)
+{
+  int result;
+
+  _close(IN_FD);
+  _close(OUT_FD);
+  result = _fsunlink(BENCH_OUT);
+  assert(result >= 0);
+}
+
+static void report(const char * what, uint64_t total, uint64_t usec, unsigned long calls)
+{
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "%s: %lu bytes, %lu us, %lu KB/s, %lu system calls",
+           what, (unsigned long)total, (unsigned long)usec,
+           (unsigned long)(usec ? total * 1000000 / 1024 / usec : 0), calls);
+  _msgout(msg);
+}
+
+void main()
+{
+  uint64_t len, total, t0, usec;
+  unsigned long calls;
+  long n;
+  int result;
+
+  memset(buf, 0, sizeof(buf));
+
+  open_files();
+  result = _ioctl(IN_FD, IOCTL_GETLEN, &len);
+  assert(result >= 0);
+  total = 0;
+  calls = 0;
+  t0 = bench_time();
+  for (;;)
+  {
+    n = _read(IN_FD, buf, BENCH_BLOCK);
+    calls += 1;
+    assert(n >= 0);
+    if (n == 0)
+      break;
+    n = _write(OUT_FD, buf, n);
+    calls += 1;
+    assert(n >= 0);
+    total += n;
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+  assert(total == len);
+  report("read/write", total, usec, calls);
+  close_files();
+
+  open_files();
+  t0 = bench_time();
+  n = _sendfile(OUT_FD, IN_FD, NULL, len);
+  usec = bench_ticks_to_usec(bench_time() - t0);
+  assert(n == len);
+  report("sendfile", n, usec, 1);
+  close_files();
+}
@@ -0,0 +1,169 @@
+// echopoll.c - Event-driven echo server
+//
+// A single process echoes what is typed on ser1 and ser2 back to the same
+// port, waiting for both at once with _poll rather than one process per
+// port. A child process writes timestamps into a pipe, which the server
+// polls along with the ports; the time from the write to the server reading
+// it is the server's wakeup latency, reported once the child is done. The
+// ports and the pipe are non-blocking, so the server reads until -EAGAIN.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "error.h"
+#include "bench.h"
+
+#define SER1_FD 0
+#define SER2_FD 1
+#define SAMPLES 64
+#define SAMPLE_PERIOD_US 10000
+
+static void set_nonblock(int fd)
+{
+  int flags;
+  int result;
+
+  result = _ioctl(fd, IOCTL_GETFLAGS, &flags);
+  assert(result >= 0);
+  flags |= O_NONBLOCK;
+  result = _ioctl(fd, IOCTL_SETFLAGS, &flags);
+  assert(result >= 0);
+}
+
+// Writes all of buf, waiting for room in the port when it is full
+static void write_all(int fd, const char *buf, long n)
+{
+  struct io_pollfd pfd = {.fd = fd, .events = POLLOUT};
+  long cnt;
+
+  while (n > 0)
+  {
+    cnt = _write(fd, buf, n);
+    if (cnt == -EAGAIN)
+    {
+      _poll(&pfd, 1, 1);
+      continue;
+    }
+    assert(cnt > 0);
+    buf += cnt;
+    n -= cnt;
+  }
+}
+
+// Echoes everything the port has, ending each line with \r\n
+static void echo(int fd)
+{
+  char buf[64];
+  long n, i;
+
+  while ((n = _read(fd, buf, sizeof(buf))) > 0)
+  {
+    for (i = 0; i < n; i++)
+    {
+      if (buf[i] == '\r')
+        write_all(fd, "\r\n", 2);
+      else
+        write_all(fd, &buf[i], 1);
+    }
+  }
+  assert(n == -EAGAIN);
+}
+
+static void sampler(int fd)
+{
+  uint64_t t;
+  long n;
+  int i;
+
+  for (i = 0; i < SAMPLES; i++)
+  {
+    _usleep(SAMPLE_PERIOD_US);
+    t = bench_time();
+    n = _write(fd, &t, sizeof(t));
+    assert(n == sizeof(t));
+  }
+  _close(fd);
+  _exit();
+}
+
+void main()
+{
+  struct io_pollfd pfds[3];
+  uint64_t stamps[8];
+  uint64_t now, lat, lat_min = UINT64_MAX, lat_max = 0, lat_sum = 0;
+  int nsamples = 0;
+  int fds[2];
+  char msg[128];
+  long n;
+  int nfds;
+  int result;
+  int i;
+
+  result = _devopen(SER1_FD, "ser", 1);
+  assert(result >= 0);
+  result = _devopen(SER2_FD, "ser", 2);
+  assert(result >= 0);
+  result = _pipe(fds, 0);
+  assert(result == 0);
+
+  result = _fork();
+  assert(result >= 0);
+  if (result == 0)
+  {
+    _close(fds[0]);
+    sampler(fds[1]);
+  }
+  _close(fds[1]);
+
+  set_nonblock(SER1_FD);
+  set_nonblock(SER2_FD);
+  set_nonblock(fds[0]);
+
+  pfds[0].fd = SER1_FD;
+  pfds[1].fd = SER2_FD;
+  pfds[2].fd = fds[0];
+  for (i = 0; i < 3; i++)
+    pfds[i].events = POLLIN;
+  nfds = 3;
+
+  for (;;)
+  {
+    result = _poll(pfds, nfds, 1);
+    assert(result > 0);
+
+    if (pfds[0].revents & POLLIN)
+      echo(SER1_FD);
+    if (pfds[1].revents & POLLIN)
+      echo(SER2_FD);
+    if (nfds < 3 || !(pfds[2].revents & POLLIN))
+      continue;
+
+    now = bench_time();
+    while ((n = _read(fds[0], stamps, sizeof(stamps))) > 0)
+    {
+      for (i = 0; i < n / sizeof(stamps[0]); i++)
+      {
+        lat = now - stamps[i];
+        lat_min = lat < lat_min ? lat : lat_min;
+        lat_max = lat > lat_max ? lat : lat_max;
+        lat_sum += lat;
+        nsamples += 1;
+      }
+    }
+
+    if (n == 0)
+    {
+      // the sampler is done; report and keep echoing
+      _close(fds[0]);
+      nfds = 2;
+      _wait(0);
+      snprintf(msg, sizeof(msg), "poll wakeup latency over %d samples: min %lu us, avg %lu us, max %lu us",
+               nsamples, (unsigned long)bench_ticks_to_usec(lat_min),
+               (unsigned long)bench_ticks_to_usec(nsamples ? lat_sum / nsamples : 0),
+               (unsigned long)bench_ticks_to_usec(lat_max));
+      _msgout(msg);
+    }
+    else
+      assert(n == -EAGAIN);
+  }
+}
@@ -0,0 +1,59 @@
+// execbench.c - Program load latency benchmark
+//
+// Forks a child that loads and runs the program true with _exec, waits for it
+// and repeats, reporting the time per fork, exec and wait. Loading a program
+// logs each of its segments to the console, so the result shows what that
+// logging costs: with the kernel log drained by its own thread, _exec only
+// stores the messages in memory; a kernel built with -DCONSOLE_SYNC writes
+// them out to the UART before it returns. The end of the kernel log is read
+// back with _klog and shown last.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "true"
+#define BENCH_ITERS 64
+#define FD 0
+
+static char klog[512];
+
+void main()
+{
+  uint64_t t0, usec;
+  char msg[128];
+  long n;
+  int tid;
+  int result;
+  int i;
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_ITERS; i++)
+  {
+    tid = _fork();
+    assert(tid >= 0);
+    if (tid == 0)
+    {
+      result = _fsopen(FD, BENCH_FILE);
+      assert(result >= 0);
+      _exec(FD);
+      _exit();
+    }
+    result = _wait(tid);
+    assert(result >= 0);
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  snprintf(msg, sizeof(msg), "%s: %d fork/exec/wait, %lu us, %lu us each",
+           BENCH_FILE, BENCH_ITERS, (unsigned long)usec, (unsigned long)(usec / BENCH_ITERS));
+  _msgout(msg);
+
+  // the kernel writes the log into the buffer, so it must be mapped
+  memset(klog, 0, sizeof(klog));
+  n = _klog(klog, sizeof(klog) - 1);
+  assert(n >= 0);
+  klog[n] = '\0';
+  _msgout("kernel log ends with:");
+  _msgout(klog);
+}
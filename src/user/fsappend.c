@@ -0,0 +1,81 @@
+// fsappend.c - Append-heavy write benchmark
+//
+// Creates a file, appends small records to it, and reports the time and the
+// block device requests per append. Then truncates and deletes the file.
+// Needs a version 2 image, made with MKFS_FLAGS=-v2 util/mkfs.sh.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "error.h"
+#include "bench.h"
+
+#define BENCH_FILE "fsappend.log"
+#define BENCH_RECORD 64
+#define BENCH_RECORDS 2048
+
+static char record[BENCH_RECORD];
+
+void main()
+{
+  struct io_stats before, after;
+  uint64_t len, t0, usec;
+  char msg[128];
+  long n;
+  int result;
+  int i;
+
+  _fsunlink(BENCH_FILE);
+  result = _fscreate(BENCH_FILE);
+  if (result == -ENOTSUP)
+  {
+    _msgout("fsappend: image cannot grow files, use a version 2 image");
+    _exit();
+  }
+  assert(result == 0);
+  result = _fsopen(0, BENCH_FILE);
+  assert(result >= 0);
+
+  memset(record, '.', BENCH_RECORD - 1);
+  record[BENCH_RECORD - 1] = '\n';
+
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+  t0 = bench_time();
+  for (i = 0; i < BENCH_RECORDS; i++)
+  {
+    n = _write(0, record, BENCH_RECORD);
+    assert(n == BENCH_RECORD);
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+
+  result = _ioctl(0, IOCTL_GETLEN, &len);
+  assert(result >= 0 && len == BENCH_RECORD * BENCH_RECORDS);
+
+  snprintf(msg, sizeof(msg),
+           "%d %d-byte appends: %lu us, %lu us/append, %lu requests",
+           BENCH_RECORDS, BENCH_RECORD, (unsigned long)usec,
+           (unsigned long)(usec / BENCH_RECORDS),
+           (unsigned long)(after.reqcnt - before.reqcnt));
+  _msgout(msg);
+
+  // the last record must read back after truncating the file to half
+  result = _truncate(0, len / 2);
+  assert(result == 0);
+  result = _ioctl(0, IOCTL_GETLEN, &len);
+  assert(result >= 0 && len == BENCH_RECORD * BENCH_RECORDS / 2);
+  len -= BENCH_RECORD;
+  result = _ioctl(0, IOCTL_SETPOS, &len);
+  assert(result >= 0);
+  memset(record, 0, BENCH_RECORD);
+  n = _read(0, record, BENCH_RECORD);
+  assert(n == BENCH_RECORD && record[0] == '.' && record[BENCH_RECORD - 1] == '\n');
+
+  _close(0);
+  result = _fsunlink(BENCH_FILE);
+  assert(result == 0);
+  result = _fsopen(0, BENCH_FILE);
+  assert(result < 0);
+}
@@ -0,0 +1,118 @@
+// fsjournal.c - Small-file create benchmark for the kfs journal
+//
+// Creates and deletes a batch of empty files twice: once syncing after every
+// operation, which commits one journal transaction per operation, and once
+// syncing only at the end, which lets the journal commit the whole batch
+// together. Reports the time per file and the cache flushes for both.
+// Needs a version 2 image with a journal, made with MKFS_FLAGS=-v2 util/mkfs.sh.
+//
+// util/crashtest.sh boots this program and kills QEMU while it runs.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "error.h"
+#include "bench.h"
+
+#define BENCH_FILES 32
+#define BENCH_ROUNDS 4
+
+static void bench_name(char *buf, size_t size, int i)
+{
+  snprintf(buf, size, "fsj%d", i);
+}
+
+// Creates up to BENCH_FILES files and deletes them again. With /sync/ set,
+// every create and unlink is followed by a sync. Returns the number of files.
+
+static int bench_round(int sync, int round)
+{
+  struct io_stats before, after;
+  uint64_t t0, usec;
+  char name[16];
+  char msg[128];
+  int result;
+  int n, i;
+
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+  t0 = bench_time();
+  for (n = 0; n < BENCH_FILES; n++)
+  {
+    bench_name(name, sizeof(name), n);
+    result = _fscreate(name);
+    if (result == -ENOSPC)
+      break;
+    assert(result == 0);
+    if (sync)
+    {
+      result = _fsync(0);
+      assert(result == 0);
+    }
+  }
+  for (i = 0; i < n; i++)
+  {
+    bench_name(name, sizeof(name), i);
+    result = _fsunlink(name);
+    assert(result == 0);
+    if (sync)
+    {
+      result = _fsync(0);
+      assert(result == 0);
+    }
+  }
+  if (!sync)
+  {
+    result = _fsync(0);
+    assert(result == 0);
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+
+  if (n == 0)
+    return 0;
+  snprintf(msg, sizeof(msg),
+           "round %d, %s: %d files created and deleted in %lu us, %lu us/file, %lu flushes",
+           round, sync ? "sync per op" : "group commit", n, (unsigned long)usec,
+           (unsigned long)(usec / n), (unsigned long)(after.flushcnt - before.flushcnt));
+  _msgout(msg);
+  return n;
+}
+
+void main()
+{
+  char name[16];
+  int result;
+  int round, i;
+
+  // any open file of a mount syncs that mount's journal
+  result = _fsopen(0, "fsjournal");
+  assert(result >= 0);
+
+  // leftovers of a run that was killed
+  for (i = 0; i < BENCH_FILES; i++)
+  {
+    bench_name(name, sizeof(name), i);
+    _fsunlink(name);
+  }
+  result = _fscreate("fsj0");
+  if (result == -ENOTSUP)
+  {
+    _msgout("fsjournal: image cannot create files, use a version 2 image");
+    _exit();
+  }
+  assert(result == 0);
+  result = _fsunlink("fsj0");
+  assert(result == 0);
+
+  for (round = 0; round < BENCH_ROUNDS; round++)
+  {
+    if (bench_round(1, round) == 0)
+    {
+      _msgout("fsjournal: no free directory entries");
+      _exit();
+    }
+    bench_round(0, round);
+  }
+}
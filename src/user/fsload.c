@@ -0,0 +1,77 @@
+// fsload.c - Program load time benchmark
+//
+// Reads the programs in the root directory the way the loader does, whole
+// files in large chunks, and reports the time, block device requests and
+// bytes read from the device per program. Compare an image made with
+// util/mkfs.sh against one made with MKFS_FLAGS=-v2 util/mkfs.sh, whose inodes
+// use extents, and one made with MKFS_FLAGS="-v2 -z" util/mkfs.sh, whose files
+// are compressed. Building the kernel with make INITRD=kfs.raw reads the
+// same image from memory, which leaves only the file system's own cost.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_CHUNK 32768
+
+static const char * const programs[] = {
+  "shell", "fib", "rule30", "trek", "rogue", "zork"
+};
+
+static char buf[BENCH_CHUNK];
+
+void main()
+{
+  struct io_stats before, after;
+  uint64_t len, t0, usec, total_usec, total_reqs, total_bytes;
+  char msg[128];
+  long n;
+  int result;
+  int i;
+
+  memset(buf, 0, sizeof(buf));
+  // device statistics are read through a file of our own
+  result = _fsopen(1, "fsload");
+  assert(result >= 0);
+  total_usec = 0;
+  total_reqs = 0;
+  total_bytes = 0;
+
+  for (i = 0; i < sizeof(programs) / sizeof(programs[0]); i++)
+  {
+    result = _ioctl(1, IOCTL_GETSTATS, &before);
+    assert(result >= 0);
+    t0 = bench_time();
+    result = _fsopen(0, programs[i]);
+    if (result < 0)
+      continue;
+    do
+    {
+      n = _read(0, buf, BENCH_CHUNK);
+      assert(n >= 0);
+    } while (n == BENCH_CHUNK);
+    usec = bench_ticks_to_usec(bench_time() - t0);
+
+    result = _ioctl(0, IOCTL_GETLEN, &len);
+    assert(result >= 0);
+    result = _ioctl(1, IOCTL_GETSTATS, &after);
+    assert(result >= 0);
+    _close(0);
+
+    snprintf(msg, sizeof(msg), "%s: %lu bytes, %lu us, %lu requests, %lu bytes read",
+             programs[i], (unsigned long)len, (unsigned long)usec,
+             (unsigned long)(after.reqcnt - before.reqcnt),
+             (unsigned long)(after.bytecnt - before.bytecnt));
+    _msgout(msg);
+    total_usec += usec;
+    total_reqs += after.reqcnt - before.reqcnt;
+    total_bytes += after.bytecnt - before.bytecnt;
+  }
+
+  snprintf(msg, sizeof(msg), "total: %lu us, %lu requests, %lu bytes read",
+           (unsigned long)total_usec, (unsigned long)total_reqs,
+           (unsigned long)total_bytes);
+  _msgout(msg);
+  _close(1);
+}
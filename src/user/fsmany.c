@@ -0,0 +1,78 @@
+// fsmany.c - Many-open-files benchmark
+//
+// Forks a number of processes that each open as many files as a process can
+// hold, so that more files are open at once than the kernel used to allow,
+// and then time cheap operations on their last file. The cost per operation
+// should not depend on how many files are open.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "fsmany"
+#define BENCH_FDS 16 // PROCESS_IOMAX in kern/process.h
+#define BENCH_PROCS_MAX 4
+#define BENCH_OPS 4096
+#define BENCH_SETTLE_US 200000
+
+static void worker(int id)
+{
+  uint64_t pos, t0, usec;
+  char msg[128];
+  char c;
+  int result;
+  int fd, i;
+
+  for (fd = 0; fd < BENCH_FDS; fd++)
+  {
+    _close(fd);
+    result = _fsopen(fd, BENCH_FILE);
+    assert(result == fd);
+  }
+  // let the other workers open their files too
+  _usleep(BENCH_SETTLE_US);
+
+  fd = BENCH_FDS - 1;
+  t0 = bench_time();
+  for (i = 0; i < BENCH_OPS; i++)
+  {
+    pos = 0;
+    result = _ioctl(fd, IOCTL_SETPOS, &pos);
+    assert(result >= 0);
+    result = _read(fd, &c, 1);
+    assert(result == 1);
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  snprintf(msg, sizeof(msg), "worker %d: %d seek+read pairs, %lu us, %lu ns/pair",
+           id, BENCH_OPS, (unsigned long)usec, (unsigned long)(usec * 1000 / BENCH_OPS));
+  _msgout(msg);
+  _exit();
+}
+
+static void run(int nprocs)
+{
+  char msg[64];
+  int tids[BENCH_PROCS_MAX];
+  int i;
+
+  snprintf(msg, sizeof(msg), "%d processes, %d open files",
+           nprocs, nprocs * BENCH_FDS);
+  _msgout(msg);
+  for (i = 0; i < nprocs; i++)
+  {
+    tids[i] = _fork();
+    assert(tids[i] >= 0);
+    if (tids[i] == 0)
+      worker(i);
+  }
+  for (i = 0; i < nprocs; i++)
+    _wait(tids[i]);
+}
+
+void main()
+{
+  run(1);
+  run(BENCH_PROCS_MAX);
+}
@@ -0,0 +1,66 @@
+// fsopen.c - File open latency benchmark
+//
+// Opens and closes every file in the root directory a number of times and
+// reports the average latency of opening the first and the last directory
+// entry, plus the average over all of them. With the name index the latency
+// should not depend on the position of the entry in the directory. Run on an
+// image with a full directory, made with util/mkbigdir.sh.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_ROUNDS 64
+
+static dentry_t dir_entries[MAX_DIR_ENTRIES];
+static char name[MAX_FILE_NAME_LENGTH + 1];
+
+static uint64_t open_latency(const dentry_t *dentry)
+{
+  uint64_t t0, ticks;
+  int result;
+  int i;
+
+  strncpy(name, dentry->file_name, MAX_FILE_NAME_LENGTH);
+  name[MAX_FILE_NAME_LENGTH] = '\0';
+
+  ticks = 0;
+  for (i = 0; i < BENCH_ROUNDS; i++)
+  {
+    t0 = bench_time();
+    result = _fsopen(1, name);
+    ticks += bench_time() - t0;
+    assert(result >= 0);
+    _close(1);
+  }
+  return bench_ticks_to_usec(ticks * 1000 / BENCH_ROUNDS);
+}
+
+void main()
+{
+  uint64_t den_num, first, last, total;
+  char msg[128];
+  int result;
+  int i;
+
+  result = _fsopen(1, "fsopen");
+  assert(result >= 0);
+  result = _ioctl(1, IOCTL_GETDENTRY_NUM, &den_num);
+  assert(result >= 0 && den_num > 0 && den_num <= MAX_DIR_ENTRIES);
+  result = _ioctl(1, IOCTL_GETDENTRY, dir_entries);
+  assert(result >= 0);
+  _close(1);
+
+  total = 0;
+  for (i = 0; i < den_num; i++)
+    total += open_latency(&dir_entries[i]);
+  first = open_latency(&dir_entries[0]);
+  last = open_latency(&dir_entries[den_num - 1]);
+
+  snprintf(msg, sizeof(msg),
+           "%lu entries: first %lu ns, last %lu ns, average %lu ns per open",
+           (unsigned long)den_num, (unsigned long)first, (unsigned long)last,
+           (unsigned long)(total / den_num));
+  _msgout(msg);
+}
@@ -0,0 +1,176 @@
+// fspath.c - Path lookup benchmark
+//
+// Builds a deep tree (a chain of nested directories with a file at the
+// bottom) and a wide one (a directory with many files), then times opening
+// files by path in both, first with an empty dentry cache and then with the
+// components cached. Reads the wide directory back and removes both trees.
+// Needs a version 2 image, made with MKFS_FLAGS=-v2 util/mkfs.sh.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "error.h"
+#include "bench.h"
+
+#define BENCH_DEPTH 12
+#define BENCH_WIDTH 128
+#define BENCH_OPENS 256
+#define BENCH_PATHLEN 256
+
+static dentry_t dentries[16];
+
+// Writes the path of the directory at /depth/ in the deep tree, "" at depth 0.
+static void deep_path(char *buf, int depth)
+{
+  buf[0] = '\0';
+  for (int i = 0; i < depth; i++)
+  {
+    size_t len = strlen(buf);
+    snprintf(buf + len, BENCH_PATHLEN - len, "%sd%d", i ? "/" : "", i);
+  }
+}
+
+static void leaf_path(char *buf)
+{
+  deep_path(buf, BENCH_DEPTH);
+  snprintf(buf + strlen(buf), BENCH_PATHLEN - strlen(buf), "/leaf");
+}
+
+static void wide_path(char *buf, int i)
+{
+  snprintf(buf, BENCH_PATHLEN, "wide/f%d", i);
+}
+
+static uint64_t time_open(const char *path)
+{
+  uint64_t t0, t;
+  int result;
+
+  t0 = bench_time();
+  result = _fsopen(0, path);
+  t = bench_time() - t0;
+  assert(result == 0);
+  _close(0);
+  return t;
+}
+
+static void report(const char *what, uint64_t ticks, int n)
+{
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "%s: %lu ns/open", what,
+           (unsigned long)(bench_ticks_to_usec(ticks * 1000) / n));
+  _msgout(msg);
+}
+
+static void cleanup(void)
+{
+  char path[BENCH_PATHLEN];
+  int i;
+
+  for (i = 0; i < BENCH_WIDTH; i++)
+  {
+    wide_path(path, i);
+    _fsunlink(path);
+  }
+  _rmdir("wide");
+  leaf_path(path);
+  _fsunlink(path);
+  for (i = BENCH_DEPTH; i > 0; i--)
+  {
+    deep_path(path, i);
+    _rmdir(path);
+  }
+}
+
+void main()
+{
+  char path[BENCH_PATHLEN];
+  char deep[BENCH_PATHLEN];
+  uint64_t t, start;
+  long n;
+  int result;
+  int i;
+
+  cleanup();
+
+  // the deep tree
+  for (i = 1; i <= BENCH_DEPTH; i++)
+  {
+    deep_path(path, i);
+    result = _mkdir(path);
+    if (result == -ENOTSUP)
+    {
+      _msgout("fspath: image cannot create directories, use a version 2 image");
+      _exit();
+    }
+    assert(result == 0);
+  }
+  leaf_path(deep);
+  result = _fscreate(deep);
+  assert(result == 0);
+
+  // the wide tree
+  result = _mkdir("wide");
+  assert(result == 0);
+  for (i = 0; i < BENCH_WIDTH; i++)
+  {
+    wide_path(path, i);
+    result = _fscreate(path);
+    assert(result == 0);
+  }
+
+  // a file in the root directory, for comparison
+  report("root file", time_open("fspath"), 1);
+  t = 0;
+  for (i = 0; i < BENCH_OPENS; i++)
+    t += time_open("fspath");
+  report("root file, repeated", t, BENCH_OPENS);
+
+  // creating the leaf cached no component of its path, the first open
+  // searches every directory on the way
+  report("deep file, first open", time_open(deep), 1);
+  t = 0;
+  for (i = 0; i < BENCH_OPENS; i++)
+    t += time_open(deep);
+  report("deep file, cached", t, BENCH_OPENS);
+
+  t = 0;
+  for (i = 0; i < BENCH_WIDTH; i++)
+  {
+    wide_path(path, i);
+    t += time_open(path);
+  }
+  report("wide files, first open", t, BENCH_WIDTH);
+  t = 0;
+  for (i = 0; i < BENCH_WIDTH; i++)
+  {
+    wide_path(path, i);
+    t += time_open(path);
+  }
+  report("wide files, cached", t, BENCH_WIDTH);
+
+  // every file shows up once in the wide directory
+  start = 0;
+  do
+  {
+    n = _readdir("wide", start, dentries, sizeof(dentries) / sizeof(dentries[0]));
+    assert(n >= 0);
+    for (i = 0; i < n; i++)
+      assert(dentries[i].type == KFS_DT_FILE && dentries[i].file_name[0] == 'f');
+    start += n;
+  } while (n != 0);
+  assert(start == BENCH_WIDTH);
+
+  // directories must be empty to be removed
+  result = _rmdir("wide");
+  assert(result == -ENOTEMPTY);
+  result = _fsopen(0, "wide");
+  assert(result == -EISDIR);
+
+  cleanup();
+  result = _mkdir("d0");
+  assert(result == 0);
+  result = _rmdir("d0");
+  assert(result == 0);
+}
@@ -0,0 +1,82 @@
+// linebench.c - Buffered terminal output benchmark
+//
+// Prints lines of formatted text to a serial port, first one character per
+// _write, as the terminal functions used to, and then with printf, which
+// collects a line in the terminal output buffer and writes it with a single
+// _write. Reads the port's statistics before and after each run and reports
+// the driver calls and time per printed line.
+
+#include "syscall.h"
+#include "string.h"
+#include "termio.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_LINES 32
+
+static void putc_unbuffered(char c, void *aux)
+{
+  long n;
+
+  if (c == '\n')
+  {
+    n = _write(0, "\r", 1);
+    assert(n == 1);
+  }
+  n = _write(0, &c, 1);
+  assert(n == 1);
+}
+
+static void print_unbuffered(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vgprintf(putc_unbuffered, NULL, fmt, ap);
+  va_end(ap);
+}
+
+static void run(int buffered)
+{
+  struct io_stats before, after;
+  uint64_t t0, usec, calls;
+  char msg[128];
+  int result;
+  int i;
+
+  result = _ioctl(0, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_LINES; i++)
+  {
+    if (buffered)
+      printf("line %d of %d, printed with printf\n", i, BENCH_LINES);
+    else
+      print_unbuffered("line %d of %d, printed a character at a time\n", i, BENCH_LINES);
+  }
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  result = _ioctl(0, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+  calls = after.reqcnt - before.reqcnt;
+
+  snprintf(msg, sizeof(msg), "%s: %lu lines, %lu driver calls, %lu calls and %lu us per line",
+           buffered ? "buffered" : "unbuffered", (unsigned long)BENCH_LINES,
+           (unsigned long)calls, (unsigned long)(calls / BENCH_LINES),
+           (unsigned long)(usec / BENCH_LINES));
+  _msgout(msg);
+}
+
+void main()
+{
+  int result;
+
+  result = _devopen(0, "ser", 1);
+  assert(result >= 0);
+
+  run(0);
+  run(1);
+
+  _close(0);
+}
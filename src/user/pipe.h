@@ -2,10 +2,14 @@
 #define _PIPE_H_
 #include "io.h"
 
-#define PIPE_SIZE 512
+#define PIPE_DEFAULT_CAPACITY 4096  // ring buffer size when _pipe is given 0
+#define PIPE_MAX_CAPACITY 65536     // largest ring buffer, 16 pages
 #define PIPE_WAIT_EMPTY 8
 
-extern int pipe_open(struct io_intf ** ioptr);
+extern int pipe_open(struct io_intf ** rdptr, struct io_intf ** wrptr, size_t capacity);
+extern long pipe_vmsplice(struct io_intf * io, void * buf, unsigned long n);
+extern int pipe_is_read_end(const struct io_intf * io);
+extern long pipe_splice(struct io_intf * in, struct io_intf * out, unsigned long n);
 
 // _PIPE_H_
-#endif
\ No newline at end of file
+#endif
@@ -3,9 +3,39 @@
 #include "stdlib.h"
 #include "pipe.h"
 
+#define TERM_FD 4
+
+// Copies a line typed on the terminal to the terminal and the pipe
+static void send_line(int pipe_wr) {
+    char c = '\0';
+    while(c != '\r'){
+        _read(TERM_FD, &c, 1); // read from terminal
+        _write(TERM_FD, &c, 1); // write to terminal
+        _write(pipe_wr, &c, 1); // write to pipe
+    }
+    _write(TERM_FD, "\n", 1);
+}
+
+// Copies a line from the pipe to the terminal
+static void receive_line(int pipe_rd) {
+    char c = '\0';
+    while(c != '\r'){
+        if(_read(pipe_rd, &c, 1) <= 0) // blocks until the other side writes
+            _exit();                    // or closes the pipe
+        _write(TERM_FD, &c, 1); // write to terminal
+    }
+    _write(TERM_FD, "\n", 1);
+}
+
+// Parent and child take turns typing a line on their own serial port, which
+// shows up on the other's port. Each direction has its own pipe.
 void main() {
+    int to_parent[2], to_child[2];
     int result;
-    result = _pipe(0);
+
+    result = _pipe(to_parent, 0);
+    if (result == 0)
+        result = _pipe(to_child, 0);
 
     if (result < 0)
     {
@@ -14,90 +44,34 @@ void main() {
     }
 
     if (_fork() == 0)
-    {   
-        result = _devopen(1, "ser", 1);
-    
+    {
+        _close(to_parent[0]);
+        _close(to_child[1]);
+        result = _devopen(TERM_FD, "ser", 1);
+
         const char * const child_read = "child reads line:";
         const char * const child_write = "child writes line:";
 
         while(1){
-            _write(1, child_write, strlen(child_write));
-
-
-            // child write until enter is pressed
-            char c = '\0';
-            while(1){
-                _read(1, &c, 1); // read from terminal
-                _write(1, &c, 1); // write to terminal
-                _write(0, &c, 1); // write to pipe
-                if(c == '\r'){
-                    // _write(0,"\n",1);
-                    break;
-                }
-            }
-
-            _write(1,"\n",1);
-            _write(1, child_read, strlen(child_read));
-            _ioctl(0, PIPE_WAIT_EMPTY, NULL); // wait until buffer empty
-            c = '\0';
-            // child read until enter
-            while(1){
-                _read(0, &c, 1); // read from pipe
-                if(c == '\0'){
-                    continue;
-                }
-                _write(1, &c, 1); // write to terminal
-                if(c == '\r'){ // read change line
-                    break;
-                }
-            }
-
-            _write(1,"\n",1);
+            _write(TERM_FD, child_write, strlen(child_write));
+            send_line(to_parent[1]);
+            _write(TERM_FD, child_read, strlen(child_read));
+            receive_line(to_child[0]);
         }
-
-        _exit();
     }
     else
     {
-        result = _devopen(1, "ser", 2);
+        _close(to_parent[1]);
+        _close(to_child[0]);
+        result = _devopen(TERM_FD, "ser", 2);
 
         const char * const parent_read = "Parent reads line:";
         const char * const parent_write = "Parent writes line:";
         while(1){
-            _write(1, parent_read, strlen(parent_read));
-
-            // parent read until enter is pressed
-            char c = '\0';
-            while(1){
-                _read(0, &c, 1); // read from pipe // non_blocking
-                if(c == '\0'){
-                    continue;
-                }
-                _write(1, &c, 1); // write to terminal
-                if(c == '\r'){
-                    break;
-                }
-            }
-
-            _write(1,"\n",1);
-            _write(1, parent_write, strlen(parent_write));
-
-            // parent write until enter
-            c = '\0';
-            while(1){
-                _read(1, &c, 1); // read from terminal
-                _write(1, &c, 1); // write to terminal
-                _write(0, &c, 1); // write to pipe
-                if(c == '\r'){
-                    // change line
-                    // _write(0,"\n",1); 
-                    break;
-                }
-            }
-            _write(1,"\n",1); 
-            _ioctl(0, 8, NULL); // wait until buffer empty
+            _write(TERM_FD, parent_read, strlen(parent_read));
+            receive_line(to_parent[0]);
+            _write(TERM_FD, parent_write, strlen(parent_write));
+            send_line(to_child[1]);
         }
-        
-        _exit();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,83 @@
+// pipebench.c - Pipe throughput benchmark
+//
+// A child process reads from a pipe until end of file while the parent writes
+// a fixed amount of data into it in blocks of one size, then closes its end.
+// Reports the throughput for a range of block sizes and pipe capacities. With
+// a ring buffer both sides make progress at once; blocks larger than the pipe
+// are written in parts as the reader makes room.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "pipe.h"
+#include "bench.h"
+
+#define BENCH_TOTAL (1024 * 1024)
+#define BENCH_BLOCK_MAX 16384
+
+static const size_t block_sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+static const size_t capacities[] = { PIPE_DEFAULT_CAPACITY, PIPE_MAX_CAPACITY };
+
+static char buf[BENCH_BLOCK_MAX];
+
+static void reader(int fd, size_t block)
+{
+  uint64_t total = 0;
+  long n;
+
+  do
+  {
+    n = _read(fd, buf, block);
+    assert(n >= 0);
+    total += n;
+  } while (n != 0);
+  assert(total == BENCH_TOTAL);
+  _exit();
+}
+
+static void run(size_t capacity, size_t block)
+{
+  uint64_t t0, usec;
+  char msg[128];
+  int fds[2];
+  long n;
+  int result;
+  int tid;
+
+  result = _pipe(fds, capacity);
+  assert(result == 0);
+
+  t0 = bench_time();
+  tid = _fork();
+  assert(tid >= 0);
+  if (tid == 0)
+  {
+    _close(fds[1]);
+    reader(fds[0], block);
+  }
+  _close(fds[0]);
+  for (uint64_t total = 0; total < BENCH_TOTAL; total += block)
+  {
+    n = _write(fds[1], buf, block);
+    assert(n == block);
+  }
+  // the reader sees end of file once the last write end is closed
+  _close(fds[1]);
+  _wait(tid);
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  snprintf(msg, sizeof(msg), "capacity %lu, block %lu: %lu us, %lu KB/s",
+           (unsigned long)capacity, (unsigned long)block, (unsigned long)usec,
+           (unsigned long)(usec ? (uint64_t)BENCH_TOTAL * 1000000 / 1024 / usec : 0));
+  _msgout(msg);
+}
+
+void main()
+{
+  int i, j;
+
+  memset(buf, 'p', sizeof(buf));
+  for (i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++)
+    for (j = 0; j < sizeof(block_sizes) / sizeof(block_sizes[0]); j++)
+      run(capacities[i], block_sizes[j]);
+}
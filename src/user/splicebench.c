@@ -0,0 +1,154 @@
+// splicebench.c - Pipe copy versus splice benchmark
+//
+// Moves data through a pipe in 64 KiB transfers, first with _write and _read,
+// which copy it into and out of the pipe, and then with _vmsplice, which moves
+// whole pages of the page-aligned buffers in and out of the pipe by remapping
+// them. Then moves a program file into a pipe, first through a user buffer
+// with _read and _write, and then with _splice, which reads it straight into
+// the pipe. Reports the throughput of each.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "pipe.h"
+#include "bench.h"
+
+#define BENCH_TOTAL (4 * 1024 * 1024)
+#define BENCH_BLOCK 65536
+#define BENCH_FILE "trek"
+#define FILE_FD 3
+
+enum mode { MODE_COPY, MODE_SPLICE };
+
+static char wbuf[BENCH_BLOCK] __attribute__ ((aligned (4096)));
+static char rbuf[BENCH_BLOCK] __attribute__ ((aligned (4096)));
+
+// Reads the pipe until end of file, checks the byte count and exits.
+static void reader(int fd, enum mode mode, uint64_t expected)
+{
+  uint64_t total = 0;
+  long n;
+
+  do
+  {
+    if (mode == MODE_SPLICE)
+      n = _vmsplice(fd, rbuf, BENCH_BLOCK);
+    else
+      n = _read(fd, rbuf, BENCH_BLOCK);
+    assert(n >= 0);
+    total += n;
+  } while (n != 0);
+  assert(total == expected);
+  _exit();
+}
+
+// Writes a whole block into the pipe, a part at a time as the reader makes room.
+static void send_block(int fd, enum mode mode)
+{
+  size_t done = 0;
+  long n;
+
+  while (done < BENCH_BLOCK)
+  {
+    if (mode == MODE_SPLICE)
+      n = _vmsplice(fd, wbuf + done, BENCH_BLOCK - done);
+    else
+      n = _write(fd, wbuf + done, BENCH_BLOCK - done);
+    assert(n > 0);
+    done += n;
+  }
+}
+
+// Moves the benchmark file into the pipe and returns its length.
+static uint64_t send_file(int fd, enum mode mode)
+{
+  uint64_t total = 0;
+  long n;
+  int result;
+
+  result = _fsopen(FILE_FD, BENCH_FILE);
+  assert(result >= 0);
+  for (;;)
+  {
+    if (mode == MODE_SPLICE)
+      n = _splice(FILE_FD, fd, BENCH_BLOCK);
+    else
+    {
+      n = _read(FILE_FD, wbuf, BENCH_BLOCK);
+      if (n > 0)
+        n = _write(fd, wbuf, n);
+    }
+    assert(n >= 0);
+    if (n == 0)
+      break;
+    total += n;
+  }
+  _close(FILE_FD);
+  return total;
+}
+
+static void report(const char * what, enum mode mode, uint64_t total, uint64_t usec)
+{
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "%s (%s): %lu bytes, %lu us, %lu KB/s",
+           what, mode == MODE_SPLICE ? "splice" : "copy",
+           (unsigned long)total, (unsigned long)usec,
+           (unsigned long)(usec ? total * 1000000 / 1024 / usec : 0));
+  _msgout(msg);
+}
+
+// Runs one transfer through a fresh pipe, of which the reader expects
+// /expected/ bytes.
+static void run(int from_file, enum mode mode, uint64_t expected)
+{
+  uint64_t t0, usec, total = 0;
+  int fds[2];
+  int result;
+  int tid;
+
+  result = _pipe(fds, PIPE_MAX_CAPACITY);
+  assert(result == 0);
+
+  t0 = bench_time();
+  tid = _fork();
+  assert(tid >= 0);
+  if (tid == 0)
+  {
+    _close(fds[1]);
+    reader(fds[0], mode, expected);
+  }
+  _close(fds[0]);
+  if (from_file)
+    total = send_file(fds[1], mode);
+  else
+    for (; total < BENCH_TOTAL; total += BENCH_BLOCK)
+      send_block(fds[1], mode);
+  _close(fds[1]);
+  _wait(tid);
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  report(from_file ? "file to pipe" : "pipe", mode, total, usec);
+}
+
+void main()
+{
+  uint64_t file_len;
+  int result;
+
+  // touch every page so that the buffers are mapped before moving them
+  memset(wbuf, 's', sizeof(wbuf));
+  memset(rbuf, 0, sizeof(rbuf));
+
+  run(0, MODE_COPY, BENCH_TOTAL);
+  run(0, MODE_SPLICE, BENCH_TOTAL);
+
+  result = _fsopen(FILE_FD, BENCH_FILE);
+  assert(result >= 0);
+  result = _ioctl(FILE_FD, IOCTL_GETLEN, &file_len);
+  assert(result >= 0);
+  _close(FILE_FD);
+
+  run(1, MODE_COPY, file_len);
+  run(1, MODE_SPLICE, file_len);
+}
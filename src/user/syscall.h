@@ -12,12 +12,32 @@ extern int _close(int fd);
 extern long _read(int fd, void * buf, size_t bufsz);
 extern long _write(int fd, const void * buf, size_t len);
 extern int _ioctl(int fd, const int cmd, void * arg);
+extern int _fsync(int fd);
 extern int _devopen(int fd, const char * name, int instno);
 extern int _fsopen(int fd, const char * name);
+extern int _fscreate(const char * name);
+extern int _fsunlink(const char * name);
+extern int _mkdir(const char * name);
+extern int _rmdir(const char * name);
+struct dentry_t;
+extern long _readdir(const char * name, uint64_t start, struct dentry_t * buf, size_t n);
+extern int _truncate(int fd, uint64_t len);
 extern int _exec(int fd);
 extern int _fork(void);
 extern int _wait(int tid);
 extern int _usleep(unsigned long us);
-extern int _pipe(int fd);
+extern int _pipe(int fds[2], size_t capacity);
+extern long _splice(int fd_in, int fd_out, size_t len);
+extern long _vmsplice(int fd, void * buf, size_t len);
+extern long _sendfile(int out_fd, int in_fd, uint64_t * offset, size_t count);
+extern long _readv(int fd, const struct io_vec * iov, int iovcnt);
+extern long _writev(int fd, const struct io_vec * iov, int iovcnt);
+extern long _pread(int fd, void * buf, size_t bufsz, uint64_t pos);
+extern long _pwrite(int fd, const void * buf, size_t len, uint64_t pos);
+extern int _poll(struct io_pollfd * fds, int nfds, int wait);
+struct uring;
+extern int _uring_setup(struct uring * ring);
+extern long _uring_enter(unsigned int min_complete);
+extern long _klog(char * buf, size_t bufsz);
 
 #endif // _SYSCALL_H_
@@ -5,23 +5,58 @@
 #include "syscall.h"
 #include "string.h"
 
+// Terminal input and output are buffered, the same way as the kernel's io_buf,
+// so that the shell makes one system call per line rather than one per
+// character. Output is written out when the buffer fills, at a newline and
+// before reading; input is read a buffer at a time.
+
+#define TERMIO_BUFSZ 128
+
+static char ibuf[TERMIO_BUFSZ];
+static size_t ipos, ilen;
+static char obuf[TERMIO_BUFSZ];
+static size_t olen;
+
 static char getchar_raw(void);
 static void putchar_raw(char c);
+static void write_raw(const char *s, size_t n);
 
-char getchar_raw(void)
+void flush(void)
 {
     long n;
-    char c;
 
-    n = _read(0, &c, 1);
+    if (olen == 0)
+        return;
 
-    if (n != 1)
-    {
-        _msgout("getchar_raw() failed");
+    n = _write(0, obuf, olen);
+    olen = 0;
+
+    if (n < 0)
         _exit();
+}
+
+char getchar_raw(void)
+{
+    long n;
+
+    if (ipos == ilen)
+    {
+        // Show the prompt and echo before waiting for input
+        flush();
+
+        n = _read(0, ibuf, sizeof(ibuf));
+
+        if (n <= 0)
+        {
+            _msgout("getchar_raw() failed");
+            _exit();
+        }
+
+        ipos = 0;
+        ilen = n;
     }
 
-    return c;
+    return ibuf[ipos++];
 }
 
 char getchar(void)
@@ -44,14 +79,29 @@ char getchar(void)
         return c;
 }
 
-void putchar_raw(char c)
+void write_raw(const char *s, size_t n)
 {
-    long n;
+    long cnt;
+
+    if (sizeof(obuf) - olen < n)
+    {
+        flush();
+        if (sizeof(obuf) <= n)
+        {
+            cnt = _write(0, s, n);
+            if (cnt < 0)
+                _exit();
+            return;
+        }
+    }
 
-    n = _write(0, &c, 1);
+    memcpy(obuf + olen, s, n);
+    olen += n;
+}
 
-    if (n != 1)
-        _exit();
+void putchar_raw(char c)
+{
+    write_raw(&c, 1);
 }
 
 void putchar(char c)
@@ -61,14 +111,17 @@ void putchar(char c)
     if (c == '\n')
         putchar_raw('\r');
     putchar_raw(c);
+
+    if (c == '\n')
+        flush();
 }
 
 void puts(const char *s)
 {
     const char *start;
 
-    // Try to minimize the number of device_write calls by writing multiple
-    // characters that are not \n at once.
+    // Copy runs of characters that are not \n at once. The line ends up in
+    // the output buffer and is written out by the flush at the end.
 
     if (s != NULL)
     {
@@ -78,13 +131,15 @@ void puts(const char *s)
             while (*s != '\0' && *s != '\n')
                 s += 1;
             if (s != start)
-                _write(0, start, s - start);
-            _write(0, "\r\n", 2);
+                write_raw(start, s - start);
+            write_raw("\r\n", 2);
             if (*s == '\0')
                 break;
             s += 1;
         }
     }
+
+    flush();
 }
 
 char *getsn(char *buf, size_t n)
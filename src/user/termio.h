@@ -13,4 +13,9 @@ extern char *getsn(char *buf, size_t n);
 extern void printf(const char *fmt, ...);
 extern void wfent();
 
+// Writes out buffered terminal output. Output is written at each newline and
+// before reading input; call flush before writing to the terminal by other
+// means, such as _sendfile, or before exiting after a partial line.
+extern void flush(void);
+
 #endif // _TERMIO_H_
\ No newline at end of file
@@ -17,24 +17,25 @@ int cat(char *filename)
       printf("%s: Error %d\n", filename, result);
     return result;
   }
-  size_t n;
+  uint64_t n;
   result = _ioctl(1, IOCTL_GETLEN, &n);
   if (result < 0)
   {
     puts("Failed to get file length");
     printf("Error %d\n", -result);
+    _close(1);
     return result;
   }
-  // n += 1;
-  char cat_buf[n];
-  result = _read(1, cat_buf, n);
-  if (result < 0)
+  // the kernel copies the file to the terminal, no user buffer needed
+  flush();
+  long sent = _sendfile(0, 1, NULL, n);
+  if (sent < 0)
   {
     puts("Failed to read file");
-    printf("Error %d\n", -result);
-    return result;
+    printf("Error %d\n", (int)-sent);
+    _close(1);
+    return sent;
   }
-  puts(cat_buf);
   puts("\n");
   _close(1);
   return 0;
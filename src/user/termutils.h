@@ -9,12 +9,15 @@
 #define MAX_INODES 1023
 #define BOOT_RESERVED_SPACE_SZ 52
 #define MAX_FILE_NAME_LENGTH 32 // 32 bytes
-#define DENTRY_RESERVED_SPACE_SZ 28
+#define DENTRY_RESERVED_SPACE_SZ 27
 #define MAX_FILE_OPEN 32
+#define KFS_DT_FILE 0
+#define KFS_DT_DIR 1
 typedef struct dentry_t
 {
   char file_name[MAX_FILE_NAME_LENGTH];
   uint32_t inode;
+  uint8_t type; // KFS_DT_FILE or KFS_DT_DIR
   uint8_t reserved[DENTRY_RESERVED_SPACE_SZ];
 } __attribute((packed)) dentry_t;
 
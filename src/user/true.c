@@ -0,0 +1,7 @@
+// true.c - Exits at once
+//
+// The smallest program there is to load, for measuring the cost of _exec.
+
+void main()
+{
+}
@@ -0,0 +1 @@
+../kern/uring.h
\ No newline at end of file
@@ -0,0 +1,125 @@
+// uringbench.c - Submission ring versus synchronous read benchmark
+//
+// Reads a program file in small chunks, first with one _read system call per
+// chunk, then by queueing batches of reads in a submission ring and calling
+// _uring_enter once per batch to wait for their completions. Reports the
+// operations per second and the system calls made by each.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "uring.h"
+#include "bench.h"
+
+#define BENCH_FILE "zork"
+#define BENCH_OPS 4096
+#define BENCH_CHUNK 256
+#define BATCH 32
+#define FD 0
+
+static struct uring ring __attribute__ ((aligned (4096)));
+static char bufs[BATCH][BENCH_CHUNK];
+
+static void report(const char *what, uint64_t usec, unsigned long calls)
+{
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "%s: %d reads of %d bytes, %lu us, %lu ops/s, %lu system calls",
+           what, BENCH_OPS, BENCH_CHUNK, (unsigned long)usec,
+           (unsigned long)(usec ? (uint64_t)BENCH_OPS * 1000000 / usec : 0), calls);
+  _msgout(msg);
+}
+
+static void run_sync(uint64_t len)
+{
+  uint64_t t0, pos = 0, zero = 0;
+  unsigned long calls = 0;
+  long n;
+  int result;
+  int i;
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_OPS; i++)
+  {
+    if (pos + BENCH_CHUNK > len)
+    {
+      result = _ioctl(FD, IOCTL_SETPOS, &zero);
+      assert(result >= 0);
+      calls += 1;
+      pos = 0;
+    }
+    n = _read(FD, bufs[0], BENCH_CHUNK);
+    assert(n == BENCH_CHUNK);
+    calls += 1;
+    pos += n;
+  }
+  report("_read", bench_ticks_to_usec(bench_time() - t0), calls);
+}
+
+static void run_ring(uint64_t len)
+{
+  struct uring_sqe *sqe;
+  struct uring_cqe *cqe;
+  uint64_t t0, pos = 0;
+  unsigned long calls = 0;
+  long n;
+  int i, j;
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_OPS; i += BATCH)
+  {
+    for (j = 0; j < BATCH; j++)
+    {
+      if (pos + BENCH_CHUNK > len)
+        pos = 0;
+      sqe = &ring.sqes[ring.sq_tail % URING_ENTRIES];
+      sqe->op = URING_OP_READ;
+      sqe->fd = FD;
+      sqe->buf = bufs[j];
+      sqe->len = BENCH_CHUNK;
+      sqe->pos = pos;
+      sqe->user_data = j;
+      pos += BENCH_CHUNK;
+      // the entry must be complete before the kernel can see it
+      asm volatile ("" ::: "memory");
+      ring.sq_tail += 1;
+    }
+
+    n = _uring_enter(BATCH);
+    assert(n >= BATCH);
+    calls += 1;
+
+    while (ring.cq_head != ring.cq_tail)
+    {
+      cqe = &ring.cqes[ring.cq_head % URING_ENTRIES];
+      assert(cqe->res == BENCH_CHUNK);
+      ring.cq_head += 1;
+    }
+  }
+  report("uring", bench_ticks_to_usec(bench_time() - t0), calls);
+}
+
+void main()
+{
+  uint64_t len;
+  int result;
+
+  result = _fsopen(FD, BENCH_FILE);
+  assert(result >= 0);
+  result = _ioctl(FD, IOCTL_GETLEN, &len);
+  assert(result >= 0);
+  assert(len >= BENCH_CHUNK);
+
+  // touch every page so that the kernel finds the ring and buffers mapped;
+  // the ring must also start zeroed
+  memset(&ring, 0, sizeof(ring));
+  memset(bufs, 0, sizeof(bufs));
+
+  run_sync(len);
+
+  result = _uring_setup(&ring);
+  assert(result == 0);
+  run_ring(len);
+
+  _close(FD);
+}
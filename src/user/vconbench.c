@@ -0,0 +1,68 @@
+// vconbench.c - Virtio console versus serial port throughput benchmark
+//
+// Writes 1 MiB to port 1 of the virtio console, vcon1, and then to ser1, in
+// large writes, waiting for each device to take all of it with IOCTL_FLUSH.
+// Reports the throughput of each with the notifications and interrupts taken.
+// Run with make VCON=vcon1.out so that the console has a port 1; the data
+// ends up in that file.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_TOTAL (1024 * 1024)
+#define BENCH_BLOCK 8192
+#define FD 0
+
+static char buf[BENCH_BLOCK];
+
+static void run(const char *name, int instno)
+{
+  struct io_stats before, after;
+  uint64_t t0, usec;
+  char msg[160];
+  long n;
+  int result;
+  int i;
+
+  result = _devopen(FD, name, instno);
+  assert(result >= 0);
+
+  result = _ioctl(FD, IOCTL_GETSTATS, &before);
+  assert(result >= 0);
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_TOTAL / BENCH_BLOCK; i++)
+  {
+    n = _write(FD, buf, BENCH_BLOCK);
+    assert(n == BENCH_BLOCK);
+  }
+  result = _ioctl(FD, IOCTL_FLUSH, NULL);
+  assert(result >= 0);
+  usec = bench_ticks_to_usec(bench_time() - t0);
+
+  result = _ioctl(FD, IOCTL_GETSTATS, &after);
+  assert(result >= 0);
+
+  snprintf(msg, sizeof(msg), "%s%d: %lu bytes, %lu us, %lu KB/s, %lu notifications, %lu interrupts",
+           name, instno, (unsigned long)BENCH_TOTAL, (unsigned long)usec,
+           (unsigned long)(usec ? (uint64_t)BENCH_TOTAL * 1000000 / 1024 / usec : 0),
+           (unsigned long)(after.notifycnt - before.notifycnt),
+           (unsigned long)(after.intrcnt - before.intrcnt));
+  _msgout(msg);
+
+  _close(FD);
+}
+
+void main()
+{
+  int i;
+
+  // lines of printable text, so the output stays readable
+  for (i = 0; i < BENCH_BLOCK; i++)
+    buf[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+
+  run("vcon", 1);
+  run("ser", 1);
+}
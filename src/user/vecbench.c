@@ -0,0 +1,126 @@
+// vecbench.c - Vectored and positional I/O benchmark
+//
+// Writes records of a small header and a body to a new file, first with one
+// _write for each part and then with a single _writev, and reads records
+// back from scattered positions, first with _ioctl(IOCTL_SETPOS) and _read
+// and then with a single _pread. Reports the time and the number of system
+// calls per record of each.
+
+#include "syscall.h"
+#include "string.h"
+#include "termutils.h"
+#include "bench.h"
+
+#define BENCH_FILE "vecbench.out"
+#define BENCH_RECORDS 64
+#define BODY_SIZE 1024
+#define FD 0
+
+struct header
+{
+  uint64_t seq;
+  uint64_t len;
+};
+
+#define RECORD_SIZE (sizeof(struct header) + BODY_SIZE)
+
+static char body[BODY_SIZE];
+static char rbuf[RECORD_SIZE];
+
+static void report(const char *what, uint64_t usec, int calls)
+{
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "%s: %lu us for %d records, %lu us and %d system calls each",
+           what, (unsigned long)usec, BENCH_RECORDS,
+           (unsigned long)(usec / BENCH_RECORDS), calls);
+  _msgout(msg);
+}
+
+static void write_records(int vectored)
+{
+  struct header hdr;
+  struct io_vec iov[2];
+  uint64_t t0;
+  long n;
+  int i;
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_RECORDS; i++)
+  {
+    hdr.seq = i;
+    hdr.len = BODY_SIZE;
+    if (vectored)
+    {
+      iov[0].base = &hdr;
+      iov[0].len = sizeof(hdr);
+      iov[1].base = body;
+      iov[1].len = BODY_SIZE;
+      n = _writev(FD, iov, 2);
+      assert(n == RECORD_SIZE);
+    }
+    else
+    {
+      n = _write(FD, &hdr, sizeof(hdr));
+      assert(n == sizeof(hdr));
+      n = _write(FD, body, BODY_SIZE);
+      assert(n == BODY_SIZE);
+    }
+  }
+  report(vectored ? "writev" : "write, write", bench_ticks_to_usec(bench_time() - t0),
+         vectored ? 1 : 2);
+}
+
+static void read_records(int positional)
+{
+  uint64_t t0, pos;
+  long n;
+  int i, rec;
+  int result;
+
+  t0 = bench_time();
+  for (i = 0; i < BENCH_RECORDS; i++)
+  {
+    // visit the records out of order, 37 is coprime to the record count
+    rec = (i * 37) % BENCH_RECORDS;
+    pos = (uint64_t)rec * RECORD_SIZE;
+    if (positional)
+    {
+      n = _pread(FD, rbuf, RECORD_SIZE, pos);
+    }
+    else
+    {
+      result = _ioctl(FD, IOCTL_SETPOS, &pos);
+      assert(result >= 0);
+      n = _read(FD, rbuf, RECORD_SIZE);
+    }
+    assert(n == RECORD_SIZE);
+    assert(((struct header *)rbuf)->seq == rec);
+  }
+  report(positional ? "pread" : "setpos, read", bench_ticks_to_usec(bench_time() - t0),
+         positional ? 1 : 2);
+}
+
+void main()
+{
+  uint64_t zero = 0;
+  int result;
+
+  memset(body, 'v', sizeof(body));
+  result = _fscreate(BENCH_FILE);
+  assert(result >= 0);
+  result = _fsopen(FD, BENCH_FILE);
+  assert(result >= 0);
+
+  write_records(0);
+  result = _ioctl(FD, IOCTL_SETPOS, &zero);
+  assert(result >= 0);
+  write_records(1);
+
+  read_records(0);
+  read_records(1);
+
+  _close(FD);
+  result = _fsunlink(BENCH_FILE);
+  assert(result >= 0);
+}
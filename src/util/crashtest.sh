@@ -0,0 +1,40 @@
+#!/bin/bash
+# Crash-injection test for the kfs journal. Boots a kernel whose INIT_PROC is
+# "fsjournal" on a fresh version 2 image, kills QEMU at a random point while
+# the benchmark creates and deletes files, and checks the image with fsck,
+# which replays the journal the way mount does. Repeats ROUNDS times.
+#
+# Build the kernel with #define INIT_PROC "fsjournal" in kern/main.c first.
+#   ./crashtest.sh [ROUNDS] [MAX_DELAY_MS]
+ROUNDS=${1:-20}
+MAX_DELAY_MS=${2:-3000}
+
+make clean
+make
+
+ROOT_FOLDER="root_folder"
+FILES=$(find "$ROOT_FOLDER" -type f)
+FAILED=0
+
+for ((i = 0; i < ROUNDS; i++)); do
+    ./mkfs -v2 kfs.raw $FILES > /dev/null || exit 1
+    mv kfs.raw ../kern/kfs.raw
+
+    # QEMU runs until killed, the benchmark never powers it off
+    (cd ../kern && make run-kernel < /dev/null > crashtest.log 2>&1) &
+    DELAY=$((RANDOM % MAX_DELAY_MS))
+    sleep "$((DELAY / 1000)).$(printf %03d $((DELAY % 1000)))"
+    pkill -KILL -f "qemu-system-riscv64.*kernel.elf"
+    wait
+
+    echo "round $i: killed after $DELAY ms"
+    if ! ./fsck ../kern/kfs.raw; then
+        FAILED=$((FAILED + 1))
+        cp ../kern/kfs.raw crash$i.raw
+        echo "round $i: inconsistent image saved as crash$i.raw"
+    fi
+done
+
+echo "$FAILED of $ROUNDS rounds left an inconsistent image"
+make clean
+[ $FAILED -eq 0 ]
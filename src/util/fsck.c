@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Checks a version 2 kfs image with bitmaps, as made by mkfs -v2 and changed
+// by the kernel. A transaction left committed in the journal is replayed
+// first, in memory, the way the kernel does at mount. Then, walking the tree
+// from the root directory, every directory entry must name a distinct
+// allocated inode, every extent must lie in the data region and in no other
+// extent, and the bitmaps must mark exactly the inodes and blocks in use. The
+// chunk index of a compressed file must fit its length and its blocks.
+//
+// Exits with 0 if the image is consistent, 1 otherwise.
+
+#define FS_BLKSZ      4096
+#define FS_NAMELEN    32
+#define FS_MAX_DENTRIES 63
+
+#define FS_MAGIC      0x3253464b // "KFS2"
+#define FS_VERSION_2  2
+#define FS_MAX_EXTENTS 511
+#define FS_FEATURE_BITMAP 0x1
+#define FS_FEATURE_JOURNAL 0x2
+#define FS_INODE_MAP_SZ 64
+#define FS_JOURNAL_MAGIC 0x4c4e524a // "JRNL"
+#define FS_JOURNAL_MAX_BLOCKS 1021
+#define FS_DT_FILE 0
+#define FS_DT_DIR 1
+#define FS_INODE_COMPRESSED 0x1
+#define FS_CHUNK_SIZE 4096
+
+typedef struct dentry_t{
+    char file_name[FS_NAMELEN];
+    uint32_t inode;
+    uint8_t type;
+    uint8_t reserved[27];
+}__attribute((packed)) dentry_t;
+
+typedef struct boot_block_t{
+    uint32_t num_dentry;
+    uint32_t num_inodes;
+    uint32_t num_data;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t features;
+    uint32_t bitmap_block;
+    uint32_t journal_block;
+    uint32_t journal_len;
+    uint8_t reserved[28];
+    dentry_t dir_entries[FS_MAX_DENTRIES];
+}__attribute((packed)) boot_block_t;
+
+typedef struct extent_t{
+    uint32_t start;
+    uint32_t len;
+}__attribute((packed)) extent_t;
+
+typedef struct inode_t{
+    uint32_t byte_len;
+    uint16_t num_extents;
+    uint16_t flags;
+    extent_t extents[FS_MAX_EXTENTS];
+}__attribute((packed)) inode_t;
+
+typedef struct bitmap_block_t{
+    uint8_t inode_map[FS_INODE_MAP_SZ];
+    uint8_t data_map[FS_BLKSZ - FS_INODE_MAP_SZ];
+}__attribute((packed)) bitmap_block_t;
+
+typedef struct journal_header_t{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t count;
+    uint32_t blocks[FS_JOURNAL_MAX_BLOCKS];
+}__attribute((packed)) journal_header_t;
+
+static uint8_t *image;
+static size_t num_blocks;
+static int errors;
+static int num_files;
+static boot_block_t *boot_block;
+static bitmap_block_t *bitmap;
+static uint8_t *inode_used;
+static uint8_t *data_used;
+
+void die(const char *);
+
+static void *
+block(size_t blkno)
+{
+  if(blkno >= num_blocks){
+    fprintf(stderr, "block %zu is past the end of the image\n", blkno);
+    exit(1);
+  }
+  return image + blkno * FS_BLKSZ;
+}
+
+static int
+test_bit(const uint8_t *map, uint32_t i)
+{
+  return (map[i / 8] >> (i % 8)) & 1;
+}
+
+static void
+problem(const char *msg, const char *name, unsigned long n)
+{
+  printf("%s: %s %lu\n", name, msg, n);
+  errors++;
+}
+
+static void
+replay(const boot_block_t *boot_block)
+{
+  journal_header_t *header = block(boot_block->journal_block);
+  uint32_t i;
+
+  if(header->magic != FS_JOURNAL_MAGIC || header->count == 0){
+    printf("Journal is clean\n");
+    return;
+  }
+  if(header->count > boot_block->journal_len - 1 || header->count > FS_JOURNAL_MAX_BLOCKS){
+    printf("Journal header is corrupt\n");
+    errors++;
+    return;
+  }
+  printf("Replaying transaction %u of %u blocks\n", header->seq, header->count);
+  for(i = 0; i < header->count; i++)
+    memcpy(block(header->blocks[i]), block(boot_block->journal_block + 1 + i), FS_BLKSZ);
+}
+
+static void check_dir(const dentry_t *dentries, uint32_t n, const char *path);
+
+// Copies the data of an inode, which may span several extents
+static uint8_t *
+read_data(const inode_t *inode, uint64_t blocks)
+{
+  uint8_t *data = malloc(blocks * FS_BLKSZ + 1);
+  uint8_t *p = data;
+  uint32_t j, k;
+
+  for(j = 0; j < inode->num_extents; j++)
+    for(k = 0; k < inode->extents[j].len; k++, p += FS_BLKSZ)
+      memcpy(p, block(1 + boot_block->num_inodes + inode->extents[j].start + k), FS_BLKSZ);
+  return data;
+}
+
+// Checks the chunk index of a compressed file, returns the length of its data
+static uint64_t
+check_chunks(const inode_t *inode, uint64_t blocks, const char *name)
+{
+  uint64_t nchunks = (inode->byte_len + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+  uint64_t i, len;
+
+  if((nchunks + 1) * sizeof(uint32_t) > blocks * FS_BLKSZ){
+    problem("chunk index longer than the data, chunks:", name, nchunks);
+    return 0;
+  }
+  uint32_t *index = (uint32_t *)read_data(inode, blocks);
+  for(i = 0; i < nchunks; i++){
+    len = (i == nchunks - 1) ? inode->byte_len - i * FS_CHUNK_SIZE : FS_CHUNK_SIZE;
+    if(index[i] < (nchunks + 1) * sizeof(uint32_t) || index[i + 1] < index[i] ||
+       index[i + 1] - index[i] > len){
+      problem("bad chunk index entry", name, i);
+      free(index);
+      return 0;
+    }
+  }
+  len = index[nchunks];
+  free(index);
+  return len;
+}
+
+// Checks an entry and, for a directory, everything under it
+static void
+check_entry(const dentry_t *dentry, const char *dir)
+{
+  uint32_t num_inodes = boot_block->num_inodes;
+  uint32_t num_data = boot_block->num_data;
+  char name[256];
+  uint32_t j, k;
+
+  snprintf(name, sizeof(name), "%s/%.*s", dir, FS_NAMELEN, dentry->file_name);
+  num_files++;
+  if(dentry->inode >= num_inodes){
+    problem("inode out of range:", name, dentry->inode);
+    return;
+  }
+  if(inode_used[dentry->inode]++){
+    problem("inode shared with another entry:", name, dentry->inode);
+    return;
+  }
+  if(!test_bit(bitmap->inode_map, dentry->inode))
+    problem("inode not marked in use:", name, dentry->inode);
+
+  inode_t *inode = block(1 + dentry->inode);
+  uint64_t blocks = 0;
+  if(inode->num_extents > FS_MAX_EXTENTS){
+    problem("too many extents:", name, inode->num_extents);
+    return;
+  }
+  for(j = 0; j < inode->num_extents; j++){
+    extent_t *extent = &inode->extents[j];
+    if(extent->len == 0 || extent->start >= num_data || extent->len > num_data - extent->start){
+      problem("extent out of range, starting at", name, extent->start);
+      return;
+    }
+    for(k = extent->start; k < extent->start + extent->len; k++){
+      if(data_used[k]++)
+        problem("block shared with another file:", name, k);
+      if(!test_bit(bitmap->data_map, k))
+        problem("block not marked in use:", name, k);
+    }
+    blocks += extent->len;
+  }
+  uint64_t data_len = inode->byte_len;
+  if(inode->flags & FS_INODE_COMPRESSED){
+    if(dentry->type != FS_DT_FILE){
+      problem("compressed, but not a file:", name, dentry->type);
+      return;
+    }
+    data_len = check_chunks(inode, blocks, name);
+  }
+  if(blocks != (data_len + FS_BLKSZ - 1) / FS_BLKSZ){
+    problem("wrong number of blocks for its length:", name, blocks);
+    return;
+  }
+
+  if(dentry->type == FS_DT_DIR){
+    if(inode->byte_len % sizeof(dentry_t) != 0){
+      problem("directory length is not a multiple of the entry size:", name, inode->byte_len);
+      return;
+    }
+    uint32_t n = inode->byte_len / sizeof(dentry_t);
+    dentry_t *dentries = (dentry_t *)read_data(inode, blocks);
+    check_dir(dentries, n, name);
+    free(dentries);
+  }else if(dentry->type != FS_DT_FILE){
+    problem("unknown type:", name, dentry->type);
+  }
+}
+
+static void
+check_dir(const dentry_t *dentries, uint32_t n, const char *path)
+{
+  uint32_t i, j;
+
+  for(i = 0; i < n; i++){
+    for(j = 0; j < i; j++)
+      if(strncmp(dentries[j].file_name, dentries[i].file_name, FS_NAMELEN) == 0)
+        problem("duplicate directory entry", path[0] ? path : "/", i);
+    check_entry(&dentries[i], path);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 2){
+    fprintf(stderr, "Usage: ./fsck [filesystem_image]\n");
+    exit(1);
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if(fd < 0)
+    die(argv[1]);
+  struct stat st;
+  if(fstat(fd, &st) < 0)
+    die(argv[1]);
+  num_blocks = st.st_size / FS_BLKSZ;
+  image = malloc(num_blocks * FS_BLKSZ);
+  if(image == NULL || read(fd, image, num_blocks * FS_BLKSZ) != (ssize_t)(num_blocks * FS_BLKSZ))
+    die(argv[1]);
+  close(fd);
+
+  boot_block = block(0);
+  if(boot_block->magic != FS_MAGIC || boot_block->version != FS_VERSION_2 ||
+     !(boot_block->features & FS_FEATURE_BITMAP)){
+    fprintf(stderr, "%s: not a version 2 image with bitmaps\n", argv[1]);
+    exit(1);
+  }
+  if(boot_block->features & FS_FEATURE_JOURNAL)
+    replay(boot_block);
+
+  bitmap = block(boot_block->bitmap_block);
+  uint32_t num_inodes = boot_block->num_inodes;
+  uint32_t num_data = boot_block->num_data;
+  inode_used = calloc(num_inodes, 1);
+  data_used = calloc(num_data, 1);
+  uint32_t i;
+
+  if(boot_block->num_dentry > FS_MAX_DENTRIES){
+    problem("too many directory entries:", "boot block", boot_block->num_dentry);
+    boot_block->num_dentry = FS_MAX_DENTRIES;
+  }
+  check_dir(boot_block->dir_entries, boot_block->num_dentry, "");
+
+  for(i = 0; i < num_inodes && i < 8 * FS_INODE_MAP_SZ; i++)
+    if(test_bit(bitmap->inode_map, i) && !inode_used[i])
+      problem("marked in use but unreferenced:", "inode", i);
+  for(i = 0; i < num_data && i < 8 * sizeof(bitmap->data_map); i++)
+    if(test_bit(bitmap->data_map, i) && !data_used[i])
+      problem("marked in use but unreferenced:", "block", i);
+
+  printf("%d files, %d problems\n", num_files, errors);
+  return errors != 0;
+}
+
+void
+die(const char *s)
+{
+  perror(s);
+  exit(1);
+}
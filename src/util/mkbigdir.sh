@@ -0,0 +1,27 @@
+#!/bin/bash
+# Makes a kfs image with a full root directory: the files in root_folder,
+# followed by empty files up to the maximum number of directory entries.
+make clean
+make
+
+ROOT_FOLDER="root_folder"
+MAX_DIR_ENTRIES=63
+FILLER_FOLDER=$(mktemp -d)
+
+FILES=$(find "$ROOT_FOLDER" -type f)
+COUNT=$(echo $FILES | wc -w)
+
+for ((i = COUNT; i < MAX_DIR_ENTRIES; i++)); do
+    touch "$FILLER_FOLDER/filler$i"
+    FILES="$FILES $FILLER_FOLDER/filler$i"
+done
+
+echo ./mkfs $MKFS_FLAGS kfs.raw $FILES
+./mkfs $MKFS_FLAGS kfs.raw $FILES
+rm -rf "$FILLER_FOLDER"
+
+rm -f ../kern/kfs.raw
+mv kfs.raw ../kern/kfs.raw
+echo Copied kfs.raw to ../kern/kfs.raw
+
+make clean
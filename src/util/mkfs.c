@@ -5,6 +5,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #define FS_BLKSZ      4096
 #define FS_NAMELEN    32
@@ -15,30 +17,108 @@
 
 // Disk layout:
 // [ boot block | inodes | data blocks ]
+//
+// The root directory is the list of entries in the boot block. Arguments
+// that are directories are copied with everything under them; each
+// subdirectory is an inode whose data is an array of directory entries.
+// Version 1 images only have files, and file paths lose their directories.
+//
+// Version 1 inodes list every data block of a file. Version 2 images are
+// marked with a magic number and version in the boot block, and their inodes
+// list extents (runs of contiguous data blocks) instead. Version 2 images
+// also reserve room for new files and end with a bitmap block and a metadata
+// journal:
+// [ boot block | inodes (FS_INODES) | data blocks (used + free) | bitmaps | journal ]
+//
+// With -z, files in version 2 images are compressed in chunks of
+// FS_CHUNK_SIZE bytes, each chunk on its own so that any part of a file can be
+// read without the rest. The data of such a file starts with the offset of
+// every chunk and the end of the last one, and a chunk that does not get
+// smaller is stored as it is. Files that would not shrink are not compressed.
+
+#define FS_MAGIC      0x3253464b // "KFS2"
+#define FS_VERSION_2  2
+#define FS_MAX_EXTENTS 511
+#define FS_FEATURE_BITMAP 0x1
+#define FS_FEATURE_JOURNAL 0x2
+#define FS_MAX_DENTRIES 63     // entries in the root directory
+#define FS_INODES 256          // default inodes in version 2 images
+#define FS_INODE_MAP_SZ 64
+#define FS_FREE_BLOCKS 1024    // default free data blocks in version 2 images
+#define FS_JOURNAL_BLOCKS 33   // default journal size: a header and 32 blocks
+#define FS_JOURNAL_MIN 6       // a header and the blocks of one operation
+#define FS_DT_FILE 0
+#define FS_DT_DIR 1
+#define FS_INODE_COMPRESSED 0x1
+#define FS_CHUNK_SIZE 4096
+#define LZ4_HASH_BITS 12
+#define LZ4_MAX_OFFSET 65535
 
 typedef struct dentry_t{
     char file_name[FS_NAMELEN];
     uint32_t inode;
-    uint8_t reserved[28];
+    uint8_t type;
+    uint8_t reserved[27];
 }__attribute((packed)) dentry_t; 
 
 typedef struct boot_block_t{
     uint32_t num_dentry;
     uint32_t num_inodes;
     uint32_t num_data;
-    uint8_t reserved[52];
-    dentry_t dir_entries[63];
+    uint32_t magic;
+    uint32_t version;
+    uint32_t features;
+    uint32_t bitmap_block;
+    uint32_t journal_block;
+    uint32_t journal_len;
+    uint8_t reserved[28];
+    dentry_t dir_entries[FS_MAX_DENTRIES];
 }__attribute((packed)) boot_block_t;
 
+typedef struct extent_t{
+    uint32_t start;
+    uint32_t len;
+}__attribute((packed)) extent_t;
+
 typedef struct inode_t{
     uint32_t byte_len;
-    uint32_t data_block_num[1023];
+    union {
+        uint32_t data_block_num[1023];
+        struct {
+            uint16_t num_extents;
+            uint16_t flags;
+            extent_t extents[FS_MAX_EXTENTS];
+        };
+    };
 }__attribute((packed)) inode_t;
 
+typedef struct bitmap_block_t{
+    uint8_t inode_map[FS_INODE_MAP_SZ];
+    uint8_t data_map[FS_BLKSZ - FS_INODE_MAP_SZ];
+}__attribute((packed)) bitmap_block_t;
+
 typedef struct data_block_t{
     uint8_t data[FS_BLKSZ];
 }__attribute((packed)) data_block_t;
 
+// A file or directory to copy into the image, numbered by its inode
+typedef struct node_t{
+    char name[FS_NAMELEN];
+    char *path;
+    int type;
+    int parent; // index of the parent directory, -1 in the root directory
+    long size;
+    uint8_t *data; // the compressed data, NULL if the file is stored as it is
+    long stored;   // bytes of data blocks used
+    int first_block;
+    int num_blocks;
+}node_t;
+
+static node_t nodes[8 * FS_INODE_MAP_SZ];
+static int num_nodes;
+static int version = 1;
+static int compress;
+
 void die(const char *);
 
 // convert to riscv byte order
@@ -64,13 +144,235 @@ xint(unsigned int x)
   return y;
 }
 
+// Appends a length continued past a 4-bit field, see lz4_sequence
+static int
+lz4_length(uint8_t *dst, int cap, int out, int len)
+{
+  for(; len >= 255; len -= 255){
+    if(out >= cap)
+      return -1;
+    dst[out++] = 255;
+  }
+  if(out >= cap)
+    return -1;
+  dst[out++] = len;
+  return out;
+}
+
+// Appends an LZ4 sequence: a token with the number of literals and the match
+// length less 4, the literals, and the offset of the match. The last
+// sequence has no match, offset is 0 for it. Returns the new length of the
+// output, or -1 if it would be longer than cap.
+static int
+lz4_sequence(uint8_t *dst, int cap, int out, const uint8_t *lit, int nlit, int offset, int mlen)
+{
+  int mcode = offset ? mlen - 4 : 0;
+
+  if(out >= cap)
+    return -1;
+  dst[out++] = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+  if(nlit >= 15 && (out = lz4_length(dst, cap, out, nlit - 15)) < 0)
+    return -1;
+  if(nlit > cap - out)
+    return -1;
+  memcpy(dst + out, lit, nlit);
+  out += nlit;
+  if(offset == 0)
+    return out;
+  if(cap - out < 2)
+    return -1;
+  dst[out++] = offset;
+  dst[out++] = offset >> 8;
+  if(mcode >= 15 && (out = lz4_length(dst, cap, out, mcode - 15)) < 0)
+    return -1;
+  return out;
+}
+
+// Compresses n bytes into a block of LZ4 sequences, finding matches through a
+// hash table of the last position of every 4-byte string. Returns the
+// compressed length, or -1 if it would be longer than cap.
+static int
+lz4_compress(const uint8_t *src, int n, uint8_t *dst, int cap)
+{
+  static int table[1 << LZ4_HASH_BITS];
+  int anchor = 0, i = 0, out = 0;
+  uint32_t seq;
+
+  memset(table, -1, sizeof(table));
+  // like LZ4, the last 12 bytes start no match and the last 5 are literals
+  while(i + 12 <= n){
+    memcpy(&seq, src + i, 4);
+    uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+    int ref = table[h];
+    table[h] = i;
+    if(ref < 0 || i - ref > LZ4_MAX_OFFSET || memcmp(src + ref, src + i, 4) != 0){
+      i++;
+      continue;
+    }
+    int len = 4;
+    while(i + len < n - 5 && src[ref + len] == src[i + len])
+      len++;
+    out = lz4_sequence(dst, cap, out, src + anchor, i - anchor, i - ref, len);
+    if(out < 0)
+      return -1;
+    i += len;
+    anchor = i;
+  }
+  return lz4_sequence(dst, cap, out, src + anchor, n - anchor, 0, 0);
+}
+
+// Compresses a file chunk by chunk, keeping the result if it is smaller
+static void
+compress_node(node_t *node)
+{
+  long size = node->size;
+  long nchunks = (size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+  uint8_t *src = malloc(size);
+  uint8_t *out = malloc((nchunks + 1) * sizeof(uint32_t) + size);
+  uint32_t *index = (uint32_t *)out;
+  long pos = (nchunks + 1) * sizeof(uint32_t);
+
+  int fd = open(node->path, O_RDONLY);
+  if(fd < 0 || read(fd, src, size) != size)
+    die(node->path);
+  close(fd);
+
+  for(long c = 0; c < nchunks; c++){
+    int len = (size - c * FS_CHUNK_SIZE < FS_CHUNK_SIZE) ? size - c * FS_CHUNK_SIZE : FS_CHUNK_SIZE;
+    index[c] = pos;
+    // a compressed chunk must be shorter than the bytes it holds
+    int z = lz4_compress(src + c * FS_CHUNK_SIZE, len, out + pos, len - 1);
+    if(z < 0){
+      memcpy(out + pos, src + c * FS_CHUNK_SIZE, len);
+      z = len;
+    }
+    pos += z;
+  }
+  index[nchunks] = pos;
+  free(src);
+
+  printf("Compressed %s: %ld bytes to %ld\n", node->path, size, pos);
+  if(pos < size){
+    node->data = out;
+    node->stored = pos;
+  }else{
+    free(out);
+  }
+}
+
+// Adds a file or a directory tree to the list of nodes. Returns its index.
+static int
+add_node(char *path, int parent)
+{
+  struct stat st;
+  if(stat(path, &st) < 0)
+    die(path);
+  if(num_nodes == sizeof(nodes) / sizeof(nodes[0])){
+    fprintf(stderr, "%s: too many files\n", path);
+    exit(1);
+  }
+
+  int n = num_nodes++;
+  // the name is the last path component
+  char *shortname = path;
+  char *slash;
+  while((slash = index(shortname, '/')) != NULL && slash[1] != '\0')
+    shortname = slash + 1;
+  strncpy(nodes[n].name, shortname, FS_NAMELEN);
+  slash = index(nodes[n].name, '/');
+  if(slash != NULL)
+    *slash = '\0';
+  nodes[n].path = path;
+  nodes[n].parent = parent;
+
+  if(!S_ISDIR(st.st_mode)){
+    nodes[n].type = FS_DT_FILE;
+    nodes[n].size = st.st_size;
+    nodes[n].stored = st.st_size;
+    if(compress && st.st_size != 0)
+      compress_node(&nodes[n]);
+    return n;
+  }
+
+  if(version != FS_VERSION_2){
+    fprintf(stderr, "%s: directories need a version 2 image, use -v2\n", path);
+    exit(1);
+  }
+  nodes[n].type = FS_DT_DIR;
+
+  struct dirent **list;
+  int count = scandir(path, &list, NULL, alphasort);
+  if(count < 0)
+    die(path);
+  int children = 0;
+  for(int i = 0; i < count; i++){
+    if(strcmp(list[i]->d_name, ".") != 0 && strcmp(list[i]->d_name, "..") != 0){
+      char *child = malloc(strlen(path) + strlen(list[i]->d_name) + 2);
+      sprintf(child, "%s/%s", path, list[i]->d_name);
+      add_node(child, n);
+      children++;
+    }
+    free(list[i]);
+  }
+  free(list);
+  nodes[n].size = children * sizeof(dentry_t);
+  nodes[n].stored = nodes[n].size;
+  return n;
+}
+
+static void
+make_dentry(dentry_t *dentry, int n)
+{
+  memset(dentry, 0, sizeof(dentry_t));
+  strncpy(dentry->file_name, nodes[n].name, FS_NAMELEN);
+  dentry->inode = n;
+  dentry->type = nodes[n].type;
+}
+
 int
 main(int argc, char *argv[])
 {
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
+  static_assert(sizeof(inode_t) == FS_BLKSZ, "Inodes must be one block!");
+
+  int free_blocks = FS_FREE_BLOCKS;
+  int journal_blocks = FS_JOURNAL_BLOCKS;
+  int num_inodes = FS_INODES;
+  int first = 2; // index of the first file argument
+
+  while(argc >= 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-v2") == 0){
+      version = FS_VERSION_2;
+      argv++;
+      argc--;
+    }else if(strcmp(argv[1], "-f") == 0 && argc >= 3){
+      free_blocks = atoi(argv[2]);
+      argv += 2;
+      argc -= 2;
+    }else if(strcmp(argv[1], "-j") == 0 && argc >= 3){
+      journal_blocks = atoi(argv[2]);
+      argv += 2;
+      argc -= 2;
+    }else if(strcmp(argv[1], "-z") == 0){
+      compress = 1;
+      argv++;
+      argc--;
+    }else if(strcmp(argv[1], "-i") == 0 && argc >= 3){
+      num_inodes = atoi(argv[2]);
+      argv += 2;
+      argc -= 2;
+    }else{
+      argc = 0;
+    }
+  }
 
   if(argc < 2){
-    fprintf(stderr, "Usage: ./mkfs [filesystem_image] [file1] [file2] ...\n");
+    fprintf(stderr, "Usage: ./mkfs [-v2 [-f free_blocks] [-j journal_blocks] [-i inodes] [-z]] [filesystem_image] [file1|dir1] [file2|dir2] ...\n");
+    exit(1);
+  }
+
+  if(compress && version != FS_VERSION_2){
+    fprintf(stderr, "compression needs a version 2 image, use -v2\n");
     exit(1);
   }
 
@@ -82,98 +384,154 @@ main(int argc, char *argv[])
   if(fsfd < 0)
     die(argv[1]);
 
-  int number_inodes = 0;
-  int i;
-  for(i = 2; i < argc; i++){ //Add all dentries
-    // get rid of "../user/bin/" or "user/bin/"
-    char *shortname;
-    // if(strncmp(argv[i], "../user/bin/", 12) == 0)
-    //   shortname = argv[i] + 12;
-    // else if(strncmp(argv[i], "user/bin/", 9) == 0)
-    //   shortname = argv[i] + 9;
-    // else
-    //   shortname = argv[i];
-
-    char * index_slash = index(argv[i], '/');
-    if(index_slash == NULL){
-      // no '/', already a good file name
-      shortname = argv[i];
-    }else{
-      // find the last '/' and take the name after that as the file name
-      // while there are still '/' in index_slash, find '/'
-      while(index(index_slash, '/') != NULL){ 
-        index_slash = index(index_slash, '/')+1;
-      }
-      shortname = index_slash; // to get rid of '/'s, because we assume flat directory
+  int i, j;
+  for(i = first; i < argc; i++){ //Add all files and directories
+    int n = add_node(argv[i], -1);
+    if(boot_block.num_dentry == FS_MAX_DENTRIES){
+      fprintf(stderr, "%s: the root directory is full\n", argv[i]);
+      exit(1);
     }
-    
-
-    
-    // printf("%s",shortname);
-    // assert(index(shortname, '/') == 0);
-
-    printf("File name is %s\n", shortname);
-    printf("Dentry index is %d\n", number_inodes);
-    printf("Inode number is %d\n", number_inodes);
-    strncpy(boot_block.dir_entries[number_inodes].file_name, shortname, FS_NAMELEN);
-    boot_block.dir_entries[number_inodes].inode = number_inodes;
-
-    number_inodes += 1;
+    printf("File name is %s\n", nodes[n].name);
+    printf("Dentry index is %d\n", boot_block.num_dentry);
+    printf("Inode number is %d\n", n);
+    make_dentry(&boot_block.dir_entries[boot_block.num_dentry], n);
+    boot_block.num_dentry += 1;
   }
 
   int data_block_idx = 0;
-  int inode_idx = 0;
-  inode_t inode_array[number_inodes];
-
-  for(i = 2; i < argc; i++){ //Add all inodes
-    FILE* fp;
-    if((fp = fopen(argv[i], "r")) == NULL)
-      die(argv[i]);
-
-    fseek(fp, 0L, SEEK_END);
-    int num_bytes = ftell(fp);
-    int num_data_blocks_for_file = (num_bytes / FS_BLKSZ) + 1;
-    if(num_bytes % FS_BLKSZ == 0){
-      num_data_blocks_for_file -= 1;
-    }
-    // we can do this since the inode index is the same as the dentry index
-    printf("Number of bytes for file %s: %d\n",boot_block.dir_entries[inode_idx].file_name, num_bytes); 
-    printf("Number of data blocks for file %s: %d\n", boot_block.dir_entries[inode_idx].file_name, num_data_blocks_for_file);
-    int j;
-    for (j = 0; j < num_data_blocks_for_file; ++j){
-      inode_array[inode_idx].data_block_num[j] = data_block_idx;
-      data_block_idx += 1; 
+  for(i = 0; i < num_nodes; i++){ //Lay out the data of all inodes
+    nodes[i].num_blocks = (nodes[i].stored + FS_BLKSZ - 1) / FS_BLKSZ;
+    nodes[i].first_block = data_block_idx;
+    data_block_idx += nodes[i].num_blocks;
+    printf("Number of bytes for %s: %ld\n", nodes[i].path, nodes[i].size);
+    printf("Number of data blocks for %s: %d\n", nodes[i].path, nodes[i].num_blocks);
+    if(version != FS_VERSION_2 && nodes[i].num_blocks > 1023){
+      fprintf(stderr, "%s: too large for a version 1 image, use -v2\n", nodes[i].path);
+      exit(1);
     }
-
-    inode_array[inode_idx].byte_len = num_bytes;
-    inode_idx += 1;
-
-    fclose(fp);
   }
 
-  boot_block.num_dentry = number_inodes;
-  boot_block.num_inodes = number_inodes;
+  boot_block.num_inodes = num_nodes;
   boot_block.num_data = data_block_idx;
 
+  static bitmap_block_t bitmap;
+  if(version == FS_VERSION_2){
+    boot_block.magic = FS_MAGIC;
+    boot_block.version = FS_VERSION_2;
+    boot_block.features = FS_FEATURE_BITMAP;
+    // room for new files
+    if(num_inodes < num_nodes)
+      num_inodes = num_nodes;
+    if(num_inodes > 8 * FS_INODE_MAP_SZ){
+      fprintf(stderr, "too many inodes for the bitmap\n");
+      exit(1);
+    }
+    boot_block.num_inodes = num_inodes;
+    boot_block.num_data = data_block_idx + free_blocks;
+    if(boot_block.num_data > 8 * sizeof(bitmap.data_map)){
+      fprintf(stderr, "too many data blocks for the bitmap\n");
+      exit(1);
+    }
+    boot_block.bitmap_block = 1 + boot_block.num_inodes + boot_block.num_data;
+    // -j 0 makes an image without a journal
+    if(journal_blocks > 0){
+      if(journal_blocks < FS_JOURNAL_MIN){
+        fprintf(stderr, "the journal needs at least %d blocks\n", FS_JOURNAL_MIN);
+        exit(1);
+      }
+      boot_block.features |= FS_FEATURE_JOURNAL;
+      boot_block.journal_block = boot_block.bitmap_block + 1;
+      boot_block.journal_len = journal_blocks;
+    }
+    for(i = 0; i < num_nodes; i++)
+      bitmap.inode_map[i / 8] |= 1 << (i % 8);
+    for(i = 0; i < data_block_idx; i++)
+      bitmap.data_map[i / 8] |= 1 << (i % 8);
+  }
+
   printf("Total number of dentries: %d\n", boot_block.num_dentry);
   printf("Total number of inodes: %d\n", boot_block.num_inodes);
   printf("Total number of data blocks: %d\n", boot_block.num_data);
+  printf("Format version: %d\n", version);
 
   write(fsfd, &boot_block, sizeof(boot_block_t)); 
 
-  for (i = 0; i < number_inodes; ++i) {
-    write(fsfd, &inode_array[i], sizeof(inode_t));
-    printf("Wrote Inode %d, Program: %s\n", i, boot_block.dir_entries[i].file_name);
+  static inode_t inode;
+  for (i = 0; i < num_nodes; ++i) {
+    memset(&inode, 0, sizeof(inode_t));
+    if(version == FS_VERSION_2){
+      // files are allocated contiguously, so one extent covers the whole file
+      if(nodes[i].num_blocks != 0){
+        inode.num_extents = 1;
+        inode.extents[0].start = nodes[i].first_block;
+        inode.extents[0].len = nodes[i].num_blocks;
+      }
+      if(nodes[i].data != NULL)
+        inode.flags = FS_INODE_COMPRESSED;
+    }else{
+      for (j = 0; j < nodes[i].num_blocks; ++j)
+        inode.data_block_num[j] = nodes[i].first_block + j;
+    }
+    inode.byte_len = nodes[i].size;
+    write(fsfd, &inode, sizeof(inode_t));
+    printf("Wrote Inode %d, Program: %s\n", i, nodes[i].name);
   }
 
-  for(i = 2; i < argc; i++){ //Add all data blocks
-    int fd;
-    if((fd = open(argv[i], 0)) < 0)
-      die(argv[i]);
+  static const char zero_block[FS_BLKSZ];
+  for (; i < boot_block.num_inodes; ++i)
+    write(fsfd, zero_block, FS_BLKSZ);
 
+  for(i = 0; i < num_nodes; i++){ //Add all data blocks
     char buf[FS_BLKSZ] = {0};
-    while(read(fd, buf, sizeof(buf)) > 0)
+
+    if(nodes[i].type == FS_DT_DIR){
+      // the entries of the children, in the order they were added
+      dentry_t *dentries = (dentry_t *)buf;
+      int k = 0;
+      for(j = i + 1; j < num_nodes; j++){
+        if(nodes[j].parent != i)
+          continue;
+        make_dentry(&dentries[k++], j);
+        if(k == FS_BLKSZ / sizeof(dentry_t)){
+          write(fsfd, buf, FS_BLKSZ);
+          memset(buf, 0, FS_BLKSZ);
+          k = 0;
+        }
+      }
+      if(k != 0)
+        write(fsfd, buf, FS_BLKSZ);
+      continue;
+    }
+
+    if(nodes[i].data != NULL){
+      // whole blocks, the last one padded with zeros
+      for(long pos = 0; pos < nodes[i].stored; pos += FS_BLKSZ){
+        long len = nodes[i].stored - pos < FS_BLKSZ ? nodes[i].stored - pos : FS_BLKSZ;
+        memcpy(buf, nodes[i].data + pos, len);
+        write(fsfd, buf, FS_BLKSZ);
+        memset(buf, 0, FS_BLKSZ);
+      }
+      continue;
+    }
+
+    int fd;
+    if((fd = open(nodes[i].path, 0)) < 0)
+      die(nodes[i].path);
+
+    while(read(fd, buf, sizeof(buf)) > 0){
       write(fsfd, buf, FS_BLKSZ);
+      memset(buf, 0, FS_BLKSZ);
+    }
+    close(fd);
+  }
+
+  if(version == FS_VERSION_2){
+    for(i = data_block_idx; i < boot_block.num_data; i++)
+      write(fsfd, zero_block, FS_BLKSZ);
+    write(fsfd, &bitmap, sizeof(bitmap));
+    // an all-zero journal holds no transaction
+    for(i = 0; i < boot_block.journal_len; i++)
+      write(fsfd, zero_block, FS_BLKSZ);
   }
 
   printf("Wrote filesystem image to %s\n", argv[1]);
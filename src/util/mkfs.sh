@@ -4,12 +4,19 @@ make
 # Define the root folder
 ROOT_FOLDER="root_folder"
 
-# Collect all files in the root folder
-FILES=$(find "$ROOT_FOLDER" -type f)
+# Collect all files in the root folder; version 2 images keep its
+# subdirectories, version 1 images get all files in one directory
+if [[ "$MKFS_FLAGS" == *-v2* ]]; then
+    FILES=$(find "$ROOT_FOLDER" -mindepth 1 -maxdepth 1)
+else
+    FILES=$(find "$ROOT_FOLDER" -type f)
+fi
 
 # Execute the mkfs command with the collected files
-echo ./mkfs kfs.raw $FILES
-./mkfs kfs.raw $FILES
+# (MKFS_FLAGS=-v2 makes a version 2 image with extents, MKFS_FLAGS="-v2 -z"
+# one with compressed files)
+echo ./mkfs $MKFS_FLAGS kfs.raw $FILES
+./mkfs $MKFS_FLAGS kfs.raw $FILES
 
 # Remove the existing kfs.raw file in the ../kern/ directory
 rm -f ../kern/kfs.raw